@@ -0,0 +1,200 @@
+#ifndef _BUFTLS_H_ENV__
+#define _BUFTLS_H_ENV__ 1
+
+#include "osp.h"
+#include <string>
+#include <string.h>
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <errno.h>
+#include <netinet/tcp.h>
+#include <netinet/ip.h>
+#include <netdb.h>
+#include <sys/socketvar.h>
+
+#ifndef __linux__
+#include <netinet/in_pcb.h>
+#include <netinet/tcp_var.h>
+#endif
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+#include "bufgen.h"
+#include "cthread.h"
+
+class BufTls : public BufGen {
+ public:
+    /* a cached client session for one host:port, used to do an
+     * abbreviated handshake when we reconnect to the same server.
+     */
+    class Session {
+    public:
+        std::string _key;
+        SSL_SESSION *_sessionp;
+        Session *_dqNextp;
+        Session *_dqPrevp;
+
+        Session() {
+            _sessionp = NULL;
+        }
+
+        ~Session() {
+            if (_sessionp) {
+                SSL_SESSION_free(_sessionp);
+                _sessionp = NULL;
+            }
+        }
+    };
+
+    class Stats {
+    public:
+        uint64_t _fullHandshakes;
+        uint64_t _resumedHandshakes;
+        uint64_t _sessionsCached;
+
+        Stats() {
+            memset(this, 0, sizeof(*this));
+        }
+    };
+
+ private:
+    static const uint32_t _defaultBaseTimeoutMs = 60000;
+    static const uint32_t _maxSessions = 256;
+
+    /* output is gathered into buffers of one full TLS record, so that
+     * small writes (e.g. chunk headers) share a record with the data
+     * around them.  Input is read in bigger pieces, since one
+     * SSL_read may be able to return several records' worth.
+     */
+    static const uint32_t _recordBytes = 16384;
+    static const uint32_t _inputBytes = 65536;
+    static pthread_once_t _once;
+    int _s;
+
+    OspMBuf *_inp;
+    OspMBuf *_outp;
+    int32_t _error;
+    uint8_t _closed;
+    uint8_t _connected;
+    uint8_t _verbose;
+    uint8_t _server;
+    std::string _sessionKey;
+
+    /* all client connections share one context; sessions in LRU order,
+     * protected by _mutex.
+     */
+    static SSL_CTX *_sslClientContextp;
+    static dqueue<Session> _sessions;
+    static Stats _stats;
+
+    static SSL_CTX *_sslServerContextp;
+    static const SSL_METHOD *_sslClientMethodp;
+    static const SSL_METHOD *_sslServerMethodp;
+    static std::string _pathPrefix;
+    static CThreadMutex _mutex;
+    SSL *_sslp;
+    uint32_t _baseTimeoutMs;
+
+    int32_t fillFromSocket(OspMBuf *mbp);
+
+    int32_t sslWrite(const char *bufferp, int32_t count);
+
+    static int newSessionCallback(SSL *sslp, SSL_SESSION *sessionp);
+
+    static Session *findSession(std::string *keyp);
+
+    void dropSession();
+
+ public:
+    static void mainInit();
+
+    static void getStats(Stats *statsp);
+
+    void init(struct sockaddr *sockAddrp, int socklen);
+
+    int getSocket() {
+        return _s;
+    }
+
+    int32_t listen();
+
+    int32_t accept(BufGen **remotepp);
+
+    void showCerts(SSL *sslp);
+
+    int32_t getc();
+
+    void abort();
+
+    int32_t read(char *tbuffer, int32_t count);
+
+    int32_t readLine(char *tbuffer, int32_t count);
+
+    int32_t putc(const char tbuffer);
+
+    int32_t write(const char *tbuffer, int32_t count);
+
+    void init(char *hostNamep, uint32_t defaultPort);
+
+    int32_t doConnect();
+
+    int32_t doSetup(uint16_t srcPort);
+
+    int32_t flush();
+
+    void reopen();
+
+    void disconnect();
+
+    void setTimeoutMs(uint32_t ms) {
+        return;
+    }
+
+    void setVerbose() {
+        _verbose = 1;
+    }
+
+    int32_t getError() {
+        return _error;
+    }
+
+    int atEof() {
+        return _closed;
+    }
+
+    BufTls(std::string pathPrefix) {
+        /* since _pathPrefix is static, we don't want to have multiple assigners
+         * running at once.  All the strings are identical, so ordering doesn't
+         * matter, but serialization might (depends upon std::string atomicity)
+         */
+        _mutex.take();
+        _pathPrefix = pathPrefix;
+        _mutex.release();
+
+        _s = -1;
+        _error = 0;
+        _connected = 0;
+        _verbose = 0;
+        _sslp = NULL;
+        _inp = NULL;
+        _outp = NULL;
+        _baseTimeoutMs = _defaultBaseTimeoutMs;
+    }
+
+    ~BufTls();
+};
+
+class BufTlsFactory : public BufGenFactory {
+ public:
+    BufGen *allocate(int secure) {
+        if (secure)
+            return new BufTls("");
+        else
+            return NULL;
+    }
+};
+
+#endif /* _BUFTLS_H_ENV__ */
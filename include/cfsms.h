@@ -0,0 +1,769 @@
+#ifndef _CFSMS_H_ENV__
+#define _CFSMS_H_ENV__ 1
+
+#include "osp.h"
+#include "cfs.h"
+#include "json.h"
+#include "xapipool.h"
+
+class Cfs;
+class CnOps;
+class Cnode;
+class CfsMs;
+class CnodeMs;
+class CnodeLockSet;
+
+/* Lock order: cnode lock (parent to child), hash lock, ref count lock.
+ *
+ * You can't remove a node from the parent/child tree without holding the refCount
+ * lock, seeing that the child has a zero ref count, and that the node being
+ * removed has no children.
+ *
+ * You can't modify a CnodeBackEntry without holding the parent's lock and a reference
+ * on the child cnode (to prevent it from being freed).  Once you're doing this, you
+ * can change the name or do other things to the entry, as long as its parent, child
+ * and queue pointers all remain unchanged.  That is you can change the name, or turn
+ * on or off the _valid flag, should we add one.
+ *
+ * You must hold a reference count on a child to advance the child
+ * search to the new node.  Once you hold the reference, you can
+ * release the _refLock.
+ */
+class CnodeBackEntry {
+ public:
+    std::string _name;
+    CnodeMs *_parentp;                  /* soft reference */
+    CnodeMs *_childp;                   /* soft reference */
+
+    /* next entry belonging to this same child, i.e. another hard link to this same
+     * file.
+     */
+    CnodeBackEntry *_nextSameChildp;
+
+    /* list of all same parent */
+    CnodeBackEntry *_dqNextp;
+    CnodeBackEntry *_dqPrevp;
+
+    /* next in parent's name hash bucket; entries with an empty
+     * (invalidated) name aren't hashed.
+     */
+    CnodeBackEntry *_nextNamep;
+    uint8_t _inNameHash;
+
+    CnodeBackEntry() {
+        _parentp = NULL;
+        _nextSameChildp = NULL;
+        _nextNamep = NULL;
+        _inNameHash = 0;
+    }
+};
+
+/* a name in a listed directory whose entry was recycled out of the
+ * cnode cache.  The name still exists at the server, so a lookup of
+ * it goes there rather than being answered from the listing.
+ */
+class CnodeLostName {
+ public:
+    std::string _name;
+    CnodeLostName *_nextp;
+
+    CnodeLostName() {
+        _nextp = NULL;
+    }
+};
+
+/* reads a large file ahead of its upload in a helper thread, into
+ * one of two buffers, so that reading the next chunk overlaps
+ * sending this one.  Only one read is outstanding at a time.
+ */
+class CnodeMsReader : public CThread {
+ public:
+    class Buffer {
+    public:
+        char *_datap;
+        uint32_t _allocSize;
+        uint64_t _offset;
+        uint32_t _count;        /* bytes asked for */
+        int32_t _readCount;     /* bytes read, or negative for error */
+        uint8_t _ready;
+
+        Buffer() {
+            _datap = NULL;
+            _allocSize = 0;
+            _offset = 0;
+            _count = 0;
+            _readCount = 0;
+            _ready = 0;
+        }
+
+        ~Buffer() {
+            if (_datap)
+                free(_datap);
+        }
+    };
+
+    Buffer _buffers[2];
+
+ private:
+    CDataSource *_sourcep;
+    CThreadMutex _lock;
+    CThreadCV _cv;
+    Buffer *_requestp;          /* next buffer for the thread to fill */
+    uint8_t _shutdown;
+    uint8_t _exited;
+
+ public:
+    CnodeMsReader(CDataSource *sourcep) : _cv(&_lock) {
+        _sourcep = sourcep;
+        _requestp = NULL;
+        _shutdown = 0;
+        _exited = 0;
+    }
+
+    void start();
+
+    void request(Buffer *bufferp, uint64_t offset, uint32_t count);
+
+    void wait(Buffer *bufferp);
+
+    void shutdown();
+
+    void readerThread(void *contextp);
+};
+
+/* Cnodes represent files in the local file system or the cloud; _parentp is null
+ * for the root.
+ */
+class CnodeMs : public Cnode {
+    friend class CfsMs;
+
+    std::string _id;
+
+    CnodeMs *_nextHashp;
+    CnodeMs *_nextFreep;                /* union with nextHashp? */
+    CnodeBackEntry *_backEntriesp;      /* our names in our parent */
+    dqueue<CnodeBackEntry> _children;   /* list of our children */
+
+    /* _children indexed by name, allocated on first use, and grown as
+     * the directory does.  Protected by _refLock, like _children.
+     */
+    CnodeBackEntry **_nameHashp;
+    uint32_t _nameHashSize;
+    uint32_t _nameCount;
+    uint64_t _hashValue;                /* fnv hash of _id */
+    uint8_t _isRoot;
+    uint8_t _clockRef;                  /* held since the CLOCK hand last passed */
+    uint8_t _inHash;
+
+    /* _listed is set when every name in the directory, as of
+     * _listedMs, is either in _children or in _lostNamesp.  Entries
+     * recycled out of a listed directory, or one being listed, leave
+     * their names in _lostNamesp, so a big directory stays listed even
+     * though it doesn't fit in the cache.  Invalidating the tree clears
+     * the listing, and bumps _listGen so that a listing in progress
+     * knows it's stale.  Protected by _refLock, like _children.
+     */
+    uint8_t _listed;
+    uint32_t _listing;                  /* readdir calls in progress */
+    uint32_t _listGen;
+    uint64_t _listedMs;
+    CnodeLostName **_lostNamesp;
+    uint32_t _lostHashSize;
+    uint32_t _lostCount;
+
+public:
+    /* queue entries for CfsMs CLOCK queue */
+    CnodeMs *_dqNextp;
+    CnodeMs *_dqPrevp;
+
+ protected:
+    CfsMs *_cfsp;
+
+ public:
+
+    CnodeMs() {
+        _cfsp = NULL;
+        _nextHashp = NULL;
+        _backEntriesp = NULL;
+        _isRoot = 0;
+        _clockRef = 0;
+        _hashValue = 0;
+        _inHash = 0;
+        _listed = 0;
+        _listing = 0;
+        _listGen = 0;
+        _listedMs = 0;
+        _lostNamesp = NULL;
+        _lostHashSize = 0;
+        _lostCount = 0;
+        _nameHashp = NULL;
+        _nameHashSize = 0;
+        _nameCount = 0;
+    }
+
+    /* call with _refLock held, so _children is stable; a zero ref
+     * count only stays zero if the cnode's hash lock is held, too.
+     */
+    int recyclable() {
+        if ( __atomic_load_n(&_refCount, __ATOMIC_SEQ_CST) > 0 ||
+             _children.count() > 0)
+            return 0;
+        else
+            return 1;
+    }
+
+    int32_t fillAttrs( CEnv *envp, CnodeLockSet *lockSetp);
+
+    int32_t nameSearch(std::string nanme, CnodeMs **childpp);
+
+    CnodeBackEntry *findChildNL(std::string *namep);
+
+    void hashChildNL(CnodeBackEntry *ep);
+
+    void unhashChildNL(CnodeBackEntry *ep);
+
+    int32_t readdir(CEnv *envp);
+
+    void addLostNameNL(std::string *namep);
+
+    int removeLostNameNL(std::string *namep);
+
+    void clearLostNamesNL();
+
+    int listingFresh();
+
+    int listingMissing(std::string *namep);
+
+    void hold();
+
+    void release();
+
+    void invalidateTree();
+
+    void unthreadEntry(CnodeBackEntry *ep);
+
+    /* virtual ops realized */
+    int32_t getAttr(CAttr *attrsp, CEnv *envp);
+
+    int32_t lookup(std::string name, int forceBackend, Cnode **nodepp, CEnv *envp);
+
+    std::string getCloudId() {
+        return _id;
+    }
+
+    int32_t create(std::string name, Cnode **nodepp, CEnv *envp) {
+        return -1;
+    }
+    int32_t mkdir(std::string name, Cnode **nodepp, CEnv *envp);
+
+    int32_t open(uint32_t flags, CFile **filepp) {
+        return -1;
+    }
+    int32_t close(CFile *filep) {
+        return -1;
+    }
+
+    int32_t write(CFile *cp, uint64_t offset, uint32_t length, CEnv *envp) {
+        return -1;
+    }
+
+    int32_t read(CFile *cp, uint64_t offset, uint32_t length, CEnv *envp) {
+        return -1;
+    }
+
+    int32_t startSession(std::string name,
+                         std::string *sessionUrlp);
+
+    int32_t sendData( std::string name,
+                      std::string *sessionUrlp,
+                      char *dataBufferp,
+                      uint64_t fileLength,
+                      uint64_t byteOffset,
+                      uint32_t byteCount,
+                      uint64_t *nextOffsetp);
+
+    int32_t getSessionOffset( std::string *sessionUrlp,
+                              uint64_t fileLength,
+                              uint64_t *nextOffsetp);
+
+    static int parseNextOffset( Json::Node *jnodep,
+                                uint64_t fileLength,
+                                uint64_t *nextOffsetp);
+
+    static int32_t abortSession( std::string *sessionUrlp);
+
+    int32_t sendSmallFile(std::string name, CDataSource *sourcep, CEnv *envp);
+
+    /* how long to wait for the server to finish a copy */
+    static const uint32_t _copyWaitMs = 120000;
+
+    int32_t copyFile(std::string name, std::string srcId, CAttr *srcAttrsp, CEnv *envp);
+
+    int32_t checkCopySource(std::string *srcIdp, CAttr *srcAttrsp, CEnv *envp);
+
+    int32_t waitForCopy(std::string *monitorUrlp, std::string *idp);
+
+    int32_t linkItem(std::string name, Json::Node *jnodep, CnodeMs **childpp);
+
+    int32_t linkSentFile(std::string name, Json::Node *jnodep, int32_t httpError);
+
+    int32_t linkNewDir(std::string name, Json::Node *jnodep, Cnode **newDirpp);
+
+    /* send the whole file, whose final size is 'size'.  Use fillProc to obtain
+     * data to send.  Creates a file with specified name in dir cp.  Large
+     * files go through an upload session, in chunks sized to keep each
+     * PUT between _chunkFastMs and _chunkSlowMs.
+     */
+    static const uint32_t _chunkUnit = 320*1024;        /* MS wants multiples */
+    static const uint32_t _minChunkUnits = 4;
+    static const uint32_t _maxChunkUnits = 48;
+    static const uint32_t _chunkFastMs = 2000;
+    static const uint32_t _chunkSlowMs = 8000;
+    static const uint32_t _maxResumes = 4;      /* in a row, without progress */
+
+    int32_t sendFile( std::string name,
+                      CDataSource *sourcep,
+                      uint64_t *bytesCopiedp,
+                      CEnv *envp);
+    
+    int32_t getPath(std::string *pathp, CEnv *envp);
+
+    int32_t parseResults( Json::Node *jnodep,
+                          std::string *idp,
+                          uint64_t *sizep,
+                          uint64_t *changeTimep,
+                          uint64_t *modTimep,
+                          CAttr::FileType *fileTypep,
+                          uint8_t *allFoundp = NULL);
+};
+
+/* state for retryError calls */
+class CfsRetryError {
+ public:
+    /* max # of retries for errors that by definition should be fatal immediately, but
+     * which Azure nevertheless returns intermittently.  Don't make < 2, or we won't
+     * be able to handle authentication handshakes triggered by auth errors.
+     */
+    static const uint32_t _maxRetries=6;
+    uint32_t _retries;
+    int32_t _finalCode;
+
+    CfsRetryError() {
+        _retries = 0;
+        _finalCode = 0;
+    }
+
+    int32_t getCode() {
+        return _finalCode;
+    }
+};
+
+/* AIMD governor for requests to Graph, shared by every thread using
+ * a CfsMs.  A caller holds a Slot from sending a request until its
+ * response is read, and at most _window slots are out at once.  A
+ * throttling response halves the window, at most once a second, and
+ * holds off new requests for the Retry-After time; each success
+ * grows it by 1/_window, or by about one per window of successes.
+ *
+ * Don't wait for a slot while holding one, or while holding locks
+ * that a slot holder may need.
+ */
+class CfsGovernor {
+ public:
+    static const uint32_t _minWindow = 1;
+    static const uint32_t _maxWindow = 64;
+    static const uint32_t _initWindow = 16;
+    static const uint32_t _defaultPauseMs = 8000;       /* no Retry-After */
+    static const uint32_t _maxPauseMs = 300000;
+    static const uint32_t _decreaseMs = 1000;
+
+    class Slot {
+        CfsGovernor *_govp;
+    public:
+        Slot(CfsGovernor *govp) {
+            _govp = govp;
+            govp->enter();
+        }
+
+        /* release early, once the response is in */
+        void leave() {
+            if (_govp) {
+                _govp->leave();
+                _govp = NULL;
+            }
+        }
+
+        ~Slot() {
+            leave();
+        }
+    };
+
+ private:
+    CThreadMutex _lock;
+    CThreadCV _cv;
+    double _window;
+    uint32_t _inFlight;
+    uint64_t _pauseUntilMs;
+    uint64_t _lastDecreaseMs;
+    CfsStats *_statsp;
+
+ public:
+    CfsGovernor() : _cv(&_lock) {
+        _window = _initWindow;
+        _inFlight = 0;
+        _pauseUntilMs = 0;
+        _lastDecreaseMs = 0;
+        _statsp = NULL;
+    }
+
+    void setStats(CfsStats *statsp) {
+        _statsp = statsp;
+        statsp->_govWindow = (uint32_t) _window;
+    }
+
+    void enter();
+
+    void leave();
+
+    void succeeded();
+
+    void throttled(uint32_t retryAfterMs);
+};
+
+/* groups small PUTs and mkdirs from concurrent callers into Graph
+ * JSON $batch requests.  The first caller to find no batch forming
+ * leads one: it waits up to _lingerMs for company, sends the batch,
+ * and hands each member its own HTTP status and response body.  A
+ * caller with nobody else around lately doesn't wait; it sends its
+ * request itself, as does a caller left alone or one whose batch
+ * failed as a whole.
+ */
+class CfsMsBatch {
+ public:
+    class Item {
+    public:
+        std::string _method;            /* "PUT" or "POST" */
+        std::string _url;               /* as for a direct call, starting /v1.0 */
+        std::string _contentType;
+        std::string _body;              /* JSON, or raw bytes sent base64 encoded */
+
+        /* results, valid once _done is set */
+        uint32_t _httpError;
+        uint32_t _retryAfterMs;         /* from the item's Retry-After, or 0 */
+        Json::Node *_responsep;         /* ours until takeResponse */
+        uint8_t _batched;               /* false if caller must send it alone */
+        uint8_t _done;
+
+        Item *_dqNextp;
+        Item *_dqPrevp;
+
+        Item() {
+            _httpError = 0;
+            _retryAfterMs = 0;
+            _responsep = NULL;
+            _batched = 0;
+            _done = 0;
+        }
+
+        ~Item() {
+            if (_responsep)
+                delete _responsep;
+        }
+
+        Json::Node *takeResponse() {
+            Json::Node *nodep = _responsep;
+            _responsep = NULL;
+            return nodep;
+        }
+    };
+
+    static const uint32_t _maxItems = 20;       /* Graph's limit */
+    static const uint32_t _maxBytes = 2*1024*1024;
+    static const uint32_t _lingerMs = 20;
+
+    /* a caller arriving this soon after another suggests there are
+     * others to batch with; a lone caller's calls are a round trip apart.
+     */
+    static const uint32_t _companyMs = 2 * _lingerMs;
+
+ private:
+    CfsMs *_cfsp;
+    CThreadMutex _lock;
+    CThreadCV _cv;
+    dqueue<Item> *_formingp;            /* batch accepting members, if any */
+    uint32_t _formingBytes;
+    uint32_t _callers;                  /* threads in call */
+    uint64_t _lastCallMs;               /* when call was last entered */
+
+    void send(dqueue<Item> *itemsp);
+
+    static Json::Node *findMember(Json::Node *structp, const char *namep);
+
+ public:
+    CfsMsBatch(CfsMs *cfsp) : _cv(&_lock) {
+        _cfsp = cfsp;
+        _formingp = NULL;
+        _formingBytes = 0;
+        _callers = 0;
+        _lastCallMs = 0;
+    }
+
+    int call(Item *itemp);
+};
+
+/* one of these per file system instance */
+class CfsMs : public Cfs {
+ public:
+    /* the hash table's size is a power of two, and at least
+     * _hashLockCount, so the low bits of a cnode's _hashValue pick
+     * both its bucket and its stripe lock, and the stripe doesn't
+     * change as the table grows.  Growing takes every stripe lock.
+     */
+    static const uint32_t _hashLockCount = 64;
+    static const uint32_t _minHashSize = 1024;
+
+    /* rough memory cost of a cached cnode, counting its name entry
+     * and the heap copies of its id and name.
+     */
+    static const uint32_t _cnodeBytes = ( sizeof(CnodeMs) +
+                                          sizeof(CnodeBackEntry) + 128);
+    static const uint64_t _defaultCacheBytes = 32 << 20;
+
+    uint32_t _maxCnodeCount;
+    uint32_t _cnodeCount;
+    SApiLoginCookie *_loginCookiep;
+    CThreadMutex _hashLocks[_hashLockCount];    /* protect hash table */
+    CThreadMutex _refLock;      /* protect tree structure and CLOCK queue */
+    CnodeMs **_hashTablep;
+    uint32_t _hashSize;
+    XApiPool *_xapiPoolp;
+    CnodeMs *_rootp;
+    uint8_t _verbose;
+    uint8_t _pipelineGets;
+    uint32_t _listingMs;        /* how long a dir listing is trusted; 0 disables */
+    uint32_t _negativeMs;       /* how long a listing may answer NOENT */
+    uint32_t _batchFileBytes;   /* largest file sent in a $batch; 0 disables */
+    CfsMsBatch *_batchp;
+    CfsGovernor _governor;
+    dqueue<CnodeMs> _clockQueue;        /* every cnode; the hand is at the head */
+    std::string _pathPrefix;
+    CnodeMs *_freeListp;
+    uint64_t _stalledErrors;
+    CfsStats _stats;
+
+    CfsMs(SApiLoginCookie *loginCookiep, std::string pathPrefix) {
+        _pathPrefix = pathPrefix;
+        _xapiPoolp = new XApiPool(pathPrefix);
+        _loginCookiep = loginCookiep;
+        _rootp = NULL;
+        _verbose = 0;
+        _pipelineGets = 0;
+        _listingMs = 300000;
+        _negativeMs = 0;
+        _batchFileBytes = 64*1024;
+        _batchp = new CfsMsBatch(this);
+        _governor.setStats(&_stats);
+        _cnodeCount = 0;
+        _maxCnodeCount = _defaultCacheBytes / _cnodeBytes;
+        _stalledErrors = 0;
+        _freeListp = NULL;
+        _hashSize = _minHashSize;
+        _hashTablep = new CnodeMs *[_hashSize];
+        memset(_hashTablep, 0, _hashSize * sizeof(CnodeMs *));
+    }
+
+    CfsStats *getStats() {
+        return &_stats;
+    }
+
+    void setVerbose() {
+        _verbose = 1;
+    }
+
+    /* send lookup and attribute GETs pipelined on shared connections */
+    void setPipelineGets(int on) {
+        _pipelineGets = (on? 1 : 0);
+    }
+
+    /* close pooled sockets idle for this long; see XApiPool */
+    void setConnIdleMs(uint32_t ms) {
+        _xapiPoolp->setIdleTimeout(ms);
+    }
+
+    /* answer lookups from a full listing of the directory, fetched
+     * on the first miss, for up to ms milliseconds; 0 turns this off,
+     * and each name is looked up separately.
+     */
+    void setListingMs(uint32_t ms) {
+        _listingMs = ms;
+    }
+
+    /* for up to ms milliseconds after a directory is listed, answer a
+     * lookup of a name that isn't in the listing with CFS_ERR_NOENT,
+     * without asking the server.  Other clients may have created the
+     * name since, so this defaults to 0, and is only safe for a caller
+     * that's the sole writer of its tree.
+     */
+    void setNegativeMs(uint32_t ms) {
+        _negativeMs = ms;
+    }
+
+    /* send files up to this size, and mkdirs, in $batch requests
+     * shared with other threads; 0 turns batching off.
+     */
+    void setBatchFileBytes(uint32_t bytes) {
+        _batchFileBytes = bytes;
+    }
+
+    /* how much memory the cnode cache may use before recycling
+     * cnodes; cnodes that are held or have cached children aren't
+     * recyclable, so the cache can go over when the tree is busy.
+     */
+    void setCacheBytes(uint64_t bytes) {
+        _maxCnodeCount = bytes / _cnodeBytes;
+        if (_maxCnodeCount < 100)
+            _maxCnodeCount = 100;
+    }
+
+    uint32_t getCnodeCount() {
+        return _cnodeCount;
+    }
+
+    uint32_t getMaxCnodeCount() {
+        return _maxCnodeCount;
+    }
+
+    XApiPool *getPool() {
+        return _xapiPoolp;
+    }
+
+    void startGet(XApi::ClientReq *reqp, std::string *relPathp);
+
+#if 0
+    void setLogin(SApiLoginMS *loginp) {
+        if (_loginp)
+            delete _loginp;
+        _loginp = loginp;
+    }
+#endif
+
+    /* if any of the last 8 operations failed with a stalling code,
+     * return that we're stalling.
+     */
+    int getStalling() {
+        if ((_stalledErrors & 0xFF) == 0)
+            return 0;
+        else
+            return 1;
+    }
+
+    static int legalFirst(int tc);
+
+    static int legalAnywhere(int tc);
+
+    std::string legalizeIt(std::string ins);
+    
+int32_t root(Cnode **rootpp, CEnv *envp);
+    
+    CnodeMs *allocCnode(CThreadMutex *hashLockp);
+
+    void recycle();
+
+    void checkRecycle();
+
+    void growHash();
+
+    int32_t getCnode(std::string *idp, CnodeMs **cnodepp);
+
+    int32_t retryError( CfsLog::OpType type,
+                        XApi::ClientReq *reqp,
+                        Json::Node **parsedNodepp,
+                        CfsRetryError *statep);
+
+    static uint32_t getRetryAfterMs(XApi::ClientReq *reqp);
+
+    int retryHttpError( CfsLog::OpType type,
+                        uint32_t httpError,
+                        uint32_t retryAfterMs,
+                        XApi::ClientReq *reqp,
+                        Json::Node **parsedNodepp,
+                        CfsRetryError *statep);
+
+    int retryRpcError( CfsLog::OpType type,
+                       int32_t error,
+                       CfsRetryError *retryStatep);
+
+    int32_t getCnodeLinked( CnodeMs *parentp,
+                            std::string name,
+                            std::string *idp,
+                            CnodeMs **cnodepp,
+                            CnodeLockSet *lockSetp);
+};
+
+class CnodeLockSet {
+    static const uint32_t _maxLocks = 4;
+    uint8_t _nlocks;
+    CnodeMs *_cnodep[_maxLocks];
+
+ public:
+
+    CnodeLockSet() {
+        uint32_t i;
+
+        _nlocks = 0;
+        for(i=0;i<_maxLocks;i++)
+            _cnodep[i] = NULL;
+    }
+
+    /* returns 0 if caller doesn't need to revalidate locked data; for
+     * now, we're always locking from parent down, so there are no
+     * cases where we lock in wrong order.
+     */
+    int add(CnodeMs *cnodep) {
+        int32_t best = -1;
+        int32_t i;
+
+        for(i=0;i<_maxLocks;i++) {
+            if (_cnodep[i] == cnodep)
+                return 0;
+
+            if (_cnodep[i] == NULL && best < 0)
+                best = i;
+        }
+
+        osp_assert(best >= 0);
+        _cnodep[best] = cnodep;
+        cnodep->_lock.take();
+        return 0;
+    }
+
+    int remove(CnodeMs *cnodep) {
+        uint32_t i;
+
+        for(i=0;i<_maxLocks;i++) {
+            if (_cnodep[i] == cnodep) {
+                _cnodep[i]->_lock.release();
+                _cnodep[i] = NULL;
+                return 0;
+            }
+        }
+        return -1;
+    }
+
+    void reset() {
+        int32_t i;
+
+        for(i=0;i<_maxLocks;i++) {
+            if (_cnodep[i]) {
+                _cnodep[i]->_lock.release();
+                _cnodep[i] = NULL;
+            }
+        }
+    }
+
+    ~CnodeLockSet() {
+        reset();
+    }
+};
+
+#endif /* _CFSMS_H_ENV__ */
@@ -0,0 +1,176 @@
+#ifndef __FSWATCH_H_ENV__
+#define __FSWATCH_H_ENV__ 1
+
+#include "osp.h"
+#include "dqueue.h"
+#include "cthread.h"
+#include <string>
+#include <string.h>
+
+/* A change journal for a local tree.  On Linux, FsWatcher puts an
+ * inotify watch on every directory under the root, and its thread
+ * records the path (relative to the root, with a leading '/') of
+ * everything created, written, renamed in or having its attributes
+ * changed.  A directory created or renamed into the tree is recorded
+ * as a subtree, since it may have been populated before we got a
+ * watch on it.
+ *
+ * The journal is only complete once a full walk has run after our
+ * watches were all in place, and stays complete until the event queue
+ * overflows, we run out of watches, or the process restarts.  The
+ * caller's protocol is to call takeChanges before each pass; if it
+ * returns 0, the pass only needs to look at the returned entries.
+ * Otherwise the pass must walk everything.  Either way, the caller
+ * then calls passDone, saying whether everything got uploaded; if
+ * not, the next pass walks everything again.
+ *
+ * Deletions aren't recorded, since uploads never delete anything.
+ * On other platforms, takeChanges always asks for a full walk.
+ */
+class FsWatcher : public CThread {
+ public:
+    class Change {
+    public:
+        Change *_dqNextp;
+        Change *_dqPrevp;
+        Change *_nextHashp;
+        std::string _relPath;
+        uint64_t _hash;
+        uint8_t _subtree;       /* walk everything under _relPath */
+    };
+
+ private:
+    class Watch {
+    public:
+        Watch *_nextHashp;
+        int _wd;
+        std::string _relPath;
+    };
+
+    static const uint32_t _minHashSize = 256;
+
+    CThreadMutex _lock;
+    CThreadCV _cv;
+    std::string _root;
+    int _fd;
+
+    /* watches, by wd; only the watcher thread looks at these */
+    Watch **_watchHashp;
+    uint32_t _watchHashSize;
+    uint32_t _watchCount;
+
+    /* the journal, protected by _lock */
+    dqueue<Change> _changes;
+    Change **_changeHashp;
+    uint32_t _changeHashSize;
+    uint32_t _changeCount;
+
+    uint8_t _ready;             /* initial watches all set up */
+    uint8_t _lost;              /* dropped events since the last full walk started */
+    uint8_t _failed;            /* gave up watching entirely */
+    uint8_t _fullPass;          /* the current pass walks everything */
+    uint8_t _passPending;       /* a pass has taken changes and not finished */
+    uint8_t _fullReady;         /* the current full pass started after _ready */
+    uint8_t _complete;          /* journal covers everything since the last pass */
+    uint8_t _shutdown;
+    uint8_t _exited;
+
+    /* stats */
+    uint64_t _eventCount;
+    uint64_t _overflowCount;
+
+    static uint64_t hashPath(const char *pathp, size_t length);
+
+    void watchThread(void *contextp);
+
+    int32_t addWatches(std::string *relPathp);
+
+    void removeWatches(std::string *relPathp);
+
+    Watch *findWatch(int wd);
+
+    void hashWatch(Watch *watchp);
+
+    void unhashWatch(Watch *watchp);
+
+    void recordNL(std::string *relPathp, int subtree);
+
+    Change *findChangeNL(const char *pathp, size_t length, uint64_t hash);
+
+    int coveredNL(Change *changep);
+
+    void handleEvents(char *bufferp, long count);
+
+    void loseEvents(const char *whyp);
+
+    void clearChangesNL();
+
+ public:
+    FsWatcher(std::string root) : _cv(&_lock) {
+        _root = root;
+        _fd = -1;
+        _watchHashSize = _minHashSize;
+        _watchHashp = new Watch *[_watchHashSize];
+        memset(_watchHashp, 0, _watchHashSize * sizeof(Watch *));
+        _watchCount = 0;
+        _changeHashSize = _minHashSize;
+        _changeHashp = new Change *[_changeHashSize];
+        memset(_changeHashp, 0, _changeHashSize * sizeof(Change *));
+        _changeCount = 0;
+        _ready = 0;
+        _lost = 0;
+        _failed = 0;
+        _fullPass = 0;
+        _passPending = 0;
+        _fullReady = 0;
+        _complete = 0;
+        _shutdown = 0;
+        _exited = 0;
+        _eventCount = 0;
+        _overflowCount = 0;
+    }
+
+    ~FsWatcher();
+
+    int32_t start();
+
+    void shutdown();
+
+    int32_t takeChanges(dqueue<Change> *changesp, int forceFull = 0);
+
+    void passDone(int finished);
+
+    int matches(std::string *rootp) {
+        return (*rootp == _root);
+    }
+
+    int isComplete() {
+        return _complete;
+    }
+
+    uint32_t getWatchCount() {
+        return _watchCount;
+    }
+
+    uint64_t getEventCount() {
+        return _eventCount;
+    }
+
+    uint64_t getOverflowCount() {
+        return _overflowCount;
+    }
+
+    /* for fswatchtest: handle events as if we'd read them from inotify */
+    void injectEvents(char *bufferp, long count) {
+        handleEvents(bufferp, count);
+    }
+
+    static void freeChanges(dqueue<Change> *changesp) {
+        Change *changep;
+        while((changep = changesp->pop()) != NULL) {
+            delete changep;
+        }
+    }
+};
+
+#endif /* __FSWATCH_H_ENV__ */
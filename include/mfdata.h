@@ -0,0 +1,6 @@
+#ifndef __MFDATA_H_ENV__
+#define __MFDATA_H_ENV__ 1
+
+/* nothing here yet */
+
+#endif /* __MFDATA_H_ENV__ */
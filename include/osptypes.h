@@ -0,0 +1,14 @@
+#ifndef _OSP_TYPES_H_ENV__
+#define _OSP_TYPES_H_ENV__ 1
+
+#include <sys/types.h>
+#include <stdlib.h>
+#include <stddef.h>
+
+typedef u_int8_t uint8_t;
+typedef u_int16_t uint16_t;
+typedef u_int32_t uint32_t;
+typedef u_int64_t uint64_t;
+
+#endif /* _OSP_TYPES_H_ENV__ */
+
@@ -0,0 +1,386 @@
+#include <string>
+#include <vector>
+#include <list>
+
+#include "dqueue.h"
+#include "xapi.h"
+#include "bufgen.h"
+#include "cthread.h"
+#include "cdisp.h"
+
+/* Usage: this module is responsible for taking a query string, like 'WYEP' and finding
+ * the radio station info for that station, and providing the info, and the stream URL,
+ * to the caller.  We'd also like to upcall station status information, specifically,
+ * whether the streaming URL appear to be working.
+ *
+ * A query (RadioScanQuery) can match multiple stations (RadioScanStation).  Each
+ * station may have multiple associated streams.
+ *
+ * Each query has its own lock, which its searches and verifications
+ * take to change it.  Callers watching a query don't need it: a
+ * station is linked in, and a station's verification results are
+ * written, before the query's _nextVersion update counter is
+ * advanced past the station's _updateVersion, so a caller that reads
+ * the counter with getUpdateVersion, and then walks the stations with
+ * getFirstStation and getNextStation, sees every update numbered below
+ * what it read.  Verification runs as tasks on a pool of threads shared
+ * by all of a RadioScan's queries, each query running at most
+ * _maxVerifyTasks of them at once.
+ */
+
+class RadioScan;
+class RadioScanQuery;
+class RadioScanStation;
+class RadioScanWork;
+class RadioScanVerifyTask;
+
+class RadioScanWork {
+public:
+    RadioScanWork *_dqNextp;
+    RadioScanWork *_dqPrevp;
+    RadioScanStation *_stationp;
+};
+
+/* instantiate a radioscan object once, and then perform multiple search operations.
+ * It creates its own cdisp object now, but if we ever have multiple users of a 
+ * thread pool, we can pass in a cdisp instead.
+ */
+class RadioScan {
+    friend class RadioScanQuery;
+
+    bool _strictLicense;
+
+    /* threads verifying stations, for all queries */
+    static const uint32_t _verifyThreads = 24;
+    CDisp *_verifyDispp;
+    CDispGroup *_verifyGroupp;
+
+ public:
+    /* max # of 301 redirects before we call it quits */
+    static const uint32_t _maxRedirects = 6;
+
+    // unqualified tokens might be interpreted as components of a
+    // name, or of a keyword tag.
+    typedef enum _ScanType {
+        useTag = 1,
+        useName = 2,
+    } ScanType;
+
+    XApi *_xapip;
+    BufGen *_stwBufp;
+    XApi::ClientConn *_stwConnp;
+    BufGenFactory *_factoryp;
+
+    void init(BufGenFactory *factoryp, std::string dirPrefix);
+
+    void searchStation(RadioScanQuery *resp, ScanType=useName);
+
+    void browseStations( RadioScanQuery *resp);
+
+    void queueVerify(RadioScanQuery *queryp);
+
+    static void scanSort(int32_t *datap, int32_t count);
+
+    int32_t retrieveContents(std::string url , std::string *strp);
+
+    void setStrictLicense() {
+        _strictLicense = true;
+    }
+};
+
+/* verifies one station of a query, and then queues another task to
+ * do the next, behind any other queries' tasks.
+ */
+class RadioScanVerifyTask : public CDispTask {
+public:
+    RadioScanQuery *_queryp;
+
+    int32_t start();
+};
+
+class RadioScanQuery {
+    static const uint32_t _maxVerifyTasks = 6;
+    friend class RadioScan;
+    friend class RadioScanStation;
+private:
+    std::string _baseStatus;
+
+    /* protects everything a search or verification changes */
+    CThreadMutex _lock;
+
+    /* stations as published to watchers, linked by _publishNextp */
+    RadioScanStation *_publishHeadp;
+    RadioScanStation *_publishTailp;
+
+    uint32_t _verifyTasks;      /* running or queued */
+
+    void takeLock() {
+        _lock.take();
+    }
+
+    void releaseLock() {
+        _lock.release();
+    }
+
+    void publishUpdate(RadioScanStation *stationp);
+public:
+    std::string _query;         /* for simple queries */
+
+    std::string _verifyingUrl;  // URL being checked, if any
+
+    std::list<std::string> _nameList;
+    std::list<std::string> _countryList;
+    std::list<std::string> _cityList;;
+    std::list<std::string> _genreList;
+    int32_t _browseMaxCount;
+
+    CThreadCV _cv;
+
+    RadioScan *_scanp;
+    dqueue<RadioScanStation> _goodStations;
+    dqueue<RadioScanWork> _workEntries;
+    uint32_t _refCount;
+    std::string _detailedStatus;
+    int _aborted;
+
+    bool _verifying;
+    uint32_t _verifyingCount;
+    uint32_t _verifyingIndex;
+    bool _allVerified;
+    uint32_t _nextVersion;
+
+    uint32_t _maxReturnCount;
+
+    RadioScanQuery() : _cv(&_lock) {
+        _refCount = 0;
+        _aborted = 0;
+        _verifying = false;
+        _allVerified = false;
+        _browseMaxCount = 10000;
+        _nextVersion = 0;
+        _maxReturnCount = 0;
+        _publishHeadp = nullptr;
+        _publishTailp = nullptr;
+        _verifyTasks = 0;
+    }
+
+    void init(RadioScan *scanp, std::string query) {
+        _query = query;
+        _scanp = scanp;
+    }
+
+    void buildWorkEntries();
+
+    void setMaxReturnCount(uint32_t amax) {
+        _maxReturnCount = amax;
+    }
+
+    void initBrowse(RadioScan *scanp, 
+                    int32_t maxCount,
+                    std::string country,
+                    std::string state,
+                    std::string city,
+                    std::string genre);
+
+    /* every station update numbered below this is visible */
+    uint32_t getUpdateVersion() {
+        return __atomic_load_n(&_nextVersion, __ATOMIC_ACQUIRE);
+    }
+
+    RadioScanStation *getFirstStation() {
+        return __atomic_load_n(&_publishHeadp, __ATOMIC_ACQUIRE);
+    }
+
+    RadioScanStation *getNextStation(RadioScanStation *stationp);
+
+    void setVerifyingUrl(std::string url) {
+        takeLock();
+        _verifyingUrl = url;
+        releaseLock();
+    }
+
+    bool isVerifying() {
+        return __atomic_load_n(&_verifying, __ATOMIC_ACQUIRE);
+    }
+
+    /* read before a final getUpdateVersion, so that a last scan sees everything */
+    bool isAllVerified() {
+        return __atomic_load_n(&_allVerified, __ATOMIC_ACQUIRE);
+    }
+
+    void initSmart(RadioScan *scanp, std::string query);
+
+    void freeUnusedStations(std::vector<RadioScanStation *> *stations);
+
+    void considerStation(RadioScanStation *stationp);
+
+    void returnStation(RadioScanStation *stationp);
+
+    int32_t searchStreamTheWorld(RadioScan::ScanType scanType);
+
+    int32_t searchRadioTime(RadioScan::ScanType scanType);
+
+    int32_t searchDar(RadioScan::ScanType scanType);
+
+    void addWord(std::string newWord);
+
+    void verifyStations();
+
+    void verifyNext();
+
+    int32_t searchFile();
+
+    int32_t searchShoutcast(RadioScan::ScanType scanType);
+
+    int32_t browseFile(RadioScan::ScanType scanType);
+
+    std::string getStatus();
+
+    bool isPrefix(std::string prefix, std::string target);
+
+    bool isDelimeter(char ac);
+
+    void abort() {
+        // the helper threads all watch this, and will exit early if
+        // aborted gets set.
+        _aborted = 1;
+        // _baseStatus = std::string("Aborting");
+    }
+
+    int isAborted() {
+        return _aborted;
+    }
+
+    ~RadioScanQuery();
+};
+
+class RadioScanStation {
+ public:
+
+    // for URLs that turn into playlists, max # of working entries we'll add,
+    // since some of these files have *lots* of streams.
+    static const uint32_t _maxStreamsPerUrl = 4;
+
+    class Entry {
+    public:
+        Entry *_dqNextp;
+        Entry *_dqPrevp;
+        uint32_t _streamRateKb;    /* station stream rate in kbits/second */
+        std::string _streamUrl;
+        std::string _streamType;
+        int8_t _alive;  /* -1 means unknown, 0 is no, 1 is yes */
+        int8_t _sawIcyBr;       // saw icy-br
+
+        Entry() {
+            _alive = -1;
+            _sawIcyBr = 0;
+        }
+    };
+
+    typedef int32_t (streamUrlProc)(void *urlContextp, const char *urlStringp);
+    uint32_t _refCount;
+    uint8_t _deleted;
+    RadioScan *_scanp;
+    RadioScanQuery *_queryp;
+    dqueue<Entry> _entries;
+    std::string _stationName;
+    std::string _stationShortDescr;
+    std::string _iconUrl;
+    RadioScanStation *_dqNextp;
+    RadioScanStation *_dqPrevp;
+    RadioScanStation *_publishNextp;
+    std::string _stationSource;
+    bool _inQueryList;
+
+    // These fields come from the radio directory, but
+    // the url may expand into multiple stream URLs
+    std::string _sourceUrl;
+    std::string _altSourceUrl;  // if we have a second to check
+    uint32_t _streamRateKb;     /* station stream rate in kbits/second */
+    uint8_t _sawIcyBr;
+    std::string _streamType;
+
+    bool _verified;
+    bool _verifiedWorking;
+    uint32_t _updateVersion;
+    uint32_t _userFlags;        // flags for our caller to use
+
+    void init(RadioScanQuery *queryp) {
+        _queryp = queryp;
+        _scanp = queryp->_scanp;
+        _updateVersion = 0;
+        _verified = false;
+        _verifiedWorking = false;
+        _userFlags = 0;
+    }
+
+    /* only meaningful for stations reached from their query's
+     * getFirstStation, and the same for isVerified and
+     * isVerifiedWorking.
+     */
+    uint32_t getUpdateVersion() {
+        return __atomic_load_n(&_updateVersion, __ATOMIC_ACQUIRE);
+    }
+
+    bool isVerified() {
+        return __atomic_load_n(&_verified, __ATOMIC_ACQUIRE);
+    }
+
+    bool isVerifiedWorking() {
+        return __atomic_load_n(&_verifiedWorking, __ATOMIC_ACQUIRE);
+    }
+
+    void addStreamEntry(const char *streamUrlp,
+                        const char *typep,
+                        uint32_t streamRateKb,
+                        int sawIcyBr);
+
+    int32_t streamApply(std::string url,
+                        streamUrlProc *urlProcp,
+                        void *urlContextp,
+                        RadioScanQuery *queryp);
+
+    void updatedEntries();
+
+    void updatedState();
+
+    Entry *getFirstEntry();
+
+    Entry *getNextEntry(Entry *ep);
+
+    void hold();
+
+    void release();
+
+    void del(); /* delete is a reserved word */
+
+    int parsePls(const char *resultp, streamUrlProc *urlProcp, void *urlContextp,
+                 RadioScanQuery *qp);
+
+    int parseUrl(const char *resultp, streamUrlProc *urlProcp, void *urlContextp,
+                 RadioScanQuery *qp);
+
+    ~RadioScanStation();
+
+    static std::string trimToFirst(std::string url);
+
+    static std::string extractFields(std::string tags, int32_t fields);
+
+    static int queryMatch(const char *a, const char *b);
+
+    static int hasISubstr(const char *keyp, std::string target);
+
+    static int32_t stwCallback(void *contextp, const char *urlp);
+
+    static int skipPastEol(const char **datap, int32_t *lenp);
+
+    static int32_t splitLine(const char *bufferp, uint32_t count, char **targetsp);
+
+    static std::string upperCase(std::string name);
+
+    RadioScanStation() {
+        _inQueryList = false;
+        _sawIcyBr = 0;
+        _publishNextp = nullptr;
+    }
+};
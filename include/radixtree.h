@@ -0,0 +1,270 @@
+#ifndef __RADIXTREE_H_ENV__
+
+#define __RADIXTREE_H_ENV__ 1
+
+#include <string>
+#include <string.h>
+#include "osp.h"
+#include "dqueue.h"
+
+/* a RadixTree tree, implemented as an adaptive radix tree.  Inner
+ * nodes come in four sizes (4, 16, 48 and 256 children), and grow and
+ * shrink between them as children come and go.  Each inner node
+ * carries the key bytes that all of its descendants share, so chains
+ * of single child nodes never exist, and a key that's the only one
+ * under some prefix is stored as a leaf right there, rather than at
+ * the bottom of a chain of nodes.
+ *
+ * A leaf holds all of the items with one key, in the order they were
+ * inserted.  A key that's a prefix of other keys hangs off the inner
+ * node where it ends, in the node's _termp, which apply visits before
+ * the node's children, so iteration is in key order.
+ */
+class RadixTree {
+public:
+    class Item;
+
+private:
+    /* define Node types */
+    static const uint8_t _typeLeaf = 0;
+    static const uint8_t _typeNode4 = 1;
+    static const uint8_t _typeNode16 = 2;
+    static const uint8_t _typeNode48 = 3;
+    static const uint8_t _typeNode256 = 4;
+
+    /* a Node256 shrinks to a Node48 when it gets down to this many
+     * children, a Node48 to a Node16 and so on; these leave some room
+     * so that a node flapping around a boundary doesn't get copied
+     * back and forth.
+     */
+    static const uint32_t _shrink256 = 36;
+    static const uint32_t _shrink48 = 12;
+    static const uint32_t _shrink16 = 3;
+
+    class Node {
+    public:
+        uint8_t _type;
+    };
+
+    class Leaf : public Node {
+    public:
+        dqueue<Item> _items;
+        std::string *_keyp;     /* key of the first item */
+
+        Leaf() {
+            _type = _typeLeaf;
+            _keyp = NULL;
+        }
+    };
+
+    class Inner : public Node {
+    public:
+        uint16_t _count;        /* children, not counting _termp */
+        std::string _prefix;    /* key bytes shared by everything below */
+        Leaf *_termp;           /* key ending right after _prefix */
+
+        Inner() {
+            _count = 0;
+            _termp = NULL;
+        }
+    };
+
+    /* children kept sorted by key byte */
+    class Node4 : public Inner {
+    public:
+        uint8_t _keys[4];
+        Node *_childp[4];
+
+        Node4() {
+            _type = _typeNode4;
+        }
+    };
+
+    class Node16 : public Inner {
+    public:
+        uint8_t _keys[16];
+        Node *_childp[16];
+
+        Node16() {
+            _type = _typeNode16;
+        }
+    };
+
+    /* _index maps a key byte to its slot + 1, or 0 if there's no such
+     * child; _slotKeys maps back, so that a slot can be moved.
+     */
+    class Node48 : public Inner {
+    public:
+        uint8_t _index[256];
+        uint8_t _slotKeys[48];
+        Node *_childp[48];
+
+        Node48() {
+            _type = _typeNode48;
+            memset(_index, 0, sizeof(_index));
+        }
+    };
+
+    class Node256 : public Inner {
+    public:
+        Node *_childp[256];
+
+        Node256() {
+            _type = _typeNode256;
+            memset(_childp, 0, sizeof(_childp));
+        }
+    };
+
+    /* you put one of these in your object for each key in a radix tree */
+public:
+    class Item {
+    public:
+        std::string *_keyp;
+        void *_backp;
+
+        Item *_dqNextp;
+        Item *_dqPrevp;
+
+        uint8_t _inList;
+
+        Item() {
+            _backp = NULL;
+            _inList = 0;
+            _keyp = NULL;
+            _dqNextp = NULL;
+            _dqPrevp = NULL;
+        }
+
+        static uint32_t getStrByte(std::string *keyp, uint32_t ix) {
+            uint8_t *tp;
+            uint32_t len;
+
+            tp = (uint8_t *) keyp->c_str();
+            len = (uint32_t) keyp->length();
+            if (ix < len)
+                return tp[ix];
+            else
+                return 0;
+        }
+
+        uint32_t getKeyByte(uint32_t ix) {
+            return Item::getStrByte(_keyp, ix);
+        }
+    };
+
+    typedef int32_t (Callback)(void *callbackContextp, void *recordContextp);
+
+private:
+    Node *_rootp;
+    uint32_t _keyCount;         /* leaves */
+    uint32_t _itemCount;
+
+    /* while an apply is running, removing an item leaves its leaf in
+     * place, even if it's empty, and the tree is cleaned up once the
+     * outermost apply finishes.
+     */
+    uint32_t _applyCount;
+    uint32_t _emptyCount;
+
+    static uint32_t capacity(uint8_t type);
+
+    static Inner *newInner(uint32_t count);
+
+    static void deleteNode(Node *nodep);
+
+    static void freeNode(Node *nodep);
+
+    static Node **findChild(Inner *innerp, uint8_t key);
+
+    static Node *nextChild(Inner *innerp, uint32_t *posp, uint8_t *keyp);
+
+    static void addChild(Node **refpp, uint8_t key, Node *childp);
+
+    static void putChild(Inner *innerp, uint8_t key, Node *childp);
+
+    static void removeChild(Inner *innerp, uint8_t key);
+
+    static void resize(Node **refpp, uint32_t count);
+
+    static void compact(Node **refpp);
+
+    Leaf *newLeaf(Item *itemp);
+
+    Node *buildNode(Item **itemsp, uint32_t count, uint32_t depth);
+
+    void dropLeaf(Leaf *leafp, Node **parentpp, int32_t keyByte);
+
+    void prune(Node **refpp);
+
+    Leaf *findLeaf(std::string *keyp, Node ***parentppp, int32_t *keyBytep);
+
+    void leafEmptied(Leaf *leafp, Node **parentpp, int32_t keyByte);
+
+    int32_t applyNode(Node *nodep, Callback *procp, void *callbackContextp, int onlyUnique);
+
+    static int32_t applyLeaf(Leaf *leafp, Callback *procp, void *callbackContextp, int onlyUnique);
+
+public:
+    RadixTree() {
+        _rootp = NULL;
+        _keyCount = 0;
+        _itemCount = 0;
+        _applyCount = 0;
+        _emptyCount = 0;
+        return;
+    }
+
+    ~RadixTree() {
+        if (_rootp)
+            freeNode(_rootp);
+    }
+
+    /* find the first item with a key, and the list of all items with
+     * that key.
+     */
+    int32_t find(std::string *keyp, dqueue<Item> **listpp, Item **itempp);
+
+    /* add an item; keys needn't be unique.  Not allowed from an apply
+     * callback.
+     */
+    int32_t insert(std::string *keyp, Item *recordItemp, void *objp);
+
+    /* build an empty tree from items already sorted by key, whose
+     * _keyp and _backp are set; much faster than inserting them one at
+     * a time.  Fails, leaving the tree alone, if the tree isn't empty
+     * or the items aren't sorted.
+     */
+    int32_t bulkLoad(Item **itemsp, uint32_t count);
+
+    /* return the object of the first item with a key */
+    int32_t lookup(std::string *keyp, void **objp);
+
+    /* if objp is non-null, we check that it matches, and fail if it doesn't */
+    int32_t remove(std::string *keyp, void *objp = NULL);
+
+    /* remove one item, which must be in the tree; unlike remove with
+     * an objp, this doesn't search the key's items for it.
+     */
+    int32_t removeItem(Item *itemp);
+
+    /* call back with each item's object, in key order; the callback
+     * may remove the item it's called with, and free its object.
+     */
+    int32_t apply(Callback *callbackp, void *callbackContextp, int onlyUnique=0);
+
+    /* like apply, but only for the keys starting with *prefixp */
+    int32_t applyPrefix( std::string *prefixp,
+                         Callback *callbackp,
+                         void *callbackContextp,
+                         int onlyUnique=0);
+
+    uint32_t getKeyCount() {
+        return _keyCount;
+    }
+
+    uint32_t getItemCount() {
+        return _itemCount;
+    }
+};
+
+#endif /* __RADIXTREE_H_ENV__ */
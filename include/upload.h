@@ -0,0 +1,1045 @@
+#ifndef __UPLOAD_H_ENV__
+#define __UPLOAD_H_ENV__ 1
+
+#include <stdio.h>
+#include <string>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <openssl/evp.h>
+
+#include "sapi.h"
+#include "sapilogin.h"
+#include "xapi.h"
+#include "bufsocket.h"
+// #include "buftls.h"
+#include "json.h"
+#include "cfsms.h"
+#include "walkdisp.h"
+#include "fswatch.h"
+
+class Uploader;
+class UploadApp;
+class UploadEntry;
+
+class DataSourceString : public CDataSource {
+    const char *_datap;
+    std::string _dataStr;
+
+ public:
+    int32_t getAttr(CAttr *attrp) {
+	attrp->_mtime = 1000000000ULL;
+	attrp->_ctime = 1000000000ULL;
+	attrp->_length = strlen(_datap)+1;
+	return 0;
+    }
+
+    int32_t read( uint64_t offset, uint32_t count, char *bufferp) {
+	int32_t tcount = count;
+	int32_t length = (int32_t) strlen(_datap)+1;
+
+	if (offset >= length)
+	    return 0;
+
+	if (tcount > length - offset)
+	    tcount = (int32_t) (length-offset);
+
+	memcpy(bufferp, _datap+offset, tcount);
+	return tcount;
+    }
+
+    int32_t close() {
+	return 0;
+    }
+
+    void setString( std::string data) {
+        _dataStr = data;
+        _datap = _dataStr.c_str();
+    }
+
+    DataSourceString ( std::string data) {
+        _dataStr = data;
+        _datap = _dataStr.c_str();
+    }
+
+    ~DataSourceString() {
+	return;
+    }
+};
+
+class DataSourceFile : public CDataSource {
+ public:
+    /* how reads should treat the page cache: normally we ask for
+     * sequential readahead, and prefetch the chunk after each read.
+     * Big files can instead drop pages behind us as we go, or bypass
+     * the cache entirely with O_DIRECT (F_NOCACHE on OS X), so that a
+     * backup doesn't push everything else out of memory.
+     */
+    typedef enum {
+        cacheNormal = 0,
+        cacheDropBehind = 1,
+        cacheDirect = 2,
+    } CacheMode;
+
+    static const uint32_t _directAlign = 4096;
+
+ private:
+    int _fd;
+    int _directFd;              /* opened O_DIRECT, for cacheDirect */
+    CacheMode _cacheMode;
+    CThreadMutex _lock;         /* protects the hash state */
+
+    /* once startHash is called, reads that go through the file in
+     * order feed a content hash; reads of data already hashed, as on
+     * retries, are fine, but skipping ahead spoils it.
+     */
+    EVP_MD_CTX *_hashCtxp;
+    uint64_t _hashOffset;
+    uint8_t _hashValid;
+
+ public:
+    static const uint32_t _digestBytes = 32;
+
+    int32_t open(const char *fileNamep, CacheMode mode = cacheNormal);
+
+    int32_t readDirect( uint64_t offset, uint32_t count, char *bufferp);
+
+    int32_t getAttr(CAttr *attrp);
+
+    int32_t read( uint64_t offset, uint32_t count, char *bufferp);
+
+    void startHash();
+
+    int finishHash(uint64_t length, uint8_t *digestp);
+
+    int32_t computeHash(uint64_t length, uint8_t *digestp);
+
+    int32_t close() {
+        if (_fd >= 0) {
+            // printf("DataSourceFile closing fd=%d\n", _fd);
+            ::close(_fd);
+            _fd = -1;
+        }
+        if (_directFd >= 0) {
+            ::close(_directFd);
+            _directFd = -1;
+        }
+        return 0;
+    }
+
+    static void statToAttr(struct stat *tstatp, CAttr *attrp) {
+#ifdef __linux__
+        attrp->_mtime = ((uint64_t) tstatp->st_mtim.tv_sec *1000000000ULL + 
+                         tstatp->st_mtim.tv_nsec);
+        attrp->_ctime = ((uint64_t) tstatp->st_ctim.tv_sec *1000000000ULL + 
+                         tstatp->st_ctim.tv_nsec);
+#else
+        attrp->_mtime = ((uint64_t) tstatp->st_mtimespec.tv_sec *1000000000ULL + 
+                         tstatp->st_mtimespec.tv_nsec);
+        attrp->_ctime = ((uint64_t) tstatp->st_ctimespec.tv_sec *1000000000ULL + 
+                         tstatp->st_ctimespec.tv_nsec);
+#endif
+        attrp->_length = tstatp->st_size;
+    }
+
+    DataSourceFile() {
+        _fd = -1;
+        _directFd = -1;
+        _cacheMode = cacheNormal;
+        _hashCtxp = NULL;
+        _hashOffset = 0;
+        _hashValid = 0;
+    }
+
+    ~DataSourceFile() {
+        close();
+        if (_hashCtxp)
+            EVP_MD_CTX_free(_hashCtxp);
+    }
+};
+
+class UploadReq : public SApi::ServerReq {
+public:
+    static UploadReq *factory(SApi *sapip) {
+        return new UploadReq(sapip);
+    }
+
+    UploadReq(SApi *sapip) : SApi::ServerReq(sapip) {
+        return;
+    }
+
+    void UploadHomeScreenMethod();
+
+    void UploadStartAllScreenMethod();
+
+    void UploadStartSelScreenMethod();
+
+    void UploadStopAllScreenMethod();
+
+    void UploadStopSelScreenMethod();
+
+    void UploadPauseAllScreenMethod();
+
+    void UploadPauseSelScreenMethod();
+
+    void UploadStatusDataMethod();
+
+    void UploadInfoDataMethod();
+
+    void UploadLoadConfigMethod();
+
+    void UploadDeleteConfigMethod();
+
+    void UploadHelpPicsMethod();
+
+    void UploadDeleteSelScreenMethod();
+
+    void UploadSetSelectedConfigMethod();
+
+    void UploadSetEnabledConfigMethod();
+
+    void UploadCreateConfigMethod();
+
+    void UploadBackupIntervalMethod();
+
+    void UploadInfoScreenMethod();
+
+    void UploadZapBothTokensMethod();
+
+    void UploadZapAuthTokenMethod();
+};
+
+class UploadErrorEntry {
+ public:
+    std::string _op;
+    int32_t _httpError;
+    std::string _shortError;
+    std::string _longError;
+    UploadErrorEntry *_dqNextp;
+    UploadErrorEntry *_dqPrevp;
+};
+
+/* A persistent record of what we've already uploaded for one
+ * UploadEntry, mapping each file's path relative to the backup root
+ * to its size and mtime when uploaded, along with the cloud object's
+ * ID and mtime.  The uploader consults this before going to the
+ * cloud, so unchanged files cost only a hash lookup.
+ *
+ * The file is a header followed by one record per path, written to a
+ * temporary file and renamed into place; a manifest for some other
+ * pair of roots, or one we can't parse, is treated as empty.
+ */
+class UploadManifest {
+ public:
+    static const uint32_t _magic = 0x554d4631;  /* "UMF1" */
+    static const uint32_t _saveEvery = 1000;    /* updates between saves */
+
+    class Entry {
+    public:
+        Entry *_nextHashp;
+        std::string _relPath;
+        uint64_t _size;
+        uint64_t _mtime;        /* local mtime, in ns */
+        uint64_t _cloudMtime;   /* in ns */
+        std::string _cloudId;
+    };
+
+ private:
+    CThreadMutex _lock;
+    std::string _fileName;
+    std::string _fsRoot;
+    std::string _cloudRoot;
+    Entry **_hashTablep;
+    uint32_t _hashSize;
+    uint32_t _count;
+    uint32_t _unsavedCount;
+
+    void rehash(uint32_t newSize);
+
+    Entry *findNL(std::string *relPathp, uint64_t hash);
+
+ public:
+    UploadManifest(std::string fileName, std::string fsRoot, std::string cloudRoot) {
+        _fileName = fileName;
+        _fsRoot = fsRoot;
+        _cloudRoot = cloudRoot;
+        _hashSize = 1024;
+        _hashTablep = new Entry *[_hashSize];
+        memset(_hashTablep, 0, _hashSize * sizeof(Entry *));
+        _count = 0;
+        _unsavedCount = 0;
+    }
+
+    ~UploadManifest() {
+        clear();
+        delete [] _hashTablep;
+    }
+
+    void clear();
+
+    int32_t load();
+
+    int32_t save();
+
+    /* save if enough updates have accumulated */
+    void checkpoint();
+
+    /* return true if relPath was uploaded with this size and mtime */
+    int isCurrent(std::string *relPathp, uint64_t size, uint64_t mtime);
+
+    void update( std::string *relPathp,
+                 uint64_t size,
+                 uint64_t mtime,
+                 uint64_t cloudMtime,
+                 std::string *cloudIdp);
+
+    uint32_t getCount() {
+        return _count;
+    }
+
+    int matches(std::string *fsRootp, std::string *cloudRootp) {
+        return (*fsRootp == _fsRoot && *cloudRootp == _cloudRoot);
+    }
+
+    void unlinkFile() {
+        unlink(_fileName.c_str());
+    }
+};
+
+/* An index from file contents, by length and digest, to the cloud ID
+ * of a file we've uploaded with those contents, so that a duplicate
+ * can be copied by the server rather than sent again.  It's only kept
+ * in memory, and is shared by all the backup entries.  A bitmap of
+ * the lengths we've seen lets the uploader skip hashing files that
+ * can't be duplicates, hashing them while they're sent instead.  The
+ * cloud file's mtime lets copyFile check that it hasn't been changed
+ * since we sent it.
+ */
+class UploadDedup {
+ public:
+    static const uint64_t _minBytes = 1024*1024;        /* smaller files are just sent */
+    static const uint32_t _maxEntries = 256*1024;
+    static const uint32_t _hashSize = 65536;
+    static const uint32_t _lengthBits = 1<<20;
+
+    class Entry {
+    public:
+        Entry *_nextHashp;
+        uint64_t _length;
+        uint8_t _digest[DataSourceFile::_digestBytes];
+        std::string _cloudId;
+        uint64_t _cloudMtime;
+    };
+
+ private:
+    CThreadMutex _lock;
+    Entry **_hashTablep;
+    uint32_t _count;
+    uint8_t *_lengthMapp;
+
+    static uint32_t hashKey(uint64_t length, uint8_t *digestp) {
+        uint32_t tval;
+        memcpy(&tval, digestp, sizeof(tval));
+        return (tval ^ (uint32_t) length) & (_hashSize-1);
+    }
+
+    static uint32_t lengthBit(uint64_t length) {
+        return (uint32_t) ((length * 0x9e3779b97f4a7c15ULL) >> 44) & (_lengthBits-1);
+    }
+
+    Entry *findNL(uint64_t length, uint8_t *digestp);
+
+ public:
+    UploadDedup() {
+        _hashTablep = new Entry *[_hashSize];
+        memset(_hashTablep, 0, _hashSize * sizeof(Entry *));
+        _count = 0;
+        _lengthMapp = new uint8_t[_lengthBits/8];
+        memset(_lengthMapp, 0, _lengthBits/8);
+    }
+
+    ~UploadDedup();
+
+    /* false if no file we know of has this length */
+    int mayHave(uint64_t length) {
+        uint32_t bit = lengthBit(length);
+        return (_lengthMapp[bit>>3] >> (bit & 7)) & 1;
+    }
+
+    int find(uint64_t length, uint8_t *digestp, std::string *cloudIdp, uint64_t *cloudMtimep);
+
+    void add(uint64_t length, uint8_t *digestp, std::string *cloudIdp, uint64_t cloudMtime);
+
+    void remove(uint64_t length, uint8_t *digestp);
+};
+
+class UploadEntry {
+public:
+    Uploader *_uploaderp;
+    UploadManifest *_manifestp;
+    FsWatcher *_watcherp;               /* null unless watching for changes */
+    UploadApp *_app;
+    std::string _fsRoot;
+    std::string _cloudRoot;
+    uint32_t _lastFinishedTime;
+    uint32_t _lastReconcileTime;
+    uint8_t _enabled;
+    uint8_t _manual;
+    uint8_t _selected;
+
+    UploadEntry() {
+        _uploaderp = NULL;
+        _manifestp = NULL;
+        _watcherp = NULL;
+        _app = NULL;
+        _lastFinishedTime = 0;
+        _lastReconcileTime = 0;
+        _enabled = 1;
+        _manual = 0;
+        _selected = 0;
+    }
+
+    ~UploadEntry();
+
+    void stop();
+};
+
+class Uploader {
+public:
+    typedef enum { STOPPED = 1,
+                   PAUSED = 2,
+                   RUNNING = 3,
+                   STALLED = 4,
+                   STARTING = 5,
+    } Status;
+
+    typedef enum { REASON_MANUAL = 1,   /* manually stopped by admin */
+                   REASON_AUTH = 2,     /* authentication expired */
+                   REASON_DONE = 3,     /* normal termination */
+                   REASON_HARD = 4,     /* hard failure */
+    } StopReason;
+
+    typedef void StateProc(void *contextp);
+
+    CDisp *_cdisp;
+    CDispGroup *_group;
+    Cfs *_cfsp;
+    std::string _fsRoot;      /* not counting terminal '/' */
+    uint32_t _fsRootLen;
+    CThreadMutex _lock;
+    WalkTask *_walkTaskp;
+    Status _status;
+    StopReason _stopReason;
+    std::string _cloudRoot;
+    uint8_t _verbose;
+    StateProc *_stateProcp;
+    void *_stateContextp;
+    UploadManifest *_manifestp;         /* may be null */
+    uint8_t _reconcile;                 /* check the cloud even if manifest says current */
+    dqueue<FsWatcher::Change> *_changesp; /* if set, only look at these paths */
+    FsWatcher *_watcherp;               /* told if we fail to start; may be null */
+    UploadDedup *_dedupp;               /* may be null */
+    uint64_t _bypassCacheBytes;         /* files this big skip the page cache; 0 for none */
+    uint8_t _directIO;                  /* skip it with O_DIRECT, not by dropping pages */
+
+    /* some stats */
+    uint64_t _filesCopied;
+    uint64_t _bytesCopied;
+    uint64_t _filesSkipped;
+    uint64_t _manifestSkips;            /* subset of _filesSkipped */
+    uint64_t _fileCopiesFailed;
+
+    Uploader() {
+        _cdisp = NULL;
+        _group = NULL;
+        _cfsp = NULL;
+        _fsRootLen = 0;
+        _status = STOPPED;
+        _stopReason = REASON_DONE;
+        _verbose = 0;
+        _stateProcp = NULL;
+        _stateContextp = NULL;
+        _manifestp = NULL;
+        _reconcile = 0;
+        _changesp = NULL;
+        _watcherp = NULL;
+        _dedupp = NULL;
+        _bypassCacheBytes = 0;
+        _directIO = 0;
+
+        _filesCopied = 0;
+        _bytesCopied = 0;
+        _filesSkipped = 0;
+        _manifestSkips = 0;
+        _fileCopiesFailed = 0;
+
+        return;
+    }
+
+    ~Uploader() {
+        if (_group) {
+            delete _group;
+            _group = NULL;
+        }
+        /* don't delete walkTaskp, since it auto deletes */
+        if (_changesp) {
+            FsWatcher::freeChanges(_changesp);
+            delete _changesp;
+        }
+    }
+
+    static int32_t mainCallback(void *contextp, std::string *pathp, struct stat *statp);
+
+    void init(std::string cloudRoot,
+              std::string fsRoot,
+              CDisp *cdisp,
+              Cfs *cfsp,
+              StateProc *procp,
+              void *contextp) {
+        _cloudRoot = cloudRoot;
+        _cdisp = cdisp;
+        _cfsp = cfsp;
+        _fsRoot = fsRoot;
+        _fsRootLen = (uint32_t) _fsRoot.length();
+        _stateProcp = procp;
+        _stateContextp = contextp;
+    }
+
+    int checkAbort(int32_t code);
+
+    void startFailed(int32_t code);
+    
+    void setStateProc(StateProc *procp, void *contextp) {
+        _stateProcp = procp;
+        _stateContextp = contextp;
+    }
+
+    void setVerbose() {
+        _verbose = 1;
+    }
+
+    /* use manifestp to skip files uploaded by earlier passes; if
+     * reconcile is set, check every file with the cloud anyway, and
+     * rebuild the manifest from what we find.
+     */
+    void setManifest(UploadManifest *manifestp, int reconcile) {
+        _manifestp = manifestp;
+        _reconcile = reconcile;
+    }
+
+    /* make the next start an incremental pass over just the paths in
+     * changesp, which we take ownership of.
+     */
+    void setChanges(dqueue<FsWatcher::Change> *changesp) {
+        _changesp = changesp;
+    }
+
+    /* the watcher whose pass we're running, so a failed start can end it */
+    void setWatcher(FsWatcher *watcherp) {
+        _watcherp = watcherp;
+    }
+
+    /* copy duplicates of files already uploaded on the server */
+    void setDedup(UploadDedup *dedupp) {
+        _dedupp = dedupp;
+    }
+
+    void setCacheBypass(uint64_t bytes, int directIO) {
+        _bypassCacheBytes = bytes;
+        _directIO = (directIO? 1 : 0);
+    }
+
+    /* true if the last pass ran to completion and copied everything */
+    int finishedAll() {
+        return (_stopReason == REASON_DONE && _fileCopiesFailed == 0);
+    }
+
+    void recordUpload( std::string *relPathp,
+                       CAttr *fsAttrp,
+                       std::string *cloudIdp,
+                       uint64_t cloudMtime,
+                       uint8_t *digestp = NULL);
+
+    void pause();
+
+    void stop();
+
+    void start();
+
+    void resume();
+
+    static void done(CDisp *disp, void *contextp);
+
+    StopReason getStopReason() {
+        return _stopReason;
+    }
+
+    Status getStatus() {
+        Status status;
+
+        /* see if we finished the tree walk, since we don't get callbacks when done;
+         * if in STARTING state, we havne't fired up the cdisp group yet.
+         */
+        if (_status != STOPPED && _status != STARTING) {
+            if (_group && _group->isAllDone())
+                _status = STOPPED;
+        }
+
+        status = _status;
+
+        if (_cfsp->getStalling() && (status == RUNNING || status == STARTING))
+            status = STALLED;
+            
+        return status;
+    }
+
+    int isIdle() {
+        if (_status == STOPPED && _group->isAllDone())
+            return 1;
+        else
+            return 0;
+    }
+
+    std::string getStatusString() {
+        Status status = getStatus();
+        if (status == STOPPED) {
+            if (_stopReason == REASON_AUTH)
+                return "<font color=\"red\">ReLogin</font>";
+            else
+                return "Stopped";
+        }
+        else if (status == PAUSED)
+            return "Paused";
+        else if (status == STALLED)
+            return "Server2Busy";
+        else if (status == STARTING)
+            return "Starting";
+        else
+            return "Running";
+    }
+
+    void getFullStatus( Status *statep,
+                        uint64_t *filesCopiedp,
+                        uint64_t *bytesCopiedp,
+                        uint64_t *totalFilesp,
+                        uint64_t *totalBytesp);
+
+    static void logError(int32_t code, std::string errorString, std::string longErrorString);
+};
+
+/* these fields should all be indexed by a cookie dictionary hanging
+ * off of the SApi structure.
+ */
+class UploadApp : public CThread {
+public:
+    static const uint32_t _maxUploaders = 128;
+    static const uint32_t _maxErrorEntries = 64;
+    static UploadApp *_globalApp;
+    UploadEntry *_uploadEntryp[_maxUploaders]; /* array of pointers to UploaderEntries */
+    SApiLoginCookie *_loginCookiep;
+    std::string _pathPrefix;
+    std::string _libPath;
+    std::string _picPath;
+    std::string fsRoot;
+    std::string cloudRoot;
+    uint32_t _backupInterval;
+    uint32_t _reconcileInterval;        /* secs between full cloud checks; 0 means never */
+    uint32_t _cacheMB;                  /* cnode cache budget; 0 means the default */
+    uint8_t _watchChanges;              /* journal changes so passes needn't walk everything */
+    uint8_t _dedup;                     /* copy duplicate files on the server */
+    UploadDedup *_dedupp;               /* allocated if _dedup is set */
+    uint32_t _bypassCacheMB;            /* files this big skip the page cache; 0 for none */
+    uint8_t _directIO;                  /* use O_DIRECT for those, not dropping pages behind */
+    uint8_t _pipelineGets;              /* pipeline the cloud's lookup and attribute GETs */
+    uint32_t _connIdleSec;              /* close cloud sockets idle this long; 0 means the default */
+    Cfs *_cfsp;
+    CDisp *_cdisp;
+    CThreadMutex _lock; /* protect error entries */
+    dqueue<UploadErrorEntry> _errorEntries;
+    CThreadMutex _entryLock;    /* protect upload entries */
+
+    class Log : public CfsLog {
+        UploadApp *_uploadApp;
+    public:
+        void logError( CfsLog::OpType type,
+                       int32_t httpError,
+                       std::string errorString,
+                       std::string longErrorString);
+
+        Log(UploadApp *uploadApp) {
+            _uploadApp = uploadApp;
+        }
+    } _log;
+
+    UploadApp(std::string pathPrefix, std::string libPath, std::string picPath) : _log(this) {
+        uint32_t i;
+        for(i=0;i<_maxUploaders;i++) {
+            _uploadEntryp[i] = NULL;
+        }
+        _pathPrefix = pathPrefix;
+        _libPath = libPath;
+        _picPath = picPath;
+        _loginCookiep = NULL;
+        _cfsp = NULL;
+        _cdisp = NULL;
+        _dedupp = NULL;
+
+        readConfig(libPath);
+
+        /* TBD: get this from some configuration mechanism */
+#ifndef __linux__
+        if (_uploadEntryp[0] == NULL) {
+            fsRoot = std::string(getenv("HOME")) + "/Pictures";
+            cloudRoot = "/" + std::string(getenv("USER")) + "_backup/Pictures";
+            addConfigEntry(cloudRoot, fsRoot, 0, 1);
+            writeConfig(libPath);
+        }
+#endif
+        _globalApp = this;
+    }
+
+    void setGlobalLoginCookie(SApiLoginCookie *loginCookiep) {
+        _loginCookiep = loginCookiep;
+    }
+
+    static std::string showInterval(int32_t interval);
+    
+    static int32_t parseInterval(std::string istring);
+
+    static UploadApp *getGlobalApp() {
+        return _globalApp;
+    }
+
+    void schedule(void *cxp);
+
+    int32_t initLoop(SApi *sapip, int single);
+
+    int32_t init(SApi *sapip, int single);
+
+    static std::string getDate(time_t secs);
+
+    int32_t addConfigEntry( std::string cloudRoot,
+                            std::string fsRoot,
+                            uint32_t lastFinishedTime,
+                            int enabled,
+                            uint32_t lastReconcileTime = 0);
+
+    int32_t deleteConfigEntry(int32_t ix);
+
+    void openManifest(UploadEntry *ep);
+
+    void openWatcher(UploadEntry *ep);
+
+    int32_t setEnabledConfig(int32_t ix);
+
+    int deleteSel() {
+        uint32_t i;
+        UploadEntry *ep;
+        int rcode = 0;
+
+        _entryLock.take();
+        for(i=0; i<_maxUploaders; i++) {
+            ep = _uploadEntryp[i];
+            if (!ep || !ep->_selected)
+                continue;
+            deleteConfigEntry(i);
+            rcode = 1;
+        }
+        _entryLock.release();
+        return rcode;
+    }
+
+    int stopSel() {
+        uint32_t i;
+        UploadEntry *ep;
+        Uploader *uploaderp;
+        int rcode = 0;
+
+        _entryLock.take();
+        for(i=0; i<_maxUploaders; i++) {
+            ep = _uploadEntryp[i];
+            if (!ep || !ep->_selected)
+                continue;
+            uploaderp = ep->_uploaderp;
+            if (!uploaderp)
+                continue;
+            ep->_manual = 1;
+            rcode = 1;
+            uploaderp->stop();
+        }
+        _entryLock.release();
+        return rcode;
+    }
+
+    int pauseSel() {
+        uint32_t i;
+        UploadEntry *ep;
+        Uploader *uploaderp;
+        int rcode = 0;
+
+        _entryLock.take();
+        for(i=0; i<_maxUploaders; i++) {
+            ep = _uploadEntryp[i];
+            if (!ep || !ep->_selected)
+                continue;
+            uploaderp = ep->_uploaderp;
+            if (!uploaderp)
+                continue;
+            ep->_manual = 1;
+            uploaderp->pause();
+            rcode = 1;
+        }
+        _entryLock.release();
+        return rcode;
+    }
+
+    int stopAll() {
+        uint32_t i;
+        UploadEntry *ep;
+        Uploader *uploaderp;
+
+        _entryLock.take();
+        for(i=0; i<_maxUploaders; i++) {
+            ep = _uploadEntryp[i];
+            if (!ep)
+                continue;
+            uploaderp = ep->_uploaderp;
+            if (!uploaderp)
+                continue;
+            ep->_manual = 1;
+            uploaderp->stop();
+        }
+        _entryLock.release();
+        return 1;
+    }
+
+    int pauseAll() {
+        uint32_t i;
+        UploadEntry *ep;
+        Uploader *uploaderp;
+        int rcode=0;
+
+        _entryLock.take();
+        for(i=0; i<_maxUploaders; i++) {
+            ep = _uploadEntryp[i];
+            if (!ep)
+                continue;
+            uploaderp = ep->_uploaderp;
+            if (!uploaderp)
+                continue;
+            ep->_manual = 1;
+            uploaderp->pause();
+            rcode = 1;
+        }
+        _entryLock.release();
+        return rcode;
+    }
+
+    void startEntry(UploadEntry *ep);
+
+    void start(uint32_t ix) {
+        UploadEntry *ep;
+
+        _entryLock.take();
+        if (ix < _maxUploaders) {
+            ep = _uploadEntryp[ix];
+            if (ep && ep->_enabled) {
+                ep->_manual = 0;
+                startEntry(ep);
+            }
+        }
+        _entryLock.release();
+    }
+
+    int startAll() {
+        UploadEntry *ep;
+        uint32_t i;
+        int rcode = 0;
+
+        _entryLock.take();
+        for(i=0; i<_maxUploaders; i++) {
+            ep = _uploadEntryp[i];
+            if (ep && ep->_enabled) {
+                ep->_manual = 0;
+                startEntry(ep);
+                rcode = 1;
+            }
+        }
+        _entryLock.release();
+        return rcode;
+    }
+
+    int startSel() {
+        UploadEntry *ep;
+        uint32_t i;
+        int rcode = 0;
+
+        _entryLock.take();
+        for(i=0; i<_maxUploaders; i++) {
+            ep = _uploadEntryp[i];
+            if (ep && ep->_selected) {
+                ep->_manual = 0;
+                startEntry(ep);
+                rcode = 1;
+            }
+        }
+        _entryLock.release();
+        return rcode;
+    }
+
+    int authProblems();
+
+    void resetAuthProblems();
+
+    static void stateChanged(void *contextp);
+
+    void readConfig(std::string pathPrefix);
+
+    /* a cloud file system set up as the config says */
+    Cfs *newCfs();
+
+    /* pass entryLocked if the caller already holds _entryLock */
+    int32_t writeConfig(std::string pathPrefix, int entryLocked = 0);
+};
+
+/* This class presents the basic application test screen.  It gets you
+ * to the login screen using SApiLoginApple if you aren't logged in
+ * (if there's no saved token).  Otherwise, it presents the
+ * application screen from login-home.html.
+ *
+ * The class runs the startMethod when the registered URL is reached.
+ * That's '/' for this application.
+ */
+class UploadHomeScreen : public SApi::ServerReq {
+public:
+    static SApi::ServerReq *factory(std::string *opcode, SApi *sapip);
+
+    UploadHomeScreen(SApi *sapip) : SApi::ServerReq(sapip) {
+        return;
+    }
+
+    void startMethod();
+};
+
+class UploadStartScreen : public SApi::ServerReq {
+public:
+    static SApi::ServerReq *factory(std::string *opcode, SApi *sapip);
+
+    UploadStartScreen(SApi *sapip) : SApi::ServerReq(sapip) {
+        return;
+    }
+
+    void startMethod();
+};
+
+class UploadStopScreen : public SApi::ServerReq {
+public:
+    static SApi::ServerReq *factory(std::string *opcode, SApi *sapip);
+
+    UploadStopScreen(SApi *sapip) : SApi::ServerReq(sapip) {
+        return;
+    }
+
+    void startMethod();
+};
+
+class UploadInfoScreen : public SApi::ServerReq {
+public:
+    static SApi::ServerReq *factory(std::string *opcode, SApi *sapip);
+
+    UploadInfoScreen(SApi *sapip) : SApi::ServerReq(sapip) {
+        return;
+    }
+
+    void startMethod();
+};
+
+class UploadPauseScreen : public SApi::ServerReq {
+public:
+    static SApi::ServerReq *factory(std::string *opcode, SApi *sapip);
+
+    UploadPauseScreen(SApi *sapip) : SApi::ServerReq(sapip) {
+        return;
+    }
+
+    void startMethod();
+};
+
+class UploadStatusData : public SApi::ServerReq {
+public:
+    static SApi::ServerReq *factory(std::string *opcode, SApi *sapip);
+
+    UploadStatusData(SApi *sapip) : SApi::ServerReq(sapip) {
+        return;
+    }
+
+    void startMethod();
+};
+
+class UploadInfoData : public SApi::ServerReq {
+public:
+    static SApi::ServerReq *factory(std::string *opcode, SApi *sapip);
+
+    UploadInfoData(SApi *sapip) : SApi::ServerReq(sapip) {
+        return;
+    }
+
+    void startMethod();
+};
+
+class UploadLoadConfig : public SApi::ServerReq {
+public:
+    static SApi::ServerReq *factory(std::string *opcode, SApi *sapip);
+
+    UploadLoadConfig(SApi *sapip) : SApi::ServerReq(sapip) {
+        return;
+    }
+
+    void startMethod();
+};
+
+class UploadDeleteConfig : public SApi::ServerReq {
+public:
+    static SApi::ServerReq *factory(std::string *opcode, SApi *sapip);
+
+    UploadDeleteConfig(SApi *sapip) : SApi::ServerReq(sapip) {
+        return;
+    }
+
+    void startMethod();
+};
+
+class UploadSetEnabledConfig : public SApi::ServerReq {
+public:
+    static SApi::ServerReq *factory(std::string *opcode, SApi *sapip);
+
+    UploadSetEnabledConfig(SApi *sapip) : SApi::ServerReq(sapip) {
+        return;
+    }
+
+    void startMethod();
+};
+
+class UploadBackupInterval : public SApi::ServerReq {
+public:
+    static SApi::ServerReq *factory(std::string *opcode, SApi *sapip);
+
+    UploadBackupInterval(SApi *sapip) : SApi::ServerReq(sapip) {
+        return;
+    }
+
+    void startMethod();
+};
+
+class UploadCreateConfig : public SApi::ServerReq {
+public:
+    static SApi::ServerReq *factory(std::string *opcode, SApi *sapip);
+
+    UploadCreateConfig(SApi *sapip) : SApi::ServerReq(sapip) {
+        return;
+    }
+
+    void startMethod();
+};
+
+#endif /* __UPLOAD_H_ENV__ */
@@ -0,0 +1,738 @@
+#ifndef __UPNP_H_ENV_
+#define __UPNP_H_ENV_ 1
+
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/stat.h>
+
+#if 0
+#include <netinet/udp.h>
+#endif
+
+#include <errno.h>
+#include <string>
+#include <stdio.h>
+
+#include "dqueue.h"
+#include "bufsocket.h"
+#include "rst.h"
+#include "json.h"
+#include "xapi.h"
+#include "xapipool.h"
+#include "cdisp.h"
+#include "oasha1.h"
+#include "xgml.h"
+#include "radixtree.h"
+#include "upnpsearch.h"
+
+class UpnpDevice {
+
+public:
+    std::string _name;
+    std::string _host;
+    std::string _deviceRelativePath;    /* used to get device details, controlRelativePath */
+    std::string _controlRelativePath;   /* used for browsing */
+    uint32_t _tag;
+    uint8_t _controlPathKnown;     /* we read the device file */
+
+    UpnpDevice *_dqNextp;
+    UpnpDevice *_dqPrevp;
+
+    static uint32_t _nextTag;
+
+    UpnpDevice() {
+        _dqNextp = NULL;
+        _dqPrevp = NULL;
+        _controlPathKnown = 0;
+        _tag = _nextTag++;
+    }
+};
+
+class UpnpProbe {
+public:
+    XApi *_xapip;
+    dqueue<UpnpDevice> _allDevices;
+
+    UpnpDevice *findDeviceByHost(std::string *hostp) {
+        UpnpDevice *devp;
+
+        for(devp = _allDevices.head(); devp; devp=devp->_dqNextp) {
+            if (strcasecmp(devp->_host.c_str(), hostp->c_str()) == 0)
+                return devp;
+        }
+        return NULL;
+    }
+
+    int32_t parseProbeResponse(char *respBufferp, std::string *locationStrp);
+
+    int32_t scanForService(Xgml::Node *rootNodep,
+                           std::string *controlRelativePathp,
+                           std::string *namep);
+
+    int32_t init ();
+
+    UpnpDevice *getFirstDevice() {
+        return _allDevices.head();
+    }
+
+    int32_t count() {
+        uint32_t i;
+        UpnpDevice *devp;
+        for(i=0, devp=_allDevices.head(); devp; i++, devp=devp->_dqNextp)
+            ;
+        return i;
+    }
+
+    void deleteNthDevice(int32_t ix) {
+        UpnpDevice *devp;
+
+        devp = getNthDevice(ix);
+        if (devp) {
+            _allDevices.remove(devp);
+            delete devp;
+        }
+    }
+
+    UpnpDevice *getNthDevice(int32_t ix) {
+        uint32_t i;
+        UpnpDevice *devp;
+        for(i=0, devp=_allDevices.head(); devp; i++, devp=devp->_dqNextp)
+            if (i == (unsigned) ix)
+                return devp;
+        return NULL;
+        
+    }
+
+    UpnpDevice *getDeviceByTag(uint32_t tag) {
+        UpnpDevice *devp;
+
+        for(devp = _allDevices.head(); devp; devp=devp->_dqNextp) {
+            if (devp->_tag == tag)
+                return devp;
+        }
+        return NULL;
+    }
+
+    void clearAll() {
+        UpnpDevice *devp;
+        UpnpDevice *ndevp;
+        for(devp=_allDevices.head(); devp; devp=ndevp) {
+            ndevp = devp->_dqNextp;
+            delete devp;
+        }
+        UpnpDevice::_nextTag = 1;
+        _allDevices.init();
+    }
+
+    int32_t contactAllDevices() {
+        UpnpDevice *devp;
+        int32_t code;
+        int32_t rcode;
+
+        rcode = 0;
+        for(devp = _allDevices.head(); devp; devp=devp->_dqNextp) {
+            code = contactDevice(devp);
+            if (code != 0 && rcode == 0)
+                rcode = code;
+        }
+
+        return rcode;
+    }
+
+    /* get the control port */
+    int32_t contactDevice(UpnpDevice *devp);
+
+    int32_t saveToFile(const char *fileNamep);
+
+    int32_t restoreFromFile(const char *fileNamep);
+};
+
+/* media database */
+class UpnpDBase {
+public:
+    class Record {
+    public:
+        std::string _url;
+        std::string _title;
+        std::string _artist;
+        std::string _album;
+        std::string _genre;
+        std::string _artUrl;
+
+        uint32_t _tag;
+        uint8_t _inArtistTree;
+        uint8_t _inAlbumTree;
+        uint8_t _inGenreTree;
+        uint64_t _userFlags;
+        uint64_t _userContext;
+        uint32_t _snapIx;       /* position in a snapshot being saved */
+
+        Record *_urlNextp;
+        Record *_titleNextp;
+        Record *_artistNextp;
+        Record *_albumNextp;
+
+        RadixTree::Item _urlLinks;
+        RadixTree::Item _titleLinks;
+        RadixTree::Item _artistLinks;
+        RadixTree::Item _albumLinks;
+        RadixTree::Item _genreLinks;
+
+        Record() {
+            _urlNextp = NULL;
+            _titleNextp = NULL;
+            _artistNextp = NULL;
+            _albumNextp = NULL;
+            _tag = 0;
+            _inArtistTree = 0;
+            _inAlbumTree = 0;
+            _inGenreTree = 0;
+            _userFlags = 0;
+            _userContext = 0;
+            _snapIx = 0;
+        }
+    };
+
+    /* class variables */
+    RadixTree _urlTree;
+    RadixTree _titleTree;
+    RadixTree _artistTree;
+    RadixTree _albumTree;
+    RadixTree _genreTree;
+    UpnpSearchIndex _searchIndex;
+    long _version;
+    uint32_t _deleteTag;
+
+    /* stuff from iteration for saveToFile */
+    Json::Node *_rootNodep;
+
+    UpnpDBase() {
+        _version = 1;
+    }
+
+    Record *findRecord(std::string *urlStrp) {
+        void *objp;
+        int32_t code;
+
+        code = _urlTree.lookup(urlStrp, &objp);
+        if (code != 0)
+            return NULL;
+        else
+            return static_cast<Record *>(objp);
+    }
+
+    int32_t addRecord( std::string *urlStrp,
+                       std::string *titleStrp,
+                       std::string *albumStrp,
+                       std::string *artistStrp,
+                       std::string *genreStrp,
+                       std::string *artUrlStrp,
+                       uint32_t tag) {
+        Record *recordp;
+
+        if (findRecord(urlStrp))
+            return -2;  /* exists */
+
+        recordp = new UpnpDBase::Record();
+        recordp->_url = *urlStrp;
+        recordp->_tag = tag;
+        recordp->_title = *titleStrp;
+
+        if (albumStrp) {
+            recordp->_album = *albumStrp;
+            recordp->_inAlbumTree = 1;
+        }
+        if (artistStrp) {
+            recordp->_artist = *artistStrp;
+            recordp->_inArtistTree = 1;
+        }
+        if (genreStrp) {
+            recordp->_genre = *genreStrp;
+            recordp->_inGenreTree = 1;
+        }
+        if (artUrlStrp) {
+            recordp->_artUrl = *artUrlStrp;
+        }
+
+        linkRecord(recordp);
+
+        _version++;
+
+        return 0;
+    }
+
+    void deleteRecord(Record *recordp) {
+        unlinkRecord(recordp);
+        delete recordp;
+        _version++;
+    }
+
+    /* put a record into the trees its _in*Tree flags say, and the
+     * search index; all records are visible through the url and title
+     * trees.
+     */
+    void linkRecord(Record *recordp);
+
+    void unlinkRecord(Record *recordp);
+
+    void linkKey(RadixTree *treep, uint8_t field, std::string *keyp, RadixTree::Item *itemp, Record *recordp);
+
+    void unlinkKey(RadixTree *treep, uint8_t field, std::string *keyp, RadixTree::Item *itemp);
+
+    static int32_t tagCallback(void *callbackContextp, void *recordContextp);
+
+    RadixTree *titleTree() {
+        return &_titleTree;
+    }
+
+    RadixTree *artistTree() {
+        return &_artistTree;
+    }
+
+    RadixTree *albumTree() {
+        return &_albumTree;
+    }
+
+    RadixTree *urlTree() {
+        return &_urlTree;
+    }
+
+    RadixTree *genreTree() {
+        return &_genreTree;
+    }
+
+    void deleteByTag(uint32_t tag);
+
+    void deleteAll();
+
+    void apply(RadixTree::Callback *procp, void *contextp, int onlyUnique = 0);
+
+    void applyTree( RadixTree *treep,
+                    RadixTree::Callback *procp,
+                    void *contextp,
+                    int onlyUnique = 0);
+
+    /* apply to the records in a tree whose keys start with *prefixp */
+    void applyPrefix( RadixTree *treep,
+                      std::string *prefixp,
+                      RadixTree::Callback *procp,
+                      void *contextp,
+                      int onlyUnique = 0);
+
+    /* find up to maxRecords records with the query somewhere in one
+     * of the fields in fieldMask (bits by UpnpSearchIndex field),
+     * ignoring case, best matches first.
+     */
+    int32_t search( std::string *queryp,
+                    uint32_t fieldMask,
+                    Record **recordsp,
+                    uint32_t maxRecords,
+                    uint32_t *countp);
+
+    static int32_t saveToFileCallback(void *callbackContextp, void *recordContextp);
+
+    int32_t saveToFile(const char *fileNamep);
+
+    int32_t restoreFromFile(const char *fileNamep);
+
+    /* binary snapshots, which load much faster than the JSON files
+     * above; those remain for export.
+     */
+    static const uint32_t _snapMagic = 0x42445055;     /* "UPDB" */
+    static const uint32_t _snapVersion = 1;
+
+    static int32_t snapCollectCallback(void *callbackContextp, void *recordContextp);
+
+    int32_t saveSnapshot(const char *fileNamep);
+
+    int32_t restoreSnapshot(const char *fileNamep);
+
+    long getVersion() {
+        return _version;
+    }
+};
+
+class UpnpAv {
+    class RecurseCheck {
+    public:
+        std::string _id;
+        RecurseCheck *_dqNextp;
+        RecurseCheck *_dqPrevp;
+    };
+
+    /* a crawl worker's response buffer, and the strings it parses each
+     * item into; kept on _crawlBuffers between pages, so that neither
+     * gets reallocated for every page.
+     */
+    class CrawlBuffer {
+    public:
+        char *_datap;
+        uint32_t _size;
+        std::string _didl;      /* the decoded Result */
+        std::string _containerId;
+        std::string _parentId;
+        std::string _title;
+        std::string _album;
+        std::string _artist;
+        std::string _genre;
+        std::string _artUrl;
+        std::string _url;
+        std::string _class;
+        uint32_t _haveFields;   /* which of the above the object had */
+
+        static const uint32_t _haveTitle = 1;
+        static const uint32_t _haveAlbum = 2;
+        static const uint32_t _haveArtist = 4;
+        static const uint32_t _haveGenre = 8;
+        static const uint32_t _haveArtUrl = 0x10;
+        static const uint32_t _haveUrl = 0x20;
+        static const uint32_t _haveClass = 0x40;
+
+        CrawlBuffer *_dqNextp;
+        CrawlBuffer *_dqPrevp;
+
+        CrawlBuffer() {
+            _size = UpnpAv::_crawlBufferBytes;
+            _datap = (char *) malloc(_size);
+            _haveFields = 0;
+            _dqNextp = NULL;
+            _dqPrevp = NULL;
+        }
+
+        ~CrawlBuffer() {
+            free(_datap);
+        }
+    };
+
+    /* a track url, and how many containers list it; its record goes
+     * when the last of them stops listing it.
+     */
+    class CrawlUrl {
+    public:
+        std::string _url;
+        uint32_t _refs;
+        CrawlUrl *_nextHashp;
+    };
+
+    /* a container that a crawl browsed, remembered so that refresh can
+     * tell whether it has changed since, and which tracks and child
+     * containers came from it.
+     */
+    class CrawlContainer {
+    public:
+        std::string _id;
+        CrawlContainer *_parentp;
+        dqueue<CrawlContainer> _children;
+        int _rlevel;
+        uint32_t _updateId;
+        uint8_t _haveUpdateId;  /* the server told us one */
+        uint8_t _changed;       /* being browsed again by refresh */
+        uint8_t _gone;          /* the server says there's no such object */
+        uint8_t _failed;        /* a page failed, so we don't know it all */
+        uint32_t _listedGen;    /* refresh that last saw it in its parent */
+
+        /* urls from this container's items, and while it's being
+         * browsed again, the ones from before.
+         */
+        CrawlUrl **_urlsp;
+        uint32_t _urlCount;
+        uint32_t _maxUrls;
+        CrawlUrl **_oldUrlsp;
+        uint32_t _oldUrlCount;
+
+        /* in parent's _children */
+        CrawlContainer *_dqNextp;
+        CrawlContainer *_dqPrevp;
+        CrawlContainer *_nextHashp;
+
+        CrawlContainer() {
+            _parentp = NULL;
+            _rlevel = 0;
+            _updateId = 0;
+            _haveUpdateId = 0;
+            _changed = 0;
+            _gone = 0;
+            _failed = 0;
+            _listedGen = 0;
+            _urlsp = NULL;
+            _urlCount = 0;
+            _maxUrls = 0;
+            _oldUrlsp = NULL;
+            _oldUrlCount = 0;
+            _dqNextp = NULL;
+            _dqPrevp = NULL;
+            _nextHashp = NULL;
+        }
+
+        ~CrawlContainer() {
+            free(_urlsp);
+            free(_oldUrlsp);
+        }
+    };
+
+    /* browse one page of one container, or with _checkOnly, just get
+     * the container's UpdateID.
+     */
+    class CrawlTask : public CDispTask {
+    public:
+        UpnpAv *_avp;
+        CrawlContainer *_containerp;
+        uint32_t _startIx;
+        uint32_t _count;
+        uint8_t _firstPage;     /* queue the container's other pages */
+        uint8_t _checkOnly;
+
+        int32_t start();
+    };
+
+    std::string _host;
+    XApi::ClientConn *_connp;
+    XApi::ClientReq *_reqp;
+    XApi *_xapip;
+    BufSocket *_socketp;
+    std::string _browseTemplate;
+    uint8_t _recurse;
+    uint8_t _musicHack;
+    uint8_t _canceled;
+    UpnpDevice *_devp;
+    uint32_t _loadedPages;
+    uint32_t _loadedItems;
+
+    /* crawl state; the counters above and the database are protected by
+     * _crawlMutex while a crawl is running.
+     */
+    static const uint32_t _crawlBufferBytes = 4*1024*1024;
+    static const uint32_t _numAtOnce = 999;
+    XApiPool *_xapiPoolp;
+    CDisp *_crawlDispp;
+    CDispGroup *_crawlGroupp;
+    uint32_t _maxInFlight;
+    CThreadMutex _crawlMutex;
+    CThreadCV _crawlDoneCV;
+    uint32_t _crawlTasks;
+    int32_t _crawlError;
+    UpnpDBase *_crawlDBasep;
+    dqueue<CrawlBuffer> _crawlBuffers;
+
+    /* what the last crawl or refresh saw; refresh uses these, and
+     * changes them only from the thread calling it, between runs of
+     * crawl tasks, apart from adding new containers and urls, which is
+     * done under _crawlMutex.
+     */
+    static const uint32_t _containerHashSize = 16384;
+    static const uint32_t _urlHashSize = 65536;
+    CrawlContainer **_containerHashp;
+    CrawlUrl **_urlHashp;
+    CrawlContainer *_rootContainerp;
+    uint32_t _containerCount;
+    uint32_t _systemUpdateId;
+    uint8_t _haveSystemUpdateId;
+    uint8_t _refreshing;
+    uint32_t _refreshGen;
+    uint32_t _changedContainers;
+
+    static uint32_t crawlHash(std::string *strp, uint32_t hashSize);
+
+    CrawlContainer *findContainer(std::string *idp);
+
+    CrawlContainer *newContainer(std::string *idp, CrawlContainer *parentp);
+
+    void addContainerUrl(CrawlContainer *containerp, std::string *urlp);
+
+    void releaseUrls(CrawlUrl **urlsp, uint32_t count);
+
+    void deleteContainer(CrawlContainer *containerp);
+
+    void clearContainers();
+
+    void queueCrawl(CrawlContainer *containerp, uint32_t startIx, uint32_t count, int firstPage);
+
+    void queueCheck(CrawlContainer *containerp);
+
+    void waitForCrawl();
+
+    int32_t crawlCall( const char *actionp,
+                       const char *sendDatap,
+                       CrawlBuffer *bufp,
+                       int32_t *httpCodep);
+
+    int32_t getSystemUpdateId(CrawlBuffer *bufp, uint32_t *idp);
+
+    int32_t crawlPage(CrawlTask *taskp, CrawlBuffer *bufp);
+
+    int32_t crawlCheck(CrawlTask *taskp, CrawlBuffer *bufp);
+
+    int32_t crawlRead(XApi::ClientReq *reqp, CrawlBuffer *bufp, uint32_t *lengthp);
+
+    int32_t crawlScan(CrawlTask *taskp, CrawlBuffer *bufp);
+
+    void crawlContainer(CrawlTask *taskp, CrawlBuffer *bufp);
+
+    void crawlAddItem(CrawlTask *taskp, CrawlBuffer *bufp);
+
+    void crawlTaskDone(int32_t code);
+
+public:
+    UpnpAv() : _crawlDoneCV(&_crawlMutex) {
+        _recurse = 1;
+        _canceled = 0;
+        _xapiPoolp = NULL;
+        _crawlDispp = NULL;
+        _crawlGroupp = NULL;
+        _maxInFlight = 8;
+        _crawlTasks = 0;
+        _crawlError = 0;
+        _crawlDBasep = NULL;
+        _containerHashp = NULL;
+        _urlHashp = NULL;
+        _rootContainerp = NULL;
+        _containerCount = 0;
+        _systemUpdateId = 0;
+        _haveSystemUpdateId = 0;
+        _refreshing = 0;
+        _refreshGen = 0;
+        _changedContainers = 0;
+        _devp = NULL;
+        return;
+    }
+
+    void cancel() {
+        _canceled = 1;
+    }
+
+    uint32_t loadedPages() {
+        return _loadedPages;
+    }
+
+    uint32_t loadedItems() {
+        return _loadedItems;
+    }
+
+    /* containers the last refresh found changed */
+    uint32_t changedContainers() {
+        return _changedContainers;
+    }
+
+    void setRecurse(uint8_t x) {
+        _recurse = x;
+    }
+
+    /* how many Browse requests crawl keeps outstanding; takes effect
+     * for the first crawl only, which starts the worker threads.
+     */
+    void setMaxInFlight(uint32_t count) {
+        if (count < 1)
+            count = 1;
+        else if (count > 64)
+            count = 64;
+        _maxInFlight = count;
+    }
+
+    /* filter was id,dc:title,upnp:artist,upnp:album,res instead of * */
+    int32_t init(UpnpDevice *devp) {
+        /* what we know about containers is only good for one device */
+        if (_containerHashp && devp != _devp)
+            clearContainers();
+
+        _musicHack = 1;
+        _loadedPages = 0;
+        _loadedItems = 0;
+
+        _host = std::string(devp->_host);
+        _devp = devp;
+        _browseTemplate = "<?xml version=\"1.0\" encoding=\"utf-8\"?>\r\n\
+<s:Envelope s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\" xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\">\r\n\
+<s:Body>\r\n\
+<u:Browse xmlns:u=\"urn:schemas-upnp-org:service:ContentDirectory:1\">\r\n\
+<ObjectID>%s</ObjectID>\r\n\
+<BrowseFlag>BrowseDirectChildren</BrowseFlag>\r\n\
+<Filter>*</Filter>\r\n\
+<StartingIndex>%d</StartingIndex>\r\n\
+<RequestedCount>%d</RequestedCount>\r\n\
+<SortCriteria></SortCriteria>\r\n\
+</u:Browse>\r\n\
+</s:Body>\r\n\
+</s:Envelope>\r\n";
+
+        _xapip = new XApi();
+        /* note that the 1900 below is just a default which can be overridden by host string */
+        _socketp = new BufSocket();
+        _socketp->init(const_cast<char *>(_host.c_str()), 1900);
+        // _socketp->setVerbose();
+        _connp = _xapip->addClientConn(_socketp);
+
+        /* crawl gets its connections from a pool, one per request in flight;
+         * the pool is keyed by host, so it's shared across init calls.
+         */
+        if (!_xapiPoolp)
+            _xapiPoolp = new XApiPool(std::string(""));
+        return 0;
+    }
+
+    /* do a DFS adding items from tree */
+    int32_t addItemsFromTree( UpnpDBase *dbasep,
+                              const char *servicep,
+                              const char *obIdp,
+                              Xgml::Node *nodep,
+                              int rlevel);
+
+    void computeHash(const char *datap, char *resultp, uint32_t resultLen) {
+        /* compute a sha1 checksum */
+        uint8_t *hashp;
+        uint32_t i;
+        sha1nfo sha1State;
+        uint8_t tval;
+
+        sha1_init(&sha1State);
+        sha1_write(&sha1State, datap, strlen(datap));
+        hashp = sha1_result(&sha1State);
+
+        for (i=0; i<20; i++) {
+            tval = hashp[i] >> 4;
+            if (tval < 10)
+                tval += '0';
+            else
+                tval += ('A' - 10);
+            *resultp++ = tval;
+
+            tval = hashp[i] & 0xF;
+            if (tval < 10)
+                tval += '0';
+            else
+                tval += ('A' - 10);
+            *resultp++ = tval;
+        }
+        *resultp++ = 0;
+    }
+
+    /* the filters that browse and crawl both apply: a top level
+     * container we don't descend into, since it's for photos or video,
+     * and whether an item is a music track.
+     */
+    static int skipContainer(const char *titlep);
+
+    static int isAudioItem(const char *classp, const char *urlp);
+
+    int32_t browse(UpnpDBase *dbasep, const char *idp, int rlevel = 0);
+
+    /* load the same items as browse, but with up to _maxInFlight Browse
+     * requests outstanding at once, across containers and across the
+     * pages of large containers.  Responses are scanned in place,
+     * rather than built into Xgml trees, with items going straight
+     * into the database.  Returns the first error seen, though the
+     * crawl continues past containers that fail.
+     */
+    int32_t crawl(UpnpDBase *dbasep, const char *idp);
+
+    /* bring the database up to date with the server, after a crawl of
+     * the same idp.  If the server's SystemUpdateID hasn't changed,
+     * that's all it costs; otherwise each container's UpdateID is
+     * checked, and only containers whose UpdateIDs changed are browsed
+     * again, adding and deleting only their own tracks and
+     * subcontainers.  Does a full crawl if there wasn't one.
+     */
+    int32_t refresh(UpnpDBase *dbasep, const char *idp);
+};
+#endif /* __UPNP_H_ENV_ */
@@ -0,0 +1,143 @@
+#ifndef __WALKDISP_H_ENV__
+#define __WALKDISP_H_ENV__ 1
+
+#include "osp.h"
+#include "dqueue.h"
+#include "cdisp.h"
+#include <string>
+#include <sys/stat.h>
+
+class WalkBatchTask;
+
+/* an open directory, shared by the batch tasks holding its entries,
+ * and closed when the last of them is done.
+ */
+class WalkDir {
+ public:
+    int _fd;
+    std::string _path;
+    uint32_t _refCount;
+
+    WalkDir(int fd, std::string *pathp) {
+        _fd = fd;
+        _path = *pathp;
+        _refCount = 1;
+    }
+
+    void hold() {
+        __atomic_add_fetch(&_refCount, 1, __ATOMIC_SEQ_CST);
+    }
+
+    void release();
+};
+
+class WalkTask : public CDispTask {
+ public:
+    typedef int32_t (CallbackProc) (void *contextp, std::string *pathp, struct stat *statp);
+
+ private:
+    std::string _path;
+
+    CallbackProc *_callbackProcp;
+    void *_callbackContextp;
+
+    /* fast mode reads directories with getdents and d_type, and hands
+     * their non-directory entries to WalkBatchTasks, _batchSize at a
+     * time, which stat them relative to the directory's fd.  With
+     * _typeOnly set, entries whose type d_type gives aren't stat'd at
+     * all, and the callback gets a stat with only st_mode filled in.
+     */
+    uint8_t _fast;
+    uint8_t _typeOnly;
+    uint32_t _batchSize;
+
+    /* call back for _path itself, but don't descend if it's a directory */
+    uint8_t _entryOnly;
+
+    /* our own stat, if our parent already had it */
+    uint8_t _haveStat;
+    struct stat _stat;
+
+    int32_t startFast();
+
+    void addEntry(WalkDir *dirp, WalkBatchTask **batchpp, const char *namep, uint8_t type);
+
+    void inheritMode(WalkTask *parentp) {
+        _fast = parentp->_fast;
+        _typeOnly = parentp->_typeOnly;
+        _batchSize = parentp->_batchSize;
+    }
+
+ public:
+    int32_t start();
+
+    int32_t initWithPath(std::string path) {
+        _path = path;
+        return 0;
+    }
+
+    /* works even for null pointers */
+    void setCallback(CallbackProc *procp, void *contextp) {
+        _callbackProcp = procp;
+        _callbackContextp = contextp;
+    }
+
+    /* use the fast walker for this task and all of its descendants */
+    void setFast(uint32_t batchSize, int typeOnly = 0) {
+        _fast = 1;
+        _batchSize = (batchSize > 0? batchSize : 1);
+        _typeOnly = (typeOnly? 1 : 0);
+    }
+
+    /* only look at this task's own path, not its children */
+    void setEntryOnly() {
+        _entryOnly = 1;
+    }
+
+    WalkTask() {
+        _callbackProcp = NULL;
+        _callbackContextp = NULL;
+        _fast = 0;
+        _typeOnly = 0;
+        _batchSize = 1;
+        _entryOnly = 0;
+        _haveStat = 0;
+        return;
+    }
+};
+
+/* a batch of one directory's non-directory entries, for the fast
+ * walker.  The names are packed, null terminated, into one string.
+ */
+class WalkBatchTask : public CDispTask {
+    friend class WalkTask;
+
+    WalkDir *_dirp;
+    WalkTask::CallbackProc *_callbackProcp;
+    void *_callbackContextp;
+    uint8_t _typeOnly;
+    std::string _names;
+    uint8_t *_typesp;           /* d_type of each entry */
+    uint32_t _count;
+
+ public:
+    int32_t start();
+
+    WalkBatchTask(WalkDir *dirp, uint32_t maxCount) {
+        dirp->hold();
+        _dirp = dirp;
+        _callbackProcp = NULL;
+        _callbackContextp = NULL;
+        _typeOnly = 0;
+        _typesp = new uint8_t[maxCount];
+        _count = 0;
+    }
+
+    /* tasks are deleted whether or not they're started */
+    ~WalkBatchTask() {
+        delete [] _typesp;
+        _dirp->release();
+    }
+};
+
+#endif /* __WALKDISP_H_ENV__ */
@@ -9,6 +9,9 @@
 #include "cthread.h"
 
 SSL_CTX *BufTls::_sslServerContextp;
+SSL_CTX *BufTls::_sslClientContextp;
+dqueue<BufTls::Session> BufTls::_sessions;
+BufTls::Stats BufTls::_stats;
 const SSL_METHOD *BufTls::_sslClientMethodp;
 const SSL_METHOD *BufTls::_sslServerMethodp;
 CThreadMutex BufTls::_mutex;
@@ -20,7 +23,8 @@ void
 BufTls::init(struct sockaddr *sockAddrp, int socklen)
 {
     BufGen::init(sockAddrp, socklen);
-    _outp = OspMBuf::alloc(0);
+    _inp = OspMBuf::alloc(_inputBytes);
+    _outp = OspMBuf::alloc(_recordBytes);
     _s = -1;
 
     _fullHostName = "_Accepted_";
@@ -31,7 +35,6 @@ BufTls::init(struct sockaddr *sockAddrp, int socklen)
     _listening = 0;
     _verbose = 0;
     _server = 1;
-    _sslClientContextp = NULL;
 }
 
 int32_t
@@ -242,6 +245,7 @@ int32_t
 BufTls::doConnect()
 {
     int32_t code;
+    Session *sessionp;
 
     if (_connected)
         return 0;
@@ -256,32 +260,37 @@ BufTls::doConnect()
         return -errno;
     }
 
-    _sslClientContextp = SSL_CTX_new(_sslClientMethodp);   /* Create new context */
-    if ( !_sslClientContextp) {
-        ERR_print_errors_fp(stdout);
-        osp_assert(0);
-    }
-    SSL_CTX_set_verify(_sslClientContextp, SSL_VERIFY_NONE, NULL);
-
-    SSL_CTX_set_options(_sslClientContextp, SSL_OP_ALL | SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3 | SSL_OP_NO_TLSv1 | SSL_OP_NO_TLSv1_1);
-    SSL_CTX_set_cipher_list(_sslClientContextp,"ECDHE-ECDSA-AES256-GCM-SHA384:ECDHE-RSA-AES256-GCM-SHA384:ECDHE-ECDSA-CHACHA20-POLY1305:ECDHE-RSA-CHACHA20-POLY1305:ECDHE-ECDSA-AES128-GCM-SHA256:ECDHE-RSA-AES128-GCM-SHA256:ECDHE-ECDSA-AES256-SHA384:ECDHE-RSA-AES256-SHA384:ECDHE-ECDSA-AES128-SHA256:ECDHE-RSA-AES128-SHA256");
-
-
     _sslp = SSL_new(_sslClientContextp);
     if (!_sslp){
         printf("BufTls: failed to create SSL client connection state\n");
         return -1;
     }
+    SSL_set_app_data(_sslp, this);
     SSL_set_fd(_sslp, _s);
     SSL_set_verify(_sslp, SSL_VERIFY_NONE, NULL);
     SSL_set_tlsext_host_name(_sslp, _hostName.c_str());
 
+    /* offer our last session with this server, if we have one */
+    _mutex.take();
+    sessionp = findSession(&_sessionKey);
+    if (sessionp)
+        SSL_set_session(_sslp, sessionp->_sessionp);
+    _mutex.release();
+
     code = SSL_connect(_sslp);
-    if (code < 0) {
+    if (code <= 0) {
         ERR_print_errors_fp(stdout);
+        dropSession();
         return -1;
     }
 
+    _mutex.take();
+    if (SSL_session_reused(_sslp))
+        _stats._resumedHandshakes++;
+    else
+        _stats._fullHandshakes++;
+    _mutex.release();
+
     // showCerts(_sslp);        /* get any certs */
     _connected = 1;
 
@@ -292,8 +301,13 @@ void
 BufTls::disconnect()
 {
     _connected = 0;
+
+    /* any buffered input belongs to the old connection */
+    if (_inp)
+        _inp->reset();
     if (_sslp) {
         SSL_shutdown(_sslp);
+        SSL_free(_sslp);
         _sslp = NULL;
     }
 
@@ -303,37 +317,48 @@ BufTls::disconnect()
         close(_s);
         _s = -1;
     }
-    if (_sslClientContextp) {
-        SSL_CTX_free(_sslClientContextp);
-        _sslClientContextp = NULL;
-    }
 }
 
-/* return -1 on error or EOF (error will be 0 on normal EOF),
- * or a byte of data from the socket.
+/* fill the (empty) buffer with as much decrypted data as
+ * SSL_read has available, without blocking once we have some.
+ * Return 0 if we read data, -2 at EOF, or -1 on an error, after
+ * which the connection has been disconnected.
  */
 int32_t
-BufTls::getc()
+BufTls::fillFromSocket(OspMBuf *mbp)
 {
     int32_t code;
-    unsigned char tc;
+    int sslError;
 
-#if 0
-    // don't need to connect on a read, and might mess things up on protocol error recovery
-    code = doConnect();
-    if (code) return code;
-#endif
+    osp_assert(mbp->dataBytes() == 0);
+    mbp->reset();
+
+    if (!_sslp)
+        return -1;
 
     while(1) {
-        code = SSL_read(_sslp, (char *) &tc, sizeof(tc));
-        if (code == 1) {
+        code = SSL_read(_sslp, mbp->data(), mbp->bytesAtEnd());
+        if (code > 0) {
+            mbp->pushNBytesNoCopy(code);
+
+            /* pick up anything else already decrypted, or sitting in
+             * a record we've already received.
+             */
+            while (mbp->bytesAtEnd() > 0 && SSL_pending(_sslp) > 0) {
+                code = SSL_read( _sslp,
+                                 mbp->data() + mbp->dataBytes(),
+                                 mbp->bytesAtEnd());
+                if (code <= 0)
+                    break;
+                mbp->pushNBytesNoCopy(code);
+            }
+
             if (_verbose) {
-                printf("%c", tc);
+                printf("%.*s", (int) mbp->dataBytes(), mbp->data());
             }
-            return tc;
+            return 0;
         }
         else {
-            int sslError;
             sslError = SSL_get_error(_sslp, code);
             if (sslError == SSL_ERROR_WANT_READ) {
                 printf(" SSL read terminate (cont) with want read, code=%d sslError=%d",
@@ -344,7 +369,6 @@ BufTls::getc()
             printf(" SSL read terminate with code=%d sslError=%d\n", code, sslError);
             if (code == 0 && sslError == SSL_ERROR_ZERO_RETURN) {
                 return -2;
-                // continue;
             }
             else {
                 disconnect();   /* so we reconnect at next write */
@@ -354,6 +378,30 @@ BufTls::getc()
     }
 }
 
+/* return -1 on error, -2 on EOF, or a byte of data from the socket.
+ */
+int32_t
+BufTls::getc()
+{
+    int32_t code;
+    char *datap;
+
+#if 0
+    // don't need to connect on a read, and might mess things up on protocol error recovery
+    code = doConnect();
+    if (code) return code;
+#endif
+
+    if (_inp->dataBytes() == 0) {
+        code = fillFromSocket(_inp);
+        if (code)
+            return code;
+    }
+
+    datap = _inp->popNBytes(1);
+    return *((uint8_t *) datap);
+}
+
 /* return a negative error code, or the count of bytes transferred.  Count of
  * 0 means at EOF
  */
@@ -361,26 +409,35 @@ int32_t
 BufTls::read(char *bufferp, int32_t acount)
 {
     int32_t i;
-    int tc;
+    int32_t tcount;
+    int32_t code;
+    char *datap;
 
     if (_verbose)
         printf("TLS=%p read start ct=%d:", this, acount);
-    for(i=0;i<acount;i++) {
-        tc = getc();
-        if (tc == -1) {
-            if (_verbose)
-                printf("TLS=%p error after %d bytes\n", this, i);
-            return tc;
-        }
-        else if (tc == -2) {
-            /* hit EOF; return count of characters actually read */
-            if (_verbose)
-                printf("TLS=%p read done at eof, ret=%d\n", this, i);
-            return i;
-        }
-        else {
-            *bufferp++ = tc;
+    i = 0;
+    while(i < acount) {
+        if (_inp->dataBytes() == 0) {
+            code = fillFromSocket(_inp);
+            if (code == -2) {
+                /* hit EOF; return count of characters actually read */
+                if (_verbose)
+                    printf("TLS=%p read done at eof, ret=%d\n", this, i);
+                return i;
+            }
+            else if (code) {
+                if (_verbose)
+                    printf("TLS=%p error after %d bytes\n", this, i);
+                return code;
+            }
         }
+
+        tcount = _inp->dataBytes();
+        if (tcount > acount - i)
+            tcount = acount - i;
+        datap = _inp->popNBytes(tcount);
+        memcpy(bufferp + i, datap, tcount);
+        i += tcount;
     }
 
     if (_verbose)
@@ -469,13 +526,18 @@ BufTls::putc(const char tbuffer)
     return 0;
 }
 
-/* return count written for success, or negative error code if something went wrong */
+/* return count written for success, or negative error code if something went wrong.
+ *
+ * Data is gathered into the record-sized output buffer, which is sent
+ * each time it fills.  If the buffer is empty and we have at least a
+ * full record to send, we skip the copy and send straight from the
+ * caller's buffer.
+ */
 int32_t
 BufTls::write(const char *abufferp, int32_t acount)
 {
     int32_t code;
-    char tc;
-    int32_t i;
+    int32_t tcount;
     int32_t origCount;
 
     if (_verbose)
@@ -495,14 +557,34 @@ BufTls::write(const char *abufferp, int32_t acount)
         return -1;
     }
 
-    for(i=0;i<acount;i++) {
-        tc = *abufferp++;
-        code = putc(tc);
+    if (_verbose) {
+        printf("%.*s", (int) acount, abufferp);
+    }
+
+    while(acount > 0) {
+        if (_outp->dataBytes() == 0 && acount >= (signed) _recordBytes) {
+            tcount = acount - (acount % _recordBytes);
+            code = sslWrite(abufferp, tcount);
+        }
+        else {
+            tcount = _outp->bytesAtEnd();
+            if (tcount > acount)
+                tcount = acount;
+            _outp->pushNBytes((char *) abufferp, tcount);
+            code = 0;
+            if (_outp->bytesAtEnd() == 0) {
+                code = sslWrite(_outp->data(), _outp->dataBytes());
+                if (code == 0)
+                    _outp->reset();
+            }
+        }
         if (code != 0) {
             if (_verbose)
                 printf("TLS=%p write failed code=%d\n", this, code);
             return code;
         }
+        abufferp += tcount;
+        acount -= tcount;
     }
 
     if (_verbose)
@@ -510,24 +592,20 @@ BufTls::write(const char *abufferp, int32_t acount)
     return origCount;
 }
 
+/* send count bytes through SSL_write, retrying if SSL wants us to;
+ * returns 0 or a negative error code.
+ */
 int32_t
-BufTls::flush()
+BufTls::sslWrite(const char *bufferp, int32_t nbytes)
 {
     int32_t code;
-    int32_t nbytes;
     int sslError;
 
-    nbytes = _outp->dataBytes();
-    if (nbytes == 0)
-        return 0;
-
-    if (!_sslp) {
-        disconnect();
-        return 0;
-    }
-
     while(1) {
-        code = SSL_write(_sslp, _outp->data(), nbytes);
+        if (!_sslp)
+            return -1;
+
+        code = SSL_write(_sslp, bufferp, nbytes);
         if (code != nbytes) {
             sslError = SSL_get_error(_sslp, code);
             printf("TLS=%p flush failed code=%d sslError=%d\n", this, code, sslError);
@@ -551,12 +629,32 @@ BufTls::flush()
             return -1;
         }
         else {
-            _outp->reset();
             return 0;
         }
     }
 }
 
+int32_t
+BufTls::flush()
+{
+    int32_t code;
+    int32_t nbytes;
+
+    nbytes = _outp->dataBytes();
+    if (nbytes == 0)
+        return 0;
+
+    if (!_sslp) {
+        disconnect();
+        return 0;
+    }
+
+    code = sslWrite(_outp->data(), nbytes);
+    if (code == 0)
+        _outp->reset();
+    return code;
+}
+
 void
 BufTls::mainInit()
 {
@@ -570,12 +668,29 @@ BufTls::mainInit()
     OpenSSL_add_all_algorithms();
     SSL_load_error_strings();
 
-    /* setup client side */
+    /* setup client side; all client connections share this context,
+     * and we keep our own per-server session cache, fed by the new
+     * session callback, so that reconnects can resume.
+     */
     _sslClientMethodp = TLS_client_method();  /* use for client conns */
+    _sslClientContextp = SSL_CTX_new(_sslClientMethodp);
+    if ( !_sslClientContextp) {
+        ERR_print_errors_fp(stdout);
+        osp_assert(0);
+    }
+    SSL_CTX_set_verify(_sslClientContextp, SSL_VERIFY_NONE, NULL);
+
+    SSL_CTX_set_options(_sslClientContextp, SSL_OP_ALL | SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3 | SSL_OP_NO_TLSv1 | SSL_OP_NO_TLSv1_1);
+    SSL_CTX_set_cipher_list(_sslClientContextp,"ECDHE-ECDSA-AES256-GCM-SHA384:ECDHE-RSA-AES256-GCM-SHA384:ECDHE-ECDSA-CHACHA20-POLY1305:ECDHE-RSA-CHACHA20-POLY1305:ECDHE-ECDSA-AES128-GCM-SHA256:ECDHE-RSA-AES128-GCM-SHA256:ECDHE-ECDSA-AES256-SHA384:ECDHE-RSA-AES256-SHA384:ECDHE-ECDSA-AES128-SHA256:ECDHE-RSA-AES128-SHA256");
+    SSL_CTX_set_session_cache_mode( _sslClientContextp,
+                                    SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(_sslClientContextp, &BufTls::newSessionCallback);
+    SSL_CTX_set_read_ahead(_sslClientContextp, 1);
 
     /* setup server side */
     _sslServerMethodp = TLS_server_method();
     _sslServerContextp = SSL_CTX_new(_sslServerMethodp);
+    SSL_CTX_set_read_ahead(_sslServerContextp, 1);
 
     if (SSL_CTX_load_verify_locations( _sslServerContextp,
                                        certPath.c_str(),
@@ -620,13 +735,8 @@ BufTls::init(char *namep, uint32_t defaultPort)
 
     pthread_once(&_once, &BufTls::mainInit);
 
-    _sslClientContextp = SSL_CTX_new(_sslClientMethodp);   /* Create new context */
-    if ( !_sslClientContextp) {
-        ERR_print_errors_fp(stdout);
-        osp_assert(0);
-    }
-
-    _outp = OspMBuf::alloc(0);
+    _inp = OspMBuf::alloc(_inputBytes);
+    _outp = OspMBuf::alloc(_recordBytes);
     _s = -1;
 
     if (namep)
@@ -634,6 +744,7 @@ BufTls::init(char *namep, uint32_t defaultPort)
     else
         _fullHostName = "Local Listening";
     _defaultPort = defaultPort;
+    _sessionKey = _hostName + ":" + std::to_string(_port);
 
     _error = 0;
     _closed = 0;
@@ -655,6 +766,7 @@ BufTls::abort()
 
 BufTls::~BufTls()
 {
+    delete _inp;
     delete _outp;
 
 #if 0
@@ -664,9 +776,9 @@ BufTls::~BufTls()
     }
 #endif
 
-    if (_sslClientContextp) {
-        SSL_CTX_free(_sslClientContextp);
-        _sslClientContextp = NULL;
+    if (_sslp) {
+        SSL_free(_sslp);
+        _sslp = NULL;
     }
 
     if (_s >= 0) {
@@ -677,3 +789,94 @@ BufTls::~BufTls()
         _s = -1;
     }
 }
+
+/* called with _mutex held; returns the cached session for this key,
+ * moving it to the end of the LRU queue.
+ */
+/* static */ BufTls::Session *
+BufTls::findSession(std::string *keyp)
+{
+    Session *sessionp;
+
+    for(sessionp = _sessions.head(); sessionp; sessionp=sessionp->_dqNextp) {
+        if (sessionp->_key == *keyp) {
+            _sessions.remove(sessionp);
+            _sessions.append(sessionp);
+            return sessionp;
+        }
+    }
+    return NULL;
+}
+
+/* forget any saved session for our server, e.g. after a failed
+ * handshake, so that we don't keep offering a session the server
+ * won't take.
+ */
+void
+BufTls::dropSession()
+{
+    Session *sessionp;
+
+    _mutex.take();
+    sessionp = findSession(&_sessionKey);
+    if (sessionp) {
+        _sessions.remove(sessionp);
+        _stats._sessionsCached = _sessions.count();
+    }
+    _mutex.release();
+
+    if (sessionp)
+        delete sessionp;
+}
+
+/* static; called by OpenSSL when a server gives us a new session,
+ * either during the handshake or, with TLS 1.3, in a ticket sent
+ * after it.  Returning 1 means that we've kept the reference.
+ */
+int
+BufTls::newSessionCallback(SSL *sslp, SSL_SESSION *newSessionp)
+{
+    BufTls *tlsp;
+    Session *sessionp;
+    Session *oldp;
+
+    tlsp = (BufTls *) SSL_get_app_data(sslp);
+    if (!tlsp || tlsp->_sessionKey.length() == 0)
+        return 0;
+
+    _mutex.take();
+    sessionp = findSession(&tlsp->_sessionKey);
+    if (sessionp) {
+        SSL_SESSION_free(sessionp->_sessionp);
+        sessionp->_sessionp = newSessionp;
+        oldp = NULL;
+    }
+    else {
+        sessionp = new Session();
+        sessionp->_key = tlsp->_sessionKey;
+        sessionp->_sessionp = newSessionp;
+        _sessions.append(sessionp);
+
+        /* trim the least recently used entry */
+        if (_sessions.count() > _maxSessions) {
+            oldp = _sessions.pop();
+        }
+        else
+            oldp = NULL;
+    }
+    _stats._sessionsCached = _sessions.count();
+    _mutex.release();
+
+    if (oldp)
+        delete oldp;
+
+    return 1;
+}
+
+/* static */ void
+BufTls::getStats(Stats *statsp)
+{
+    _mutex.take();
+    *statsp = _stats;
+    _mutex.release();
+}
@@ -3,6 +3,7 @@
 
 #include "osp.h"
 #include <string>
+#include <string.h>
 
 #include <sys/socket.h>
 #include <sys/types.h>
@@ -25,17 +26,69 @@
 #include "cthread.h"
 
 class BufTls : public BufGen {
+ public:
+    /* a cached client session for one host:port, used to do an
+     * abbreviated handshake when we reconnect to the same server.
+     */
+    class Session {
+    public:
+        std::string _key;
+        SSL_SESSION *_sessionp;
+        Session *_dqNextp;
+        Session *_dqPrevp;
+
+        Session() {
+            _sessionp = NULL;
+        }
+
+        ~Session() {
+            if (_sessionp) {
+                SSL_SESSION_free(_sessionp);
+                _sessionp = NULL;
+            }
+        }
+    };
+
+    class Stats {
+    public:
+        uint64_t _fullHandshakes;
+        uint64_t _resumedHandshakes;
+        uint64_t _sessionsCached;
+
+        Stats() {
+            memset(this, 0, sizeof(*this));
+        }
+    };
+
+ private:
     static const uint32_t _defaultBaseTimeoutMs = 60000;
+    static const uint32_t _maxSessions = 256;
+
+    /* output is gathered into buffers of one full TLS record, so that
+     * small writes (e.g. chunk headers) share a record with the data
+     * around them.  Input is read in bigger pieces, since one
+     * SSL_read may be able to return several records' worth.
+     */
+    static const uint32_t _recordBytes = 16384;
+    static const uint32_t _inputBytes = 65536;
     static pthread_once_t _once;
     int _s;
 
+    OspMBuf *_inp;
     OspMBuf *_outp;
     int32_t _error;
     uint8_t _closed;
     uint8_t _connected;
     uint8_t _verbose;
     uint8_t _server;
-    SSL_CTX *_sslClientContextp;
+    std::string _sessionKey;
+
+    /* all client connections share one context; sessions in LRU order,
+     * protected by _mutex.
+     */
+    static SSL_CTX *_sslClientContextp;
+    static dqueue<Session> _sessions;
+    static Stats _stats;
 
     static SSL_CTX *_sslServerContextp;
     static const SSL_METHOD *_sslClientMethodp;
@@ -47,9 +100,19 @@ class BufTls : public BufGen {
 
     int32_t fillFromSocket(OspMBuf *mbp);
 
+    int32_t sslWrite(const char *bufferp, int32_t count);
+
+    static int newSessionCallback(SSL *sslp, SSL_SESSION *sessionp);
+
+    static Session *findSession(std::string *keyp);
+
+    void dropSession();
+
  public:
     static void mainInit();
 
+    static void getStats(Stats *statsp);
+
     void init(struct sockaddr *sockAddrp, int socklen);
 
     int getSocket() {
@@ -116,6 +179,8 @@ class BufTls : public BufGen {
         _connected = 0;
         _verbose = 0;
         _sslp = NULL;
+        _inp = NULL;
+        _outp = NULL;
         _baseTimeoutMs = _defaultBaseTimeoutMs;
     }
 
@@ -162,7 +162,7 @@ Cfs::nameInt( std::string path,
 }
 
 int32_t
-Cfs::stat(std::string path, CAttr *attrsp, CEnv *envp)
+Cfs::stat(std::string path, CAttr *attrsp, CEnv *envp, std::string *idp)
 {
     int32_t code;
     Cnode *nodep;
@@ -171,21 +171,44 @@ Cfs::stat(std::string path, CAttr *attrsp, CEnv *envp)
     if (code)
         return code;
     code = nodep->getAttr(attrsp, envp);
+    if (code == 0 && idp)
+        *idp = nodep->getCloudId();
     nodep->release();
     return code;
 }
 
+/* get the attributes and ID of a file we just made in dirNodep; it's
+ * normally in the cache, so this doesn't cost a call.
+ */
+static void
+newFileInfo(Cnode *dirNodep, std::string *namep, CAttr *attrsp, std::string *idp, CEnv *envp)
+{
+    Cnode *nodep;
+
+    if (dirNodep->lookup(*namep, 0, &nodep, envp) != 0)
+        return;
+    if (!attrsp || nodep->getAttr(attrsp, envp) == 0) {
+        if (idp)
+            *idp = nodep->getCloudId();
+    }
+    nodep->release();
+}
+
 int32_t
 Cfs::sendFile( std::string path,
                CDataSource *sourcep,
                uint64_t *bytesCopiedp,
-               CEnv *envp)
+               CEnv *envp,
+               CAttr *attrsp,
+               std::string *idp)
 {
     int32_t code;
     Cnode *dirNodep;
     std::string dirPath;
     std::string name;
 
+    if (idp)
+        idp->clear();
     code = splitPath(path, &dirPath, &name);
     if (code)
         return code;
@@ -193,6 +216,8 @@ Cfs::sendFile( std::string path,
     if (code)
         return code;
     code = dirNodep->sendFile( name, sourcep, bytesCopiedp, envp);
+    if (code == 0 && (attrsp || idp))
+        newFileInfo(dirNodep, &name, attrsp, idp, envp);
     dirNodep->release();
     return code;
 }
@@ -216,6 +241,34 @@ Cfs::mkdir(std::string path, Cnode **newDirpp, CEnv *envp)
     return code;
 }
 
+int32_t
+Cfs::copyFile( std::string path,
+               std::string srcId,
+               CAttr *srcAttrsp,
+               CEnv *envp,
+               CAttr *attrsp,
+               std::string *idp)
+{
+    int32_t code;
+    Cnode *dirNodep;
+    std::string dirPath;
+    std::string name;
+
+    if (idp)
+        idp->clear();
+    code = splitPath(path, &dirPath, &name);
+    if (code)
+        return code;
+    code = namei(dirPath, 0, &dirNodep, envp);
+    if (code)
+        return code;
+    code = dirNodep->copyFile( name, srcId, srcAttrsp, envp);
+    if (code == 0 && (attrsp || idp))
+        newFileInfo(dirNodep, &name, attrsp, idp, envp);
+    dirNodep->release();
+    return code;
+}
+
 /* static */ std::string
 CfsLog::opToString(OpType type)
 {
@@ -255,6 +308,9 @@ CfsLog::opToString(OpType type)
         case opMisc:
             result = "misc";
             break;
+        case opCopy:
+            result = "copy";
+            break;
         default:
             result = "badOp";
             break;
@@ -20,6 +20,7 @@ static const int32_t CFS_ERR_NOTDIR = 20;
 static const int32_t CFS_ERR_INVAL = 22;
 static const int32_t CFS_ERR_TIMEDOUT = 60;
 static const int32_t CFS_ERR_SERVER = 61;
+static const int32_t CFS_ERR_STALE = 70;
 
 class CfsStats {
  public:
@@ -41,8 +42,28 @@ class CfsStats {
     uint64_t _sendSmallFilesCalls;
     uint64_t _sendLargeFilesCalls;
     uint64_t _sendDataCalls;
+    uint64_t _sendDataResumes;  /* upload sessions resumed after a failed chunk */
+    uint64_t _batchCalls;
+    uint64_t _batchItems;       /* small PUTs and mkdirs sent in batches */
+
+    /* request governor */
+    uint32_t _govWindow;        /* requests allowed in flight */
+    uint32_t _govInFlight;
+    uint64_t _govWaits;         /* requests that waited for the window */
+    uint64_t _throttleEvents;   /* 429s and 5xxs */
+    uint64_t _windowDecreases;
+    uint64_t _retryAfterMs;     /* total time paused for Retry-After */
     uint64_t _fillAttrCalls;
     uint64_t _mkdirCalls;
+    uint64_t _readdirCalls;
+    uint64_t _readdirPages;
+    uint64_t _listingHits;      /* lookups answered, including misses, from a dir listing */
+    uint64_t _cnodeRecycles;
+    uint64_t _cnodeOverflows;   /* cnodes allocated over budget, none being recyclable */
+    uint64_t _hashGrows;
+    uint64_t _copyCalls;        /* server side copies */
+    uint64_t _dedupFiles;       /* files copied from a duplicate instead of sent */
+    uint64_t _dedupBytesSaved;
 
     CfsStats() {
         memset(this, 0, sizeof(*this));
@@ -63,6 +84,7 @@ class CfsLog {
         opSendFile,
         opPosix,
         opMisc,
+        opCopy,
     } OpType;
 
     virtual void logError( OpType type,
@@ -147,6 +169,25 @@ class Cnode {
                               uint64_t *bytesCopiedp,
                               CEnv *envp) = 0;
 
+    /* make a file named 'name' in this dir, by copying the file whose
+     * backing store ID is srcId without sending the data again.  If
+     * srcAttrsp is set, the source must still have its length and
+     * mtime, or the copy fails with CFS_ERR_STALE.
+     */
+    virtual int32_t copyFile( std::string name,
+                              std::string srcId,
+                              CAttr *srcAttrsp,
+                              CEnv *envp) {
+        return -1;
+    }
+
+    /* the backing store's ID for this node, or an empty string if it
+     * doesn't have one.
+     */
+    virtual std::string getCloudId() {
+        return std::string();
+    }
+
     Cnode() {
         _refCount = 1;
         _valid = 0;
@@ -225,15 +266,29 @@ class Cfs {
                                   Cnode **outNodep,
                                   CEnv *envp);
 
-    int32_t stat(std::string path, CAttr *attrsp, CEnv *envp);
+    int32_t stat(std::string path, CAttr *attrsp, CEnv *envp, std::string *idp = NULL);
 
+    /* if attrsp or idp is set, they get the new file's attributes and
+     * backing store ID, which are normally cached by the send; *idp is
+     * left empty if we can't get them.
+     */
     int32_t sendFile( std::string path,
                       CDataSource *sourcep,
                       uint64_t *sendFilep,
-                      CEnv *envp);
+                      CEnv *envp,
+                      CAttr *attrsp = NULL,
+                      std::string *idp = NULL);
 
     int32_t mkdir(std::string path, Cnode **newDirpp, CEnv *envp);
 
+    /* attrsp and idp get the copy's attributes and ID, as for sendFile */
+    int32_t copyFile( std::string path,
+                      std::string srcId,
+                      CAttr *srcAttrsp,
+                      CEnv *envp,
+                      CAttr *attrsp = NULL,
+                      std::string *idp = NULL);
+
     int32_t getAttr(std::string path, CAttr *attrp, CEnv *envp);
 
     /* just a utility function for hashing IDs and/or names */
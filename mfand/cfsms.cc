@@ -1,9 +1,44 @@
 #include <time.h>
+#include <openssl/evp.h>
 
 #include "cfsms.h"
 #include "xapi.h"
 #include "buftls.h"
 
+/* start a GET against the graph server, pipelining it with other
+ * GETs if that's been enabled.
+ */
+void
+CfsMs::startGet(XApi::ClientReq *reqp, std::string *relPathp)
+{
+    XApi::ClientConn *connp;
+    std::string host("graph.microsoft.com");
+
+    if (_pipelineGets) {
+        connp = _xapiPoolp->getPipelineConn(host, 443, /* TLS */ 1);
+        reqp->startPipelinedCall(connp, relPathp->c_str());
+    }
+    else {
+        connp = _xapiPoolp->getConn(host, 443, /* TLS */ 1);
+        reqp->startCall(connp, relPathp->c_str(), XApi::reqGet);
+    }
+}
+
+/* read everything remaining in a pipe */
+static void
+readWholePipe(CThreadPipe *pipep, std::string *resultp)
+{
+    char tbuffer[0x4000];
+    int32_t code;
+
+    while(1) {
+        code = pipep->read(tbuffer, sizeof(tbuffer));
+        if (code <= 0)
+            break;
+        resultp->append(tbuffer, code);
+    }
+}
+
 /* called with THIS held; generate a path to it.  Since going up the tree violates
  * our locking hierarchy, we have to be careful to lock only one thing at a time.
  *
@@ -77,9 +112,13 @@ CnodeMs::invalidateTree()
     _valid = 0;
     
     cfsp->_refLock.take();
+    _listed = 0;
+    _listGen++;
+    clearLostNamesNL();
     for(bep = _children.head(); bep; bep=nbep) {
         childp = bep->_childp;
-        childp->holdNL();
+        childp->hold();
+        unhashChildNL(bep);
         bep->_name = "";        /* invalidate the name */
         cfsp->_refLock.release();       /* child hold now protects bep from deallocation */
 
@@ -90,7 +129,7 @@ CnodeMs::invalidateTree()
 
         cfsp->_refLock.take();
         nbep = bep->_dqNextp;
-        childp->releaseNL();
+        childp->release();
     }
     cfsp->_refLock.release();
 
@@ -176,8 +215,185 @@ CnodeMs::parseResults( Json::Node *jnodep,
     }
 }
 
+/* called with refLock held; find the entry in this dir with the
+ * given name, if any.
+ */
+CnodeBackEntry *
+CnodeMs::findChildNL(std::string *namep)
+{
+    CnodeBackEntry *ep;
+
+    if (_nameCount == 0)
+        return NULL;
+
+    for( ep = _nameHashp[Cfs::fnvHash64(namep) % _nameHashSize];
+         ep;
+         ep = ep->_nextNamep) {
+        if (ep->_name == *namep)
+            return ep;
+    }
+    return NULL;
+}
+
+/* called with refLock held; add an entry with a non-empty name to
+ * the name index, growing it if the directory has gotten big.
+ */
+void
+CnodeMs::hashChildNL(CnodeBackEntry *ep)
+{
+    CnodeBackEntry **newHashp;
+    CnodeBackEntry *tep;
+    CnodeBackEntry *nextp;
+    uint32_t newSize;
+    uint32_t i;
+    uint32_t ix;
+
+    osp_assert(!ep->_inNameHash && ep->_name.length() > 0);
+
+    if (_nameHashSize == 0 || _nameCount >= 2 * _nameHashSize) {
+        newSize = (_nameHashSize == 0? 8 : 4 * _nameHashSize);
+        newHashp = new CnodeBackEntry *[newSize];
+        memset(newHashp, 0, newSize * sizeof(CnodeBackEntry *));
+        for(i=0;i<_nameHashSize;i++) {
+            for(tep = _nameHashp[i]; tep; tep = nextp) {
+                nextp = tep->_nextNamep;
+                ix = Cfs::fnvHash64(&tep->_name) % newSize;
+                tep->_nextNamep = newHashp[ix];
+                newHashp[ix] = tep;
+            }
+        }
+        if (_nameHashp)
+            delete [] _nameHashp;
+        _nameHashp = newHashp;
+        _nameHashSize = newSize;
+    }
+
+    ix = Cfs::fnvHash64(&ep->_name) % _nameHashSize;
+    ep->_nextNamep = _nameHashp[ix];
+    _nameHashp[ix] = ep;
+    ep->_inNameHash = 1;
+    _nameCount++;
+
+    /* the name's back in _children, so it's no longer lost */
+    if (_lostCount)
+        removeLostNameNL(&ep->_name);
+}
+
+/* called with refLock held; remember a name in a listed directory
+ * whose entry is being recycled.
+ */
+void
+CnodeMs::addLostNameNL(std::string *namep)
+{
+    CnodeLostName **newHashp;
+    CnodeLostName *tp;
+    CnodeLostName *nextp;
+    uint32_t newSize;
+    uint32_t i;
+    uint32_t ix;
+
+    if (_lostHashSize == 0 || _lostCount >= 2 * _lostHashSize) {
+        newSize = (_lostHashSize == 0? 8 : 4 * _lostHashSize);
+        newHashp = new CnodeLostName *[newSize];
+        memset(newHashp, 0, newSize * sizeof(CnodeLostName *));
+        for(i=0;i<_lostHashSize;i++) {
+            for(tp = _lostNamesp[i]; tp; tp = nextp) {
+                nextp = tp->_nextp;
+                ix = Cfs::fnvHash64(&tp->_name) % newSize;
+                tp->_nextp = newHashp[ix];
+                newHashp[ix] = tp;
+            }
+        }
+        if (_lostNamesp)
+            delete [] _lostNamesp;
+        _lostNamesp = newHashp;
+        _lostHashSize = newSize;
+    }
+
+    tp = new CnodeLostName();
+    tp->_name = *namep;
+    ix = Cfs::fnvHash64(namep) % _lostHashSize;
+    tp->_nextp = _lostNamesp[ix];
+    _lostNamesp[ix] = tp;
+    _lostCount++;
+}
+
+/* called with refLock held; forget a lost name, returning 1 if it
+ * was there.
+ */
+int
+CnodeMs::removeLostNameNL(std::string *namep)
+{
+    CnodeLostName **lpp;
+    CnodeLostName *tp;
+
+    if (_lostCount == 0)
+        return 0;
+
+    for( lpp = &_lostNamesp[Cfs::fnvHash64(namep) % _lostHashSize], tp = *lpp;
+         tp;
+         lpp = &tp->_nextp, tp = *lpp) {
+        if (tp->_name == *namep) {
+            *lpp = tp->_nextp;
+            delete tp;
+            _lostCount--;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* called with refLock held; forget all lost names, when the listing
+ * they belong to is discarded.
+ */
+void
+CnodeMs::clearLostNamesNL()
+{
+    CnodeLostName *tp;
+    CnodeLostName *nextp;
+    uint32_t i;
+
+    if (_lostCount == 0)
+        return;
+
+    for(i=0;i<_lostHashSize;i++) {
+        for(tp = _lostNamesp[i]; tp; tp = nextp) {
+            nextp = tp->_nextp;
+            delete tp;
+        }
+        _lostNamesp[i] = NULL;
+    }
+    _lostCount = 0;
+}
+
+/* called with refLock held; call before changing an entry's name or
+ * removing it from _children.
+ */
+void
+CnodeMs::unhashChildNL(CnodeBackEntry *ep)
+{
+    CnodeBackEntry **lepp;
+    CnodeBackEntry *tep;
+
+    if (!ep->_inNameHash)
+        return;
+
+    for( lepp = &_nameHashp[Cfs::fnvHash64(&ep->_name) % _nameHashSize], tep = *lepp;
+         tep;
+         lepp = &tep->_nextNamep, tep = *lepp) {
+        if (tep == ep) {
+            *lepp = ep->_nextNamep;
+            break;
+        }
+    }
+    osp_assert(tep != NULL);
+    ep->_nextNamep = NULL;
+    ep->_inNameHash = 0;
+    _nameCount--;
+}
+
 /* called with dir lock held, but not child lock held; returns held child
- * pointer.  Drops refLock periodically to let others in.
+ * pointer.
  */
 int32_t
 CnodeMs::nameSearch(std::string name, CnodeMs **childpp)
@@ -187,33 +403,230 @@ CnodeMs::nameSearch(std::string name, CnodeMs **childpp)
     CfsMs *cfsp = _cfsp;
 
     cfsp->_refLock.take();
-    for(backp = _children.head(); backp; backp=backp->_dqNextp) {
+    backp = findChildNL(&name);
+    if (backp) {
         childp = backp->_childp;
-        childp->holdNL();
+        childp->hold();
         cfsp->_refLock.release();
-
-        if (name == backp->_name) {
-            /* return this one; already held from above */
-            *childpp = childp;
-            return 0;
-        }
-        cfsp->_refLock.take();
-        childp->releaseNL();    /* release hold from above */
+        *childpp = childp;
+        return 0;
     }
     cfsp->_refLock.release();
     *childpp = NULL;
     return CFS_ERR_NOENT;
 }
 
+/* return true if we have every name in the directory, and the
+ * listing is recent enough to trust.
+ */
+int
+CnodeMs::listingFresh()
+{
+    CfsMs *cfsp = _cfsp;
+    int fresh;
+
+    cfsp->_refLock.take();
+    fresh = (_listed && osp_time_ms() - _listedMs < cfsp->_listingMs);
+    cfsp->_refLock.release();
+    return fresh;
+}
+
+/* return true if a fresh listing shows that a name, which the caller
+ * didn't find in _children, doesn't exist.  A recycled name does, and
+ * a listing older than _negativeMs may have missed another client's
+ * create, so those go to the server.
+ */
+int
+CnodeMs::listingMissing(std::string *namep)
+{
+    CfsMs *cfsp = _cfsp;
+    CnodeLostName *tp;
+    uint64_t ageMs;
+    int missing;
+
+    cfsp->_refLock.take();
+    ageMs = osp_time_ms() - _listedMs;
+    missing = (_listed && ageMs < cfsp->_listingMs && ageMs < cfsp->_negativeMs);
+    if (missing && _lostCount) {
+        for(tp = _lostNamesp[Cfs::fnvHash64(namep) % _lostHashSize]; tp; tp = tp->_nextp) {
+            if (tp->_name == *namep) {
+                missing = 0;
+                break;
+            }
+        }
+    }
+    cfsp->_refLock.release();
+    return missing;
+}
+
+/* fetch all of the entries in this directory from the server, a page
+ * at a time, creating cnodes with attributes for each, and threading
+ * them into _children.  If we get every page, mark the listing as
+ * complete.  Called with the dir held, but not locked.
+ */
+int32_t
+CnodeMs::readdir(CEnv *envp)
+{
+    XApi::ClientReq *reqp;
+    CThreadPipe *outPipep;
+    std::string response;
+    const char *tp;
+    Json json;
+    Json::Node *jnodep = NULL;
+    Json::Node *tnodep;
+    Json::Node *itemp;
+    std::string callbackString;
+    std::string authHeader;
+    std::string id;
+    std::string name;
+    uint64_t size;
+    uint64_t modTime;
+    uint64_t changeTime;
+    uint64_t startMs;
+    uint32_t listGen;
+    int32_t code;
+    CnodeMs *childp;
+    CnodeLockSet lockSet;
+    CAttr::FileType fileType;
+    CfsRetryError retryState;
+    size_t prefixLen;
+    static const char *graphPrefix = "https://graph.microsoft.com";
+
+    _cfsp->_stats._readdirCalls++;
+    startMs = osp_time_ms();
+
+    if (_isRoot)
+        callbackString = "/v1.0/me/drive/root/children";
+    else
+        callbackString = "/v1.0/me/drive/items/" + _id + "/children";
+    callbackString += "?$select=id,name,size,lastModifiedDateTime,folder&$top=1000";
+
+    /* start a new listing; names recycled from here on are kept */
+    _cfsp->_refLock.take();
+    _listed = 0;
+    _listing++;
+    listGen = ++_listGen;
+    clearLostNamesNL();
+    _cfsp->_refLock.release();
+
+    prefixLen = strlen(graphPrefix);
+    code = 0;
+    while(1) {
+        CfsGovernor::Slot slot(&_cfsp->_governor);
+        _cfsp->_stats._totalCalls++;
+        _cfsp->_stats._readdirPages++;
+        reqp = new XApi::ClientReq();
+        authHeader = "Bearer " + _cfsp->_loginCookiep->getAuthToken();
+        reqp->addHeader("Authorization", authHeader.c_str());
+        reqp->addHeader("Content-Type", "application/json");
+        _cfsp->startGet(reqp, &callbackString);
+
+        outPipep = reqp->getOutgoingPipe();
+        outPipep->eof();
+
+        code = reqp->waitForHeadersDone();
+        if (code) {
+            delete reqp;
+            reqp = NULL;
+            if (_cfsp->retryRpcError(CfsLog::opLookup, code, &retryState))
+                continue;
+            code = CFS_ERR_TIMEDOUT;
+            break;
+        }
+
+        response.clear();
+        readWholePipe(reqp->getIncomingPipe(), &response);
+
+        tp = response.c_str();
+        slot.leave();
+        code = json.parseJsonChars((char **) &tp, &jnodep);
+        if (code != 0) {
+            printf("readdir: json parse failed code=%d\n", code);
+            delete reqp;
+            reqp = NULL;
+            code = CFS_ERR_INVAL;
+            break;
+        }
+
+        if (_cfsp->retryError(CfsLog::opLookup, reqp, &jnodep, &retryState)) {
+            delete reqp;
+            reqp = NULL;
+            continue;
+        }
+        delete reqp;
+        reqp = NULL;
+
+        if ((code = retryState.getCode()) != 0)
+            break;
+
+        /* the items are in an array named "value" */
+        lockSet.add(this);
+        tnodep = jnodep->searchForChild("value");
+        if (tnodep && (tnodep = tnodep->_children.head()) != NULL) {
+            for(itemp = tnodep->_children.head(); itemp; itemp=itemp->_dqNextp) {
+                tnodep = itemp->searchForChild("name");
+                if (!tnodep || !tnodep->_children.head())
+                    continue;
+                name = tnodep->_children.head()->_name;
+                if (parseResults(itemp, &id, &size, &changeTime, &modTime, &fileType) != 0)
+                    continue;
+                if (_cfsp->getCnodeLinked(this, name, &id, &childp, &lockSet) != 0)
+                    continue;
+                childp->_valid = 1;
+                childp->_attrs._length = size;
+                childp->_attrs._ctime = changeTime;
+                childp->_attrs._mtime = modTime;
+                childp->_attrs._fileType = fileType;
+                lockSet.remove(childp);
+                childp->release();
+            }
+        }
+        lockSet.remove(this);
+
+        /* absolute URL of the next page, if any */
+        tnodep = jnodep->searchForChild("@odata.nextLink");
+        if (!tnodep || !tnodep->_children.head()) {
+            /* all done; the listing is only complete if the tree
+             * wasn't invalidated, or relisted, while we were fetching.
+             */
+            delete jnodep;
+            jnodep = NULL;
+            _cfsp->_refLock.take();
+            if (_listGen == listGen) {
+                _listed = 1;
+                _listedMs = startMs;
+            }
+            _cfsp->_refLock.release();
+            code = 0;
+            break;
+        }
+        callbackString = tnodep->_children.head()->_name;
+        delete jnodep;
+        jnodep = NULL;
+        if (callbackString.compare(0, prefixLen, graphPrefix) == 0)
+            callbackString = callbackString.substr(prefixLen);
+        retryState = CfsRetryError();
+    }
+
+    if (jnodep)
+        delete jnodep;
+
+    _cfsp->_refLock.take();
+    _listing--;
+    _cfsp->_refLock.release();
+
+    if (_cfsp->_verbose)
+        printf("readdir: id='%s' done code=%d\n", _id.c_str(), code);
+    return code;
+}
+
 int32_t
 CnodeMs::lookup(std::string name, int forceBackend, Cnode **childpp, CEnv *envp)
 {
     /* perform getAttr operation */
-    char tbuffer[0x4000];
-    XApi::ClientConn *connp;
     XApi::ClientReq *reqp;
     std::string postData;
-    CThreadPipe *inPipep;
+    std::string response;
     CThreadPipe *outPipep;
     const char *tp;
     Json json;
@@ -241,6 +654,31 @@ CnodeMs::lookup(std::string name, int forceBackend, Cnode **childpp, CEnv *envp)
         if (code == 0) {
             return 0;
         }
+
+        /* if we can, list the whole directory, since our caller will
+         * probably want its siblings too.  We only list once per
+         * _listingMs, even if the directory is bigger than the cache;
+         * names recycled since are looked up one at a time.
+         */
+        if (_cfsp->_listingMs != 0) {
+            if (!listingFresh()) {
+                lockSet.remove(this);
+                code = readdir(envp);
+                lockSet.add(this);
+                if (code == 0) {
+                    code = nameSearch(name, (CnodeMs **) childpp);
+                    if (code == 0) {
+                        _cfsp->_stats._listingHits++;
+                        return 0;
+                    }
+                }
+            }
+            if (listingMissing(&name)) {
+                _cfsp->_stats._listingHits++;
+                *childpp = NULL;
+                return CFS_ERR_NOENT;
+            }
+        }
     }
 
     /* temporarily drop lock over getPath call */
@@ -256,15 +694,13 @@ CnodeMs::lookup(std::string name, int forceBackend, Cnode **childpp, CEnv *envp)
     callbackString = "/v1.0/me/drive/root:" + Rst::urlPathEncode(dirPath + name);
     
     while(1) {
+        CfsGovernor::Slot slot(&_cfsp->_governor);
         _cfsp->_stats._totalCalls++;
-        connp = _cfsp->_xapiPoolp->getConn(std::string("graph.microsoft.com"), 443, /* TLS */ 1);
         reqp = new XApi::ClientReq();
         authHeader = "Bearer " + _cfsp->_loginCookiep->getAuthToken();
         reqp->addHeader("Authorization", authHeader.c_str());
         reqp->addHeader("Content-Type", "application/json");
-        reqp->startCall( connp,
-                         callbackString.c_str(),
-                         /* isPost */ XApi::reqGet);
+        _cfsp->startGet(reqp, &callbackString);
         
         outPipep = reqp->getOutgoingPipe();
         outPipep->write(postData.c_str(), postData.length());
@@ -282,13 +718,11 @@ CnodeMs::lookup(std::string name, int forceBackend, Cnode **childpp, CEnv *envp)
             }
         }
 
-        inPipep = reqp->getIncomingPipe();
-        code = inPipep->read(tbuffer, sizeof(tbuffer));
-        if (code >= 0 && code < (signed) sizeof(tbuffer)-1) {
-            tbuffer[code] = 0;
-        }
-        
-        tp = tbuffer;
+        response.clear();
+        readWholePipe(reqp->getIncomingPipe(), &response);
+
+        tp = response.c_str();
+        slot.leave();
         code = json.parseJsonChars((char **) &tp, &jnodep);
         if (code != 0) {
             printf("json parse failed code=%d\n", code);
@@ -357,20 +791,13 @@ CnodeMs::sendSmallFile(std::string name, CDataSource *sourcep, CEnv *envp)
     std::string callbackString;
     std::string authHeader;
     int32_t code;
-    std::string id;
-    uint64_t size;
-    uint64_t modTime;
-    uint64_t changeTime;
-    CnodeMs *childp;
-    CnodeLockSet lockSet;
     CAttr dataAttrs;
     char *dataBufferp = NULL;
     uint32_t sendBytes;
-    uint8_t allFound;
-    CAttr::FileType fileType;
     static const uint32_t dataBufferBytes = 4*1024*1024;
     int32_t httpError;
     CfsRetryError retryState;
+    int useBatch = (_cfsp->_batchFileBytes != 0);
     
     if (_cfsp->_verbose)
         printf("sendSmallFile: id=%s name=%s\n", _id.c_str(), name.c_str());
@@ -391,6 +818,40 @@ CnodeMs::sendSmallFile(std::string name, CDataSource *sourcep, CEnv *envp)
         sourcep->getAttr(&dataAttrs);
         sendBytes = dataAttrs._length;
 
+        if (useBatch && sendBytes <= _cfsp->_batchFileBytes) {
+            CfsMsBatch::Item item;
+
+            code = sourcep->read(0, sendBytes, dataBufferp);
+            if (code < 0) {
+                printf("read code=%d\n", code);
+                code = CFS_ERR_SERVER;
+                break;
+            }
+            item._method = "PUT";
+            item._url = callbackString;
+            item._contentType = "text/plain";
+            item._body.assign(dataBufferp, code);
+            if (_cfsp->_batchp->call(&item)) {
+                httpError = item._httpError;
+                jnodep = item.takeResponse();
+                if (_cfsp->retryHttpError( CfsLog::opSendFile,
+                                           httpError,
+                                           item._retryAfterMs,
+                                           NULL,
+                                           &jnodep,
+                                           &retryState))
+                    continue;
+                code = retryState.getCode();
+                if (code == 0)
+                    code = linkSentFile(name, jnodep, httpError);
+                break;
+            }
+
+            /* nobody to batch with; send it ourselves */
+            useBatch = 0;
+        }
+
+        CfsGovernor::Slot slot(&_cfsp->_governor);
         _cfsp->_stats._totalCalls++;
         connp = _cfsp->_xapiPoolp->getConn(std::string("graph.microsoft.com"), 443, /* TLS */ 1);
         reqp = new XApi::ClientReq();
@@ -436,6 +897,7 @@ CnodeMs::sendSmallFile(std::string name, CDataSource *sourcep, CEnv *envp)
         }
         
         tp = tbuffer;
+        slot.leave();
         code = json.parseJsonChars((char **) &tp, &jnodep);
         if (code != 0) {
             if (reqp) {
@@ -468,32 +930,7 @@ CnodeMs::sendSmallFile(std::string name, CDataSource *sourcep, CEnv *envp)
             httpError = 1000;
         }
 
-        /* don't need the lock until we're merging in the results */
-        lockSet.add(this);
-
-        code = parseResults(jnodep, &id, &size, &changeTime, &modTime, &fileType, &allFound);
-        if (code == 0) {
-            code = _cfsp->getCnodeLinked(this, name, &id, &childp, &lockSet);
-            if (code == 0) {
-                if (allFound) {
-                    childp->_valid = 1;
-                    childp->_attrs._length = size;
-                    childp->_attrs._ctime = changeTime;
-                    childp->_attrs._mtime = modTime;
-                    childp->_attrs._fileType = fileType;
-                }
-                else {
-                    printf("json analyze failed code=%d\n", code);
-                    childp->_valid = 0;
-                }
-                childp->release();    /* lock held by getCnodeLinked */
-                childp = NULL;
-            }
-        }
-        else {
-            jnodep->print();
-            printf("json parseresults failed code=%d httpError=%d\n", code, httpError);
-        }
+        code = linkSentFile(name, jnodep, httpError);
         break;
     }
 
@@ -513,21 +950,13 @@ CnodeMs::sendSmallFile(std::string name, CDataSource *sourcep, CEnv *envp)
     return code;
 }
 
+/* merge an item returned by the server as name into the cache, and
+ * return its cnode held.  Its attributes are only valid if the item
+ * had all of them.
+ */
 int32_t
-CnodeMs::mkdir(std::string name, Cnode **newDirpp, CEnv *envp)
+CnodeMs::linkItem(std::string name, Json::Node *jnodep, CnodeMs **childpp)
 {
-    /* perform mkdir operation */
-    char tbuffer[0x4000];
-    XApi::ClientConn *connp;
-    XApi::ClientReq *reqp;
-    CThreadPipe *inPipep;
-    CThreadPipe *outPipep;
-    std::string postData;
-    const char *tp;
-    Json json;
-    Json::Node *jnodep = NULL;
-    std::string callbackString;
-    std::string authHeader;
     int32_t code;
     std::string id;
     uint64_t size;
@@ -535,10 +964,391 @@ CnodeMs::mkdir(std::string name, Cnode **newDirpp, CEnv *envp)
     uint64_t changeTime;
     CnodeMs *childp;
     CnodeLockSet lockSet;
+    uint8_t allFound;
     CAttr::FileType fileType;
+
+    code = parseResults(jnodep, &id, &size, &changeTime, &modTime, &fileType, &allFound);
+    if (code != 0)
+        return code;
+
+    code = _cfsp->getCnodeLinked(this, name, &id, &childp, &lockSet);
+    if (code != 0)
+        return code;
+
+    if (allFound) {
+        childp->_valid = 1;
+        childp->_attrs._length = size;
+        childp->_attrs._ctime = changeTime;
+        childp->_attrs._mtime = modTime;
+        childp->_attrs._fileType = fileType;
+    }
+    else {
+        printf("json analyze failed for %s\n", name.c_str());
+        childp->_valid = 0;
+    }
+    *childpp = childp;
+    return 0;
+}
+
+/* merge the item returned by a small file PUT into the cache */
+int32_t
+CnodeMs::linkSentFile(std::string name, Json::Node *jnodep, int32_t httpError)
+{
+    int32_t code;
+    CnodeMs *childp;
+
+    code = linkItem(name, jnodep, &childp);
+    if (code == 0) {
+        childp->release();
+    }
+    else {
+        jnodep->print();
+        printf("json parseresults failed code=%d httpError=%d\n", code, httpError);
+    }
+    return code;
+}
+
+/* merge the item returned by a mkdir into the cache; returns the new
+ * dir held.
+ */
+int32_t
+CnodeMs::linkNewDir(std::string name, Json::Node *jnodep, Cnode **newDirpp)
+{
+    return linkItem(name, jnodep, (CnodeMs **) newDirpp);
+}
+
+/* true if a mkdir's 409 response says the name is already there */
+static int
+nameAlreadyExists(Json::Node *jnodep)
+{
+    Json::Node *tnodep;
+
+    tnodep = jnodep->searchForChild("code");
+    return ( tnodep &&
+             tnodep->_children.head() &&
+             tnodep->_children.head()->_name == "nameAlreadyExists");
+}
+
+/* fetch the copy source's attributes from the server, ignoring any
+ * we have cached, and check that it still has the length and mtime
+ * our caller saw when it was recorded; anyone could have changed it
+ * since.
+ */
+int32_t
+CnodeMs::checkCopySource(std::string *srcIdp, CAttr *srcAttrsp, CEnv *envp)
+{
+    CnodeMs *srcp;
+    CnodeLockSet lockSet;
+    CAttr attrs;
+    int32_t code;
+
+    code = _cfsp->getCnode(srcIdp, &srcp);
+    if (code)
+        return code;
+
+    code = srcp->fillAttrs(envp, &lockSet);
+    if (code == 0)
+        attrs = srcp->_attrs;
+    lockSet.reset();
+    srcp->release();
+    if (code)
+        return code;
+
+    if ( attrs._fileType != CAttr::FILE ||
+         attrs._length != srcAttrsp->_length ||
+         attrs._mtime != srcAttrsp->_mtime) {
+        if (_cfsp->_verbose)
+            printf("copyFile: source %s changed\n", srcIdp->c_str());
+        return CFS_ERR_STALE;
+    }
+    return 0;
+}
+
+/* copy the file with ID srcId into this dir as 'name', replacing
+ * anything already there.  The server does the copy asynchronously,
+ * so we wait for it to finish, and then link in the new file; its
+ * attributes are fetched if someone asks for them.
+ */
+int32_t
+CnodeMs::copyFile(std::string name, std::string srcId, CAttr *srcAttrsp, CEnv *envp)
+{
+    char tbuffer[0x4000];
+    XApi::ClientConn *connp;
+    XApi::ClientReq *reqp = NULL;
+    CThreadPipe *inPipep;
+    CThreadPipe *outPipep;
+    std::string postData;
+    const char *tp;
+    Json json;
+    Json::Node *jnodep = NULL;
+    std::string callbackString;
+    std::string authHeader;
+    std::string monitorUrl;
+    std::string id;
+    int32_t code;
+    uint32_t httpError;
+    CfsRetryError retryState;
+    Rst::Hdr *hdrp;
+    CnodeMs *childp;
+    CnodeLockSet lockSet;
+
+    if (_cfsp->_verbose)
+        printf("copyFile: id=%s name=%s from=%s\n", _id.c_str(), name.c_str(), srcId.c_str());
+
+    callbackString = ("/v1.0/me/drive/items/" + srcId +
+                      "/copy?@microsoft.graph.conflictBehavior=replace");
+
+    _cfsp->_stats._copyCalls++;
+
+    if (srcAttrsp) {
+        code = checkCopySource(&srcId, srcAttrsp, envp);
+        if (code)
+            return code;
+    }
+
+    postData = "{\n";
+    if (_isRoot)
+        postData += "\"parentReference\": {\"path\": \"/drive/root:\"},\n";
+    else
+        postData += "\"parentReference\": {\"id\": \"" + _id + "\"},\n";
+    postData += "\"name\": \"" + name + "\"\n";
+    postData += "}\n";
+
+    while(1) {
+        CfsGovernor::Slot slot(&_cfsp->_governor);
+        _cfsp->_stats._totalCalls++;
+        connp = _cfsp->_xapiPoolp->getConn(std::string("graph.microsoft.com"), 443, /* TLS */ 1);
+        reqp = new XApi::ClientReq();
+        reqp->setSendContentLength(postData.length());
+        authHeader = "Bearer " + _cfsp->_loginCookiep->getAuthToken();
+        reqp->addHeader("Authorization", authHeader.c_str());
+        reqp->addHeader("Content-Type", "application/json");
+        reqp->startCall( connp,
+                         callbackString.c_str(),
+                         /* isPost */ XApi::reqPost);
+
+        outPipep = reqp->getOutgoingPipe();
+        outPipep->write(postData.c_str(), postData.length());
+        outPipep->eof();
+
+        code = reqp->waitForHeadersDone();
+        if (code != 0) {
+            delete reqp;
+            reqp = NULL;
+            if (_cfsp->retryRpcError(CfsLog::opCopy, code, &retryState))
+                continue;
+            else {
+                code = CFS_ERR_TIMEDOUT;
+                break;
+            }
+        }
+        httpError = reqp->getHttpError();
+
+        /* accepted, with a Location header telling us where to watch
+         * for the result.
+         */
+        if (httpError == 202) {
+            for(hdrp = reqp->getRecvHeaders(); hdrp; hdrp=hdrp->_dqNextp) {
+                if (strcasecmp(hdrp->_key.c_str(), "location") == 0)
+                    monitorUrl = hdrp->_value;
+            }
+            _cfsp->retryHttpError(CfsLog::opCopy, httpError, 0, reqp, &jnodep, &retryState);
+            delete reqp;
+            reqp = NULL;
+            code = (monitorUrl.length() > 0? 0 : CFS_ERR_SERVER);
+            break;
+        }
+
+        inPipep = reqp->getIncomingPipe();
+        code = inPipep->read(tbuffer, sizeof(tbuffer));
+        if (code >= 0 && code < (signed) sizeof(tbuffer)-1) {
+            tbuffer[code] = 0;
+        }
+        else
+            tbuffer[0] = 0;
+
+        tp = tbuffer;
+        slot.leave();
+        code = json.parseJsonChars((char **) &tp, &jnodep);
+        if (code != 0)
+            jnodep = NULL;
+
+        if (_cfsp->retryError(CfsLog::opCopy, reqp, &jnodep, &retryState)) {
+            delete reqp;
+            reqp = NULL;
+            continue;
+        }
+        code = retryState.getCode();
+        delete reqp;
+        reqp = NULL;
+
+        /* some other success code, but we can't tell what it made */
+        if (code == 0)
+            code = CFS_ERR_SERVER;
+        break;
+    }
+
+    if (jnodep) {
+        delete jnodep;
+        jnodep = NULL;
+    }
+
+    if (code == 0)
+        code = waitForCopy(&monitorUrl, &id);
+
+    if (code == 0) {
+        lockSet.add(this);
+        code = _cfsp->getCnodeLinked(this, name, &id, &childp, &lockSet);
+        if (code == 0) {
+            childp->_valid = 0;
+            childp->release();    /* lock held by getCnodeLinked */
+            childp = NULL;
+        }
+    }
+
+    if (_cfsp->_verbose)
+        printf("copyFile: done code=%d\n", code);
+
+    return code;
+}
+
+/* poll a copy's monitor URL until the copy is done, returning the new
+ * item's ID in *idp.  Monitor URLs are on some other host, and need
+ * no authorization.  Polls go through the governor like any other
+ * call, and a 429 or 5xx, or a Retry-After on a progress report, slows
+ * them down.
+ */
+int32_t
+CnodeMs::waitForCopy(std::string *monitorUrlp, std::string *idp)
+{
+    XApi::ClientConn *connp;
+    XApi::ClientReq *reqp;
+    std::string host;
+    std::string path;
+    std::string response;
+    std::string status;
+    Json json;
+    Json::Node *jnodep;
+    Json::Node *tnodep;
+    Rst::Hdr *hdrp;
+    const char *tp;
+    size_t slashPos;
+    uint32_t httpError;
+    uint32_t delayMs;
+    uint32_t retryAfterMs;
+    uint64_t startMs;
+    int32_t code;
+
+    /* split https://host/path */
+    path = *monitorUrlp;
+    if (path.compare(0, 8, "https://") == 0)
+        path = path.substr(8);
+    slashPos = path.find('/');
+    if (slashPos == std::string::npos)
+        return CFS_ERR_SERVER;
+    host = path.substr(0, slashPos);
+    path = path.substr(slashPos);
+
+    startMs = osp_time_ms();
+    delayMs = 250;
+    retryAfterMs = 0;
+    while(1) {
+        if (osp_time_ms() - startMs > _copyWaitMs) {
+            printf("copyFile: gave up waiting for %s\n", monitorUrlp->c_str());
+            return CFS_ERR_TIMEDOUT;
+        }
+        usleep((retryAfterMs > delayMs? retryAfterMs : delayMs) * 1000);
+        if (delayMs < 4000)
+            delayMs *= 2;
+
+        CfsGovernor::Slot slot(&_cfsp->_governor);
+        _cfsp->_stats._totalCalls++;
+        connp = _cfsp->_xapiPoolp->getConn(host, 443, /* TLS */ 1);
+        reqp = new XApi::ClientReq();
+        reqp->startCall(connp, path.c_str(), XApi::reqGet);
+        reqp->getOutgoingPipe()->eof();
+
+        code = reqp->waitForHeadersDone();
+        if (code != 0) {
+            delete reqp;
+            continue;
+        }
+        httpError = reqp->getHttpError();
+
+        /* the governor pauses everyone for a throttle; we also wait at
+         * least as long as we're told before polling again.
+         */
+        retryAfterMs = CfsMs::getRetryAfterMs(reqp);
+        if (httpError == 429 || (httpError >= 500 && httpError <= 504)) {
+            _cfsp->_governor.throttled(retryAfterMs);
+            if (retryAfterMs == 0)
+                retryAfterMs = CfsGovernor::_defaultPauseMs;
+        }
+        if (retryAfterMs > CfsGovernor::_maxPauseMs)
+            retryAfterMs = CfsGovernor::_maxPauseMs;
+
+        /* a redirect to the new item itself means it's done */
+        if (httpError == 303) {
+            for(hdrp = reqp->getRecvHeaders(); hdrp; hdrp=hdrp->_dqNextp) {
+                if (strcasecmp(hdrp->_key.c_str(), "location") == 0) {
+                    slashPos = hdrp->_value.rfind('/');
+                    if (slashPos != std::string::npos)
+                        *idp = hdrp->_value.substr(slashPos+1);
+                }
+            }
+            delete reqp;
+            return (idp->length() > 0? 0 : CFS_ERR_SERVER);
+        }
+
+        response.clear();
+        readWholePipe(reqp->getIncomingPipe(), &response);
+        delete reqp;
+        slot.leave();
+
+        tp = response.c_str();
+        if (json.parseJsonChars((char **) &tp, &jnodep) != 0)
+            continue;
+
+        status.clear();
+        tnodep = jnodep->searchForChild("status");
+        if (tnodep && tnodep->_children.head())
+            status = tnodep->_children.head()->_name;
+        if (status == "completed") {
+            tnodep = jnodep->searchForChild("resourceId");
+            if (tnodep && tnodep->_children.head())
+                *idp = tnodep->_children.head()->_name;
+            delete jnodep;
+            return (idp->length() > 0? 0 : CFS_ERR_SERVER);
+        }
+        delete jnodep;
+        if (status == "failed" || (httpError >= 400 && httpError != 429 && httpError < 500)) {
+            printf("copyFile: copy failed status=%s http=%d\n", status.c_str(), httpError);
+            return CFS_ERR_SERVER;
+        }
+    }
+}
+
+int32_t
+CnodeMs::mkdir(std::string name, Cnode **newDirpp, CEnv *envp)
+{
+    /* perform mkdir operation */
+    char tbuffer[0x4000];
+    XApi::ClientConn *connp;
+    XApi::ClientReq *reqp;
+    CThreadPipe *inPipep;
+    CThreadPipe *outPipep;
+    std::string postData;
+    const char *tp;
+    Json json;
+    Json::Node *jnodep = NULL;
+    std::string callbackString;
+    std::string authHeader;
+    int32_t code;
     uint32_t httpError;
     int errorOk = 0;
     CfsRetryError retryState;
+    int useBatch = (_cfsp->_batchFileBytes != 0);
+    Cnode *childp;
     
     if (_cfsp->_verbose)
         printf("mkdir: id=%s name=%s\n", _id.c_str(), name.c_str());
@@ -557,6 +1367,38 @@ CnodeMs::mkdir(std::string name, Cnode **newDirpp, CEnv *envp)
     postData += "}\n";
     
     while(1) {
+        if (useBatch) {
+            CfsMsBatch::Item item;
+
+            item._method = "POST";
+            item._url = callbackString;
+            item._contentType = "application/json";
+            item._body = postData;
+            if (_cfsp->_batchp->call(&item)) {
+                httpError = item._httpError;
+                jnodep = item.takeResponse();
+                if (httpError == 409 && nameAlreadyExists(jnodep)) {
+                    code = CFS_ERR_EXIST;
+                    break;
+                }
+                if (_cfsp->retryHttpError( CfsLog::opMkdir,
+                                           httpError,
+                                           item._retryAfterMs,
+                                           NULL,
+                                           &jnodep,
+                                           &retryState))
+                    continue;
+                code = retryState.getCode();
+                if (code == 0)
+                    code = linkNewDir(name, jnodep, newDirpp);
+                break;
+            }
+
+            /* nobody to batch with; send it ourselves */
+            useBatch = 0;
+        }
+
+        CfsGovernor::Slot slot(&_cfsp->_governor);
         _cfsp->_stats._totalCalls++;
         connp = _cfsp->_xapiPoolp->getConn(std::string("graph.microsoft.com"), 443, /* TLS */ 1);
         reqp = new XApi::ClientReq();
@@ -592,6 +1434,7 @@ CnodeMs::mkdir(std::string name, Cnode **newDirpp, CEnv *envp)
         }
         
         tp = tbuffer;
+        slot.leave();
         code = json.parseJsonChars((char **) &tp, &jnodep);
         if (code != 0) {
             printf("json parse failed code=%d\n", code);
@@ -600,18 +1443,12 @@ CnodeMs::mkdir(std::string name, Cnode **newDirpp, CEnv *envp)
             break;
         }
         
-        if (httpError == 409) {
-            Json::Node *tnodep;
-            tnodep = jnodep->searchForChild("code");
-            if (tnodep &&
-                tnodep->_children.head() &&
-                tnodep->_children.head()->_name == "nameAlreadyExists") {
-                code = CFS_ERR_EXIST;
-                errorOk = 1;    /* even though we had an error, this is OK */
-                delete reqp;
-                reqp = NULL;
-                break;
-            }
+        if (httpError == 409 && nameAlreadyExists(jnodep)) {
+            code = CFS_ERR_EXIST;
+            errorOk = 1;    /* even though we had an error, this is OK */
+            delete reqp;
+            reqp = NULL;
+            break;
         }
         
         if (!errorOk) {
@@ -637,18 +1474,7 @@ CnodeMs::mkdir(std::string name, Cnode **newDirpp, CEnv *envp)
         /* this will fail with a 409 but that doesn't hurt us; we just won't fill
          * in the attributes now.
          */
-        code = parseResults(jnodep, &id, &size, &changeTime, &modTime, &fileType);
-        if (code == 0) {
-            code = _cfsp->getCnodeLinked(this, name, &id, &childp, &lockSet);
-            if (code == 0) {
-                childp->_valid = 1;
-                childp->_attrs._length = size;
-                childp->_attrs._ctime = changeTime;
-                childp->_attrs._mtime = modTime;
-                childp->_attrs._fileType = fileType;
-                *newDirpp = childp;
-            }
-        }
+        code = linkNewDir(name, jnodep, newDirpp);
         break;
     }
 
@@ -660,6 +1486,15 @@ CnodeMs::mkdir(std::string name, Cnode **newDirpp, CEnv *envp)
     if (reqp)
         delete reqp;
 
+    if (code == CFS_ERR_EXIST) {
+        /* the dir's already there.  Our caller will look it up next, so
+         * get it and its attributes into the cache now, as we would have
+         * if we'd made it; a complete listing of ours may not have it.
+         */
+        if (lookup(name, /* forceBackend */ 1, &childp, envp) == 0)
+            childp->release();
+    }
+
     if (code)
         *newDirpp = NULL;
 
@@ -675,7 +1510,6 @@ CnodeMs::fillAttrs( CEnv *envp, CnodeLockSet *lockSetp)
 {
     /* perform getAttr operation */
     char tbuffer[0x4000];
-    XApi::ClientConn *connp;
     XApi::ClientReq *reqp;
     std::string postData;
     CThreadPipe *inPipep;
@@ -703,15 +1537,13 @@ CnodeMs::fillAttrs( CEnv *envp, CnodeLockSet *lockSetp)
     _cfsp->_stats._fillAttrCalls++;
 
     while(1) {
+        CfsGovernor::Slot slot(&_cfsp->_governor);
         _cfsp->_stats._totalCalls++;
-        connp = _cfsp->_xapiPoolp->getConn(std::string("graph.microsoft.com"), 443, /* TLS */ 1);
         reqp = new XApi::ClientReq();
         authHeader = "Bearer " + _cfsp->_loginCookiep->getAuthToken();
         reqp->addHeader("Authorization", authHeader.c_str());
         reqp->addHeader("Content-Type", "application/json");
-        reqp->startCall( connp,
-                         callbackString.c_str(),
-                         /* isPost */ XApi::reqGet);
+        _cfsp->startGet(reqp, &callbackString);
         
         outPipep = reqp->getOutgoingPipe();
         outPipep->write(postData.c_str(), postData.length());
@@ -736,6 +1568,7 @@ CnodeMs::fillAttrs( CEnv *envp, CnodeLockSet *lockSetp)
         }
         
         tp = tbuffer;
+        slot.leave();
         code = json.parseJsonChars((char **) &tp, &jnodep);
         if (code != 0) {
             printf("json parse failed code=%d\n", code);
@@ -840,6 +1673,7 @@ CnodeMs::startSession( std::string name,
     postData += "}\n";
     
     while(1) {
+        CfsGovernor::Slot slot(&_cfsp->_governor);
         _cfsp->_stats._totalCalls++;
         connp = _cfsp->_xapiPoolp->getConn(std::string("graph.microsoft.com"), 443, /* TLS */ 1);
         reqp = new XApi::ClientReq();
@@ -874,6 +1708,7 @@ CnodeMs::startSession( std::string name,
         }
         
         tp = tbuffer;
+        slot.leave();
         code = json.parseJsonChars((char **) &tp, &jnodep);
         if (code != 0) {
             printf("json parse failed code=%d\n", code);
@@ -927,69 +1762,86 @@ CnodeMs::startSession( std::string name,
     
 }
 
-/* bytesReadp is set only on 0 returns */
+/* pull the next byte the server wants out of an upload session
+ * response, whose nextExpectedRanges look like ["12345-"], or notice
+ * that the response is the finished item.  Returns false if the
+ * response says neither.
+ */
+/* static */ int
+CnodeMs::parseNextOffset( Json::Node *jnodep,
+                          uint64_t fileLength,
+                          uint64_t *nextOffsetp)
+{
+    Json::Node *tnodep;
+
+    if (!jnodep)
+        return 0;
+
+    tnodep = jnodep->searchForChild("nextExpectedRanges", 0);
+    if (tnodep && (tnodep = tnodep->_children.head()) != NULL) {
+        if ((tnodep = tnodep->_children.head()) == NULL) {
+            /* nothing more expected */
+            *nextOffsetp = fileLength;
+            return 1;
+        }
+        *nextOffsetp = strtoull(tnodep->_name.c_str(), NULL, 10);
+        return 1;
+    }
+
+    if (jnodep->searchForChild("id", 0)) {
+        *nextOffsetp = fileLength;
+        return 1;
+    }
+
+    return 0;
+}
+
+/* send byteCount bytes from dataBufferp at byteOffset; on 0 returns,
+ * nextOffsetp is set to the first byte the server still wants, which
+ * is fileLength once the upload is complete.  The finished file is
+ * cached as name in this dir.
+ */
 int32_t
-CnodeMs::sendData( std::string *sessionUrlp,
-                   CDataSource *sourcep,
+CnodeMs::sendData( std::string name,
+                   std::string *sessionUrlp,
+                   char *dataBufferp,
                    uint64_t fileLength,
                    uint64_t byteOffset,
                    uint32_t byteCount,
-                   uint32_t *bytesReadp)
+                   uint64_t *nextOffsetp)
 {
-    /* perform mkdir operation */
-    char tbuffer[0x4000];
-    char *dataBufferp;
+    char tbuffer[100];
     std::string sessionHost;
     std::string sessionRelativeUrl;
+    std::string result;
     XApi::ClientConn *connp;
     XApi::ClientReq *reqp = NULL;
-    CThreadPipe *inPipep;
     CThreadPipe *outPipep;
     const char *tp;
     Json json;
     Json::Node *jnodep = NULL;
-    std::string authHeader;
     int32_t code=0;
-    std::string id;
-    uint32_t readCount;
-    int32_t actuallyReadCount;
     uint16_t port;
+    uint8_t duplicate = 0;
+    uint32_t httpError;
     CfsRetryError retryState;
     
     Rst::splitUrl(*sessionUrlp, &sessionHost, &sessionRelativeUrl, &port);
 
-    osp_assert(byteCount < 4*1024*1024);
-    dataBufferp = new char[byteCount];
     _cfsp->_stats._sendDataCalls++;
+    *nextOffsetp = byteOffset + byteCount;
 
     while(1) {
+        CfsGovernor::Slot slot(&_cfsp->_governor);
         _cfsp->_stats._totalCalls++;
         connp = _cfsp->_xapiPoolp->getConn(sessionHost, port, /* TLS */ 1);
-        /* read some bytes */
-        readCount = (byteOffset + byteCount > fileLength?
-                     fileLength - byteOffset :
-                     byteCount);
-        actuallyReadCount = sourcep->read( byteOffset, readCount, dataBufferp);
-        if (actuallyReadCount == 0) {
-            connp->setBusy(0);  /* marked busy by getConn */
-            break;
-        }
-        if (actuallyReadCount < 0) {
-            connp->setBusy(0);  /* marked busy by getConn */
-            code = CFS_ERR_IO;
-            break;
-        }
 
         reqp = new XApi::ClientReq();
-        reqp->setSendContentLength(actuallyReadCount);
-#if 0
-        authHeader = "Bearer " + _cfsp->_loginCookiep->getAuthToken();
-        reqp->addHeader("Authorization", authHeader.c_str());
-#endif
+        reqp->setSendContentLength(byteCount);
         snprintf(tbuffer, sizeof(tbuffer),
                  "bytes %ld-%ld/%ld",
                 (long) byteOffset,
-                (long) byteOffset+actuallyReadCount-1,
+                (long) byteOffset+byteCount-1,
                 (long) fileLength);
         reqp->addHeader("Content-Range", tbuffer);
         reqp->startCall( connp,
@@ -997,7 +1849,7 @@ CnodeMs::sendData( std::string *sessionUrlp,
                          /* isPut */ XApi::reqPut);
         
         outPipep = reqp->getOutgoingPipe();
-        outPipep->write(dataBufferp, actuallyReadCount);
+        outPipep->write(dataBufferp, byteCount);
         outPipep->eof();
         
         code = reqp->waitForHeadersDone();
@@ -1012,13 +1864,11 @@ CnodeMs::sendData( std::string *sessionUrlp,
             }
         }
 
-        inPipep = reqp->getIncomingPipe();
-        code = inPipep->read(tbuffer, sizeof(tbuffer));
-        if (code >= 0 && code < (signed) sizeof(tbuffer)-1) {
-            tbuffer[code] = 0;
-        }
+        result.erase();
+        readWholePipe(reqp->getIncomingPipe(), &result);
         
-        tp = tbuffer;
+        tp = result.c_str();
+        slot.leave();
         code = json.parseJsonChars((char **) &tp, &jnodep);
         if (code != 0) {
             printf("json parse failed code=%d\n", code);
@@ -1033,6 +1883,19 @@ CnodeMs::sendData( std::string *sessionUrlp,
             continue;
         }
         code = retryState.getCode();
+        if (code == 0) {
+            httpError = reqp->getHttpError();
+            /* a 416 means the server already has some of these bytes */
+            if (httpError == 416)
+                duplicate = 1;
+            else {
+                parseNextOffset(jnodep, fileLength, nextOffsetp);
+
+                /* the last chunk gets back the finished item */
+                if (httpError == 200 || httpError == 201)
+                    linkSentFile(name, jnodep, httpError);
+            }
+        }
 
         delete reqp;
         reqp = NULL;
@@ -1048,17 +1911,88 @@ CnodeMs::sendData( std::string *sessionUrlp,
         jnodep = NULL;
     }
 
-    if (dataBufferp) {
-        delete [] dataBufferp;
-    }
+    if (duplicate)
+        code = getSessionOffset(sessionUrlp, fileLength, nextOffsetp);
 
-    if (code == 0) {
-        *bytesReadp = actuallyReadCount;
-    }
-    else {
-        *bytesReadp = 0;
+    return code;
+}
+
+/* ask an upload session which byte it wants next, so we can resume
+ * after a failed chunk without starting over.
+ */
+int32_t
+CnodeMs::getSessionOffset( std::string *sessionUrlp,
+                           uint64_t fileLength,
+                           uint64_t *nextOffsetp)
+{
+    std::string sessionHost;
+    std::string sessionRelativeUrl;
+    std::string result;
+    XApi::ClientConn *connp;
+    XApi::ClientReq *reqp = NULL;
+    const char *tp;
+    Json json;
+    Json::Node *jnodep = NULL;
+    int32_t code=0;
+    uint16_t port;
+    CfsRetryError retryState;
+
+    Rst::splitUrl(*sessionUrlp, &sessionHost, &sessionRelativeUrl, &port);
+
+    while(1) {
+        CfsGovernor::Slot slot(&_cfsp->_governor);
+        _cfsp->_stats._totalCalls++;
+        connp = _cfsp->_xapiPoolp->getConn(sessionHost, port, /* TLS */ 1);
+
+        reqp = new XApi::ClientReq();
+        reqp->startCall( connp,
+                         sessionRelativeUrl.c_str(),
+                         XApi::reqGet);
+
+        code = reqp->waitForHeadersDone();
+        if (code != 0) {
+            delete reqp;
+            reqp = NULL;
+            if (_cfsp->retryRpcError(CfsLog::opSendFile, code, &retryState))
+                continue;
+            else {
+                code = CFS_ERR_TIMEDOUT;
+                break;
+            }
+        }
+
+        result.erase();
+        readWholePipe(reqp->getIncomingPipe(), &result);
+
+        tp = result.c_str();
+        slot.leave();
+        code = json.parseJsonChars((char **) &tp, &jnodep);
+        if (code != 0) {
+            printf("json parse failed code=%d\n", code);
+            break;
+        }
+
+        if (_cfsp->retryError(CfsLog::opSendFile, reqp, &jnodep, &retryState)) {
+            delete reqp;
+            reqp = NULL;
+            continue;
+        }
+        code = retryState.getCode();
+        if (code == 0 && !parseNextOffset(jnodep, fileLength, nextOffsetp))
+            code = CFS_ERR_SERVER;
+
+        break;
     }
-    
+
+    if (reqp)
+        delete reqp;
+
+    if (jnodep)
+        delete jnodep;
+
+    if (_cfsp->_verbose)
+        printf("getSessionOffset code=%d next=%lld\n", code, (long long) *nextOffsetp);
+
     return code;
 }
 
@@ -1069,6 +2003,109 @@ CnodeMs::abortSession( std::string *sessionUrlp)
     return 0;
 }
 
+void
+CnodeMsReader::start()
+{
+    CThreadHandle *hp;
+
+    hp = new CThreadHandle();
+    hp->init((CThread::StartMethod) &CnodeMsReader::readerThread, this, NULL);
+}
+
+/* ask the reader thread to fill bufferp; the other buffer must not
+ * have a read outstanding.
+ */
+void
+CnodeMsReader::request(Buffer *bufferp, uint64_t offset, uint32_t count)
+{
+    if (bufferp->_allocSize < count) {
+        /* page aligned, so sources doing direct I/O can read right into it */
+        if (bufferp->_datap)
+            free(bufferp->_datap);
+        if (posix_memalign((void **) &bufferp->_datap, 4096, count) != 0)
+            osp_assert(0);
+        bufferp->_allocSize = count;
+    }
+
+    _lock.take();
+    osp_assert(_requestp == NULL);
+    bufferp->_offset = offset;
+    bufferp->_count = count;
+    bufferp->_readCount = 0;
+    bufferp->_ready = 0;
+    _requestp = bufferp;
+    _cv.broadcast();
+    _lock.release();
+}
+
+/* wait for a requested read to finish */
+void
+CnodeMsReader::wait(Buffer *bufferp)
+{
+    _lock.take();
+    while(!bufferp->_ready) {
+        _cv.wait();
+    }
+    _lock.release();
+}
+
+/* stop the thread; waits for any read in progress, since it's
+ * reading into our buffers.
+ */
+void
+CnodeMsReader::shutdown()
+{
+    _lock.take();
+    _shutdown = 1;
+    _cv.broadcast();
+    while(!_exited) {
+        _cv.wait();
+    }
+    _lock.release();
+}
+
+void
+CnodeMsReader::readerThread(void *contextp)
+{
+    Buffer *bufferp;
+    int32_t code;
+
+    _lock.take();
+    while(1) {
+        if (_shutdown)
+            break;
+
+        bufferp = _requestp;
+        if (!bufferp) {
+            _cv.wait();
+            continue;
+        }
+        _requestp = NULL;
+        _lock.release();
+
+        /* fill the buffer, unless we hit EOF or an error */
+        while((uint32_t) bufferp->_readCount < bufferp->_count) {
+            code = _sourcep->read( bufferp->_offset + bufferp->_readCount,
+                                   bufferp->_count - bufferp->_readCount,
+                                   bufferp->_datap + bufferp->_readCount);
+            if (code < 0) {
+                bufferp->_readCount = code;
+                break;
+            }
+            if (code == 0)
+                break;
+            bufferp->_readCount += code;
+        }
+
+        _lock.take();
+        bufferp->_ready = 1;
+        _cv.broadcast();
+    }
+    _exited = 1;
+    _cv.broadcast();
+    _lock.release();
+}
+
 int32_t
 CnodeMs::sendFile( std::string name,
                    CDataSource *sourcep,
@@ -1077,12 +2114,19 @@ CnodeMs::sendFile( std::string name,
 {
     int32_t code;
     std::string sessionUrl;
-    uint64_t remainingBytes;
     uint64_t currentOffset;
+    uint64_t nextOffset;
     uint64_t size;
+    uint64_t startMs;
+    uint64_t elapsedMs;
     CnodeLockSet lockSet;
     CAttr dataAttrs;
-    uint32_t bytesSent;
+    CnodeMsReader *readerp;
+    CnodeMsReader::Buffer *bufferp;
+    CnodeMsReader::Buffer *nextBufferp;
+    CnodeMsReader::Buffer *tbufferp;
+    uint32_t chunkUnits;
+    uint32_t resumes;
 
     code = sourcep->getAttr(&dataAttrs);
     if (code) {
@@ -1102,90 +2146,149 @@ CnodeMs::sendFile( std::string name,
     if (_cfsp->_verbose)
         printf("sendBigFile: id=%s name=%s\n", _id.c_str(), name.c_str());
 
-    /* MS claims in docs that multiples of this are only safe values;
-     * commenters don't believe them.
-     */
-    uint32_t bytesPerPut = 12*320*1024;
-    
     code = startSession( name, &sessionUrl);
     if (code) {
         printf("sendFile: session start failed code=%d\n", code);
         return code;
     }
 
-    remainingBytes = size;
-    currentOffset = 0;
-    while(remainingBytes > 0) {
-        code = sendData( &sessionUrl,
-                         sourcep,
-                         size,
-                         currentOffset,
-                         bytesPerPut,
-                         &bytesSent);
-        if (code) {
-            printf("sendFile: sendData failed code=%d\n", code);
-            abortSession( &sessionUrl);
-            return code;
+    /* Graph wants a session's chunks in order, so we can't have more
+     * than one PUT going; instead, the reader thread reads the next
+     * chunk while we send this one.
+     */
+    readerp = new CnodeMsReader(sourcep);
+    readerp->start();
+    bufferp = &readerp->_buffers[0];
+    nextBufferp = &readerp->_buffers[1];
+
+    chunkUnits = 12;
+    resumes = 0;
+    currentOffset = 0;
+    readerp->request(bufferp, 0, (size < chunkUnits * _chunkUnit?
+                                  size : chunkUnits * _chunkUnit));
+    while(currentOffset < size) {
+        readerp->wait(bufferp);
+        if (bufferp->_readCount <= 0) {
+            /* error, or the file shrank under us */
+            code = CFS_ERR_IO;
+            break;
+        }
+
+        /* start reading the chunk after this one, assuming this one
+         * goes through.
+         */
+        nextOffset = currentOffset + bufferp->_readCount;
+        if (nextOffset < size) {
+            readerp->request( nextBufferp,
+                              nextOffset,
+                              (size - nextOffset < chunkUnits * _chunkUnit?
+                               size - nextOffset : chunkUnits * _chunkUnit));
+        }
+
+        startMs = osp_time_ms();
+        code = sendData( name,
+                         &sessionUrl,
+                         bufferp->_datap,
+                         size,
+                         currentOffset,
+                         bufferp->_readCount,
+                         &nextOffset);
+        elapsedMs = osp_time_ms() - startMs;
+        if (code) {
+            /* see how far the server got, and pick up from there with
+             * smaller chunks.
+             */
+            chunkUnits = _minChunkUnits;
+            _cfsp->_stats._sendDataResumes++;
+            code = getSessionOffset(&sessionUrl, size, &nextOffset);
+            if (code || ++resumes > _maxResumes) {
+                printf("sendFile: sendData failed code=%d\n", code);
+                if (code == 0)
+                    code = CFS_ERR_TIMEDOUT;
+                break;
+            }
+        }
+        else {
+            if (nextOffset > currentOffset)
+                resumes = 0;
+            else if (++resumes > _maxResumes) {
+                printf("sendFile: session stopped making progress\n");
+                code = CFS_ERR_SERVER;
+                break;
+            }
+
+            /* size the chunks so that each PUT takes a few seconds */
+            if (elapsedMs < _chunkFastMs && chunkUnits < _maxChunkUnits)
+                chunkUnits = (2*chunkUnits > _maxChunkUnits? _maxChunkUnits : 2*chunkUnits);
+            else if (elapsedMs > _chunkSlowMs && chunkUnits > _minChunkUnits)
+                chunkUnits = (chunkUnits/2 < _minChunkUnits? _minChunkUnits : chunkUnits/2);
         }
-        else if (bytesSent < bytesPerPut) {
-            /* we've hit EOF, so we're done */
-            if (bytesCopiedp)
-                *bytesCopiedp += bytesSent;
-            code = 0;
+
+        if (bytesCopiedp && nextOffset > currentOffset)
+            *bytesCopiedp += nextOffset - currentOffset;
+
+        if (nextOffset >= size) {
+            currentOffset = nextOffset;
             break;
         }
+
+        if (currentOffset + bufferp->_readCount < size) {
+            /* a read is outstanding into nextBufferp */
+            readerp->wait(nextBufferp);
+            if (nextBufferp->_offset != nextOffset) {
+                /* server wants something other than what we read ahead */
+                readerp->request( nextBufferp,
+                                  nextOffset,
+                                  (size - nextOffset < chunkUnits * _chunkUnit?
+                                   size - nextOffset : chunkUnits * _chunkUnit));
+            }
+        }
         else {
-            /* update counters */
-            if (bytesCopiedp)
-                *bytesCopiedp += bytesSent;
-            currentOffset += bytesPerPut;
+            readerp->request( nextBufferp,
+                              nextOffset,
+                              (size - nextOffset < chunkUnits * _chunkUnit?
+                               size - nextOffset : chunkUnits * _chunkUnit));
         }
+        currentOffset = nextOffset;
+
+        tbufferp = bufferp;
+        bufferp = nextBufferp;
+        nextBufferp = tbufferp;
+    }
+
+    readerp->shutdown();
+    delete readerp;
+
+    if (code) {
+        abortSession( &sessionUrl);
+        return code;
     }
 
     if (_cfsp->_verbose)
         printf("sendFile: done code=0\n");
 
-    /* note that non-zero codes have already been handled */
     return 0;
 }
 
+/* reference counts are atomic, so holding and releasing a cnode
+ * takes no locks.  A cnode with no references only gets its first
+ * new one via a hash table lookup, under its hash lock, or via a
+ * name search, under _refLock; allocCnode holds both when it
+ * recycles one.
+ */
 void
 CnodeMs::hold() {
-    _cfsp->_refLock.take();
-    holdNL();
-    _cfsp->_refLock.release();
-}
-
-void
-CnodeMs::holdNL() {
-    _refCount++;
-    if (_inLru) {
-        _cfsp->_lruQueue.remove(this);
-        _inLru = 0;
-    }
+    __atomic_add_fetch(&_refCount, 1, __ATOMIC_SEQ_CST);
+    _clockRef = 1;
 }
 
 void
 CnodeMs::release()
 {
-    CfsMs *cfsp = _cfsp;
-    cfsp->_refLock.take();
-    releaseNL();
-    cfsp->_refLock.release();
-}
+    int32_t count;
 
-/* if call this, must call check recycle once locks are done */
-void
-CnodeMs::releaseNL() {
-    osp_assert(_refCount > 0);
-    CfsMs *cfsp;
-
-    cfsp = _cfsp;               /* once ref count hits zero, all bets are off */
-    _refCount--;
-    if (recyclable() && !_inLru) {
-        _inLru = 1;
-        cfsp->_lruQueue.append(this);
-    }
+    count = __atomic_sub_fetch(&_refCount, 1, __ATOMIC_SEQ_CST);
+    osp_assert(count >= 0);
 }
 
 /* returns held reference to root */
@@ -1231,6 +2334,11 @@ CfsMs::root(Cnode **nodepp, CEnv *envp)
 
 /* returns null if lost race condition and had to drop hash lock; if it returns a
  * real cnode, it means that the hash lock hadn't been dropped.
+ *
+ * Once the cache is full, we recycle cnodes CLOCK style: the hand
+ * walks _clockQueue from the head, moving each cnode to the tail,
+ * and gives cnodes that have been held since its last pass a second
+ * chance.  Directories in use keep getting held, and so stay cached.
  */
 CnodeMs *
 CfsMs::allocCnode(CThreadMutex *hashLockp)
@@ -1240,6 +2348,8 @@ CfsMs::allocCnode(CThreadMutex *hashLockp)
     CnodeMs **lnodepp;
     CnodeMs *parentp;
     CnodeBackEntry *backp;
+    CThreadMutex *lockp;
+    uint32_t scanned;
     int doRelease;
 
     _refLock.take();
@@ -1252,14 +2362,15 @@ CfsMs::allocCnode(CThreadMutex *hashLockp)
         cnodep = new CnodeMs();
         cnodep->_cfsp = this;
         _cnodeCount++;
+        _clockQueue.append(cnodep);
         _refLock.release();
         return cnodep;
     }
 
-    /* otherwise, try LRU queue, and if that doesn't find anyone, just allocate a new
-     * one anyway, and bump a counter.
+    /* otherwise, sweep the CLOCK queue, and if that doesn't find anyone, just
+     * allocate a new one anyway, and bump a counter.
      */
-    while(1) {
+    for(scanned = 0; ; scanned++) {
         /* see if we have an already recycled cnode; currently unused */
         if ((cnodep = _freeListp) != NULL) {
             _freeListp = cnodep->_nextFreep;
@@ -1267,20 +2378,31 @@ CfsMs::allocCnode(CThreadMutex *hashLockp)
             return cnodep;
         }
 
-        /* try to get one from the LRU queue */
-        cnodep = _lruQueue.pop();
-        if (!cnodep) {
+        /* two passes are enough to clear every reference bit, so if we
+         * haven't found one by then, everything's busy.
+         */
+        if (scanned >= 2 * _cnodeCount) {
             _cnodeCount++;
+            _stats._cnodeOverflows++;
             cnodep = new CnodeMs();
             cnodep->_cfsp = this;
+            _clockQueue.append(cnodep);
             _refLock.release();
             return cnodep;
         }
-        cnodep->_inLru = 0;
+
+        /* advance the hand */
+        cnodep = _clockQueue.pop();
+        _clockQueue.append(cnodep);
+
+        if (cnodep->_clockRef) {
+            cnodep->_clockRef = 0;
+            continue;
+        }
 
         if (!cnodep->recyclable()) {
-            /* can't recycle this one; they'll get added to LRU queue again
-             * once their children disppear or their ref count hits zero
+            /* can't recycle this one; we'll look again once their children
+             * disappear or their ref count hits zero
              */
             continue;
         }
@@ -1288,45 +2410,46 @@ CfsMs::allocCnode(CThreadMutex *hashLockp)
         /* here, cnodep is recyclable, but we can't recycle it without adding
          * the hash lock for this entry, so we can hash it out.
          */
-        if (hashLockp == &_lock) {
+        if (cnodep->_inHash)
+            lockp = &_hashLocks[cnodep->_hashValue & (_hashLockCount-1)];
+        else
+            lockp = NULL;
+        if (!lockp || lockp == hashLockp) {
             doRelease = 0;
         }
-        else if (_lock.tryTake() == 0) {
+        else if (lockp->tryTake() == 0) {
             doRelease = 1;
         }
         else {
             /* couldn't get the hash lock directly; because we're going to
              * drop the lock, our caller can't do anything with our cnode anyway.
              * So, we'll just wait for the lock we wanted to get with lock.try
-             * above, and then return failure.
+             * above, and then return failure.  Our caller will retry.
              */
             _refLock.release();
             if (hashLockp)
                 hashLockp->release();
-            _lock.take(); /* if we use multiple hash locks, ensure this one matches cnodep */
-            _refLock.take();
-            _lock.release();
-
-            /* rather than recheck conditions, just put cnodep in the LRU queue
-             * if it isn't, but should be.  And then return failure.  Our caller
-             * will retry.
-             */
-            if (!cnodep->_inLru && cnodep->recyclable()) {
-                cnodep->_inLru = 1;
-                _lruQueue.append(cnodep);
-            }
-            _refLock.release();
+            lockp->take();
+            lockp->release();
             return NULL;
         }
 
+        /* a lookup may have found and held it before we got the hash lock;
+         * now that we have both locks, nobody else can get a new reference.
+         */
+        if (!cnodep->recyclable()) {
+            if (doRelease)
+                lockp->release();
+            continue;
+        }
+
         /* if we make it here, we have the hash lock for the old cnode
-         * we're trying to recycle.  It should still be recyclable,
-         * since we never dropped the _refLock, and we still have our
-         * caller's hash lock, if one was held.
+         * we're trying to recycle, and we still have our caller's hash
+         * lock, if one was held.
          */
         if (cnodep->_inHash) {
             cnodep->_inHash = 0;
-            for( lnodepp = &_hashTablep[cnodep->_hashIx], tnodep = *lnodepp;
+            for( lnodepp = &_hashTablep[cnodep->_hashValue & (_hashSize-1)], tnodep = *lnodepp;
                  tnodep;
                  lnodepp = &tnodep->_nextHashp, tnodep = *lnodepp) {
                 if (tnodep == cnodep) {
@@ -1340,19 +2463,26 @@ CfsMs::allocCnode(CThreadMutex *hashLockp)
         while ((backp = cnodep->_backEntriesp) != NULL) {
             osp_assert(backp->_childp == cnodep);
             parentp = backp->_parentp;
+            parentp->unhashChildNL(backp);
             parentp->_children.remove(backp);
+            if ((parentp->_listed || parentp->_listing) && backp->_name.length() > 0)
+                parentp->addLostNameNL(&backp->_name);
             cnodep->unthreadEntry(backp);
             delete backp;
-            /* and see if parent should be in LRU */
-            if (parentp->recyclable() && !parentp->_inLru) {
-                parentp->_inLru = 1;
-                _lruQueue.append(parentp);
-            }
         }
 
-        osp_assert(!cnodep->_inLru);
+        /* don't let the next id inherit this one's attributes, and give
+         * our caller its reference before the hand can come around again.
+         */
+        cnodep->_valid = 0;
+        cnodep->_listed = 0;
+        cnodep->_listGen++;
+        cnodep->clearLostNamesNL();
+        cnodep->_refCount = 1;
+
+        _stats._cnodeRecycles++;
         if (doRelease)
-            _lock.release();
+            lockp->release();
         _refLock.release();
         return cnodep;
     } /* loop */
@@ -1361,38 +2491,83 @@ CfsMs::allocCnode(CThreadMutex *hashLockp)
     return NULL;
 }
 
+/* quadruple the hash table once it averages more than two cnodes per
+ * bucket.  Called with no hash locks held.
+ */
+void
+CfsMs::growHash()
+{
+    CnodeMs **newTablep;
+    CnodeMs *cp;
+    CnodeMs *np;
+    uint32_t newSize;
+    uint32_t i;
+    uint32_t ix;
+
+    for(i=0;i<_hashLockCount;i++)
+        _hashLocks[i].take();
+
+    /* someone else may have beaten us to it */
+    if (_cnodeCount > 2 * _hashSize) {
+        newSize = 4 * _hashSize;
+        newTablep = new CnodeMs *[newSize];
+        memset(newTablep, 0, newSize * sizeof(CnodeMs *));
+        for(i=0;i<_hashSize;i++) {
+            for(cp = _hashTablep[i]; cp; cp = np) {
+                np = cp->_nextHashp;
+                ix = cp->_hashValue & (newSize-1);
+                cp->_nextHashp = newTablep[ix];
+                newTablep[ix] = cp;
+            }
+        }
+        delete [] _hashTablep;
+        _hashTablep = newTablep;
+        _hashSize = newSize;
+        _stats._hashGrows++;
+    }
+
+    for(i=_hashLockCount; i>0; i--)
+        _hashLocks[i-1].release();
+}
+
 int32_t
 CfsMs::getCnode(std::string *idp, CnodeMs **cnodepp)
 {
     uint64_t hashValue;
     CnodeMs *cp;
+    CThreadMutex *lockp;
 
-    hashValue = Cfs::fnvHash64(idp) % _hashSize;
+    hashValue = Cfs::fnvHash64(idp);
+    lockp = &_hashLocks[hashValue & (_hashLockCount-1)];
 
     while(1) {
-        _lock.take();
+        if (_cnodeCount > 2 * _hashSize)
+            growHash();
 
-        for(cp = _hashTablep[hashValue]; cp; cp=cp->_nextHashp) {
+        lockp->take();
+
+        for(cp = _hashTablep[hashValue & (_hashSize-1)]; cp; cp=cp->_nextHashp) {
             if (cp->_id == *idp)
                 break;
         }
 
         if (!cp) {
-            cp = allocCnode(&_lock);
+            cp = allocCnode(lockp);
             if (!cp) {
-                /* _lockp was released on failure; must reverify hash table search */
+                /* lockp was released on failure; must reverify hash table search */
                 continue;
             }
 
             cp->_cfsp = this;
             cp->_id = *idp;
             cp->_refCount = 1;
+            cp->_clockRef = 1;
 
-            /* hash in */
-            cp->_hashIx = hashValue;
+            /* hash in; the table can't grow while we hold lockp */
+            cp->_hashValue = hashValue;
             cp->_inHash = 1;
-            cp->_nextHashp = _hashTablep[hashValue];
-            _hashTablep[hashValue] = cp;
+            cp->_nextHashp = _hashTablep[hashValue & (_hashSize-1)];
+            _hashTablep[hashValue & (_hashSize-1)] = cp;
         }
         else {
             cp->hold();
@@ -1401,7 +2576,7 @@ CfsMs::getCnode(std::string *idp, CnodeMs **cnodepp)
         break;
     }
 
-    _lock.release();
+    lockp->release();
     return 0;
 }
 
@@ -1430,39 +2605,42 @@ CfsMs::getCnodeLinked( CnodeMs *parentp,
 
     /* otherwise, thread us in */
     _refLock.take();
-    for( entryp = parentp->_children.head(); entryp; entryp=entryp->_dqNextp) {
-        if (entryp->_name.length() == 0 && entryp->_childp == childp) {
-            /* we found an invalid entry with the same child, probably the
-             * result of an earlier invalidateTree call.  Just revalidate.
-             */
-            entryp->_name = name;
-            break;
+
+    /* look for an invalid entry from this parent to the same child,
+     * probably the result of an earlier invalidateTree call, and
+     * revalidate it if there's no valid entry with the name.
+     */
+    entryp = parentp->findChildNL(&name);
+    if (!entryp) {
+        for(entryp = childp->_backEntriesp; entryp; entryp=entryp->_nextSameChildp) {
+            if (entryp->_parentp == parentp && entryp->_name.length() == 0) {
+                entryp->_name = name;
+                parentp->hashChildNL(entryp);
+                break;
+            }
         }
-        if (entryp->_name == name) {
-            if (childp != entryp->_childp) {
-                /* we have the object with this name, so replace the object and
-                 * unsplice the back entry from the old child.
-                 *
-                 * This could just be one name out of many for the
-                 * child, so we have to find the entry in the child's
-                 * back pointer list.
-                 */
-                oldChildp = entryp->_childp;
-
-                /* remove this back entry structure from the wrong child */
-                oldChildp->unthreadEntry(entryp);
-
-                /* and add it into the new child's back pointer list */
-                osp_assert(childp->_backEntriesp == NULL); /* debugging only */
-                entryp->_nextSameChildp = childp->_backEntriesp;
-                childp->_backEntriesp = entryp;
-
-                /* and set the downward pointer */
-                entryp->_childp = childp;
-            } /* child doesn't match */
-            break;
-        } /* name matches */
-    } /* see if name already exists in parent dir */
+    }
+    else if (childp != entryp->_childp) {
+        /* we have the object with this name, so replace the object and
+         * unsplice the back entry from the old child.
+         *
+         * This could just be one name out of many for the
+         * child, so we have to find the entry in the child's
+         * back pointer list.
+         */
+        oldChildp = entryp->_childp;
+
+        /* remove this back entry structure from the wrong child */
+        oldChildp->unthreadEntry(entryp);
+
+        /* and add it into the new child's back pointer list */
+        osp_assert(childp->_backEntriesp == NULL); /* debugging only */
+        entryp->_nextSameChildp = childp->_backEntriesp;
+        childp->_backEntriesp = entryp;
+
+        /* and set the downward pointer */
+        entryp->_childp = childp;
+    } /* name exists with a different child */
     _refLock.release();
 
     if (!entryp) {
@@ -1474,6 +2652,7 @@ CfsMs::getCnodeLinked( CnodeMs *parentp,
         entryp->_parentp = parentp;
         entryp->_childp = childp;
         parentp->_children.append(entryp);
+        parentp->hashChildNL(entryp);
         _refLock.release();
     }
 
@@ -1525,15 +2704,10 @@ CfsMs::retryError( CfsLog::OpType type,
                    Json::Node **parsedNodepp,
                    CfsRetryError *retryStatep)
 {
-    uint32_t httpError;
-    httpError = reqp->getHttpError();
     int32_t code;
-    Json::Node *parsedNodep = *parsedNodepp;
-
-    /* add in a 1 in the stalling cases below */
-    _stalledErrors <<= 1;
 
     if (reqp->getError() != 0) {
+        _stalledErrors <<= 1;
         code = 1000000 + reqp->getError();
         if (_logp)
             _logp->logError(type, code, "RPC error", "");
@@ -1541,7 +2715,53 @@ CfsMs::retryError( CfsLog::OpType type,
         retryStatep->_finalCode = code;
         return 0;
     }
-    else if (httpError >= 200 && httpError < 300) {
+
+    return retryHttpError( type,
+                           reqp->getHttpError(),
+                           getRetryAfterMs(reqp),
+                           reqp,
+                           parsedNodepp,
+                           retryStatep);
+}
+
+/* the response's Retry-After, in ms, or 0 if it has none we understand */
+/* static */ uint32_t
+CfsMs::getRetryAfterMs(XApi::ClientReq *reqp)
+{
+    Rst::Hdr *hdrp;
+
+    for(hdrp = reqp->getRecvHeaders(); hdrp; hdrp=hdrp->_dqNextp) {
+        if (strcasecmp(hdrp->_key.c_str(), "retry-after") == 0)
+            return 1000 * strtoul(hdrp->_value.c_str(), NULL, 10);
+    }
+    return 0;
+}
+
+/* like retryError, but given just the HTTP status, as for an item in a
+ * $batch response; reqp is NULL in that case, since the batch's
+ * connection was fine.
+ */
+int
+CfsMs::retryHttpError( CfsLog::OpType type,
+                       uint32_t httpError,
+                       uint32_t retryAfterMs,
+                       XApi::ClientReq *reqp,
+                       Json::Node **parsedNodepp,
+                       CfsRetryError *retryStatep)
+{
+    int32_t code;
+    Json::Node *parsedNodep = *parsedNodepp;
+
+    /* add in a 1 in the stalling cases below */
+    _stalledErrors <<= 1;
+
+    /* let the governor know how the server's coping */
+    if ((httpError >= 500 && httpError <= 504) || httpError == 429)
+        _governor.throttled(retryAfterMs);
+    else
+        _governor.succeeded();
+
+    if (httpError >= 200 && httpError < 300) {
         retryStatep->_finalCode = CFS_ERR_OK;
         return 0;
     }
@@ -1632,14 +2852,17 @@ CfsMs::retryError( CfsLog::OpType type,
     }
     else if ( (httpError >= 500 && httpError <= 504) ||
               httpError == 429) {
-        /* overloaded server, or bad choice of server.  Must rebind */
+        /* overloaded server, or bad choice of server.  Must rebind.  The
+         * governor holds off our retry, along with everyone else's
+         * requests, so no sleep here.
+         */
         if (httpError == 429)
             _stats._busy429++;
         else
             _stats._overloaded5xx++;
         _stalledErrors |= 1;
-        reqp->resetConn();
-        sleep(8);
+        if (reqp)
+            reqp->resetConn();
         delete parsedNodep;
         *parsedNodepp = NULL;
         return 1;
@@ -1653,6 +2876,344 @@ CfsMs::retryError( CfsLog::OpType type,
     }
 }
 
+/* add itemp to the batch being formed, or start and lead a new one.
+ * Returns true once itemp's results are in, or false if the caller
+ * should send it alone.
+ */
+int
+CfsMsBatch::call(Item *itemp)
+{
+    dqueue<Item> items;
+    uint32_t itemBytes;
+    uint64_t startMs;
+    uint64_t lastMs;
+    uint64_t now;
+    Item *tp;
+
+    /* bytes once base64 encoded, plus the rest of the request */
+    itemBytes = (itemp->_body.length() + 2) / 3 * 4 + itemp->_url.length() + 128;
+    if (itemBytes > _maxBytes)
+        return 0;
+
+    itemp->_batched = 0;
+    itemp->_done = 0;
+
+    startMs = osp_time_ms();
+    _lock.take();
+    lastMs = _lastCallMs;
+    _lastCallMs = startMs;
+    if (_formingp) {
+        if ( _formingp->count() >= _maxItems ||
+             _formingBytes + itemBytes > _maxBytes) {
+            /* full, but its leader hasn't sent it yet */
+            _lock.release();
+            return 0;
+        }
+        _formingp->append(itemp);
+        _formingBytes += itemBytes;
+        if (_formingp->count() >= _maxItems)
+            _cv.broadcast();    /* wake the leader early */
+        _callers++;
+        while(!itemp->_done) {
+            _cv.wait();
+        }
+        _callers--;
+        _lock.release();
+        return itemp->_batched;
+    }
+
+    /* if nobody else is in here or has been lately, nobody's likely to
+     * join us, and lingering would just slow down a lone caller.
+     */
+    if (_callers == 0 && startMs - lastMs >= _companyMs) {
+        _lock.release();
+        return 0;
+    }
+
+    /* lead a new batch, giving others a moment to join */
+    _callers++;
+    _formingp = &items;
+    _formingBytes = itemBytes;
+    items.append(itemp);
+    while(items.count() < _maxItems) {
+        now = osp_time_ms();
+        if (now >= startMs + _lingerMs)
+            break;
+        _cv.timedWait(startMs + _lingerMs - now);
+    }
+    _formingp = NULL;
+    _lock.release();
+
+    /* a batch of one would just be a slower PUT */
+    if (items.count() > 1)
+        send(&items);
+
+    _lock.take();
+    for(tp = items.head(); tp; tp=tp->_dqNextp) {
+        tp->_done = 1;
+    }
+    _callers--;
+    _cv.broadcast();
+    _lock.release();
+
+    return itemp->_batched;
+}
+
+/* find a pair in a JSON struct without descending into its values */
+/* static */ Json::Node *
+CfsMsBatch::findMember(Json::Node *structp, const char *namep)
+{
+    Json::Node *tnodep;
+
+    for(tnodep = structp->_children.head(); tnodep; tnodep=tnodep->_dqNextp) {
+        if (tnodep->_isNamed && tnodep->_name == namep)
+            return tnodep->_children.head();
+    }
+    return NULL;
+}
+
+/* send a batch and distribute the per-item results; items without a
+ * result are left unbatched, for their callers to send alone.
+ */
+void
+CfsMsBatch::send(dqueue<Item> *itemsp)
+{
+    std::string postData;
+    std::string authHeader;
+    std::string result;
+    Item *itemArray[_maxItems];
+    uint32_t itemCount = 0;
+    XApi::ClientConn *connp;
+    XApi::ClientReq *reqp = NULL;
+    CThreadPipe *outPipep;
+    const char *tp;
+    char *encodedp;
+    char tbuffer[32];
+    Json json;
+    Json::Node *jnodep = NULL;
+    Json::Node *respp;
+    Json::Node *tnodep;
+    Json::Node *bodyp;
+    CfsRetryError retryState;
+    CfsStats *statsp = _cfsp->getStats();
+    Item *itemp;
+    uint32_t ix;
+    int32_t code;
+
+    /* item URLs are relative to the API version */
+    postData = "{\"requests\": [\n";
+    for(itemp = itemsp->head(); itemp; itemp=itemp->_dqNextp) {
+        snprintf(tbuffer, sizeof(tbuffer), "%d", (int) itemCount);
+        if (itemCount > 0)
+            postData += ",\n";
+        postData += "{\"id\": \"" + std::string(tbuffer) + "\", ";
+        postData += "\"method\": \"" + itemp->_method + "\", ";
+        postData += "\"url\": \"";
+        Json::Node::appendStr( &postData,
+                               (itemp->_url.compare(0, 5, "/v1.0") == 0?
+                                itemp->_url.substr(5) : itemp->_url));
+        postData += "\", ";
+        postData += "\"headers\": {\"Content-Type\": \"" + itemp->_contentType + "\"}, ";
+        postData += "\"body\": ";
+        if (itemp->_contentType == "application/json") {
+            postData += itemp->_body;
+        }
+        else {
+            encodedp = new char[(itemp->_body.length() + 2) / 3 * 4 + 1];
+            EVP_EncodeBlock( (unsigned char *) encodedp,
+                             (const unsigned char *) itemp->_body.data(),
+                             (int) itemp->_body.length());
+            postData += "\"";
+            postData += encodedp;
+            postData += "\"";
+            delete [] encodedp;
+        }
+        postData += "}";
+        itemArray[itemCount++] = itemp;
+    }
+    postData += "\n]}\n";
+
+    statsp->_batchCalls++;
+
+    while(1) {
+        CfsGovernor::Slot slot(&_cfsp->_governor);
+        statsp->_totalCalls++;
+        connp = _cfsp->_xapiPoolp->getConn(std::string("graph.microsoft.com"), 443, /* TLS */ 1);
+        reqp = new XApi::ClientReq();
+        reqp->setSendContentLength(postData.length());
+        authHeader = "Bearer " + _cfsp->_loginCookiep->getAuthToken();
+        reqp->addHeader("Authorization", authHeader.c_str());
+        reqp->addHeader("Content-Type", "application/json");
+        reqp->startCall( connp,
+                         "/v1.0/$batch",
+                         /* isPost */ XApi::reqPost);
+
+        outPipep = reqp->getOutgoingPipe();
+        outPipep->write(postData.c_str(), postData.length());
+        outPipep->eof();
+
+        code = reqp->waitForHeadersDone();
+        if (code != 0) {
+            delete reqp;
+            reqp = NULL;
+            if (_cfsp->retryRpcError(CfsLog::opMisc, code, &retryState))
+                continue;
+            break;
+        }
+
+        result.erase();
+        readWholePipe(reqp->getIncomingPipe(), &result);
+
+        tp = result.c_str();
+        slot.leave();
+        code = json.parseJsonChars((char **) &tp, &jnodep);
+        if (code != 0) {
+            printf("batch json parse failed code=%d\n", code);
+            break;
+        }
+
+        /* retry the batch as a whole for throttling and auth errors */
+        if (_cfsp->retryError(CfsLog::opMisc, reqp, &jnodep, &retryState)) {
+            delete reqp;
+            reqp = NULL;
+            continue;
+        }
+        code = retryState.getCode();
+        if (code != 0)
+            break;
+
+        /* responses come back in any order, tagged with our ids */
+        tnodep = jnodep->searchForChild("responses", 0);
+        if (!tnodep || !(tnodep = tnodep->_children.head()))
+            break;
+        for(respp = tnodep->_children.head(); respp; respp=respp->_dqNextp) {
+            if ( !(tnodep = findMember(respp, "id")) ||
+                 (ix = atoi(tnodep->_name.c_str())) >= itemCount)
+                continue;
+            itemp = itemArray[ix];
+            if (!(tnodep = findMember(respp, "status")))
+                continue;
+            itemp->_httpError = atoi(tnodep->_name.c_str());
+            if ( (tnodep = findMember(respp, "headers")) != NULL &&
+                 (tnodep = findMember(tnodep, "Retry-After")) != NULL)
+                itemp->_retryAfterMs = 1000 * strtoul(tnodep->_name.c_str(), NULL, 10);
+            bodyp = findMember(respp, "body");
+            if (bodyp) {
+                bodyp->detach();
+            }
+            else {
+                bodyp = new Json::Node();
+                bodyp->initStruct();
+            }
+            itemp->_responsep = bodyp;
+            itemp->_batched = 1;
+            statsp->_batchItems++;
+        }
+        break;
+    }
+
+    if (reqp)
+        delete reqp;
+
+    if (jnodep)
+        delete jnodep;
+}
+
+/* wait for room in the window, and for any Retry-After pause to end */
+void
+CfsGovernor::enter()
+{
+    uint64_t now;
+    int waited = 0;
+
+    _lock.take();
+    while(1) {
+        now = osp_time_ms();
+        if (now < _pauseUntilMs) {
+            waited = 1;
+            _cv.timedWait(_pauseUntilMs - now);
+            continue;
+        }
+        if (_inFlight >= (uint32_t) _window) {
+            waited = 1;
+            _cv.wait();
+            continue;
+        }
+        break;
+    }
+    _inFlight++;
+    if (_statsp) {
+        _statsp->_govInFlight = _inFlight;
+        if (waited)
+            _statsp->_govWaits++;
+    }
+    _lock.release();
+}
+
+void
+CfsGovernor::leave()
+{
+    _lock.take();
+    osp_assert(_inFlight > 0);
+    _inFlight--;
+    if (_statsp)
+        _statsp->_govInFlight = _inFlight;
+    _cv.broadcast();
+    _lock.release();
+}
+
+/* additive increase */
+void
+CfsGovernor::succeeded()
+{
+    _lock.take();
+    if (_window < _maxWindow) {
+        _window += 1.0 / _window;
+        if (_window > _maxWindow)
+            _window = _maxWindow;
+        if (_statsp)
+            _statsp->_govWindow = (uint32_t) _window;
+        _cv.broadcast();
+    }
+    _lock.release();
+}
+
+/* multiplicative decrease, and a pause for everyone; a burst of
+ * throttles from one overload only halves the window once.
+ */
+void
+CfsGovernor::throttled(uint32_t retryAfterMs)
+{
+    uint64_t now;
+
+    if (retryAfterMs == 0)
+        retryAfterMs = _defaultPauseMs;
+    else if (retryAfterMs > _maxPauseMs)
+        retryAfterMs = _maxPauseMs;
+
+    _lock.take();
+    now = osp_time_ms();
+    if (_statsp)
+        _statsp->_throttleEvents++;
+    if (now >= _lastDecreaseMs + _decreaseMs) {
+        _lastDecreaseMs = now;
+        _window = _window / 2;
+        if (_window < _minWindow)
+            _window = _minWindow;
+        if (_statsp) {
+            _statsp->_govWindow = (uint32_t) _window;
+            _statsp->_windowDecreases++;
+        }
+    }
+    if (now + retryAfterMs > _pauseUntilMs) {
+        if (_statsp)
+            _statsp->_retryAfterMs += ( now + retryAfterMs -
+                                        (_pauseUntilMs > now? _pauseUntilMs : now));
+        _pauseUntilMs = now + retryAfterMs;
+    }
+    _lock.release();
+}
+
 /* return false if this character isn't legal at the start of a file name, even if it
  * is legal in other places in a file name.
  */
@@ -145,16 +145,19 @@ HomeScreen::runTests(SApiLoginCookie *loginCookiep)
 	printf("test sending data\n");
 	TestDataSource testSource("This is some test data\n");
         CAttr attrs;
-        uint32_t sentBytes;
+        uint64_t nextOffset;
+        char dataBuffer[100];
 
         testSource.getAttr(&attrs);
+        testSource.read(0, attrs._length, dataBuffer);
 
-	code = rootp->sendData( &uploadUrl,
-				&testSource,
+	code = rootp->sendData( std::string("testfile"),
+				&uploadUrl,
+				dataBuffer,
 				attrs._length,
 				0,
 				attrs._length,
-                                &sentBytes);
+                                &nextOffset);
 	printf("test send code=%d\n", code);
 
 #if 0
@@ -0,0 +1,539 @@
+/*
+
+Copyright 2016-2020 Cazamar Systems
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be
+included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <poll.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include "fswatch.h"
+
+#ifdef __linux__
+static const uint32_t fsWatchMask = ( IN_CREATE | IN_CLOSE_WRITE | IN_ATTRIB |
+                                      IN_MOVED_TO | IN_MOVED_FROM |
+                                      IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK);
+#endif
+
+/* FNV-1a, as in Cfs::fnvHash64, which we can't link against here */
+/* static */ uint64_t
+FsWatcher::hashPath(const char *pathp, size_t length)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    size_t i;
+
+    for(i=0;i<length;i++) {
+        hash ^= (uint8_t) pathp[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+FsWatcher::~FsWatcher()
+{
+    uint32_t i;
+    Watch *watchp;
+    Watch *nextp;
+
+    shutdown();
+
+    clearChangesNL();
+    delete [] _changeHashp;
+
+    for(i=0;i<_watchHashSize;i++) {
+        for(watchp = _watchHashp[i]; watchp; watchp = nextp) {
+            nextp = watchp->_nextHashp;
+            delete watchp;
+        }
+    }
+    delete [] _watchHashp;
+}
+
+int32_t
+FsWatcher::start()
+{
+#ifdef __linux__
+    CThreadHandle *hp;
+
+    _fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (_fd >= 0) {
+        hp = new CThreadHandle();
+        hp->init((CThread::StartMethod) &FsWatcher::watchThread, this, NULL);
+        return 0;
+    }
+    printf("fswatch: inotify_init failed errno=%d, using full walks\n", errno);
+#endif
+
+    _failed = 1;
+    _exited = 1;
+    return -1;
+}
+
+/* stop the thread, and wait for it to close the inotify fd */
+void
+FsWatcher::shutdown()
+{
+    _lock.take();
+    _shutdown = 1;
+    while(!_exited) {
+        _cv.wait();
+    }
+    _lock.release();
+}
+
+/* called with _lock held */
+void
+FsWatcher::clearChangesNL()
+{
+    freeChanges(&_changes);
+    memset(_changeHashp, 0, _changeHashSize * sizeof(Change *));
+    _changeCount = 0;
+}
+
+/* hand the journal to the caller for an incremental pass and return
+ * 0, or return -1 if the pass has to walk everything.  Entries under
+ * a subtree entry are left out, since walking the subtree covers them.
+ */
+int32_t
+FsWatcher::takeChanges(dqueue<Change> *changesp, int forceFull)
+{
+    Change *changep;
+
+    _lock.take();
+    if ( forceFull || _failed || !_ready || _lost || !_complete || _passPending) {
+        clearChangesNL();
+        _fullPass = 1;
+        _fullReady = (_ready && !_failed);
+        _lost = 0;
+        _complete = 0;
+        _passPending = 1;
+        _lock.release();
+        return -1;
+    }
+
+    for(changep = _changes.head(); changep; changep = changep->_dqNextp) {
+        if (coveredNL(changep))
+            changep->_hash = 0;     /* mark for deletion */
+    }
+    while((changep = _changes.pop()) != NULL) {
+        if (changep->_hash == 0)
+            delete changep;
+        else
+            changesp->append(changep);
+    }
+    memset(_changeHashp, 0, _changeHashSize * sizeof(Change *));
+    _changeCount = 0;
+
+    _fullPass = 0;
+    _passPending = 1;
+    _lock.release();
+    return 0;
+}
+
+/* a pass started by takeChanges has ended; the journal is complete
+ * if every file got uploaded and, for a full pass, nothing was lost
+ * since it started.
+ */
+void
+FsWatcher::passDone(int finished)
+{
+    _lock.take();
+    if (_passPending) {
+        if (!finished)
+            _complete = 0;
+        else if (_fullPass)
+            _complete = (_fullReady && !_lost && !_failed);
+        _passPending = 0;
+    }
+    _lock.release();
+}
+
+/* called with _lock held */
+FsWatcher::Change *
+FsWatcher::findChangeNL(const char *pathp, size_t length, uint64_t hash)
+{
+    Change *changep;
+
+    for(changep = _changeHashp[hash & (_changeHashSize-1)]; changep; changep = changep->_nextHashp) {
+        if ( changep->_hash == hash &&
+             changep->_relPath.length() == length &&
+             memcmp(changep->_relPath.data(), pathp, length) == 0)
+            return changep;
+    }
+    return NULL;
+}
+
+/* return true if one of changep's ancestors is a subtree entry; called
+ * with _lock held.
+ */
+int
+FsWatcher::coveredNL(Change *changep)
+{
+    const char *pathp = changep->_relPath.data();
+    size_t length = changep->_relPath.length();
+    Change *parentp;
+
+    while(length > 0) {
+        /* strip the last component */
+        while(length > 0 && pathp[length-1] != '/')
+            length--;
+        if (length <= 1)
+            break;
+        length--;
+
+        parentp = findChangeNL(pathp, length, hashPath(pathp, length));
+        if (parentp && parentp->_subtree)
+            return 1;
+    }
+    return 0;
+}
+
+/* called with _lock held */
+void
+FsWatcher::recordNL(std::string *relPathp, int subtree)
+{
+    Change *changep;
+    Change *tp;
+    Change *nextp;
+    Change **newHashp;
+    uint32_t newSize;
+    uint32_t i;
+    uint64_t hash;
+
+    hash = hashPath(relPathp->data(), relPathp->length());
+    if (hash == 0)
+        hash = 1;       /* 0 marks covered entries in takeChanges */
+
+    changep = findChangeNL(relPathp->data(), relPathp->length(), hash);
+    if (changep) {
+        if (subtree)
+            changep->_subtree = 1;
+        return;
+    }
+
+    changep = new Change();
+    changep->_relPath = *relPathp;
+    changep->_hash = hash;
+    changep->_subtree = (subtree? 1 : 0);
+    _changes.append(changep);
+
+    if (_changeCount >= 2 * _changeHashSize) {
+        newSize = _changeHashSize * 4;
+        newHashp = new Change *[newSize];
+        memset(newHashp, 0, newSize * sizeof(Change *));
+        for(i=0;i<_changeHashSize;i++) {
+            for(tp = _changeHashp[i]; tp; tp = nextp) {
+                nextp = tp->_nextHashp;
+                tp->_nextHashp = newHashp[tp->_hash & (newSize-1)];
+                newHashp[tp->_hash & (newSize-1)] = tp;
+            }
+        }
+        delete [] _changeHashp;
+        _changeHashp = newHashp;
+        _changeHashSize = newSize;
+    }
+
+    changep->_nextHashp = _changeHashp[hash & (_changeHashSize-1)];
+    _changeHashp[hash & (_changeHashSize-1)] = changep;
+    _changeCount++;
+}
+
+/* we missed some events, so the next pass has to walk everything */
+void
+FsWatcher::loseEvents(const char *whyp)
+{
+    printf("fswatch: %s under %s, next pass walks everything\n", whyp, _root.c_str());
+    _lock.take();
+    _lost = 1;
+    _complete = 0;
+    _overflowCount++;
+    clearChangesNL();
+    _lock.release();
+}
+
+FsWatcher::Watch *
+FsWatcher::findWatch(int wd)
+{
+    Watch *watchp;
+
+    for(watchp = _watchHashp[(uint32_t) wd & (_watchHashSize-1)]; watchp; watchp = watchp->_nextHashp) {
+        if (watchp->_wd == wd)
+            return watchp;
+    }
+    return NULL;
+}
+
+void
+FsWatcher::hashWatch(Watch *watchp)
+{
+    Watch **newHashp;
+    Watch *tp;
+    Watch *nextp;
+    uint32_t newSize;
+    uint32_t i;
+
+    if (_watchCount >= 2 * _watchHashSize) {
+        newSize = _watchHashSize * 4;
+        newHashp = new Watch *[newSize];
+        memset(newHashp, 0, newSize * sizeof(Watch *));
+        for(i=0;i<_watchHashSize;i++) {
+            for(tp = _watchHashp[i]; tp; tp = nextp) {
+                nextp = tp->_nextHashp;
+                tp->_nextHashp = newHashp[(uint32_t) tp->_wd & (newSize-1)];
+                newHashp[(uint32_t) tp->_wd & (newSize-1)] = tp;
+            }
+        }
+        delete [] _watchHashp;
+        _watchHashp = newHashp;
+        _watchHashSize = newSize;
+    }
+
+    i = (uint32_t) watchp->_wd & (_watchHashSize-1);
+    watchp->_nextHashp = _watchHashp[i];
+    _watchHashp[i] = watchp;
+    _watchCount++;
+}
+
+void
+FsWatcher::unhashWatch(Watch *watchp)
+{
+    Watch **lpp;
+    Watch *tp;
+
+    for( lpp = &_watchHashp[(uint32_t) watchp->_wd & (_watchHashSize-1)];
+         (tp = *lpp) != NULL;
+         lpp = &tp->_nextHashp) {
+        if (tp == watchp) {
+            *lpp = tp->_nextHashp;
+            _watchCount--;
+            return;
+        }
+    }
+    osp_assert(0);
+}
+
+/* watch the directory at relPathp and everything under it; returns
+ * -1 only if we've had to give up watching.
+ */
+int32_t
+FsWatcher::addWatches(std::string *relPathp)
+{
+#ifdef __linux__
+    int wd;
+    Watch *watchp;
+    std::string path;
+    std::string childPath;
+    DIR *dirp;
+    struct dirent *entryp;
+    struct stat tstat;
+    int isDir;
+
+    path = _root + *relPathp;
+    wd = inotify_add_watch(_fd, path.c_str(), fsWatchMask);
+    if (wd < 0) {
+        if (errno == ENOSPC || errno == ENOMEM) {
+            printf("fswatch: out of inotify watches at %s, using full walks\n", path.c_str());
+            _lock.take();
+            _failed = 1;
+            _complete = 0;
+            _lock.release();
+            return -1;
+        }
+        /* probably deleted or replaced by a file already */
+        return 0;
+    }
+
+    watchp = findWatch(wd);
+    if (watchp) {
+        /* same directory under a new name */
+        watchp->_relPath = *relPathp;
+    }
+    else {
+        watchp = new Watch();
+        watchp->_wd = wd;
+        watchp->_relPath = *relPathp;
+        hashWatch(watchp);
+    }
+
+    dirp = opendir(path.c_str());
+    if (!dirp)
+        return 0;
+    while((entryp = readdir(dirp)) != NULL) {
+        if ( strcmp(entryp->d_name, ".") == 0 ||
+             strcmp(entryp->d_name, "..") == 0)
+            continue;
+        if (entryp->d_type == DT_UNKNOWN) {
+            childPath = path + "/" + entryp->d_name;
+            isDir = (lstat(childPath.c_str(), &tstat) == 0 && S_ISDIR(tstat.st_mode));
+        }
+        else
+            isDir = (entryp->d_type == DT_DIR);
+        if (!isDir)
+            continue;
+
+        childPath = *relPathp + "/" + entryp->d_name;
+        if (addWatches(&childPath) < 0) {
+            closedir(dirp);
+            return -1;
+        }
+    }
+    closedir(dirp);
+#endif
+    return 0;
+}
+
+/* stop watching relPathp and everything under it, since it's been
+ * renamed out from under us.
+ */
+void
+FsWatcher::removeWatches(std::string *relPathp)
+{
+#ifdef __linux__
+    uint32_t i;
+    Watch *watchp;
+    Watch *nextp;
+    size_t length = relPathp->length();
+
+    for(i=0;i<_watchHashSize;i++) {
+        for(watchp = _watchHashp[i]; watchp; watchp = nextp) {
+            nextp = watchp->_nextHashp;
+            if ( watchp->_relPath.compare(0, length, *relPathp) == 0 &&
+                 ( watchp->_relPath.length() == length ||
+                   watchp->_relPath[length] == '/')) {
+                inotify_rm_watch(_fd, watchp->_wd);
+                unhashWatch(watchp);
+                delete watchp;
+            }
+        }
+    }
+#endif
+}
+
+void
+FsWatcher::handleEvents(char *bufferp, long count)
+{
+#ifdef __linux__
+    struct inotify_event *eventp;
+    long offset;
+    Watch *watchp;
+    std::string relPath;
+
+    for(offset = 0; offset < count; offset += sizeof(struct inotify_event) + eventp->len) {
+        eventp = (struct inotify_event *) (bufferp + offset);
+        _eventCount++;
+
+        if (eventp->mask & IN_Q_OVERFLOW) {
+            loseEvents("inotify queue overflow");
+            continue;
+        }
+
+        watchp = findWatch(eventp->wd);
+        if (!watchp)
+            continue;
+
+        if (eventp->mask & IN_IGNORED) {
+            /* the directory is gone */
+            unhashWatch(watchp);
+            delete watchp;
+            continue;
+        }
+
+        relPath = watchp->_relPath;
+        if (eventp->len > 0) {
+            relPath += "/";
+            relPath += eventp->name;
+        }
+        if (relPath.empty())
+            continue;   /* the root itself */
+
+        if (eventp->mask & IN_ISDIR) {
+            if (eventp->mask & (IN_CREATE | IN_MOVED_TO)) {
+                addWatches(&relPath);
+                _lock.take();
+                recordNL(&relPath, /* subtree */ 1);
+                _lock.release();
+            }
+            else if (eventp->mask & IN_MOVED_FROM) {
+                removeWatches(&relPath);
+            }
+            else {
+                _lock.take();
+                recordNL(&relPath, 0);
+                _lock.release();
+            }
+        }
+        else if (!(eventp->mask & IN_MOVED_FROM)) {
+            _lock.take();
+            recordNL(&relPath, 0);
+            _lock.release();
+        }
+    }
+#endif
+}
+
+void
+FsWatcher::watchThread(void *contextp)
+{
+#ifdef __linux__
+    std::string relPath;
+    char tbuffer[65536] __attribute__((aligned(8)));
+    struct pollfd pfd;
+    long count;
+    int32_t code;
+
+    code = addWatches(&relPath);
+    _lock.take();
+    if (code == 0)
+        _ready = 1;
+    _lock.release();
+    printf("fswatch: watching %d dirs under %s\n", _watchCount, _root.c_str());
+
+    while(!_shutdown && !_failed) {
+        pfd.fd = _fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        code = poll(&pfd, 1, 1000);
+        if (code <= 0)
+            continue;
+
+        while((count = read(_fd, tbuffer, sizeof(tbuffer))) > 0) {
+            handleEvents(tbuffer, count);
+        }
+    }
+
+    close(_fd);
+    _fd = -1;
+#endif
+
+    _lock.take();
+    _exited = 1;
+    _cv.broadcast();
+    _lock.release();
+}
@@ -0,0 +1,257 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include "fswatch.h"
+
+/* events show up asynchronously, so give the watcher a moment */
+static void
+settle()
+{
+    usleep(300000);
+}
+
+static void
+makeFile(std::string path)
+{
+    int fd;
+
+    fd = open(path.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    if (fd >= 0) {
+        write(fd, "data\n", 5);
+        close(fd);
+    }
+}
+
+/* run a full pass the way UploadApp does, until the watcher says its
+ * journal is complete; returns non-zero if it never is.
+ */
+static int32_t
+fullPass(FsWatcher *watcherp)
+{
+    dqueue<FsWatcher::Change> changes;
+    int i;
+
+    for(i=0;i<50;i++) {
+        if (watcherp->takeChanges(&changes) == 0)
+            FsWatcher::freeChanges(&changes);
+        watcherp->passDone(1);
+        if (watcherp->isComplete())
+            return 0;
+        settle();
+    }
+    return -1;
+}
+
+static FsWatcher::Change *
+findChange(dqueue<FsWatcher::Change> *changesp, const char *relPathp)
+{
+    FsWatcher::Change *changep;
+
+    for(changep = changesp->head(); changep; changep = changep->_dqNextp) {
+        if (changep->_relPath == relPathp)
+            return changep;
+    }
+    return NULL;
+}
+
+static void
+printChanges(dqueue<FsWatcher::Change> *changesp)
+{
+    FsWatcher::Change *changep;
+
+    for(changep = changesp->head(); changep; changep = changep->_dqNextp) {
+        printf("  %s%s\n", changep->_relPath.c_str(), (changep->_subtree? " (subtree)" : ""));
+    }
+}
+
+/* check that relPathp is in the change set, with the right subtree flag */
+static int32_t
+expect(dqueue<FsWatcher::Change> *changesp, const char *relPathp, int subtree)
+{
+    FsWatcher::Change *changep;
+
+    changep = findChange(changesp, relPathp);
+    if (!changep) {
+        printf("FAILED: no change for %s\n", relPathp);
+        return -1;
+    }
+    if (changep->_subtree != subtree) {
+        printf("FAILED: %s has subtree=%d, wanted %d\n", relPathp, changep->_subtree, subtree);
+        return -1;
+    }
+    return 0;
+}
+
+static int32_t
+expectNone(dqueue<FsWatcher::Change> *changesp, const char *relPathp)
+{
+    if (findChange(changesp, relPathp)) {
+        printf("FAILED: unexpected change for %s\n", relPathp);
+        return -1;
+    }
+    return 0;
+}
+
+/* take the journal for an incremental pass; fails if the watcher
+ * wants a full walk instead.
+ */
+static int32_t
+takeIncremental(FsWatcher *watcherp, dqueue<FsWatcher::Change> *changesp, const char *whatp)
+{
+    if (watcherp->takeChanges(changesp) != 0) {
+        printf("FAILED: %s: watcher wants a full walk\n", whatp);
+        return -1;
+    }
+    printf("%s: %ld changes\n", whatp, (long) changesp->count());
+    printChanges(changesp);
+    return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+#ifdef __linux__
+    FsWatcher *watcherp;
+    dqueue<FsWatcher::Change> changes;
+    char tbuffer[1024];
+    struct inotify_event event;
+    std::string root;
+    int32_t code = 0;
+
+    if (argc > 1) {
+        root = std::string(argv[1]);
+    }
+    else {
+        strcpy(tbuffer, "/tmp/fswatchtestXXXXXX");
+        if (!mkdtemp(tbuffer)) {
+            printf("usage: fswatchtest [empty dir]\n");
+            return -1;
+        }
+        root = std::string(tbuffer);
+    }
+    printf("Testing under %s\n", root.c_str());
+
+    mkdir((root + "/a").c_str(), 0755);
+    makeFile(root + "/a/old");
+
+    watcherp = new FsWatcher(root);
+    watcherp->start();
+    if (fullPass(watcherp) != 0) {
+        printf("FAILED: watcher never became complete\n");
+        return -1;
+    }
+
+    /* new files, a renamed file and a new directory with contents */
+    makeFile(root + "/a/f1");
+    rename((root + "/a/f1").c_str(), (root + "/a/f2").c_str());
+    mkdir((root + "/d").c_str(), 0755);
+    makeFile(root + "/d/x");
+    settle();
+
+    if (takeIncremental(watcherp, &changes, "create and rename") != 0)
+        return -1;
+    code |= expect(&changes, "/a/f2", 0);
+    code |= expect(&changes, "/d", 1);
+    code |= expectNone(&changes, "/d/x");       /* covered by /d */
+    code |= expectNone(&changes, "/a");
+    code |= expectNone(&changes, "/a/old");
+    FsWatcher::freeChanges(&changes);
+    watcherp->passDone(1);
+
+    /* a directory's attributes changing doesn't mean its contents did */
+    chmod((root + "/a").c_str(), 0700);
+    settle();
+
+    if (takeIncremental(watcherp, &changes, "dir attributes") != 0)
+        return -1;
+    code |= expect(&changes, "/a", 0);
+    FsWatcher::freeChanges(&changes);
+    watcherp->passDone(1);
+
+    /* a renamed directory has to be walked under its new name, and
+     * we should still see changes in it.
+     */
+    rename((root + "/a").c_str(), (root + "/b").c_str());
+    settle();
+    makeFile(root + "/b/g");
+    makeFile(root + "/d/y");
+    settle();
+
+    if (takeIncremental(watcherp, &changes, "dir rename") != 0)
+        return -1;
+    code |= expect(&changes, "/b", 1);
+    code |= expectNone(&changes, "/b/g");       /* covered by /b */
+    code |= expect(&changes, "/d/y", 0);
+    FsWatcher::freeChanges(&changes);
+    watcherp->passDone(1);
+
+    /* an unfinished pass means the next one walks everything */
+    makeFile(root + "/d/z");
+    settle();
+    if (takeIncremental(watcherp, &changes, "unfinished pass") != 0)
+        return -1;
+    FsWatcher::freeChanges(&changes);
+    watcherp->passDone(0);
+    if (watcherp->takeChanges(&changes) == 0) {
+        printf("FAILED: incremental pass after an unfinished one\n");
+        code = -1;
+    }
+    watcherp->passDone(1);
+
+    /* lost events mean the next pass walks everything, and the one
+     * after that can be incremental again.
+     */
+    memset(&event, 0, sizeof(event));
+    event.wd = -1;
+    event.mask = IN_Q_OVERFLOW;
+    watcherp->injectEvents((char *) &event, sizeof(event));
+    if (watcherp->getOverflowCount() != 1) {
+        printf("FAILED: overflow count %ld\n", (long) watcherp->getOverflowCount());
+        code = -1;
+    }
+    if (watcherp->takeChanges(&changes) == 0) {
+        printf("FAILED: incremental pass after an overflow\n");
+        code = -1;
+    }
+    watcherp->passDone(1);
+    if (!watcherp->isComplete()) {
+        printf("FAILED: not complete after a full pass\n");
+        code = -1;
+    }
+
+    makeFile(root + "/b/h");
+    settle();
+    if (takeIncremental(watcherp, &changes, "after overflow") != 0)
+        return -1;
+    code |= expect(&changes, "/b/h", 0);
+    FsWatcher::freeChanges(&changes);
+    watcherp->passDone(1);
+
+    printf("%lu events, %u dirs watched\n",
+           (unsigned long) watcherp->getEventCount(), watcherp->getWatchCount());
+    delete watcherp;
+
+    if (argc <= 1) {
+        /* we made the directory, so clean it up */
+        root = "rm -rf " + root;
+        system(root.c_str());
+    }
+
+    if (code != 0) {
+        printf("fswatchtest FAILED\n");
+        return -1;
+    }
+    printf("fswatchtest passed\n");
+    return 0;
+#else
+    printf("fswatchtest: inotify is only on Linux\n");
+    return 0;
+#endif
+}
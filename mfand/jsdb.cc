@@ -1,11 +1,19 @@
 #include <string>
 #include <sys/errno.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <math.h>
+#include <pthread.h>
 
 #include "jsdb.h"
 #include "json.h"
 
-/* XXX Note that error recovery is not implemented, beyond aborting on the first failed
- * create call.
+/* Transactions aren't isolated from each other beyond holding
+ * _tranMutex; abort undoes a transaction's creates, and so does a
+ * commit whose log write fails.  Everything readers look at is read
+ * and written with __atomic operations; the writer's own fields, like
+ * Entry::_recordp, are protected by _tranMutex.
  */
 
 JsdbInStream::JsdbInStream(FILE *filep)
@@ -39,11 +47,728 @@ JsdbInStream::next()
     fillBuffer();
 }
 
+/* static */ uint32_t
+Jsdb::hashKey(std::string *keyp)
+{
+    const uint8_t *tp;
+    uint32_t len;
+    uint32_t hash;
+
+    tp = (const uint8_t *) keyp->c_str();
+    len = (uint32_t) keyp->length();
+    hash = 2166136261U;
+    while(len-- > 0) {
+        hash ^= *tp++;
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+/* get a record's primary key; returns 0 if it doesn't have one */
+int
+Jsdb::getKey(Json::Node *recordp, std::string *keyp)
+{
+    Json::Node *nodep;
+
+    for( nodep = recordp->_children.head();
+         nodep;
+         nodep = nodep->_dqNextp) {
+        if (nodep->_name == _primaryKeyName && nodep->_children.head()) {
+            *keyp = nodep->_children.head()->_name;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* static */ Jsdb::Table *
+Jsdb::newTable(uint32_t size, uint8_t link)
+{
+    Table *tablep;
+
+    tablep = new Table();
+    tablep->_size = size;
+    tablep->_link = link;
+    tablep->_bucketsp = new Entry *[size];
+    memset(tablep->_bucketsp, 0, size * sizeof(Entry *));
+    return tablep;
+}
+
+Jsdb::Entry *
+Jsdb::findEntry(std::string *keyp, uint32_t hash)
+{
+    Table *tablep = _tablep;
+    Entry *entryp;
+
+    for( entryp = tablep->_bucketsp[hash % tablep->_size];
+         entryp;
+         entryp = entryp->_nextHashp[tablep->_link]) {
+        if (entryp->_hash == hash && entryp->_key == *keyp)
+            return entryp;
+    }
+    return NULL;
+}
+
+/* build a bigger table with the other hash link, so readers can keep
+ * walking the old one.  The link is free only once no reader can be
+ * walking the table from the last time it grew; if one still might
+ * be, we don't wait for it, but live with longer chains until a later
+ * insert tries again.
+ */
+void
+Jsdb::growHash()
+{
+    Table *oldTablep;
+    Table *tablep;
+    Entry *entryp;
+    uint32_t size;
+    uint32_t i;
+    uint32_t ix;
+    uint8_t link;
+
+    if (_tableRetired) {
+        reclaim();
+        if (_tableRetired)
+            return;
+    }
+
+    /* we may have skipped growing for a while */
+    oldTablep = _tablep;
+    size = oldTablep->_size * 4;
+    while(size <= _entryCount)
+        size *= 4;
+    link = oldTablep->_link ^ 1;
+    tablep = newTable(size, link);
+    for(i=0;i<oldTablep->_size;i++) {
+        for( entryp = oldTablep->_bucketsp[i];
+             entryp;
+             entryp = entryp->_nextHashp[oldTablep->_link]) {
+            ix = entryp->_hash % tablep->_size;
+            entryp->_nextHashp[link] = tablep->_bucketsp[ix];
+            tablep->_bucketsp[ix] = entryp;
+        }
+    }
+    __atomic_store_n(&_tablep, tablep, __ATOMIC_RELEASE);
+
+    _tableRetired = 1;
+    retire(NULL, NULL, NULL, oldTablep);
+    publish(_commitSeq + 1);
+}
+
+/* add an entry, with no versions, so readers don't see it yet */
+Jsdb::Entry *
+Jsdb::addEntry(std::string *keyp, uint32_t hash, Json::Node *recordp)
+{
+    Table *tablep;
+    Entry *entryp;
+    uint32_t ix;
+
+    if (_entryCount >= _tablep->_size)
+        growHash();
+    tablep = _tablep;
+
+    entryp = new Entry();
+    entryp->_key = *keyp;
+    entryp->_hash = hash;
+    entryp->_recordp = recordp;
+    entryp->_versionsp = NULL;
+    entryp->_indexEntriesp = NULL;
+    ix = hash % tablep->_size;
+    entryp->_nextHashp[tablep->_link] = tablep->_bucketsp[ix];
+    __atomic_store_n(&tablep->_bucketsp[ix], entryp, __ATOMIC_RELEASE);
+    _entryCount++;
+
+    return entryp;
+}
+
+/* unlink an entry whose versions are all gone */
+void
+Jsdb::removeEntry(Entry *entryp)
+{
+    Table *tablep = _tablep;
+    Entry **entrypp;
+
+    for( entrypp = &tablep->_bucketsp[entryp->_hash % tablep->_size];
+         *entrypp != entryp;
+         entrypp = &(*entrypp)->_nextHashp[tablep->_link])
+        ;
+    __atomic_store_n(entrypp, entryp->_nextHashp[tablep->_link], __ATOMIC_RELEASE);
+    _entryCount--;
+    unindexEntry(entryp);
+    retire(NULL, NULL, entryp, NULL);
+}
+
+void
+Jsdb::addVersion(Entry *entryp, Json::Node *recordp, uint64_t seq)
+{
+    Version *versionp;
+
+    versionp = new Version();
+    versionp->_recordp = recordp;
+    versionp->_seq = seq;
+    versionp->_olderp = entryp->_versionsp;
+    __atomic_store_n(&entryp->_versionsp, versionp, __ATOMIC_RELEASE);
+}
+
+/* queue something that's been unlinked to be freed once readers are
+ * done with it.  It's stamped with the next sequence number, which
+ * the caller must publish; readers that start after that can't reach
+ * it.
+ */
+void
+Jsdb::retire(Version *versionp, Version *newerp, Entry *entryp, Table *tablep)
+{
+    Retired *retiredp;
+
+    retiredp = new Retired();
+    retiredp->_seq = _commitSeq + 1;
+    retiredp->_versionp = versionp;
+    retiredp->_newerp = newerp;
+    retiredp->_entryp = entryp;
+    retiredp->_tablep = tablep;
+    _retired.append(retiredp);
+}
+
+/* let new readers see everything up to seq, and free whatever no
+ * reader can reach any more.
+ */
+void
+Jsdb::publish(uint64_t seq)
+{
+    __atomic_store_n(&_commitSeq, seq, __ATOMIC_SEQ_CST);
+    reclaim();
+}
+
+void
+Jsdb::reclaim()
+{
+    Retired *retiredp;
+    uint64_t minSeq;
+    uint64_t seq;
+    uint32_t i;
+
+    minSeq = _idleSlot;
+    for(i=0;i<_maxReaders;i++) {
+        seq = __atomic_load_n(&_readers[i]._seq, __ATOMIC_SEQ_CST);
+        if (seq < minSeq)
+            minSeq = seq;
+    }
+
+    /* stamps only grow, so we can stop at the first one still needed */
+    while((retiredp = _retired.head()) != NULL && retiredp->_seq <= minSeq) {
+        _retired.remove(retiredp);
+        if (retiredp->_versionp) {
+            if (retiredp->_newerp)
+                __atomic_store_n(&retiredp->_newerp->_olderp, (Version *) NULL, __ATOMIC_RELEASE);
+            delete retiredp->_versionp->_recordp;
+            delete retiredp->_versionp;
+        }
+        if (retiredp->_entryp)
+            delete retiredp->_entryp;
+        if (retiredp->_tablep) {
+            delete [] retiredp->_tablep->_bucketsp;
+            delete retiredp->_tablep;
+            _tableRetired = 0;
+        }
+        delete retiredp;
+    }
+}
+
+Jsdb::Index *
+Jsdb::findIndex(const char *namep)
+{
+    Index *indexp;
+
+    for(indexp = _indexes.head(); indexp; indexp = indexp->_dqNextp) {
+        if (indexp->_name == namep)
+            return indexp;
+    }
+    return NULL;
+}
+
+/* get the value of a record's indexed field; returns 0 if it doesn't
+ * have one.
+ */
+/* static */ int
+Jsdb::getValue(Index *indexp, Json::Node *recordp, std::string *valuep)
+{
+    Json::Node *nodep;
+    Json::Node *pairp;
+    uint32_t i;
+
+    nodep = recordp;
+    for(i=0;i<indexp->_pathCount;i++) {
+        for( pairp = nodep->_children.head();
+             pairp;
+             pairp = pairp->_dqNextp) {
+            if (!pairp->_isLeaf && pairp->_name == indexp->_pathp[i])
+                break;
+        }
+        if (!pairp || !(nodep = pairp->_children.head()))
+            return 0;
+    }
+
+    if (!nodep->_isLeaf)
+        return 0;
+    *valuep = nodep->_name;
+    return 1;
+}
+
+/* static */ void
+Jsdb::setNumber(IndexEntry *ientryp)
+{
+    const char *tp;
+    char *endp;
+
+    tp = ientryp->_value.c_str();
+    ientryp->_number = strtod(tp, &endp);
+    ientryp->_isNumber = (*tp != 0 && *endp == 0 && isfinite(ientryp->_number));
+}
+
+/* compare two values in an ordered index: numbers, in numeric order,
+ * and then everything else, in byte order.
+ */
+/* static */ int
+Jsdb::compareValues(IndexEntry *ap, IndexEntry *bp)
+{
+    if (ap->_isNumber && bp->_isNumber) {
+        if (ap->_number < bp->_number)
+            return -1;
+        else if (ap->_number > bp->_number)
+            return 1;
+        else
+            return 0;
+    }
+    else if (ap->_isNumber)
+        return -1;
+    else if (bp->_isNumber)
+        return 1;
+    else
+        return ap->_value.compare(bp->_value);
+}
+
+/* qsort comparison, by value and then primary key */
+/* static */ int
+Jsdb::compareEntries(const void *ap, const void *bp)
+{
+    IndexEntry *aep = *(IndexEntry **) ap;
+    IndexEntry *bep = *(IndexEntry **) bp;
+    int code;
+
+    code = compareValues(aep, bep);
+    if (code == 0)
+        code = aep->_entryp->_key.compare(bep->_entryp->_key);
+    return code;
+}
+
+void
+Jsdb::sortIndex(Index *indexp)
+{
+    if (indexp->_sorted)
+        return;
+    qsort(indexp->_sortedp, indexp->_count, sizeof(IndexEntry *), compareEntries);
+    indexp->_sorted = 1;
+}
+
+/* find the first position in a sorted index at or after probep, by
+ * value alone or, with withKey, by value and then primary key.
+ */
+uint32_t
+Jsdb::lowerBound(Index *indexp, IndexEntry *probep, int withKey)
+{
+    uint32_t low;
+    uint32_t high;
+    uint32_t mid;
+    int code;
+
+    low = 0;
+    high = indexp->_count;
+    while(low < high) {
+        mid = low + (high - low) / 2;
+        if (withKey)
+            code = compareEntries(&indexp->_sortedp[mid], &probep);
+        else
+            code = compareValues(indexp->_sortedp[mid], probep);
+        if (code < 0)
+            low = mid+1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+/* put an index entry at the head of a hash chain */
+/* static */ void
+Jsdb::linkIndexHash(IndexEntry **headpp, IndexEntry *ientryp)
+{
+    ientryp->_nextHashp = *headpp;
+    if (*headpp)
+        (*headpp)->_prevHashpp = &ientryp->_nextHashp;
+    ientryp->_prevHashpp = headpp;
+    *headpp = ientryp;
+}
+
+/* static */ void
+Jsdb::growIndexHash(Index *indexp)
+{
+    IndexEntry **oldHashp;
+    uint32_t oldSize;
+    IndexEntry *ientryp;
+    IndexEntry *nientryp;
+    uint32_t i;
+    uint32_t ix;
+
+    oldHashp = indexp->_hashp;
+    oldSize = indexp->_hashSize;
+    indexp->_hashSize = oldSize * 4;
+    indexp->_hashp = new IndexEntry *[indexp->_hashSize];
+    memset(indexp->_hashp, 0, indexp->_hashSize * sizeof(IndexEntry *));
+    for(i=0;i<oldSize;i++) {
+        for(ientryp = oldHashp[i]; ientryp; ientryp = nientryp) {
+            nientryp = ientryp->_nextHashp;
+            ix = ientryp->_hash % indexp->_hashSize;
+            linkIndexHash(&indexp->_hashp[ix], ientryp);
+        }
+    }
+    delete [] oldHashp;
+}
+
+/* add an entry's record to an index */
+void
+Jsdb::indexRecord(Index *indexp, Entry *entryp)
+{
+    IndexEntry *ientryp;
+    std::string value;
+    uint32_t ix;
+
+    if (!getValue(indexp, entryp->_recordp, &value))
+        return;
+
+    ientryp = new IndexEntry();
+    ientryp->_value = value;
+    ientryp->_entryp = entryp;
+    ientryp->_indexp = indexp;
+    ientryp->_nextEntryp = entryp->_indexEntriesp;
+    entryp->_indexEntriesp = ientryp;
+
+    if (indexp->_type == _indexHash) {
+        if (indexp->_count >= indexp->_hashSize)
+            growIndexHash(indexp);
+        ientryp->_hash = hashKey(&ientryp->_value);
+        ix = ientryp->_hash % indexp->_hashSize;
+        linkIndexHash(&indexp->_hashp[ix], ientryp);
+    }
+    else {
+        setNumber(ientryp);
+        if (indexp->_count >= indexp->_maxSorted) {
+            indexp->_maxSorted *= 2;
+            indexp->_sortedp = (IndexEntry **) realloc( indexp->_sortedp,
+                                                        indexp->_maxSorted * sizeof(IndexEntry *));
+        }
+        if (indexp->_sorted) {
+            ix = lowerBound(indexp, ientryp, 1);
+            memmove( &indexp->_sortedp[ix+1],
+                     &indexp->_sortedp[ix],
+                     (indexp->_count - ix) * sizeof(IndexEntry *));
+        }
+        else {
+            ix = indexp->_count;
+            ientryp->_ix = ix;
+        }
+        indexp->_sortedp[ix] = ientryp;
+    }
+    indexp->_count++;
+}
+
+/* take an entry out of all of the indexes */
+void
+Jsdb::unindexEntry(Entry *entryp)
+{
+    IndexEntry *ientryp;
+    Index *indexp;
+    uint32_t ix;
+
+    while((ientryp = entryp->_indexEntriesp) != NULL) {
+        entryp->_indexEntriesp = ientryp->_nextEntryp;
+        indexp = ientryp->_indexp;
+
+        if (indexp->_type == _indexHash) {
+            /* records with the same value share a chain, which can be
+             * long, so we don't search it.
+             */
+            *ientryp->_prevHashpp = ientryp->_nextHashp;
+            if (ientryp->_nextHashp)
+                ientryp->_nextHashp->_prevHashpp = ientryp->_prevHashpp;
+        }
+        else if (indexp->_sorted) {
+            ix = lowerBound(indexp, ientryp, 1);
+            osp_assert(indexp->_sortedp[ix] == ientryp);
+            memmove( &indexp->_sortedp[ix],
+                     &indexp->_sortedp[ix+1],
+                     (indexp->_count - ix - 1) * sizeof(IndexEntry *));
+        }
+        else {
+            /* move the last one into its place */
+            ix = ientryp->_ix;
+            indexp->_sortedp[ix] = indexp->_sortedp[indexp->_count - 1];
+            indexp->_sortedp[ix]->_ix = ix;
+        }
+        indexp->_count--;
+
+        delete ientryp;
+    }
+}
+
+/* called when an entry gets a new record */
+void
+Jsdb::reindexEntry(Entry *entryp)
+{
+    Index *indexp;
+
+    unindexEntry(entryp);
+    for(indexp = _indexes.head(); indexp; indexp = indexp->_dqNextp)
+        indexRecord(indexp, entryp);
+}
+
+int32_t
+Jsdb::addIndex(const char *namep, const char *pathp, uint8_t type)
+{
+    Index *indexp;
+    Entry *entryp;
+    const char *tp;
+    const char *dotp;
+    uint32_t i;
+
+    if (type != _indexHash && type != _indexOrdered)
+        return err_inval;
+    if (findIndex(namep))
+        return err_exist;
+
+    indexp = new Index();
+    indexp->_name = namep;
+    indexp->_type = type;
+
+    indexp->_pathCount = 1;
+    for(tp = pathp; *tp; tp++) {
+        if (*tp == '.')
+            indexp->_pathCount++;
+    }
+    indexp->_pathp = new std::string[indexp->_pathCount];
+    tp = pathp;
+    for(i=0;i<indexp->_pathCount;i++) {
+        dotp = strchr(tp, '.');
+        if (!dotp)
+            dotp = tp + strlen(tp);
+        indexp->_pathp[i] = std::string(tp, dotp - tp);
+        tp = dotp+1;
+    }
+
+    indexp->_count = 0;
+    indexp->_hashSize = _minHashSize;
+    indexp->_hashp = new IndexEntry *[indexp->_hashSize];
+    memset(indexp->_hashp, 0, indexp->_hashSize * sizeof(IndexEntry *));
+    indexp->_maxSorted = _minHashSize;
+    indexp->_sortedp = (IndexEntry **) malloc(indexp->_maxSorted * sizeof(IndexEntry *));
+    indexp->_sorted = 0;
+
+    _tranMutex.take();
+    _indexes.append(indexp);
+    for(i=0;i<_tablep->_size;i++) {
+        for( entryp = _tablep->_bucketsp[i];
+             entryp;
+             entryp = entryp->_nextHashp[_tablep->_link])
+            indexRecord(indexp, entryp);
+    }
+    _tranMutex.release();
+
+    return err_ok;
+}
+
+/* gather the records with values from *lowp to *highp in an ordered
+ * index, or equal to *lowp in a hash index.
+ */
+int32_t
+Jsdb::queryIndex( Index *indexp,
+                  std::string *lowp,
+                  std::string *highp,
+                  Json::Node ***recordsppp,
+                  uint32_t *countp)
+{
+    IndexEntry *ientryp;
+    IndexEntry lowProbe;
+    IndexEntry highProbe;
+    Json::Node **recordspp;
+    uint32_t count;
+    uint32_t maxCount;
+    uint32_t hash;
+    uint32_t ix;
+
+    count = 0;
+    maxCount = 16;
+    recordspp = (Json::Node **) malloc(maxCount * sizeof(Json::Node *));
+
+    if (indexp->_type == _indexHash) {
+        hash = hashKey(lowp);
+        for( ientryp = indexp->_hashp[hash % indexp->_hashSize];
+             ientryp;
+             ientryp = ientryp->_nextHashp) {
+            if (ientryp->_hash != hash || ientryp->_value != *lowp)
+                continue;
+            if (count >= maxCount) {
+                maxCount *= 2;
+                recordspp = (Json::Node **) realloc(recordspp, maxCount * sizeof(Json::Node *));
+            }
+            recordspp[count++] = ientryp->_entryp->_recordp;
+        }
+    }
+    else {
+        sortIndex(indexp);
+        ix = 0;
+        if (lowp) {
+            lowProbe._value = *lowp;
+            setNumber(&lowProbe);
+            ix = lowerBound(indexp, &lowProbe, 0);
+        }
+        if (highp) {
+            highProbe._value = *highp;
+            setNumber(&highProbe);
+        }
+        for(; ix < indexp->_count; ix++) {
+            ientryp = indexp->_sortedp[ix];
+            if (highp && compareValues(ientryp, &highProbe) > 0)
+                break;
+            if (count >= maxCount) {
+                maxCount *= 2;
+                recordspp = (Json::Node **) realloc(recordspp, maxCount * sizeof(Json::Node *));
+            }
+            recordspp[count++] = ientryp->_entryp->_recordp;
+        }
+    }
+
+    *recordsppp = recordspp;
+    *countp = count;
+    return err_ok;
+}
+
+/* add a record read from the snapshot or log, replacing any record
+ * with the same key.  A snapshot can have records without a key, which
+ * are kept, but can't be found; the log can't, since commit only logs
+ * records with one, and appending them each replay would duplicate
+ * them.
+ */
+void
+Jsdb::putRecord(Json::Node *recordp, int fromLog)
+{
+    std::string key;
+    uint32_t hash;
+    Entry *entryp;
+
+    if (!getKey(recordp, &key)) {
+        if (fromLog) {
+            printf("jsdb: dropping a log record without a key\n");
+            delete recordp;
+        }
+        else
+            _rootArrayp->appendChild(recordp);
+        return;
+    }
+    _rootArrayp->appendChild(recordp);
+
+    hash = hashKey(&key);
+    entryp = findEntry(&key, hash);
+    if (entryp) {
+        /* there are no readers yet, so just replace the record */
+        _rootArrayp->removeChild(entryp->_recordp);
+        delete entryp->_recordp;
+        entryp->_recordp = recordp;
+        entryp->_versionsp->_recordp = recordp;
+    }
+    else {
+        entryp = addEntry(&key, hash, recordp);
+        addVersion(entryp, recordp, 0);
+    }
+    reindexEntry(entryp);
+}
+
+/* read a whole file into a null terminated, malloc'd buffer; a missing
+ * file reads as empty.
+ */
+/* static */ int32_t
+Jsdb::readFile(const char *namep, char **datapp, uint64_t *sizep)
+{
+    struct stat tstat;
+    char *datap;
+    ssize_t code;
+    uint64_t size;
+    int fd;
+
+    *datapp = NULL;
+    *sizep = 0;
+    fd = open(namep, O_RDONLY);
+    if (fd < 0)
+        return (errno == ENOENT? err_ok : err_noent);
+
+    if (fstat(fd, &tstat) < 0) {
+        close(fd);
+        return err_io;
+    }
+    size = tstat.st_size;
+    datap = (char *) malloc(size + 1);
+    for(*sizep = 0; *sizep < size; *sizep += code) {
+        code = read(fd, datap + *sizep, size - *sizep);
+        if (code <= 0)
+            break;
+    }
+    close(fd);
+    datap[*sizep] = 0;
+    *datapp = datap;
+
+    return err_ok;
+}
+
+/* a log frame is a header line, "#<payload bytes> <checksum>", and
+ * then the unparsed records.
+ */
+static uint32_t
+jsdbChecksum(const char *datap, uint32_t len)
+{
+    uint32_t sum;
+
+    sum = 2166136261U;
+    while(len-- > 0) {
+        sum ^= (uint8_t) *datap++;
+        sum *= 16777619;
+    }
+    return sum;
+}
+
 int32_t
 Jsdb::loadDatabase()
 {
-    int32_t code;
+    Entry *entryp;
+    Entry *nentryp;
+    Version *versionp;
     Json::Node *recordNodep;
+    char *datap;
+    char *tp;
+    uint64_t size;
+    uint32_t i;
+    int32_t code;
+
+    /* the records themselves go with _rootArrayp */
+    for(i=0;i<_tablep->_size;i++) {
+        for(entryp = _tablep->_bucketsp[i]; entryp; entryp = nentryp) {
+            nentryp = entryp->_nextHashp[_tablep->_link];
+            unindexEntry(entryp);
+            while((versionp = entryp->_versionsp) != NULL) {
+                entryp->_versionsp = versionp->_olderp;
+                delete versionp;
+            }
+            delete entryp;
+        }
+        _tablep->_bucketsp[i] = NULL;
+    }
+    _entryCount = 0;
 
     if (_rootArrayp) {
         delete _rootArrayp;
@@ -53,174 +778,721 @@ Jsdb::loadDatabase()
     _rootArrayp = new Json::Node();
     _rootArrayp->initArray();
 
+    code = readFile(_fileNamep, &datap, &size);
+    if (code != 0) {
+        printf("jsdb: can't open file '%s'\n", _fileNamep);
+        return code;
+    }
+    _snapshotBytes = size;
+    if (!datap)
+        return err_ok;
+
+    tp = datap;
     while(1) {
-        code = _json.parseJsonValue(_inStreamp, &recordNodep);
+        code = _json.parseJsonChars(&tp, &recordNodep);
         if (code < 0) {
             break;
         }
-        _rootArrayp->appendChild(recordNodep);
+        putRecord(recordNodep, /* !fromLog */ 0);
     }
+    free(datap);
 
     return 0;
 }
 
+/* apply the log's frames, and cut it off at the first one that's
+ * incomplete or damaged, which a crash during a commit can leave.
+ */
+int32_t
+Jsdb::replayLog()
+{
+    Json::Node *recordNodep;
+    char *datap;
+    char *framep;
+    char *payloadp;
+    char *tp;
+    char saved;
+    uint64_t size;
+    uint64_t offset;
+    uint32_t length;
+    uint32_t sum;
+    int32_t code;
+
+    code = readFile(_logName.c_str(), &datap, &size);
+    if (code != 0)
+        return code;
+
+    offset = 0;
+    while(offset < size) {
+        framep = datap + offset;
+        payloadp = (char *) memchr(framep, '\n', size - offset);
+        if (*framep != '#' || !payloadp)
+            break;
+        payloadp++;
+        /* not sscanf, which looks at the whole rest of the log */
+        length = strtoul(framep+1, &tp, 10);
+        if (*tp != ' ')
+            break;
+        sum = strtoul(tp+1, &tp, 16);
+        if (tp+1 != payloadp)
+            break;
+        if (length > size - (payloadp - datap))
+            break;
+        if (jsdbChecksum(payloadp, length) != sum)
+            break;
+
+        saved = payloadp[length];
+        payloadp[length] = 0;
+        tp = payloadp;
+        while(_json.parseJsonChars(&tp, &recordNodep) == 0)
+            putRecord(recordNodep, /* fromLog */ 1);
+        payloadp[length] = saved;
+
+        offset = (payloadp + length) - datap;
+    }
+
+    if (offset < size) {
+        printf("jsdb: dropping %lld damaged bytes at the end of '%s'\n",
+               (long long) (size - offset), _logName.c_str());
+        if (truncate(_logName.c_str(), offset) < 0)
+            code = err_io;
+    }
+    _logBytes = offset;
+    free(datap);
+
+    return code;
+}
+
 int32_t
 Jsdb::init(const char *fileNamep, std::string *primaryKeyNamep)
 {
-    FILE *ifilep;
     int32_t code;
 
     _fileNamep = new char[strlen(fileNamep) + 1];
     strcpy(_fileNamep,  fileNamep);
+    _logName = std::string(fileNamep) + ".log";
     _primaryKeyName = *primaryKeyNamep;
 
-    ifilep = fopen(_fileNamep, "r");
-    if (!ifilep) {
-        if (errno != ENOENT) {
-            printf("jsdb: can't open file '%s'\n", _fileNamep);
-            return err_noent;
-        }
-        /* ENOENT represents an empty database */
-    }
-    else {
-        /* wrap a parser stream */
-        _inStreamp = new JsdbInStream(ifilep);
+    /* parse records from the database, and then the changes since */
+    code = loadDatabase();
+    if (code < 0)
+        return code;
 
-        /* parse records from the database */
-        code = loadDatabase();
-        if (code < 0)
-            return code;
+    code = replayLog();
+    if (code < 0)
+        return code;
 
-        delete _inStreamp;
-        _inStreamp = NULL;
+    _logFd = open(_logName.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0666);
+    if (_logFd < 0) {
+        printf("jsdb: can't open log '%s'\n", _logName.c_str());
+        return err_io;
     }
 
+    /* the log may be new, and synced commits need its name on disk */
+    code = syncDir();
+    if (code != 0)
+        return code;
+
     _didInit = 1;
 
     return err_ok;
 }
 
+/* append a frame of records to the log, returning its sequence number
+ * for waitForSync.
+ */
 int32_t
-Jsdb::Tran::init(Jsdb *jsdbp)
+Jsdb::appendLog(std::string *payloadp, uint64_t *seqp)
 {
-    _jsdbp = jsdbp;
-    jsdbp->_tranMutex.take();
-    return 0;
+    std::string frame;
+    char header[64];
+    const char *datap;
+    size_t length;
+    ssize_t code;
+
+    snprintf(header, sizeof(header), "#%u %08x\n",
+             (uint32_t) payloadp->length(),
+             jsdbChecksum(payloadp->c_str(), (uint32_t) payloadp->length()));
+    frame = header;
+    frame += *payloadp;
+
+    datap = frame.c_str();
+    length = frame.length();
+    while(length > 0) {
+        code = write(_logFd, datap, length);
+        if (code < 0 && errno == EINTR)
+            continue;
+        if (code <= 0) {
+            /* don't leave part of a frame for the next one to follow */
+            printf("jsdb: log write failed errno=%d\n", errno);
+            if (ftruncate(_logFd, _logBytes) < 0)
+                printf("jsdb: log truncate failed errno=%d\n", errno);
+            return err_io;
+        }
+        datap += code;
+        length -= code;
+    }
+    _logBytes += frame.length();
+
+    _syncMutex.take();
+    *seqp = ++_writtenSeq;
+    _syncMutex.release();
+
+    return err_ok;
 }
 
+/* wait until log frame seq is on disk.  Whoever finds no sync running
+ * starts one, covering every frame written so far, and the rest wait
+ * for it.
+ */
 int32_t
-Jsdb::Tran::search(std::string *keyp, Json::Node **nodepp)
+Jsdb::waitForSync(uint64_t seq)
 {
-    Json::Node *recordNodep;
+    uint64_t targetSeq;
+    int32_t code;
 
-    for( recordNodep = _jsdbp->_rootArrayp->_children.head();
-         recordNodep;
-         recordNodep=recordNodep->_dqNextp) {
-        if (matches(keyp, recordNodep)) {
-            *nodepp = recordNodep;
-            return 0;
+    code = 0;
+    _syncMutex.take();
+    while(_syncedSeq < seq) {
+        if (_syncing) {
+            _syncCV.wait();
+            continue;
+        }
+
+        _syncing = 1;
+        targetSeq = _writtenSeq;
+        _syncMutex.release();
+#ifdef __linux__
+        code = fdatasync(_logFd);
+#else
+        code = fsync(_logFd);
+#endif
+        _syncMutex.take();
+        _syncing = 0;
+        if (code == 0 && targetSeq > _syncedSeq)
+            _syncedSeq = targetSeq;
+        _syncCV.broadcast();
+        if (code < 0) {
+            code = err_io;
+            break;
         }
     }
-    *nodepp = 0;
-    return Jsdb::err_noent;
+    _syncMutex.release();
+
+    return code;
 }
 
-int
-Jsdb::Tran::matches(std::string *keyValuep, Json::Node *recordNodep)
+/* fsync the directory holding the database files */
+int32_t
+Jsdb::syncDir()
+{
+    std::string dirName;
+    const char *slashp;
+    int32_t code;
+    int fd;
+
+    slashp = strrchr(_fileNamep, '/');
+    if (!slashp)
+        dirName = ".";
+    else if (slashp == _fileNamep)
+        dirName = "/";
+    else
+        dirName = std::string(_fileNamep, slashp - _fileNamep);
+
+    fd = open(dirName.c_str(), O_RDONLY);
+    if (fd < 0)
+        return err_io;
+    code = (fsync(fd) < 0? err_io : err_ok);
+    close(fd);
+    return code;
+}
+
+/* write all the records to a new snapshot, and empty the log.  Called
+ * with _tranMutex held.
+ */
+int32_t
+Jsdb::compact()
 {
+    std::string tempName;
+    std::string outBuffer;
     Json::Node *nodep;
-    std::string keyName;
+    uint64_t bytes;
+    int32_t code;
+    int fd;
 
-    keyName = _jsdbp->_primaryKeyName;
+    tempName = std::string(_fileNamep) + ".tmp";
+    fd = open(tempName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        printf("jsdb: can't create database file %s\n", tempName.c_str());
+        return err_io;
+    }
 
-    for( nodep = recordNodep->_children.head();
-         nodep;
-         nodep = nodep->_dqNextp) {
-        if (nodep->_name == keyName) {
-            /* this is the field we're looking for; see if the value matches */
-            if (*keyValuep == nodep->_children.head()->_name) {
-                return 1;
+    code = 0;
+    bytes = 0;
+    nodep = _rootArrayp->_children.head();
+    while(1) {
+        if (nodep) {
+            nodep->unparse(&outBuffer);
+            nodep = nodep->_dqNextp;
+        }
+        if ((!nodep && outBuffer.length() > 0) || outBuffer.length() >= 65536) {
+            if (write(fd, outBuffer.c_str(), outBuffer.length()) != (ssize_t) outBuffer.length()) {
+                code = err_io;
+                break;
             }
+            bytes += outBuffer.length();
+            outBuffer.erase();
         }
+        if (!nodep)
+            break;
+    }
+
+    if (code == 0 && fsync(fd) < 0)
+        code = err_io;
+    if (close(fd) < 0 && code == 0)
+        code = err_io;
+    if (code == 0 && rename(tempName.c_str(), _fileNamep) < 0)
+        code = err_io;
+    if (code != 0) {
+        printf("jsdb: compacting %s failed\n", _fileNamep);
+        unlink(tempName.c_str());
+        return code;
+    }
+
+    /* the rename has to be on disk before we empty the log, or a crash
+     * could leave the old snapshot and an empty log.
+     */
+    code = syncDir();
+    if (code != 0) {
+        printf("jsdb: syncing the directory of %s failed\n", _fileNamep);
+        return code;
+    }
+
+    /* everything in the log is now safely in the snapshot */
+    if (ftruncate(_logFd, 0) < 0) {
+        printf("jsdb: log truncate failed errno=%d\n", errno);
+        return err_io;
     }
+    _logBytes = 0;
+    _snapshotBytes = bytes;
+
+    _syncMutex.take();
+    _syncedSeq = _writtenSeq;
+    _syncCV.broadcast();
+    _syncMutex.release();
 
     return 0;
 }
 
 int32_t
-Jsdb::Tran::create(std::string *keyValuep, Json::Node *nodep, int excl)
+Jsdb::Tran::init(Jsdb *jsdbp)
+{
+    _jsdbp = jsdbp;
+    jsdbp->_tranMutex.take();
+    return 0;
+}
+
+/* readers share the committed record, so our caller gets a copy to
+ * change, put in place as if created; a record this transaction has
+ * already replaced is its own.
+ */
+int32_t
+Jsdb::Tran::search(std::string *keyp, Json::Node **nodepp)
 {
-    Json::Node *tempNodep;
+    Entry *entryp;
+    Change *changep;
+    Json::Node *copyp;
+    std::string text;
+    Json json;
+    char *tp;
     int32_t code;
-    Json::Node *rootNodep = _jsdbp->_rootArrayp;
+
+    *nodepp = 0;
+    entryp = _jsdbp->findEntry(keyp, hashKey(keyp));
+    if (!entryp)
+        return Jsdb::err_noent;
+
+    if (entryp->_versionsp->_seq == _uncommitted) {
+        *nodepp = entryp->_recordp;
+        return 0;
+    }
+
+    entryp->_recordp->unparse(&text);
+    tp = const_cast<char *>(text.c_str());
+    code = json.parseJsonChars(&tp, &copyp);
+    if (code != 0)
+        return Jsdb::err_inval;
+
+    changep = addChange(entryp, copyp, /* searched */ 1);
+    changep->_oldText = text;
+    *nodepp = copyp;
+    return 0;
+}
+
+int
+Jsdb::Tran::matches(std::string *keyValuep, Json::Node *recordNodep)
+{
+    std::string key;
+
+    return (_jsdbp->getKey(recordNodep, &key) && key == *keyValuep);
+}
+
+int32_t
+Jsdb::Tran::create(std::string *keyValuep, Json::Node *nodep, int excl)
+{
+    Entry *entryp;
+    uint32_t hash;
 
     osp_assert(matches(keyValuep, nodep));
     _modified = 1;
 
-    code = search(keyValuep, &tempNodep);
-    if (code == 0) {
-        if (excl) {
+    hash = hashKey(keyValuep);
+    entryp = _jsdbp->findEntry(keyValuep, hash);
+
+    if (entryp) {
+        if (excl)
             return err_exist;
-        }
-        /* remove old record with this key, and insert nodep */
-        rootNodep->removeChild(tempNodep);
-        rootNodep->appendChild(nodep);
-        delete tempNodep;
     }
-    else if (code == Jsdb::err_noent) {
-        /* success */
-        rootNodep->appendChild(nodep);
+    else
+        entryp = _jsdbp->addEntry(keyValuep, hash, NULL);
+
+    addChange(entryp, nodep, /* !searched */ 0);
+    return 0;
+}
+
+/* make nodep entryp's record, as an uncommitted version, remembering
+ * the old record, if any, for abort.  A searched for copy has the
+ * same index values as the original until our caller changes it, so
+ * it's reindexed at commit, instead of here.
+ */
+Jsdb::Tran::Change *
+Jsdb::Tran::addChange(Entry *entryp, Json::Node *nodep, int searched)
+{
+    Json::Node *rootNodep = _jsdbp->_rootArrayp;
+    Change *changep;
+
+    /* if we're replacing a copy our caller searched for, its index
+     * entries are updated here, like any other record's, so abort has
+     * to put them back.
+     */
+    if (entryp->_versionsp && entryp->_versionsp->_seq == _uncommitted) {
+        for(changep = _changes.tail(); changep; changep = changep->_dqPrevp) {
+            if (changep->_versionp == entryp->_versionsp) {
+                changep->_searched = 0;
+                break;
+            }
+        }
     }
-    else {
-        return code;
+
+    changep = new Change();
+    changep->_oldp = entryp->_recordp;
+    if (entryp->_recordp)
+        rootNodep->removeChild(entryp->_recordp);
+    entryp->_recordp = nodep;
+    rootNodep->appendChild(nodep);
+    if (!searched)
+        _jsdbp->reindexEntry(entryp);
+    _jsdbp->addVersion(entryp, nodep, _uncommitted);
+
+    changep->_entryp = entryp;
+    changep->_newp = nodep;
+    changep->_versionp = entryp->_versionsp;
+    changep->_searched = searched;
+    _changes.append(changep);
+
+    return changep;
+}
+
+/* undo one change, which must be the newest for its record.  Readers
+ * may be looking at our uncommitted version on their way to older
+ * ones, so it's retired, rather than freed; the caller publishes.
+ */
+void
+Jsdb::Tran::undoChange(Change *changep)
+{
+    Json::Node *rootNodep = _jsdbp->_rootArrayp;
+
+    _changes.remove(changep);
+    rootNodep->removeChild(changep->_newp);
+    __atomic_store_n( &changep->_entryp->_versionsp,
+                      changep->_versionp->_olderp,
+                      __ATOMIC_RELEASE);
+    _jsdbp->retire(changep->_versionp, NULL, NULL, NULL);
+    if (changep->_oldp) {
+        changep->_entryp->_recordp = changep->_oldp;
+        rootNodep->appendChild(changep->_oldp);
+        if (!changep->_searched)
+            _jsdbp->reindexEntry(changep->_entryp);
     }
+    else
+        _jsdbp->removeEntry(changep->_entryp);
+    delete changep;
+}
 
-    return 0;
+/* undo our changes, newest first, since a key created twice has the
+ * first create's record as the second's old one.
+ */
+void
+Jsdb::Tran::rollback()
+{
+    Change *changep;
+
+    if (_changes.empty())
+        return;
+
+    while((changep = _changes.tail()) != NULL)
+        undoChange(changep);
+    _jsdbp->publish(_jsdbp->_commitSeq + 1);
 }
 
 int32_t
 Jsdb::Tran::commit()
 {
-    std::string outBuffer;
-    Json::Node *nodep;
-    FILE *ofilep;
+    Jsdb *jsdbp = _jsdbp;
+    std::string payload;
+    Change *changep;
+    Change *nchangep;
+    size_t start;
+    uint64_t seq;
+    uint64_t commitSeq;
+    uint64_t compactBytes;
+    uint8_t undone;
     int32_t code;
-    int32_t tempCode;
 
-    ofilep = fopen(_jsdbp->_fileNamep, "w");
-    if (!ofilep) {
-        printf("jsdb: can't create database file %s\n", _jsdbp->_fileNamep);
-        return Jsdb::err_io;
+    /* records our caller searched for, but didn't change, aren't
+     * logged, and their copies are dropped.
+     */
+    undone = 0;
+    for(changep = _changes.head(); changep; changep = nchangep) {
+        nchangep = changep->_dqNextp;
+        start = payload.length();
+        changep->_newp->unparse(&payload);
+        if (!changep->_searched)
+            continue;
+        if ( changep->_versionp == changep->_entryp->_versionsp &&
+             payload.compare(start, std::string::npos, changep->_oldText) == 0) {
+            payload.resize(start);
+            undoChange(changep);
+            undone = 1;
+            continue;
+        }
+        if (!matches(&changep->_entryp->_key, changep->_newp)) {
+            printf("jsdb: primary key of '%s' changed in place\n",
+                   changep->_entryp->_key.c_str());
+            rollback();
+            jsdbp->_tranMutex.release();
+            delete this;
+            return err_inval;
+        }
     }
 
-    code = 0;
-    nodep = _jsdbp->_rootArrayp->_children.head();
-    for(; nodep; nodep=nodep->_dqNextp) {
-        outBuffer.erase();
-        nodep->unparse(&outBuffer);
-        code = fwrite(outBuffer.c_str(), outBuffer.length(), 1, ofilep);
-        if (code != 1) {
-            code =  Jsdb::err_io;
-            break;
-        }
-        else {
-            code = 0;
+    /* the changed ones need their index entries updated, after which
+     * abort has to put them back, like a create's.
+     */
+    for(changep = _changes.head(); changep; changep = changep->_dqNextp) {
+        if (changep->_searched) {
+            jsdbp->reindexEntry(changep->_entryp);
+            changep->_searched = 0;
         }
     }
 
-    tempCode = fclose(ofilep);
-    if (code == 0)
-        code = tempCode;
+    if (_changes.empty()) {
+        if (undone)
+            jsdbp->publish(jsdbp->_commitSeq + 1);
+        jsdbp->_tranMutex.release();
+        delete this;
+        return 0;
+    }
+
+    code = jsdbp->appendLog(&payload, &seq);
+    if (code != 0) {
+        rollback();
+        jsdbp->_tranMutex.release();
+        delete this;
+        return code;
+    }
+
+    /* stamp our versions, and retire the ones they replace, which
+     * readers with older snapshots may still be using; then let new
+     * readers see them all at once.
+     */
+    commitSeq = jsdbp->_commitSeq + 1;
+    for(changep = _changes.head(); changep; changep = changep->_dqNextp) {
+        __atomic_store_n(&changep->_versionp->_seq, commitSeq, __ATOMIC_RELAXED);
+        if (changep->_versionp->_olderp)
+            jsdbp->retire(changep->_versionp->_olderp, changep->_versionp, NULL, NULL);
+    }
+    jsdbp->publish(commitSeq);
+
+    /* once the log outgrows the snapshot, fold it in; this failing
+     * doesn't lose anything, since the log is still there.
+     */
+    compactBytes = jsdbp->_snapshotBytes;
+    if (compactBytes < _minCompactBytes)
+        compactBytes = _minCompactBytes;
+    if (jsdbp->_logBytes > compactBytes)
+        jsdbp->compact();
+
+    while((changep = _changes.head()) != NULL) {
+        _changes.remove(changep);
+        delete changep;
+    }
 
     /* save this shard */
-    _jsdbp->_tranMutex.release();
+    jsdbp->_tranMutex.release();
+
+    if (jsdbp->_syncCommits)
+        code = jsdbp->waitForSync(seq);
+
     delete this;
     return code;
 }
 
+int32_t
+Jsdb::Tran::query( const char *indexNamep,
+                   std::string *valuep,
+                   Json::Node ***recordsppp,
+                   uint32_t *countp)
+{
+    Index *indexp;
+
+    indexp = _jsdbp->findIndex(indexNamep);
+    if (!indexp)
+        return err_noent;
+
+    return _jsdbp->queryIndex(indexp, valuep, valuep, recordsppp, countp);
+}
+
+int32_t
+Jsdb::Tran::queryRange( const char *indexNamep,
+                        std::string *lowp,
+                        std::string *highp,
+                        Json::Node ***recordsppp,
+                        uint32_t *countp)
+{
+    Index *indexp;
+
+    indexp = _jsdbp->findIndex(indexNamep);
+    if (!indexp)
+        return err_noent;
+    if (indexp->_type != _indexOrdered)
+        return err_inval;
+
+    return _jsdbp->queryIndex(indexp, lowp, highp, recordsppp, countp);
+}
+
 /* no need for a return code */
 void
 Jsdb::Tran::abort()
 {
+    rollback();
+    _jsdbp->_tranMutex.release();
+    delete this;
+}
+
+/* try each reader slot once, starting at *ixp, and claim the first
+ * idle one, announcing the current snapshot in it.
+ */
+Jsdb::ReaderSlot *
+Jsdb::claimSlot(uint32_t *ixp, uint64_t *seqp)
+{
+    ReaderSlot *slotp;
+    uint64_t idle;
+    uint32_t i;
+
+    for(i=0;i<_maxReaders;i++) {
+        slotp = &_readers[*ixp];
+        *seqp = __atomic_load_n(&_commitSeq, __ATOMIC_SEQ_CST);
+        idle = _idleSlot;
+        if (__atomic_compare_exchange_n( &slotp->_seq, &idle, *seqp, 0,
+                                         __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+            return slotp;
+        *ixp = (*ixp + 1) % _maxReaders;
+    }
+    return NULL;
+}
+
+/* take a free reader slot, and announce our snapshot in it.  We check
+ * that _commitSeq hasn't moved after announcing, so that a writer
+ * scanning the slots either sees our snapshot, or published after it
+ * and freed only what we couldn't reach anyway.
+ *
+ * If every slot is busy, we wait on _slotCV.  We count ourselves in
+ * _slotWaiters before looking one more time, and end frees its slot
+ * before checking the count, so one of us sees the other.
+ */
+int32_t
+Jsdb::ReadTran::init(Jsdb *jsdbp)
+{
+    ReaderSlot *slotp;
+    uint64_t seq;
+    uint32_t ix;
+
+    _jsdbp = jsdbp;
+    ix = (uint32_t) (((uintptr_t) pthread_self() >> 12) % _maxReaders);
+    slotp = jsdbp->claimSlot(&ix, &seq);
+    if (!slotp) {
+        jsdbp->_slotMutex.take();
+        __atomic_add_fetch(&jsdbp->_slotWaiters, 1, __ATOMIC_SEQ_CST);
+        while((slotp = jsdbp->claimSlot(&ix, &seq)) == NULL)
+            jsdbp->_slotCV.wait();
+        __atomic_sub_fetch(&jsdbp->_slotWaiters, 1, __ATOMIC_SEQ_CST);
+        jsdbp->_slotMutex.release();
+    }
+
+    while(1) {
+        _seq = __atomic_load_n(&jsdbp->_commitSeq, __ATOMIC_SEQ_CST);
+        if (_seq == seq)
+            break;
+        seq = _seq;
+        __atomic_store_n(&slotp->_seq, seq, __ATOMIC_SEQ_CST);
+    }
+    _slotp = slotp;
+
+    return 0;
+}
+
+int32_t
+Jsdb::ReadTran::search(std::string *keyp, Json::Node **nodepp)
+{
+    Table *tablep;
+    Entry *entryp;
+    Version *versionp;
+    uint32_t hash;
+
+    *nodepp = NULL;
+    hash = hashKey(keyp);
+    tablep = __atomic_load_n(&_jsdbp->_tablep, __ATOMIC_ACQUIRE);
+    for( entryp = __atomic_load_n(&tablep->_bucketsp[hash % tablep->_size], __ATOMIC_ACQUIRE);
+         entryp;
+         entryp = __atomic_load_n(&entryp->_nextHashp[tablep->_link], __ATOMIC_ACQUIRE)) {
+        if (entryp->_hash != hash || entryp->_key != *keyp)
+            continue;
+
+        for( versionp = __atomic_load_n(&entryp->_versionsp, __ATOMIC_ACQUIRE);
+             versionp;
+             versionp = __atomic_load_n(&versionp->_olderp, __ATOMIC_ACQUIRE)) {
+            if (__atomic_load_n(&versionp->_seq, __ATOMIC_ACQUIRE) <= _seq) {
+                *nodepp = versionp->_recordp;
+                return 0;
+            }
+        }
+        break;
+    }
+
+    return Jsdb::err_noent;
+}
+
+void
+Jsdb::ReadTran::end()
+{
+    Jsdb *jsdbp = _jsdbp;
+
+    __atomic_store_n(&_slotp->_seq, _idleSlot, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&jsdbp->_slotWaiters, __ATOMIC_SEQ_CST) > 0) {
+        jsdbp->_slotMutex.take();
+        jsdbp->_slotCV.signalOne();
+        jsdbp->_slotMutex.release();
+    }
     delete this;
 }
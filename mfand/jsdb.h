@@ -7,6 +7,7 @@
 #include "json.h"
 #include "osp.h"
 #include "cthread.h"
+#include "dqueue.h"
 
 class JsdbInStream : public InStream {
     FILE *_inFilep;
@@ -27,20 +28,159 @@ class JsdbInStream : public InStream {
     }
 };
 
-/* one shard for now */
+/* one shard for now.
+ *
+ * The database is kept in memory, with a hash index on the primary
+ * key, and stored as a snapshot file, holding all of the records, plus
+ * a log, named by appending ".log" to the snapshot's name.  A commit
+ * appends just the records that the transaction created to the log, as
+ * one frame, with a length and checksum so that a frame torn by a crash
+ * is recognized and dropped when the log is replayed.  Once the log
+ * grows bigger than the snapshot, the next commit writes a new snapshot
+ * and empties the log, so commits cost O(changed records), amortized.
+ *
+ * By default, commits are left in the OS's cache.  With setSyncCommits,
+ * commit also waits for its frame to reach the disk, and one fsync
+ * covers all of the commits that arrived while the previous one was
+ * running.
+ *
+ * Records can also be found by secondary indexes, declared with
+ * addIndex on a field path like "schedule.owner".  A hash index
+ * answers equality queries, and an ordered index ranges too.  Indexes
+ * live only in memory, and are rebuilt as the database is loaded; a
+ * transaction's creates update them right away, so its own queries
+ * see them, and abort puts them back.  Changes made in place to a
+ * record returned by search are indexed, and logged, at commit.
+ *
+ * Tran holds _tranMutex from init to commit, so writers run one at a
+ * time.  A ReadTran, for lookups by primary key, takes no lock: it
+ * sees the database as of the last commit before it started.  Each
+ * record keeps a list of versions, newest first, stamped with the
+ * sequence number of the commit that made them, and a reader uses the
+ * newest version no later than its snapshot.  Readers announce their
+ * snapshot in a slot of their own, and a writer only frees an old
+ * version, or anything else it has unlinked, once no slot holds a
+ * snapshot old enough to still reach it.
+ */
 class Jsdb {
  public:
     static const int32_t err_ok = 0;
     static const int32_t err_io = -1;
     static const int32_t err_noent = -2;
     static const int32_t err_exist = -3;
+    static const int32_t err_inval = -4;
+
+    /* index types */
+    static const uint8_t _indexHash = 0;
+    static const uint8_t _indexOrdered = 1;
 
  private:
+    class IndexEntry;
+    class Index;
+
+    static const uint64_t _uncommitted = ~0ULL;
+
+    /* a record as of some commit */
+    class Version {
+    public:
+        Json::Node *_recordp;
+        uint64_t _seq;                  /* commit that made it, or _uncommitted */
+        Version *_olderp;
+    };
+
+    /* a record, by primary key.  _recordp is the record as the writer
+     * sees it, and _versionsp what readers choose from.  There are two
+     * hash links, so that growing the hash table can link the entries
+     * into the new table while readers still walk the old one.
+     */
+    class Entry {
+    public:
+        std::string _key;
+        Json::Node *_recordp;
+        Version *_versionsp;
+        uint32_t _hash;
+        Entry *_nextHashp[2];
+        IndexEntry *_indexEntriesp;     /* one per index it's in */
+    };
+
+    class Table {
+    public:
+        Entry **_bucketsp;
+        uint32_t _size;
+        uint8_t _link;                  /* which _nextHashp */
+    };
+
+    /* something unlinked, to be freed once no reader has a snapshot
+     * before _seq; one of the pointers is set.
+     */
+    class Retired {
+    public:
+        uint64_t _seq;
+        Version *_versionp;
+        Version *_newerp;               /* version pointing at _versionp */
+        Entry *_entryp;
+        Table *_tablep;
+        Retired *_dqNextp;
+        Retired *_dqPrevp;
+    };
+
+    /* a reader's snapshot, or _idleSlot; one per cache line */
+    class ReaderSlot {
+    public:
+        uint64_t _seq;
+        char _pad[56];
+    };
+
+    static const uint64_t _idleSlot = ~0ULL;
+    static const uint32_t _maxReaders = 64;
+
+    /* a record's value in one index */
+    class IndexEntry {
+    public:
+        std::string _value;
+        double _number;
+        uint8_t _isNumber;
+        uint32_t _hash;
+        uint32_t _ix;                   /* in _sortedp, while unsorted */
+        Entry *_entryp;
+        Index *_indexp;
+        IndexEntry *_nextHashp;
+        IndexEntry **_prevHashpp;       /* what points at us */
+        IndexEntry *_nextEntryp;        /* next for the same Entry */
+    };
+
+    /* an ordered index is an array sorted by value, and then primary
+     * key.  Loading the database just appends to it, and it's sorted
+     * the first time it's used.
+     */
+    class Index {
+    public:
+        std::string _name;
+        std::string *_pathp;            /* field names, outermost first */
+        uint32_t _pathCount;
+        uint8_t _type;
+
+        IndexEntry **_hashp;
+        uint32_t _hashSize;
+        uint32_t _count;
+
+        IndexEntry **_sortedp;
+        uint32_t _maxSorted;
+        uint8_t _sorted;
+
+        Index *_dqNextp;
+        Index *_dqPrevp;
+    };
+
+    static const uint32_t _minHashSize = 64;
+    static const uint32_t _minCompactBytes = 1024*1024;
+
     JsdbInStream *_inStreamp;
     Json _json;
 
     /* name of file that stores an array of structs */
     char *_fileNamep;
+    std::string _logName;
 
     /* the name of the primary key for searches */
     std::string _primaryKeyName;
@@ -51,15 +191,135 @@ class Jsdb {
     /* the array of structs */
     Json::Node *_rootArrayp;
 
+    /* replaced, not changed in place, when it grows */
+    Table *_tablep;
+    uint32_t _entryCount;
+
+    /* the last commit readers can see; changed only with _tranMutex
+     * held.
+     */
+    uint64_t _commitSeq;
+    ReaderSlot _readers[_maxReaders];
+
+    /* readers waiting for a slot, when all of them are busy */
+    uint32_t _slotWaiters;
+    CThreadMutex _slotMutex;
+    CThreadCV _slotCV;
+
+    dqueue<Retired> _retired;
+    uint8_t _tableRetired;
+
+    /* the log, open for appending */
+    int _logFd;
+    uint64_t _logBytes;
+    uint64_t _snapshotBytes;
+
+    /* group commit.  _writtenSeq counts frames appended to the log,
+     * and _syncedSeq the ones known to be on disk; both protected by
+     * _syncMutex.
+     */
+    uint8_t _syncCommits;
+    uint8_t _syncing;
+    uint64_t _writtenSeq;
+    uint64_t _syncedSeq;
+    CThreadMutex _syncMutex;
+    CThreadCV _syncCV;
+
+    dqueue<Index> _indexes;
+
+    static uint32_t hashKey(std::string *keyp);
+
+    int getKey(Json::Node *recordp, std::string *keyp);
+
+    Entry *findEntry(std::string *keyp, uint32_t hash);
+
+    Entry *addEntry(std::string *keyp, uint32_t hash, Json::Node *recordp);
+
+    void removeEntry(Entry *entryp);
+
+    void growHash();
+
+    static Table *newTable(uint32_t size, uint8_t link);
+
+    void addVersion(Entry *entryp, Json::Node *recordp, uint64_t seq);
+
+    void retire(Version *versionp, Version *newerp, Entry *entryp, Table *tablep);
+
+    void publish(uint64_t seq);
+
+    void reclaim();
+
+    ReaderSlot *claimSlot(uint32_t *ixp, uint64_t *seqp);
+
+    void putRecord(Json::Node *recordp, int fromLog);
+
+    static int32_t readFile(const char *namep, char **datapp, uint64_t *sizep);
+
+    int32_t replayLog();
+
+    int32_t appendLog(std::string *framep, uint64_t *seqp);
+
+    int32_t waitForSync(uint64_t seq);
+
+    int32_t syncDir();
+
+    int32_t compact();
+
+    Index *findIndex(const char *namep);
+
+    static int getValue(Index *indexp, Json::Node *recordp, std::string *valuep);
+
+    static int compareValues(IndexEntry *ap, IndexEntry *bp);
+
+    static int compareEntries(const void *ap, const void *bp);
+
+    static void setNumber(IndexEntry *ientryp);
+
+    static void linkIndexHash(IndexEntry **headpp, IndexEntry *ientryp);
+
+    static void growIndexHash(Index *indexp);
+
+    void sortIndex(Index *indexp);
+
+    uint32_t lowerBound(Index *indexp, IndexEntry *probep, int withKey);
+
+    void indexRecord(Index *indexp, Entry *entryp);
+
+    void unindexEntry(Entry *entryp);
+
+    void reindexEntry(Entry *entryp);
+
+    int32_t queryIndex( Index *indexp,
+                        std::string *lowp,
+                        std::string *highp,
+                        Json::Node ***recordsppp,
+                        uint32_t *countp);
+
  public:
     /* protecting the whole thing */
     CThreadMutex _tranMutex;
 
  public:
-    Jsdb() {
+    Jsdb() : _slotCV(&_slotMutex), _syncCV(&_syncMutex) {
         _didInit = 0;
+        _inStreamp = NULL;
+        _fileNamep = NULL;
         _rootArrayp = new Json::Node();
         _rootArrayp->initArray();
+        _tablep = newTable(_minHashSize, 0);
+        _entryCount = 0;
+        _commitSeq = 0;
+        for(uint32_t i=0;i<_maxReaders;i++)
+            _readers[i]._seq = _idleSlot;
+        _slotWaiters = 0;
+        _tableRetired = 0;
+        _logFd = -1;
+        _logBytes = 0;
+        _snapshotBytes = 0;
+        _syncCommits = 0;
+        _syncing = 0;
+        _writtenSeq = 0;
+        _syncedSeq = 0;
         return;
     }
 
@@ -71,9 +331,46 @@ class Jsdb {
 
     int32_t init(const char *fileNamep, std::string *primaryKeyNamep);
 
+    /* have commit wait until its records are on disk */
+    void setSyncCommits(int syncCommits) {
+        _syncCommits = syncCommits;
+    }
+
+    uint32_t getRecordCount() {
+        return _entryCount;
+    }
+
+    /* add an index named namep on the field at pathp, a dot separated
+     * list of field names, of type _indexHash or _indexOrdered.
+     * Usually called before init; afterwards, it indexes the records
+     * already there.  Records without the field, or where it isn't a
+     * simple value, aren't in the index.  Ordered indexes compare
+     * numbers as numbers, and put them before other values.
+     */
+    int32_t addIndex(const char *namep, const char *pathp, uint8_t type);
+
     class Tran {
+        /* a record replaced by this transaction, kept until commit so
+         * that abort can put it back.  For a search, _newp is the copy
+         * we returned, and _oldText the record it was copied from, so
+         * that commit can tell if our caller changed it; its index
+         * entries are updated at commit.
+         */
+        class Change {
+        public:
+            Entry *_entryp;
+            Json::Node *_oldp;
+            Json::Node *_newp;
+            Version *_versionp;         /* holding _newp */
+            uint8_t _searched;
+            std::string _oldText;
+            Change *_dqNextp;
+            Change *_dqPrevp;
+        };
+
         Jsdb *_jsdbp;
         uint8_t _modified;
+        dqueue<Change> _changes;
 
     public:
         Tran() {
@@ -87,12 +384,70 @@ class Jsdb {
 
         void abort();
 
+        /* returns this transaction's own copy of the record, which
+         * the caller may change in place; commit saves it if it was
+         * changed, which mustn't include its primary key.  Readers
+         * don't see the changes until then.
+         */
         int32_t search(std::string *keyp, Json::Node **nodepp);
 
         int32_t create(std::string *keyp, Json::Node *nodep, int excl);
 
+        /* find the records whose indexed field equals *valuep, using
+         * either kind of index.  Returns a malloc'd array, which the
+         * caller frees, of records that stay valid until this
+         * transaction ends.  They're the database's own, which readers
+         * share, so they mustn't be changed; to update one, search
+         * for it by key, or create a new one with excl of 0.  An
+         * ordered index returns them in primary key order.
+         */
+        int32_t query( const char *indexNamep,
+                       std::string *valuep,
+                       Json::Node ***recordsppp,
+                       uint32_t *countp);
+
+        /* like query, but for the values from *lowp to *highp,
+         * inclusive, in order, using an ordered index; a null bound
+         * is open.
+         */
+        int32_t queryRange( const char *indexNamep,
+                            std::string *lowp,
+                            std::string *highp,
+                            Json::Node ***recordsppp,
+                            uint32_t *countp);
+
     private:
         int matches(std::string *keyValuep, Json::Node *recordNodep);
+
+        Change *addChange(Entry *entryp, Json::Node *nodep, int searched);
+
+        void undoChange(Change *changep);
+
+        void rollback();
+    };
+
+    /* a read only transaction, which never waits for writers */
+    class ReadTran {
+        Jsdb *_jsdbp;
+        ReaderSlot *_slotp;
+        uint64_t _seq;
+
+    public:
+        ReadTran() {
+            _jsdbp = NULL;
+            _slotp = NULL;
+            _seq = 0;
+        }
+
+        int32_t init(Jsdb *jsdbp);
+
+        /* the record returned is shared with other transactions, so
+         * it mustn't be changed; it stays valid until end.
+         */
+        int32_t search(std::string *keyp, Json::Node **nodepp);
+
+        /* deletes this, like Tran::commit */
+        void end();
     };
 };
 
@@ -1,7 +1,10 @@
 #include <stdlib.h>
+#include <unistd.h>
 
 #include "json.h"
 #include "jsdb.h"
+#include "osptimer.h"
+#include "cthread.h"
 
 /* simple test program with a few commands:
  *
@@ -11,31 +14,40 @@
  *
  * del user
  *
- * add user val1incr val2incr
+ * add user val1incr val2incr -- changes the record in place
+ *
+ * find group -- records whose stats.group is group (val1 mod 10)
+ *
+ * range low high -- records whose stats.total (val1+val2) is in [low, high]
+ *
+ * bench count [sync] -- time count single record commits, lookups and
+ * a reload, in a scratch database
+ *
+ * stress [readers] [rounds] -- run read only transactions in readers
+ * threads (4 by default) while another commits and aborts rounds (40)
+ * of 200 creates, in a scratch database; more than 64 readers have
+ * to wait for reader slots.
  */
 
 Json _json;
 Jsdb _jsdb;
 
-int32_t
-doCreate(char *userp, int32_t aval, int32_t bval)
+Json::Node *
+newRecord(const char *userp, int32_t aval, int32_t bval)
 {
     Json::Node *newNodep;
     Json::Node *intNodep;
     Json::Node *leafNodep;
     Json::Node *arrayNodep;
+    Json::Node *structNodep;
     Json::Node *tnodep;
-    std::string userName;
-    Jsdb::Tran *tranp;
-    int32_t code;
-
-    userName = userp;
+    char groupBuffer[16];
 
     newNodep = new Json::Node();
     newNodep->initStruct();
 
     leafNodep = new Json::Node();
-    leafNodep->initString(userName.c_str(), 1);
+    leafNodep->initString(userp, 1);
     tnodep = new Json::Node();
     tnodep->initNamed("user", leafNodep);
     newNodep->appendChild(tnodep);
@@ -53,20 +65,561 @@ doCreate(char *userp, int32_t aval, int32_t bval)
     tnodep->initNamed("vals", arrayNodep);
     newNodep->appendChild(tnodep);
 
+    /* some fields for the secondary indexes */
+    structNodep = new Json::Node();
+    structNodep->initStruct();
+    intNodep = new Json::Node();
+    intNodep->initInt(aval + bval);
+    tnodep = new Json::Node();
+    tnodep->initNamed("total", intNodep);
+    structNodep->appendChild(tnodep);
+    snprintf(groupBuffer, sizeof(groupBuffer), "g%d", aval % 10);
+    leafNodep = new Json::Node();
+    leafNodep->initString(groupBuffer, 1);
+    tnodep = new Json::Node();
+    tnodep->initNamed("group", leafNodep);
+    structNodep->appendChild(tnodep);
+    tnodep = new Json::Node();
+    tnodep->initNamed("stats", structNodep);
+    newNodep->appendChild(tnodep);
+
+    return newNodep;
+}
+
+int32_t
+doCreate(char *userp, int32_t aval, int32_t bval, Jsdb *jsdbp = &_jsdb)
+{
+    Json::Node *newNodep;
+    std::string userName;
+    Jsdb::Tran *tranp;
+    int32_t code;
+
+    userName = userp;
+    newNodep = newRecord(userp, aval, bval);
+
     tranp = new Jsdb::Tran();
-    tranp->init(&_jsdb);
+    tranp->init(jsdbp);
     code = tranp->create(&userName, newNodep, 1);
-    printf("record create code=%d\n", code);
-    if (code)
+    if (code) {
+        printf("record create code=%d\n", code);
+        tranp->abort();
         return code;
+    }
     code = tranp->commit();
-    printf("record commit code=%d\n", code);
+    if (code)
+        printf("record commit code=%d\n", code);
     return code;
 }
 
 int32_t
 doGet(char *userp)
 {
+    Jsdb::Tran *tranp;
+    Json::Node *recordp;
+    std::string userName;
+    std::string result;
+    int32_t code;
+
+    userName = userp;
+    tranp = new Jsdb::Tran();
+    tranp->init(&_jsdb);
+    code = tranp->search(&userName, &recordp);
+    if (code == 0) {
+        recordp->unparse(&result);
+        printf("%s", result.c_str());
+    }
+    else
+        printf("record search code=%d\n", code);
+    tranp->commit();
+
+    return code;
+}
+
+/* the old way of updating a record: search for it, change it in
+ * place, and commit.
+ */
+int32_t
+doAdd(char *userp, int32_t aincr, int32_t bincr, Jsdb *jsdbp = &_jsdb)
+{
+    Jsdb::Tran *tranp;
+    Json::Node *recordp;
+    Json::Node *valsp;
+    Json::Node *aNodep;
+    Json::Node *bNodep;
+    Json::Node *statsp;
+    Json::Node *totalp;
+    std::string userName;
+    int64_t aval;
+    int64_t bval;
+    int32_t code;
+
+    userName = userp;
+    tranp = new Jsdb::Tran();
+    tranp->init(jsdbp);
+    code = tranp->search(&userName, &recordp);
+    if (code) {
+        printf("record search code=%d\n", code);
+        tranp->abort();
+        return code;
+    }
+
+    valsp = recordp->searchForChild("vals");
+    statsp = recordp->searchForChild("stats");
+    if ( !valsp || !(valsp = valsp->_children.head()) ||
+         !(aNodep = valsp->_children.head()) ||
+         !(bNodep = aNodep->_dqNextp) ||
+         !statsp || !(totalp = statsp->searchForChild("total"))) {
+        printf("record for %s is missing fields\n", userp);
+        tranp->abort();
+        return -1;
+    }
+    aval = atoll(aNodep->_name.c_str()) + aincr;
+    bval = atoll(bNodep->_name.c_str()) + bincr;
+    aNodep->initInt(aval);
+    bNodep->initInt(bval);
+    totalp->_children.head()->initInt(aval + bval);
+
+    code = tranp->commit();
+    if (code)
+        printf("record commit code=%d\n", code);
+    return code;
+}
+
+/* get a record's first value with a read only transaction */
+int32_t
+getFirstVal(Jsdb *jsdbp, const char *userp, int64_t *valp)
+{
+    Jsdb::ReadTran *readTranp;
+    Json::Node *recordp;
+    Json::Node *valsp;
+    std::string userName;
+    int32_t code;
+
+    userName = userp;
+    readTranp = new Jsdb::ReadTran();
+    readTranp->init(jsdbp);
+    code = readTranp->search(&userName, &recordp);
+    if (code == 0) {
+        valsp = recordp->searchForChild("vals");
+        if (valsp && (valsp = valsp->_children.head()) && valsp->_children.head())
+            *valp = atoll(valsp->_children.head()->_name.c_str());
+        else
+            code = -1;
+    }
+    readTranp->end();
+    return code;
+}
+
+/* print the user names of some records, and free the array */
+void
+printRecords(Json::Node **recordspp, uint32_t count)
+{
+    Json::Node *tnodep;
+    uint32_t i;
+
+    for(i=0;i<count;i++) {
+        tnodep = recordspp[i]->searchForChild("user");
+        if (tnodep && tnodep->_children.head())
+            printf("%s\n", tnodep->_children.head()->_name.c_str());
+    }
+    printf("%u records\n", count);
+    free(recordspp);
+}
+
+int32_t
+doFind(char *groupp)
+{
+    Jsdb::Tran *tranp;
+    Json::Node **recordspp;
+    std::string group;
+    uint32_t count;
+    int32_t code;
+
+    group = groupp;
+    tranp = new Jsdb::Tran();
+    tranp->init(&_jsdb);
+    code = tranp->query("group", &group, &recordspp, &count);
+    if (code == 0)
+        printRecords(recordspp, count);
+    tranp->commit();
+
+    return code;
+}
+
+int32_t
+doRange(char *lowp, char *highp)
+{
+    Jsdb::Tran *tranp;
+    Json::Node **recordspp;
+    std::string low;
+    std::string high;
+    uint32_t count;
+    int32_t code;
+
+    low = lowp;
+    high = highp;
+    tranp = new Jsdb::Tran();
+    tranp->init(&_jsdb);
+    code = tranp->queryRange("total", &low, &high, &recordspp, &count);
+    if (code == 0)
+        printRecords(recordspp, count);
+    tranp->commit();
+
+    return code;
+}
+
+int32_t
+doBench(uint32_t count, int sync)
+{
+    static const char *benchNamep = "jsdbbench.db";
+    Jsdb *jsdbp;
+    Jsdb::Tran *tranp;
+    Jsdb::ReadTran *readTranp;
+    Json::Node *recordp;
+    Json::Node **recordspp;
+    std::string primaryKey;
+    std::string userName;
+    std::string low;
+    std::string high;
+    char userBuffer[64];
+    uint64_t startMs;
+    int64_t val;
+    uint32_t found;
+    uint32_t i;
+    int32_t code;
+
+    unlink(benchNamep);
+    unlink((std::string(benchNamep) + ".log").c_str());
+
+    primaryKey = "user";
+    jsdbp = new Jsdb();
+    jsdbp->addIndex("group", "stats.group", Jsdb::_indexHash);
+    jsdbp->addIndex("total", "stats.total", Jsdb::_indexOrdered);
+    jsdbp->init(benchNamep, &primaryKey);
+    jsdbp->setSyncCommits(sync);
+
+    startMs = osp_time_ms();
+    for(i=0;i<count;i++) {
+        snprintf(userBuffer, sizeof(userBuffer), "user%u", i);
+        code = doCreate(userBuffer, i, 2*i, jsdbp);
+        if (code)
+            return code;
+    }
+    printf("%u commits: %lld ms\n", count, (long long) (osp_time_ms() - startMs));
+
+    startMs = osp_time_ms();
+    for(i=0;i<count;i++) {
+        snprintf(userBuffer, sizeof(userBuffer), "user%u", (i * 7919) % count);
+        userName = userBuffer;
+        tranp = new Jsdb::Tran();
+        tranp->init(jsdbp);
+        code = tranp->search(&userName, &recordp);
+        tranp->commit();
+        if (code) {
+            printf("lookup of %s failed code=%d\n", userBuffer, code);
+            return code;
+        }
+    }
+    printf("%u lookups: %lld ms\n", count, (long long) (osp_time_ms() - startMs));
+
+    startMs = osp_time_ms();
+    for(i=0;i<count;i++) {
+        snprintf(userBuffer, sizeof(userBuffer), "user%u", (i * 7919) % count);
+        userName = userBuffer;
+        readTranp = new Jsdb::ReadTran();
+        readTranp->init(jsdbp);
+        code = readTranp->search(&userName, &recordp);
+        readTranp->end();
+        if (code) {
+            printf("read only lookup of %s failed code=%d\n", userBuffer, code);
+            return code;
+        }
+    }
+    printf("%u read only lookups: %lld ms\n", count, (long long) (osp_time_ms() - startMs));
+
+    /* each record's total is 3*i, so a range of width 30 has 10 of them */
+    startMs = osp_time_ms();
+    for(i=0;i<count;i++) {
+        snprintf(userBuffer, sizeof(userBuffer), "%u", 3 * ((i * 7919) % count));
+        low = userBuffer;
+        snprintf(userBuffer, sizeof(userBuffer), "%u", 3 * ((i * 7919) % count) + 29);
+        high = userBuffer;
+        tranp = new Jsdb::Tran();
+        tranp->init(jsdbp);
+        code = tranp->queryRange("total", &low, &high, &recordspp, &found);
+        tranp->commit();
+        if (code == 0)
+            free(recordspp);
+        if (code || found != ((i * 7919) % count + 10 <= count? 10 : count - (i * 7919) % count)) {
+            printf("range query %u failed code=%d found=%u\n", i, code, found);
+            return -1;
+        }
+    }
+    printf("%u range queries: %lld ms\n", count, (long long) (osp_time_ms() - startMs));
+
+    /* update every record in place, adding 1 to its first value and
+     * total; readers must see the change, and so must a reload.
+     */
+    startMs = osp_time_ms();
+    for(i=0;i<count;i++) {
+        snprintf(userBuffer, sizeof(userBuffer), "user%u", i);
+        code = doAdd(userBuffer, 1, 0, jsdbp);
+        if (code)
+            return code;
+    }
+    printf("%u in place updates: %lld ms\n", count, (long long) (osp_time_ms() - startMs));
+    for(i=0;i<count;i++) {
+        snprintf(userBuffer, sizeof(userBuffer), "user%u", i);
+        code = getFirstVal(jsdbp, userBuffer, &val);
+        if (code || val != i+1) {
+            printf("update of %s not seen code=%d\n", userBuffer, code);
+            return -1;
+        }
+    }
+
+    /* the objects aren't freed; this is just a test */
+    startMs = osp_time_ms();
+    jsdbp = new Jsdb();
+    jsdbp->addIndex("group", "stats.group", Jsdb::_indexHash);
+    jsdbp->addIndex("total", "stats.total", Jsdb::_indexOrdered);
+    code = jsdbp->init(benchNamep, &primaryKey);
+    printf("reload of %u records: %lld ms code=%d\n",
+           jsdbp->getRecordCount(), (long long) (osp_time_ms() - startMs), code);
+    if (jsdbp->getRecordCount() != count)
+        return -1;
+
+    for(i=0;i<count;i++) {
+        snprintf(userBuffer, sizeof(userBuffer), "user%u", i);
+        code = getFirstVal(jsdbp, userBuffer, &val);
+        if (code || val != i+1) {
+            printf("update of %s lost in reload code=%d\n", userBuffer, code);
+            return -1;
+        }
+    }
+
+    /* and the ordered index has the updated totals, 3*i+1 */
+    snprintf(userBuffer, sizeof(userBuffer), "%u", 3*(count-1)+1);
+    low = userBuffer;
+    tranp = new Jsdb::Tran();
+    tranp->init(jsdbp);
+    code = tranp->queryRange("total", &low, &low, &recordspp, &found);
+    tranp->commit();
+    if (code == 0)
+        free(recordspp);
+    if (code || found != 1) {
+        printf("updated total %s found %u code=%d\n", low.c_str(), found, code);
+        return -1;
+    }
+
+    /* the reloaded indexes should have everything */
+    low = "g3";
+    tranp = new Jsdb::Tran();
+    tranp->init(jsdbp);
+    code = tranp->query("group", &low, &recordspp, &found);
+    tranp->commit();
+    if (code == 0)
+        free(recordspp);
+    printf("group g3 has %u records code=%d\n", found, code);
+
+    return 0;
+}
+
+/* state shared by the stress test's threads */
+CThreadMutex _stressMutex;
+CThreadCV _stressCV(&_stressMutex);
+uint32_t _stressRunning;
+uint8_t _stressDone;
+uint8_t _stressFailed;
+
+/* a stress test reader; each record it finds must have its second
+ * value twice its first, which every version the writer makes does.
+ */
+class StressReader : public CThread {
+ public:
+    Jsdb *_jsdbp;
+    uint32_t _keyCount;
+    uint32_t _seed;
+    uint64_t _reads;
+    uint64_t _found;
+
+    StressReader(Jsdb *jsdbp, uint32_t keyCount, uint32_t seed) {
+        _jsdbp = jsdbp;
+        _keyCount = keyCount;
+        _seed = seed;
+        _reads = 0;
+        _found = 0;
+    }
+
+    void start(void *contextp);
+};
+
+void
+StressReader::start(void *contextp)
+{
+    Jsdb::ReadTran *readTranp;
+    Json::Node *recordp;
+    Json::Node *valsp;
+    Json::Node *aNodep;
+    std::string userName;
+    char userBuffer[64];
+    int64_t aval;
+    int64_t bval;
+    uint32_t i;
+
+    while(!__atomic_load_n(&_stressDone, __ATOMIC_ACQUIRE)) {
+        readTranp = new Jsdb::ReadTran();
+        readTranp->init(_jsdbp);
+        for(i=0;i<20;i++) {
+            _seed = _seed * 1103515245 + 12345;
+            snprintf(userBuffer, sizeof(userBuffer), "user%u", (_seed >> 8) % _keyCount);
+            userName = userBuffer;
+            _reads++;
+            if (readTranp->search(&userName, &recordp) != 0)
+                continue;
+            _found++;
+            valsp = recordp->searchForChild("vals");
+            if ( !valsp || !(valsp = valsp->_children.head()) ||
+                 !(aNodep = valsp->_children.head()) || !aNodep->_dqNextp) {
+                printf("record for %s is missing fields\n", userBuffer);
+                _stressFailed = 1;
+                continue;
+            }
+            aval = atoll(aNodep->_name.c_str());
+            bval = atoll(aNodep->_dqNextp->_name.c_str());
+            if (bval != 2*aval) {
+                printf("inconsistent record %s %lld %lld\n",
+                       userBuffer, (long long) aval, (long long) bval);
+                _stressFailed = 1;
+            }
+        }
+        readTranp->end();
+    }
+
+    _stressMutex.take();
+    _stressRunning--;
+    _stressCV.broadcast();
+    _stressMutex.release();
+}
+
+/* each round creates 200 records, and every third one twice, with
+ * values of 1000 more the second time; every fourth round aborts.
+ */
+int32_t
+doStress(uint32_t readerCount, uint32_t rounds)
+{
+    static const char *stressNamep = "jsdbstress.db";
+    static const uint32_t roundSize = 200;
+    Jsdb *jsdbp;
+    Jsdb::Tran *tranp;
+    Jsdb::ReadTran *pinTranp;
+    Json::Node *recordp;
+    StressReader **readerspp;
+    CThreadHandle *handlep;
+    std::string primaryKey;
+    std::string userName;
+    char userBuffer[64];
+    uint64_t startMs;
+    uint64_t reads;
+    uint64_t found;
+    uint32_t keyCount;
+    uint32_t round;
+    uint32_t mismatches;
+    int64_t val;
+    int64_t expected;
+    uint32_t i;
+    int32_t code;
+
+    unlink(stressNamep);
+    unlink((std::string(stressNamep) + ".log").c_str());
+
+    primaryKey = "user";
+    jsdbp = new Jsdb();
+    code = jsdbp->init(stressNamep, &primaryKey);
+    if (code)
+        return code;
+
+    keyCount = rounds * roundSize;
+    _stressDone = 0;
+    _stressFailed = 0;
+    _stressRunning = readerCount;
+    readerspp = new StressReader *[readerCount];
+    for(i=0;i<readerCount;i++) {
+        readerspp[i] = new StressReader(jsdbp, keyCount, 7*i + 1);
+        handlep = new CThreadHandle();
+        handlep->init((CThread::StartMethod) &StressReader::start, readerspp[i], NULL);
+    }
+
+    /* a reader from before the table first grows, held open through
+     * all of the writes; the writer mustn't wait for it to end.
+     */
+    pinTranp = new Jsdb::ReadTran();
+    pinTranp->init(jsdbp);
+
+    startMs = osp_time_ms();
+    for(round = 0; round < rounds; round++) {
+        tranp = new Jsdb::Tran();
+        tranp->init(jsdbp);
+        for(i=0;i<roundSize;i++) {
+            snprintf(userBuffer, sizeof(userBuffer), "user%u", round * roundSize + i);
+            userName = userBuffer;
+            tranp->create(&userName, newRecord(userBuffer, round, 2*round), 0);
+            if (i % 3 == 0)
+                tranp->create( &userName,
+                               newRecord(userBuffer, round + 1000, 2*(round + 1000)),
+                               0);
+        }
+        if (round % 4 == 3)
+            tranp->abort();
+        else {
+            code = tranp->commit();
+            if (code)
+                return code;
+        }
+    }
+    printf("%u rounds: %lld ms\n", rounds, (long long) (osp_time_ms() - startMs));
+
+    /* and it still sees the empty database it started with */
+    userName = "user0";
+    if (pinTranp->search(&userName, &recordp) != Jsdb::err_noent) {
+        printf("old reader sees a newer record\n");
+        _stressFailed = 1;
+    }
+    pinTranp->end();
+
+    _stressMutex.take();
+    __atomic_store_n(&_stressDone, 1, __ATOMIC_RELEASE);
+    while(_stressRunning > 0)
+        _stressCV.wait();
+    _stressMutex.release();
+
+    reads = 0;
+    found = 0;
+    for(i=0;i<readerCount;i++) {
+        reads += readerspp[i]->_reads;
+        found += readerspp[i]->_found;
+    }
+
+    /* the committed rounds' records are there, with their last values */
+    mismatches = 0;
+    for(i=0;i<keyCount;i++) {
+        snprintf(userBuffer, sizeof(userBuffer), "user%u", i);
+        round = i / roundSize;
+        code = getFirstVal(jsdbp, userBuffer, &val);
+        if (round % 4 == 3) {
+            if (code != Jsdb::err_noent)
+                mismatches++;
+            continue;
+        }
+        expected = (i % roundSize) % 3 == 0? round + 1000 : round;
+        if (code != 0 || val != expected)
+            mismatches++;
+    }
+    printf("%u readers: reads=%lld found=%lld records=%u mismatches=%u\n",
+           readerCount, (long long) reads, (long long) found,
+           jsdbp->getRecordCount(), mismatches);
+
+    if (_stressFailed || mismatches)
+        return -1;
     return 0;
 }
 
@@ -81,7 +634,22 @@ main(int argc, char **argv)
         return -1;
     }
 
+    if (!strcmp(argv[1], "bench")) {
+        code = doBench(atoi(argv[2]), (argc > 3 && !strcmp(argv[3], "sync")));
+        printf("bench code=%d\n", code);
+        return code;
+    }
+
+    if (!strcmp(argv[1], "stress")) {
+        code = doStress( (argc > 2? atoi(argv[2]) : 4),
+                         (argc > 3? atoi(argv[3]) : 40));
+        printf("stress code=%d\n", code);
+        return code;
+    }
+
     primaryKey = "user";
+    _jsdb.addIndex("group", "stats.group", Jsdb::_indexHash);
+    _jsdb.addIndex("total", "stats.total", Jsdb::_indexOrdered);
     code = _jsdb.init("jsdbtest.db", &primaryKey);
     if (code != 0) {
         printf("failed to init jsdbtest.db, code=%d\n", code);
@@ -91,9 +659,18 @@ main(int argc, char **argv)
     if (!strcmp(argv[1], "cr")) {
         code = doCreate(argv[2], atoi(argv[3]), atoi(argv[4]));
     }
+    else if(!strcmp(argv[1], "add")) {
+        code = doAdd(argv[2], atoi(argv[3]), atoi(argv[4]));
+    }
     else if(!strcmp(argv[1], "get")) {
         code = doGet(argv[2]);
     }
+    else if(!strcmp(argv[1], "find")) {
+        code = doFind(argv[2]);
+    }
+    else if(!strcmp(argv[1], "range")) {
+        code = doRange(argv[2], argv[3]);
+    }
 
     return 0;
 }
@@ -14,9 +14,6 @@
 #include "json.h"
 #include "xgml.h"
 
-/* stupid statics */
-CThreadMutex RadioScan::_lock;
-
 /* we supply a bufgen factory that can create sockets to URLs, and a
  * prefix string to add to all file names.  As such, it should either be
  * an empty string or end with a '/' character.  The directory will control 
@@ -34,6 +31,28 @@ RadioScan::init(BufGenFactory *factoryp, std::string dirPrefix)
     _stwBufp->setTimeoutMs(15000);
     _stwConnp = _xapip->addClientConn(_stwBufp);
     _strictLicense = false;
+
+    _verifyDispp = new CDisp();
+    _verifyDispp->init(_verifyThreads);
+    _verifyGroupp = new CDispGroup();
+    _verifyGroupp->init(_verifyDispp);
+}
+
+void
+RadioScan::queueVerify(RadioScanQuery *queryp)
+{
+    RadioScanVerifyTask *taskp;
+
+    taskp = new RadioScanVerifyTask();
+    taskp->_queryp = queryp;
+    _verifyGroupp->queueTask(taskp);
+}
+
+int32_t
+RadioScanVerifyTask::start()
+{
+    _queryp->verifyNext();
+    return 0;
 }
 
 /* start with the object at the URL, and resolve it until we get to an
@@ -75,7 +94,7 @@ RadioScanStation::streamApply( std::string url,
             return code;
 
         if (queryp != nullptr)
-            queryp->_verifyingUrl = url;
+            queryp->setVerifyingUrl(url);
 
         bufGenp = _scanp->_factoryp->allocate(isSecure);
         if (!bufGenp) {
@@ -241,7 +260,7 @@ RadioScanStation::streamApply( std::string url,
     }
 
     if (queryp != nullptr)
-        queryp->_verifyingUrl = "";
+        queryp->setVerifyingUrl("");
     return code;
     
 }
@@ -735,15 +754,37 @@ RadioScanQuery::freeUnusedStations(std::vector<RadioScanStation *> *stationsp) {
 }
 #endif
 
+/* called with the query locked, after changing a station, or to add
+ * a new one; stamp the station with the next update version, and
+ * then make that version visible to watchers.
+ */
 void
-RadioScanQuery::considerStation(RadioScanStation *stationp) {
-    RadioScan::takeLock();
+RadioScanQuery::publishUpdate(RadioScanStation *stationp) {
+    uint32_t version = _nextVersion;
+
+    __atomic_store_n(&stationp->_updateVersion, version, __ATOMIC_RELAXED);
+    if (!stationp->_inQueryList) {
+        stationp->_inQueryList = true;
+        _goodStations.append(stationp);
+        if (_publishTailp)
+            __atomic_store_n(&_publishTailp->_publishNextp, stationp, __ATOMIC_RELEASE);
+        else
+            __atomic_store_n(&_publishHeadp, stationp, __ATOMIC_RELEASE);
+        _publishTailp = stationp;
+    }
+    __atomic_store_n(&_nextVersion, version+1, __ATOMIC_RELEASE);
+}
 
-    _goodStations.append(stationp);
-    stationp->_inQueryList = true;
-    stationp->_updateVersion = _nextVersion++;
+RadioScanStation *
+RadioScanQuery::getNextStation(RadioScanStation *stationp) {
+    return __atomic_load_n(&stationp->_publishNextp, __ATOMIC_ACQUIRE);
+}
 
-    RadioScan::releaseLock();
+void
+RadioScanQuery::considerStation(RadioScanStation *stationp) {
+    takeLock();
+    publishUpdate(stationp);
+    releaseLock();
 }
 
 // Can tagList comma separated: all must be present.  Multiple tag= terms, any must be present
@@ -1301,6 +1342,7 @@ RadioScanQuery::getStatus()
     std::string hostName;
     size_t endIndex;
 
+    takeLock();
     if (!_verifying) {
         result = _baseStatus;
     } else {
@@ -1331,6 +1373,7 @@ RadioScanQuery::getStatus()
 
         result = status + std::string(tbuffer);
     }
+    releaseLock();
     return result;
 }
 
@@ -1445,21 +1488,6 @@ RadioScan::searchStation(RadioScanQuery *resp, ScanType scanType)
         return;
 
     resp->verifyStations();
-
-    // TODO: Why do we do this?
-    takeLock();
-    releaseLock();
-}
-
-void
-RadioScanQuery::threadWait(RadioScanThread *threadp) {
-    RadioScan::takeLock();
-    while(true) {
-        if (threadp->_done)
-            break;
-        _cv.wait();
-    }
-    RadioScan::releaseLock();
 }
 
 void
@@ -1498,77 +1526,81 @@ RadioScanQuery::buildWorkEntries() {
 void
 RadioScanQuery::verifyStations() {
     uint32_t i;
-    CThreadHandle *hp;
 
-    _verifying = true;
+    takeLock();
+    __atomic_store_n(&_verifying, true, __ATOMIC_RELEASE);
     _verifyingIndex = 0;
 
     buildWorkEntries();
 
     _verifyingCount = (uint32_t) _workEntries.count();
 
-    for(i=0;i<_kThreads;i++) {
-        // start all threads
-        _threads[i]._handlep = hp = new CThreadHandle();
-        hp->init((CThread::StartMethod) &RadioScanQuery::verifyStationThread,
-                 this,
-                 _threads+i);
+    // start up to _maxVerifyTasks tasks on the shared pool; each one
+    // requeues itself until the work runs out.
+    _verifyTasks = (_verifyingCount < _maxVerifyTasks? _verifyingCount : _maxVerifyTasks);
+    for(i=0;i<_verifyTasks;i++) {
+        _scanp->queueVerify(this);
     }
 
-    // now wait for all the threads to finish
-    for(i=0;i<_kThreads;i++) {
-        threadWait(_threads+i);
+    // now wait for all the tasks to finish
+    while(_verifyTasks > 0) {
+        _cv.wait();
     }
+    releaseLock();
 
     // mark that we're all done
-    _allVerified = true;
+    __atomic_store_n(&_allVerified, true, __ATOMIC_RELEASE);
 }
 
+/* verify the next station, and queue a task for the one after that,
+ * or, if there's nothing left, let verifyStations know we're done.
+ */
 void
-RadioScanQuery::verifyStationThread(RadioScanThread *threadp) {
+RadioScanQuery::verifyNext() {
     int32_t code;
     RadioScanStation *stationp;
     RadioScanWork *workEntryp;
 
-    RadioScan::takeLock();
-    while((workEntryp = _workEntries.pop()) != nullptr) {
-        // get the station from the work queue.
-        stationp = workEntryp->_stationp;
-        _workEntries.remove(workEntryp);
-        delete workEntryp;
+    takeLock();
+    if (isAborted() || (workEntryp = _workEntries.pop()) == nullptr) {
+        // once we release the lock, the query may be gone
+        if (--_verifyTasks == 0)
+            _cv.broadcast();
+        releaseLock();
+        return;
+    }
 
-        if (isAborted())
-            break;
-        _verifyingUrl = stationp->_sourceUrl;
-        RadioScan::releaseLock();
-        code = stationp->streamApply(stationp->_sourceUrl,
-                                     RadioScanStation::stwCallback,
-                                     stationp,
-                                     this);
-        if (code != 0) {
-            _verifyingUrl = stationp->_altSourceUrl;
-            if (stationp->_altSourceUrl.size() > 0) {
-                code = stationp->streamApply( stationp->_altSourceUrl,
-                                              RadioScanStation::stwCallback,
-                                              stationp,
-                                              this);
-            }
-        }
+    // get the station from the work queue.
+    stationp = workEntryp->_stationp;
+    delete workEntryp;
 
-        RadioScan::takeLock();
-        if (code == 0 && stationp->_entries.count() > 0) {
-            stationp->_verifiedWorking = true;
-        } else {
-            stationp->_verifiedWorking = false;
+    _verifyingUrl = stationp->_sourceUrl;
+    releaseLock();
+    code = stationp->streamApply(stationp->_sourceUrl,
+                                 RadioScanStation::stwCallback,
+                                 stationp,
+                                 this);
+    if (code != 0) {
+        if (stationp->_altSourceUrl.size() > 0) {
+            setVerifyingUrl(stationp->_altSourceUrl);
+            code = stationp->streamApply( stationp->_altSourceUrl,
+                                          RadioScanStation::stwCallback,
+                                          stationp,
+                                          this);
         }
-        stationp->_verified = true;
-        stationp->_updateVersion = _nextVersion++;
-
-        _verifyingIndex++;
     }
-    threadp->_done = true;
-    _cv.broadcast();
-    RadioScan::releaseLock();
+
+    takeLock();
+    __atomic_store_n( &stationp->_verifiedWorking,
+                      (code == 0 && stationp->_entries.count() > 0),
+                      __ATOMIC_RELAXED);
+    __atomic_store_n(&stationp->_verified, true, __ATOMIC_RELAXED);
+    publishUpdate(stationp);
+
+    _verifyingIndex++;
+    releaseLock();
+
+    _scanp->queueVerify(this);
 }
 
 RadioScanStation::Entry *
@@ -1576,9 +1608,9 @@ RadioScanStation::getFirstEntry()
 {
     RadioScanStation::Entry *ep;
 
-    RadioScan::takeLock();
+    _queryp->takeLock();
     ep = _entries.head();
-    RadioScan::releaseLock();
+    _queryp->releaseLock();
 
     return ep;
 }
@@ -1588,9 +1620,9 @@ RadioScanStation::getNextEntry(RadioScanStation::Entry *aep)
 {
     RadioScanStation::Entry *ep;
 
-    RadioScan::takeLock();
+    _queryp->takeLock();
     ep = aep->_dqNextp;
-    RadioScan::releaseLock();
+    _queryp->releaseLock();
 
     return ep;
 }
@@ -1599,27 +1631,27 @@ RadioScanStation::getNextEntry(RadioScanStation::Entry *aep)
 void
 RadioScanStation:: hold()
 {
-    RadioScan::takeLock();
+    _queryp->takeLock();
     ++_refCount;
-    RadioScan::releaseLock();
+    _queryp->releaseLock();
 }
 
 
 void 
 RadioScanStation::release()
 {
-    RadioScan::takeLock();
+    _queryp->takeLock();
     osp_assert(_refCount > 0);
-    ++_refCount;
-    RadioScan::releaseLock();
+    --_refCount;
+    _queryp->releaseLock();
 }
 
 void
 RadioScanStation::del()
 {
-    RadioScan::takeLock();
+    _queryp->takeLock();
     _deleted = 1;
-    RadioScan::releaseLock();
+    _queryp->releaseLock();
 }
 
 /* called with a short name for the radio station (eg WYEP), a longer
@@ -1646,9 +1678,9 @@ RadioScanStation::addStreamEntry(const char *streamUrlp,
     ep->_streamRateKb = streamRateKb;
     ep->_sawIcyBr = sawIcyBr;
     ep->_streamType = typep;
-    _scanp->takeLock();
+    _queryp->takeLock();
     _entries.append(ep);
-    _scanp->releaseLock();
+    _queryp->releaseLock();
 }
 
 /* static */ std::string
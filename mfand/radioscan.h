@@ -6,6 +6,7 @@
 #include "xapi.h"
 #include "bufgen.h"
 #include "cthread.h"
+#include "cdisp.h"
 
 /* Usage: this module is responsible for taking a query string, like 'WYEP' and finding
  * the radio station info for that station, and providing the info, and the stream URL,
@@ -14,12 +15,24 @@
  *
  * A query (RadioScanQuery) can match multiple stations (RadioScanStation).  Each
  * station may have multiple associated streams.
+ *
+ * Each query has its own lock, which its searches and verifications
+ * take to change it.  Callers watching a query don't need it: a
+ * station is linked in, and a station's verification results are
+ * written, before the query's _nextVersion update counter is
+ * advanced past the station's _updateVersion, so a caller that reads
+ * the counter with getUpdateVersion, and then walks the stations with
+ * getFirstStation and getNextStation, sees every update numbered below
+ * what it read.  Verification runs as tasks on a pool of threads shared
+ * by all of a RadioScan's queries, each query running at most
+ * _maxVerifyTasks of them at once.
  */
 
 class RadioScan;
 class RadioScanQuery;
 class RadioScanStation;
 class RadioScanWork;
+class RadioScanVerifyTask;
 
 class RadioScanWork {
 public:
@@ -35,10 +48,13 @@ public:
 class RadioScan {
     friend class RadioScanQuery;
 
-    dqueue<RadioScanQuery> _activeQueries;
-    static CThreadMutex _lock;
     bool _strictLicense;
 
+    /* threads verifying stations, for all queries */
+    static const uint32_t _verifyThreads = 24;
+    CDisp *_verifyDispp;
+    CDispGroup *_verifyGroupp;
+
  public:
     /* max # of 301 redirects before we call it quits */
     static const uint32_t _maxRedirects = 6;
@@ -61,13 +77,7 @@ class RadioScan {
 
     void browseStations( RadioScanQuery *resp);
 
-    static void takeLock() {
-        _lock.take();
-    }
-
-    static void releaseLock() {
-        _lock.release();
-    }
+    void queueVerify(RadioScanQuery *queryp);
 
     static void scanSort(int32_t *datap, int32_t count);
 
@@ -78,29 +88,41 @@ class RadioScan {
     }
 };
 
-class RadioScanThread {
+/* verifies one station of a query, and then queues another task to
+ * do the next, behind any other queries' tasks.
+ */
+class RadioScanVerifyTask : public CDispTask {
 public:
-    bool _done;         // thread is about to exit
-    bool _aborted;      // request to abort the running thread safely
-    CThreadHandle *_handlep;
-
-    RadioScanThread() {
-        init();
-    };
+    RadioScanQuery *_queryp;
 
-    void init() {
-        _done = false;
-        _aborted = false;
-        _handlep = nullptr;
-    }
+    int32_t start();
 };
 
-class RadioScanQuery : public CThread {
-    static const uint32_t _kThreads = 6;
+class RadioScanQuery {
+    static const uint32_t _maxVerifyTasks = 6;
     friend class RadioScan;
-    friend class RadioScanThread;
+    friend class RadioScanStation;
 private:
     std::string _baseStatus;
+
+    /* protects everything a search or verification changes */
+    CThreadMutex _lock;
+
+    /* stations as published to watchers, linked by _publishNextp */
+    RadioScanStation *_publishHeadp;
+    RadioScanStation *_publishTailp;
+
+    uint32_t _verifyTasks;      /* running or queued */
+
+    void takeLock() {
+        _lock.take();
+    }
+
+    void releaseLock() {
+        _lock.release();
+    }
+
+    void publishUpdate(RadioScanStation *stationp);
 public:
     std::string _query;         /* for simple queries */
 
@@ -112,7 +134,6 @@ public:
     std::list<std::string> _genreList;
     int32_t _browseMaxCount;
 
-    RadioScanThread _threads[_kThreads];
     CThreadCV _cv;
 
     RadioScan *_scanp;
@@ -130,7 +151,7 @@ public:
 
     uint32_t _maxReturnCount;
 
-    RadioScanQuery() : _cv(&RadioScan::_lock) {
+    RadioScanQuery() : _cv(&_lock) {
         _refCount = 0;
         _aborted = 0;
         _verifying = false;
@@ -138,6 +159,9 @@ public:
         _browseMaxCount = 10000;
         _nextVersion = 0;
         _maxReturnCount = 0;
+        _publishHeadp = nullptr;
+        _publishTailp = nullptr;
+        _verifyTasks = 0;
     }
 
     void init(RadioScan *scanp, std::string query) {
@@ -158,8 +182,30 @@ public:
                     std::string city,
                     std::string genre);
 
+    /* every station update numbered below this is visible */
     uint32_t getUpdateVersion() {
-        return _nextVersion;
+        return __atomic_load_n(&_nextVersion, __ATOMIC_ACQUIRE);
+    }
+
+    RadioScanStation *getFirstStation() {
+        return __atomic_load_n(&_publishHeadp, __ATOMIC_ACQUIRE);
+    }
+
+    RadioScanStation *getNextStation(RadioScanStation *stationp);
+
+    void setVerifyingUrl(std::string url) {
+        takeLock();
+        _verifyingUrl = url;
+        releaseLock();
+    }
+
+    bool isVerifying() {
+        return __atomic_load_n(&_verifying, __ATOMIC_ACQUIRE);
+    }
+
+    /* read before a final getUpdateVersion, so that a last scan sees everything */
+    bool isAllVerified() {
+        return __atomic_load_n(&_allVerified, __ATOMIC_ACQUIRE);
     }
 
     void initSmart(RadioScan *scanp, std::string query);
@@ -180,7 +226,7 @@ public:
 
     void verifyStations();
 
-    void verifyStationThread(RadioScanThread *threadp);
+    void verifyNext();
 
     int32_t searchFile();
 
@@ -194,10 +240,6 @@ public:
 
     bool isDelimeter(char ac);
 
-    bool threadAbort(RadioScanThread *threadp);
-
-    void threadWait(RadioScanThread *threadp);
-
     void abort() {
         // the helper threads all watch this, and will exit early if
         // aborted gets set.
@@ -246,6 +288,7 @@ class RadioScanStation {
     std::string _iconUrl;
     RadioScanStation *_dqNextp;
     RadioScanStation *_dqPrevp;
+    RadioScanStation *_publishNextp;
     std::string _stationSource;
     bool _inQueryList;
 
@@ -271,8 +314,20 @@ class RadioScanStation {
         _userFlags = 0;
     }
 
+    /* only meaningful for stations reached from their query's
+     * getFirstStation, and the same for isVerified and
+     * isVerifiedWorking.
+     */
     uint32_t getUpdateVersion() {
-        return _updateVersion;
+        return __atomic_load_n(&_updateVersion, __ATOMIC_ACQUIRE);
+    }
+
+    bool isVerified() {
+        return __atomic_load_n(&_verified, __ATOMIC_ACQUIRE);
+    }
+
+    bool isVerifiedWorking() {
+        return __atomic_load_n(&_verifiedWorking, __ATOMIC_ACQUIRE);
     }
 
     void addStreamEntry(const char *streamUrlp,
@@ -326,5 +381,6 @@ class RadioScanStation {
     RadioScanStation() {
         _inQueryList = false;
         _sawIcyBr = 0;
+        _publishNextp = nullptr;
     }
 };
@@ -0,0 +1,383 @@
+/*
+
+Copyright 2016-2020 Cazamar Systems
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be
+included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ */
+
+/* Benchmark for the RadixTree indices behind UpnpDBase.  "radixbench
+ * [<ntracks>]" builds a synthetic library of ntracks tracks (default
+ * 500,000) whose URLs all share a long server prefix, as a UPnP
+ * server's do, and times adding them, looking each one up by URL,
+ * iterating over the title and artist indices, and deleting them by
+ * tag, along with prefix queries, search-as-you-type queries for the
+ * top 50 matches, and saving and restoring the database as a binary
+ * snapshot and as JSON.  Along the way it checks that iteration comes
+ * out in key order, and that the counts are right.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <string>
+
+#include "upnp.h"
+
+static const uint32_t _artistCount = 5000;
+static const uint32_t _albumsPerArtist = 8;
+static const uint32_t _genreCount = 40;
+
+static const char *_words[] = {
+    "love", "night", "blue", "river", "fire", "heart", "dream", "road",
+    "rain", "gold", "city", "light", "song", "time", "wild", "home" };
+
+static uint32_t _seed = 1;
+
+static const uint32_t _topK = 50;
+
+static const char *_queries[] = {
+    "l", "lo", "lov", "love", "love ", "love n", "love ni", "love nig",
+    "IGHT", "rtist 42", "album 3999", "genre 7", "zzz" };
+
+class CheckContext {
+public:
+    std::string _lastKey;
+    uint64_t _count;
+    uint64_t _disorder;
+    int _field;
+};
+
+class ScanContext {
+public:
+    std::string _lowerQuery;
+    uint64_t _count;
+};
+
+uint32_t
+nextRandom()
+{
+    _seed = _seed * 1103515245 + 12345;
+    return (_seed >> 8);
+}
+
+int32_t
+checkCallback(void *contextp, void *recordp)
+{
+    CheckContext *checkp = (CheckContext *) contextp;
+    UpnpDBase::Record *recp = (UpnpDBase::Record *) recordp;
+    std::string *keyp;
+
+    if (checkp->_field == 0)
+        keyp = &recp->_url;
+    else if (checkp->_field == 1)
+        keyp = &recp->_title;
+    else
+        keyp = &recp->_artist;
+
+    if (checkp->_count > 0 && *keyp < checkp->_lastKey)
+        checkp->_disorder++;
+    checkp->_lastKey = *keyp;
+    checkp->_count++;
+    return 0;
+}
+
+void
+lowerString(std::string *strp)
+{
+    size_t i;
+
+    for(i=0;i<strp->length();i++)
+        (*strp)[i] = tolower((*strp)[i]);
+}
+
+/* count the records matching a query the slow way */
+int32_t
+scanCallback(void *contextp, void *recordp)
+{
+    ScanContext *scanp = (ScanContext *) contextp;
+    UpnpDBase::Record *recp = (UpnpDBase::Record *) recordp;
+    std::string fields[4];
+    uint32_t i;
+
+    fields[0] = recp->_title;
+    fields[1] = recp->_artist;
+    fields[2] = recp->_album;
+    fields[3] = recp->_genre;
+    for(i=0;i<4;i++) {
+        lowerString(&fields[i]);
+        if (fields[i].find(scanp->_lowerQuery) != std::string::npos) {
+            scanp->_count++;
+            break;
+        }
+    }
+    return 0;
+}
+
+int32_t
+countCallback(void *contextp, void *recordp)
+{
+    (*(uint64_t *) contextp)++;
+    return 0;
+}
+
+int
+sameCounts(UpnpDBase *ap, UpnpDBase *bp)
+{
+    return ( ap->urlTree()->getItemCount() == bp->urlTree()->getItemCount() &&
+             ap->titleTree()->getKeyCount() == bp->titleTree()->getKeyCount() &&
+             ap->artistTree()->getKeyCount() == bp->artistTree()->getKeyCount() &&
+             ap->albumTree()->getItemCount() == bp->albumTree()->getItemCount() &&
+             ap->genreTree()->getKeyCount() == bp->genreTree()->getKeyCount() &&
+             ap->_searchIndex.getTermCount() == bp->_searchIndex.getTermCount());
+}
+
+void
+report(const char *namep, uint64_t startMs, uint64_t ops)
+{
+    uint64_t elapsedMs;
+
+    elapsedMs = osp_time_ms() - startMs;
+    if (elapsedMs == 0)
+        elapsedMs = 1;
+    printf("%-16s %8lld ms  %10lld ops/sec\n",
+           namep, (long long) elapsedMs, (long long) (ops * 1000 / elapsedMs));
+}
+
+uint64_t
+timeApply(UpnpDBase *dbasep, RadixTree *treep, const char *namep, int field, int onlyUnique)
+{
+    CheckContext check;
+    uint64_t startMs;
+
+    check._count = 0;
+    check._disorder = 0;
+    check._field = field;
+    startMs = osp_time_ms();
+    dbasep->applyTree(treep, checkCallback, &check, onlyUnique);
+    report(namep, startMs, check._count);
+    if (check._disorder)
+        printf("  %lld out of order\n", (long long) check._disorder);
+    return check._count;
+}
+
+int
+main(int argc, char **argv)
+{
+    UpnpDBase *dbasep;
+    UpnpDBase *restoredp;
+    int32_t code;
+    uint32_t ntracks = 500000;
+    uint32_t i;
+    uint32_t artist;
+    uint32_t album;
+    uint32_t found;
+    uint32_t errors;
+    uint64_t count;
+    uint64_t startMs;
+    uint64_t elapsedMs;
+    uint32_t j;
+    ScanContext scan;
+    UpnpDBase::Record **results;
+    char tbuffer[256];
+    std::string url;
+    std::string title;
+    std::string artistName;
+    std::string albumName;
+    std::string genre;
+    std::string artUrl;
+
+    if (argc > 1)
+        ntracks = atoi(argv[1]);
+    if (ntracks == 0)
+        ntracks = 1;
+
+    dbasep = new UpnpDBase();
+    errors = 0;
+
+    startMs = osp_time_ms();
+    for(i=0;i<ntracks;i++) {
+        artist = nextRandom() % _artistCount;
+        album = artist * _albumsPerArtist + nextRandom() % _albumsPerArtist;
+        snprintf( tbuffer, sizeof(tbuffer),
+                  "http://192.168.1.20:9000/disk/DLNA-PNMP3-OP01-FLAGS01700000/O0$1$8I%u.mp3",
+                  i);
+        url = tbuffer;
+        snprintf( tbuffer, sizeof(tbuffer), "%s %s %u",
+                  _words[nextRandom() % 16], _words[nextRandom() % 16], nextRandom() % 100);
+        title = tbuffer;
+        snprintf(tbuffer, sizeof(tbuffer), "Artist %u", artist);
+        artistName = tbuffer;
+        snprintf(tbuffer, sizeof(tbuffer), "Album %u", album);
+        albumName = tbuffer;
+        snprintf(tbuffer, sizeof(tbuffer), "Genre %u", artist % _genreCount);
+        genre = tbuffer;
+        snprintf( tbuffer, sizeof(tbuffer),
+                  "http://192.168.1.20:9000/disk/art/album%u.jpg", album);
+        artUrl = tbuffer;
+        if (dbasep->addRecord( &url, &title, &albumName, &artistName,
+                               &genre, &artUrl, 1 + (i & 1)) != 0)
+            errors++;
+    }
+    report("add", startMs, ntracks);
+
+    startMs = osp_time_ms();
+    found = 0;
+    for(i=0;i<ntracks;i++) {
+        snprintf( tbuffer, sizeof(tbuffer),
+                  "http://192.168.1.20:9000/disk/DLNA-PNMP3-OP01-FLAGS01700000/O0$1$8I%u.mp3",
+                  (i * 7919) % ntracks);
+        url = tbuffer;
+        if (dbasep->findRecord(&url))
+            found++;
+    }
+    report("lookup", startMs, ntracks);
+    if (found != ntracks) {
+        printf("  only found %u of %u\n", found, ntracks);
+        errors++;
+    }
+
+    startMs = osp_time_ms();
+    found = 0;
+    for(i=0;i<ntracks;i++) {
+        snprintf( tbuffer, sizeof(tbuffer),
+                  "http://192.168.1.20:9000/disk/DLNA-PNMP3-OP01-FLAGS01700000/O0$1$9I%u.mp3",
+                  i);
+        url = tbuffer;
+        if (dbasep->findRecord(&url))
+            found++;
+    }
+    report("lookup-missing", startMs, ntracks);
+    if (found != 0) {
+        printf("  found %u missing records\n", found);
+        errors++;
+    }
+
+    count = timeApply(dbasep, dbasep->urlTree(), "apply-url", 0, 0);
+    if (count != ntracks)
+        errors++;
+    count = timeApply(dbasep, dbasep->titleTree(), "apply-title", 1, 0);
+    if (count != ntracks)
+        errors++;
+    count = timeApply(dbasep, dbasep->artistTree(), "apply-artists", 2, 1);
+    if (count != dbasep->artistTree()->getKeyCount())
+        errors++;
+    printf("  %u artists, %u albums, %u titles\n",
+           dbasep->artistTree()->getKeyCount(), dbasep->albumTree()->getKeyCount(),
+           dbasep->titleTree()->getKeyCount());
+
+    /* prefix queries on the artist tree: "Artist 1" covers 1111 of them */
+    startMs = osp_time_ms();
+    count = 0;
+    artistName = "Artist 1";
+    for(i=0;i<1000;i++) {
+        dbasep->applyPrefix(dbasep->artistTree(), &artistName, countCallback, &count, 1);
+    }
+    report("prefix-artists", startMs, 1000);
+    if (count != 1000 * 1111 && dbasep->artistTree()->getKeyCount() == _artistCount) {
+        printf("  prefix found %lld artists\n", (long long) count);
+        errors++;
+    }
+
+    printf("  %u search terms, %u trigrams\n",
+           dbasep->_searchIndex.getTermCount(), dbasep->_searchIndex.getTrigramCount());
+    results = new UpnpDBase::Record *[_topK];
+    for(i=0;i<sizeof(_queries)/sizeof(_queries[0]);i++) {
+        url = _queries[i];
+        startMs = osp_time_ms();
+        for(j=0;j<100;j++) {
+            dbasep->search(&url, UpnpSearchIndex::_allFields, results, _topK, &found);
+        }
+        elapsedMs = osp_time_ms() - startMs;
+
+        scan._lowerQuery = url;
+        lowerString(&scan._lowerQuery);
+        scan._count = 0;
+        dbasep->apply(scanCallback, &scan);
+        printf("search %-12s %6.2f ms  %2u results, %lld matching records\n",
+               _queries[i], (double) elapsedMs / 100, found, (long long) scan._count);
+        if (found != (scan._count < _topK? scan._count : _topK))
+            errors++;
+    }
+    delete [] results;
+
+    /* save and restore, binary and JSON */
+    startMs = osp_time_ms();
+    if (dbasep->saveSnapshot("radixbench.snap") != 0)
+        errors++;
+    report("save-snapshot", startMs, ntracks);
+
+    startMs = osp_time_ms();
+    restoredp = new UpnpDBase();
+    if (restoredp->restoreSnapshot("radixbench.snap") != 0)
+        errors++;
+    report("restore-snapshot", startMs, ntracks);
+    if (!sameCounts(dbasep, restoredp)) {
+        printf("  restored snapshot doesn't match\n");
+        errors++;
+    }
+    delete restoredp;
+    unlink("radixbench.snap");
+
+    startMs = osp_time_ms();
+    if (dbasep->saveToFile("radixbench.json") != 0)
+        errors++;
+    report("save-json", startMs, ntracks);
+
+    startMs = osp_time_ms();
+    restoredp = new UpnpDBase();
+    code = restoredp->restoreFromFile("radixbench.json");
+    if (code == 0) {
+        report("restore-json", startMs, ntracks);
+        if (!sameCounts(dbasep, restoredp)) {
+            printf("  restored JSON doesn't match\n");
+            errors++;
+        }
+    }
+    else {
+        printf("restore-json     failed code=%d\n", code);
+    }
+    delete restoredp;
+    unlink("radixbench.json");
+
+    startMs = osp_time_ms();
+    dbasep->deleteByTag(2);
+    report("delete-by-tag", startMs, ntracks / 2);
+    if (dbasep->urlTree()->getItemCount() != (ntracks+1)/2) {
+        printf("  %u left after deleting by tag\n", dbasep->urlTree()->getItemCount());
+        errors++;
+    }
+
+    startMs = osp_time_ms();
+    dbasep->deleteAll();
+    report("delete-all", startMs, (ntracks+1) / 2);
+    if ( dbasep->urlTree()->getItemCount() != 0 ||
+         dbasep->titleTree()->getKeyCount() != 0 ||
+         dbasep->_searchIndex.getTermCount() != 0 ||
+         dbasep->artistTree()->getKeyCount() != 0) {
+        printf("  records left after deleting everything\n");
+        errors++;
+    }
+
+    printf("%u tracks, %u errors\n", ntracks, errors);
+    return (errors? 1 : 0);
+}
@@ -1,83 +1,776 @@
 #include "radixtree.h"
 
-int32_t
-RadixTree::apply(Callback *procp, void *callbackContextp, int onlyUnique)
+/* the most children a node of a type can hold */
+/* static */ uint32_t
+RadixTree::capacity(uint8_t type)
+{
+    if (type == _typeNode4)
+        return 4;
+    else if (type == _typeNode16)
+        return 16;
+    else if (type == _typeNode48)
+        return 48;
+    else
+        return 256;
+}
+
+/* allocate the smallest inner node that holds count children */
+/* static */ RadixTree::Inner *
+RadixTree::newInner(uint32_t count)
+{
+    if (count <= 4)
+        return new Node4();
+    else if (count <= 16)
+        return new Node16();
+    else if (count <= 48)
+        return new Node48();
+    else
+        return new Node256();
+}
+
+/* delete just this node */
+/* static */ void
+RadixTree::deleteNode(Node *nodep)
+{
+    switch(nodep->_type) {
+    case _typeLeaf:
+        delete static_cast<Leaf *>(nodep);
+        break;
+    case _typeNode4:
+        delete static_cast<Node4 *>(nodep);
+        break;
+    case _typeNode16:
+        delete static_cast<Node16 *>(nodep);
+        break;
+    case _typeNode48:
+        delete static_cast<Node48 *>(nodep);
+        break;
+    default:
+        delete static_cast<Node256 *>(nodep);
+        break;
+    }
+}
+
+/* delete a node and everything under it; the items belong to our
+ * caller, and are left alone.
+ */
+/* static */ void
+RadixTree::freeNode(Node *nodep)
+{
+    Inner *innerp;
+    Node *childp;
+    uint32_t pos;
+    uint8_t key;
+
+    if (nodep->_type != _typeLeaf) {
+        innerp = static_cast<Inner *>(nodep);
+        if (innerp->_termp)
+            deleteNode(innerp->_termp);
+        pos = 0;
+        while((childp = nextChild(innerp, &pos, &key)) != NULL) {
+            freeNode(childp);
+        }
+    }
+    deleteNode(nodep);
+}
+
+/* return a reference to the child for a key byte, or null if there's
+ * no such child.
+ */
+/* static */ RadixTree::Node **
+RadixTree::findChild(Inner *innerp, uint8_t key)
 {
     uint32_t i;
-    uint32_t j;
-    Ptr *ptr0p;
-    Ptr *ptr1p;
-    Node *nodep;
-    dqueue<Item> *listp;
-    Item *itemp;
-    int32_t code;
-    std::string *lastKeyp;
+    uint32_t ix;
+    Node4 *n4p;
+    Node16 *n16p;
+    Node48 *n48p;
+    Node256 *n256p;
 
-    /* no root object */
-    if (_root._type == _typeNull)
-        return 0;
+    switch(innerp->_type) {
+    case _typeNode4:
+        n4p = static_cast<Node4 *>(innerp);
+        for(i=0;i<n4p->_count;i++) {
+            if (n4p->_keys[i] == key)
+                return &n4p->_childp[i];
+        }
+        return NULL;
 
-    for(i=0;i<Node::_width;i++) {
-        nodep = _root._u._nodep;
-        ptr0p = &nodep->_ptr[i];
-        if (ptr0p->_type == _typeNode) {
-            nodep = ptr0p->_u._nodep;
-            for(j=0;j<Node::_width;j++) {
-                ptr1p = &nodep->_ptr[j];
-                if (ptr1p->_type == _typeList) {
-                    listp = ptr1p->_u._listp;
-                    lastKeyp = NULL;
-                    for(itemp = listp->head(); itemp; itemp=itemp->_dqNextp) {
-                        if (!onlyUnique || (!lastKeyp || (*lastKeyp != *itemp->_keyp))) {
-                            code = procp(callbackContextp, itemp->_backp);
-                            if (code)
-                                return code;
-                        }
-                        lastKeyp = itemp->_keyp;
-                    }
-                }
+    case _typeNode16:
+        n16p = static_cast<Node16 *>(innerp);
+        for(i=0;i<n16p->_count;i++) {
+            if (n16p->_keys[i] >= key) {
+                if (n16p->_keys[i] == key)
+                    return &n16p->_childp[i];
+                break;
             }
         }
+        return NULL;
+
+    case _typeNode48:
+        n48p = static_cast<Node48 *>(innerp);
+        ix = n48p->_index[key];
+        if (ix == 0)
+            return NULL;
+        return &n48p->_childp[ix-1];
+
+    default:
+        n256p = static_cast<Node256 *>(innerp);
+        if (n256p->_childp[key] == NULL)
+            return NULL;
+        return &n256p->_childp[key];
     }
+}
 
-    return 0;
+/* iterate over a node's children in key order; *posp starts at 0, and
+ * we return null once we're done.
+ */
+/* static */ RadixTree::Node *
+RadixTree::nextChild(Inner *innerp, uint32_t *posp, uint8_t *keyp)
+{
+    uint32_t pos;
+    Node4 *n4p;
+    Node16 *n16p;
+    Node48 *n48p;
+    Node256 *n256p;
+
+    pos = *posp;
+    switch(innerp->_type) {
+    case _typeNode4:
+        n4p = static_cast<Node4 *>(innerp);
+        if (pos >= n4p->_count)
+            return NULL;
+        *posp = pos+1;
+        *keyp = n4p->_keys[pos];
+        return n4p->_childp[pos];
+
+    case _typeNode16:
+        n16p = static_cast<Node16 *>(innerp);
+        if (pos >= n16p->_count)
+            return NULL;
+        *posp = pos+1;
+        *keyp = n16p->_keys[pos];
+        return n16p->_childp[pos];
+
+    case _typeNode48:
+        n48p = static_cast<Node48 *>(innerp);
+        for(;pos<256;pos++) {
+            if (n48p->_index[pos]) {
+                *posp = pos+1;
+                *keyp = pos;
+                return n48p->_childp[n48p->_index[pos]-1];
+            }
+        }
+        *posp = pos;
+        return NULL;
+
+    default:
+        n256p = static_cast<Node256 *>(innerp);
+        for(;pos<256;pos++) {
+            if (n256p->_childp[pos]) {
+                *posp = pos+1;
+                *keyp = pos;
+                return n256p->_childp[pos];
+            }
+        }
+        *posp = pos;
+        return NULL;
+    }
+}
+
+/* add a child that isn't there yet to a node with room for it */
+/* static */ void
+RadixTree::putChild(Inner *innerp, uint8_t key, Node *childp)
+{
+    uint32_t i;
+    uint32_t count;
+    uint8_t *keysp;
+    Node **childpp;
+    Node48 *n48p;
+
+    count = innerp->_count;
+    switch(innerp->_type) {
+    case _typeNode4:
+    case _typeNode16:
+        if (innerp->_type == _typeNode4) {
+            keysp = static_cast<Node4 *>(innerp)->_keys;
+            childpp = static_cast<Node4 *>(innerp)->_childp;
+        }
+        else {
+            keysp = static_cast<Node16 *>(innerp)->_keys;
+            childpp = static_cast<Node16 *>(innerp)->_childp;
+        }
+        for(i=0;i<count;i++) {
+            if (keysp[i] > key)
+                break;
+        }
+        memmove(keysp+i+1, keysp+i, count-i);
+        memmove(childpp+i+1, childpp+i, (count-i) * sizeof(Node *));
+        keysp[i] = key;
+        childpp[i] = childp;
+        break;
+
+    case _typeNode48:
+        n48p = static_cast<Node48 *>(innerp);
+        n48p->_childp[count] = childp;
+        n48p->_slotKeys[count] = key;
+        n48p->_index[key] = count+1;
+        break;
+
+    default:
+        static_cast<Node256 *>(innerp)->_childp[key] = childp;
+        break;
+    }
+    innerp->_count = count+1;
+}
+
+/* add a child, growing the node first if it's full */
+/* static */ void
+RadixTree::addChild(Node **refpp, uint8_t key, Node *childp)
+{
+    Inner *innerp;
+
+    innerp = static_cast<Inner *>(*refpp);
+    if (innerp->_count >= capacity(innerp->_type)) {
+        resize(refpp, innerp->_count+1);
+        innerp = static_cast<Inner *>(*refpp);
+    }
+    putChild(innerp, key, childp);
+}
+
+/* remove a child; the node isn't resized */
+/* static */ void
+RadixTree::removeChild(Inner *innerp, uint8_t key)
+{
+    uint32_t i;
+    uint32_t slot;
+    uint32_t last;
+    uint32_t count;
+    uint8_t *keysp;
+    Node **childpp;
+    Node48 *n48p;
+
+    count = innerp->_count;
+    switch(innerp->_type) {
+    case _typeNode4:
+    case _typeNode16:
+        if (innerp->_type == _typeNode4) {
+            keysp = static_cast<Node4 *>(innerp)->_keys;
+            childpp = static_cast<Node4 *>(innerp)->_childp;
+        }
+        else {
+            keysp = static_cast<Node16 *>(innerp)->_keys;
+            childpp = static_cast<Node16 *>(innerp)->_childp;
+        }
+        for(i=0;i<count;i++) {
+            if (keysp[i] == key)
+                break;
+        }
+        osp_assert(i < count);
+        memmove(keysp+i, keysp+i+1, count-i-1);
+        memmove(childpp+i, childpp+i+1, (count-i-1) * sizeof(Node *));
+        break;
+
+    case _typeNode48:
+        /* move the last slot into the hole, to keep the slots dense */
+        n48p = static_cast<Node48 *>(innerp);
+        osp_assert(n48p->_index[key] != 0);
+        slot = n48p->_index[key]-1;
+        last = count-1;
+        if (slot != last) {
+            n48p->_childp[slot] = n48p->_childp[last];
+            n48p->_slotKeys[slot] = n48p->_slotKeys[last];
+            n48p->_index[n48p->_slotKeys[slot]] = slot+1;
+        }
+        n48p->_index[key] = 0;
+        break;
+
+    default:
+        static_cast<Node256 *>(innerp)->_childp[key] = NULL;
+        break;
+    }
+    innerp->_count = count-1;
+}
+
+/* move a node's contents to the smallest type of node that holds count
+ * children, if that's a different type.
+ */
+/* static */ void
+RadixTree::resize(Node **refpp, uint32_t count)
+{
+    Inner *oldp;
+    Inner *newp;
+    Node *childp;
+    uint32_t pos;
+    uint8_t key;
+
+    oldp = static_cast<Inner *>(*refpp);
+    newp = newInner(count);
+    if (newp->_type == oldp->_type) {
+        deleteNode(newp);
+        return;
+    }
+
+    newp->_prefix.swap(oldp->_prefix);
+    newp->_termp = oldp->_termp;
+    pos = 0;
+    while((childp = nextChild(oldp, &pos, &key)) != NULL) {
+        putChild(newp, key, childp);
+    }
+
+    deleteNode(oldp);
+    *refpp = newp;
+}
+
+/* called after children have been removed from a node; shrinks it, or
+ * if it's down to one entry, replaces it with that entry.
+ */
+/* static */ void
+RadixTree::compact(Node **refpp)
+{
+    Inner *innerp;
+    Inner *childp;
+    Node *onlyp;
+    uint32_t pos;
+    uint8_t key;
+    uint32_t count;
+
+    innerp = static_cast<Inner *>(*refpp);
+    count = innerp->_count;
+    if (count == 0) {
+        /* may leave null, which our caller then removes */
+        *refpp = innerp->_termp;
+        deleteNode(innerp);
+        return;
+    }
+
+    if (count == 1 && innerp->_termp == NULL) {
+        /* fold our prefix and key byte into our only child; a leaf has
+         * its whole key, and can just move up.
+         */
+        pos = 0;
+        onlyp = nextChild(innerp, &pos, &key);
+        if (onlyp->_type != _typeLeaf) {
+            childp = static_cast<Inner *>(onlyp);
+            innerp->_prefix.append(1, (char) key);
+            innerp->_prefix.append(childp->_prefix);
+            childp->_prefix.swap(innerp->_prefix);
+        }
+        *refpp = onlyp;
+        deleteNode(innerp);
+        return;
+    }
+
+    if ( (innerp->_type == _typeNode256 && count <= _shrink256) ||
+         (innerp->_type == _typeNode48 && count <= _shrink48) ||
+         (innerp->_type == _typeNode16 && count <= _shrink16)) {
+        resize(refpp, count);
+    }
+}
+
+RadixTree::Leaf *
+RadixTree::newLeaf(Item *itemp)
+{
+    Leaf *leafp;
+
+    leafp = new Leaf();
+    leafp->_items.append(itemp);
+    leafp->_keyp = itemp->_keyp;
+    _keyCount++;
+    return leafp;
+}
+
+/* build the subtree for a sorted run of items whose keys all agree
+ * up to depth.
+ */
+RadixTree::Node *
+RadixTree::buildNode(Item **itemsp, uint32_t count, uint32_t depth)
+{
+    std::string *firstp;
+    std::string *lastp;
+    const uint8_t *fp;
+    const uint8_t *lp;
+    uint32_t flen;
+    uint32_t llen;
+    uint32_t i;
+    uint32_t j;
+    uint32_t k;
+    uint32_t start;
+    uint32_t runs;
+    uint8_t key;
+    Leaf *leafp;
+    Inner *innerp;
+
+    firstp = itemsp[0]->_keyp;
+    lastp = itemsp[count-1]->_keyp;
+    if (*firstp == *lastp) {
+        leafp = newLeaf(itemsp[0]);
+        for(i=1;i<count;i++)
+            leafp->_items.append(itemsp[i]);
+        return leafp;
+    }
+
+    /* since the run is sorted, what its first and last keys share, all
+     * of them share.
+     */
+    fp = (const uint8_t *) firstp->data();
+    lp = (const uint8_t *) lastp->data();
+    flen = (uint32_t) firstp->length();
+    llen = (uint32_t) lastp->length();
+    for(i=depth; i<flen && i<llen && fp[i] == lp[i]; i++)
+        ;
+
+    /* keys ending at i sort first, and go in _termp */
+    for(start=0; start<count && itemsp[start]->_keyp->length() == i; start++)
+        ;
+
+    runs = 0;
+    for(j=start; j<count; j=k) {
+        key = (uint8_t) (*itemsp[j]->_keyp)[i];
+        for(k=j+1; k<count && (uint8_t) (*itemsp[k]->_keyp)[i] == key; k++)
+            ;
+        runs++;
+    }
+
+    innerp = newInner(runs);
+    innerp->_prefix.assign((const char *) fp+depth, i-depth);
+    if (start > 0)
+        innerp->_termp = static_cast<Leaf *>(buildNode(itemsp, start, i));
+    for(j=start; j<count; j=k) {
+        key = (uint8_t) (*itemsp[j]->_keyp)[i];
+        for(k=j+1; k<count && (uint8_t) (*itemsp[k]->_keyp)[i] == key; k++)
+            ;
+        putChild(innerp, key, buildNode(itemsp+j, k-j, i+1));
+    }
+
+    return innerp;
 }
 
-/* find the list and item with a particular key */
 int32_t
-RadixTree::find(std::string *keyp, dqueue<Item> **listpp, Item **itempp)
+RadixTree::bulkLoad(Item **itemsp, uint32_t count)
 {
-    Ptr *ptrp;
     uint32_t i;
-    uint32_t ix;
-    dqueue<Item> *listp;
-    Item *itemp;
 
-    ptrp = &_root;
-    for(i=0;i<_levelCount;i++) {
-        if (ptrp->_type == _typeNull) {
-            /* key doesn't exist; list doesn't even exist */
+    if (_rootp != NULL || _applyCount > 0)
+        return -1;
+    if (count == 0)
+        return 0;
+
+    for(i=1;i<count;i++) {
+        if (*itemsp[i]->_keyp < *itemsp[i-1]->_keyp)
             return -1;
+    }
+
+    _rootp = buildNode(itemsp, count, 0);
+    for(i=0;i<count;i++)
+        itemsp[i]->_inList = 1;
+    _itemCount += count;
+
+    return 0;
+}
+
+/* unlink an empty leaf from its parent, and free it */
+void
+RadixTree::dropLeaf(Leaf *leafp, Node **parentpp, int32_t keyByte)
+{
+    Inner *innerp;
+
+    deleteNode(leafp);
+    if (parentpp == NULL) {
+        /* leaf was the root */
+        _rootp = NULL;
+        return;
+    }
+
+    innerp = static_cast<Inner *>(*parentpp);
+    if (keyByte < 0)
+        innerp->_termp = NULL;
+    else
+        removeChild(innerp, keyByte);
+
+    /* every inner node has at least two entries, so this node can't
+     * disappear, though it may be replaced by its remaining entry.
+     */
+    compact(parentpp);
+}
+
+/* clean up after an apply removed things: free empty leaves, and fix
+ * up the nodes that held them.
+ */
+void
+RadixTree::prune(Node **refpp)
+{
+    Node *nodep;
+    Leaf *leafp;
+    Inner *innerp;
+    Node *childp;
+    Node **childpp;
+    uint32_t pos;
+    uint8_t key;
+    uint8_t deadKeys[256];
+    uint32_t deadCount;
+    uint32_t i;
+
+    nodep = *refpp;
+    if (nodep == NULL)
+        return;
+
+    if (nodep->_type == _typeLeaf) {
+        leafp = static_cast<Leaf *>(nodep);
+        if (leafp->_items.empty()) {
+            deleteNode(leafp);
+            *refpp = NULL;
         }
-        ix = Item::getStrByte(keyp, i);
-        ptrp = ptrp->_u._nodep->_ptr+ix;
+        return;
     }
 
-    /* terminal list is null */
-    if (ptrp->_type != _typeList)
-        return -1;
-    listp = ptrp->_u._listp;
+    innerp = static_cast<Inner *>(nodep);
+    if (innerp->_termp && innerp->_termp->_items.empty()) {
+        deleteNode(innerp->_termp);
+        innerp->_termp = NULL;
+    }
+
+    /* prune each child in place, and then remove the ones that are
+     * gone, so that the node doesn't change under our iteration.
+     */
+    deadCount = 0;
+    pos = 0;
+    while((childp = nextChild(innerp, &pos, &key)) != NULL) {
+        childpp = findChild(innerp, key);
+        prune(childpp);
+        if (*childpp == NULL)
+            deadKeys[deadCount++] = key;
+    }
+    for(i=0;i<deadCount;i++) {
+        removeChild(innerp, deadKeys[i]);
+    }
+
+    compact(refpp);
+}
+
+/* find the leaf holding a key, along with a reference to its parent
+ * (null for the root) and the key byte it's under in its parent (-1 if
+ * it's the parent's _termp).
+ */
+RadixTree::Leaf *
+RadixTree::findLeaf(std::string *keyp, Node ***parentppp, int32_t *keyBytep)
+{
+    Node **refpp;
+    Node **parentpp;
+    Node **childpp;
+    Node *nodep;
+    Inner *innerp;
+    Leaf *leafp;
+    const uint8_t *kp;
+    uint32_t len;
+    uint32_t plen;
+    uint32_t depth;
+    int32_t keyByte;
+
+    kp = (const uint8_t *) keyp->data();
+    len = (uint32_t) keyp->length();
+    refpp = &_rootp;
+    parentpp = NULL;
+    keyByte = -1;
+    depth = 0;
+    while(1) {
+        nodep = *refpp;
+        if (nodep == NULL)
+            return NULL;
+
+        if (nodep->_type == _typeLeaf) {
+            leafp = static_cast<Leaf *>(nodep);
+            break;
+        }
+
+        innerp = static_cast<Inner *>(nodep);
+        plen = (uint32_t) innerp->_prefix.length();
+        if ( len - depth < plen ||
+             memcmp(kp+depth, innerp->_prefix.data(), plen) != 0)
+            return NULL;
+        depth += plen;
+
+        if (depth == len) {
+            leafp = innerp->_termp;
+            if (leafp == NULL)
+                return NULL;
+            parentpp = refpp;
+            keyByte = -1;
+            break;
+        }
+
+        childpp = findChild(innerp, kp[depth]);
+        if (childpp == NULL)
+            return NULL;
+        parentpp = refpp;
+        keyByte = kp[depth];
+        refpp = childpp;
+        depth++;
+    }
+
+    /* leaves emptied during an apply are still around */
+    if (leafp->_items.empty() || *leafp->_keyp != *keyp)
+        return NULL;
+
+    *parentppp = parentpp;
+    *keyBytep = keyByte;
+    return leafp;
+}
+
+/* static */ int32_t
+RadixTree::applyLeaf(Leaf *leafp, Callback *procp, void *callbackContextp, int onlyUnique)
+{
+    Item *itemp;
+    Item *nitemp;
+    int32_t code;
+
+    for(itemp = leafp->_items.head(); itemp; itemp=nitemp) {
+        nitemp = itemp->_dqNextp;       /* before the callback removes it */
+        code = procp(callbackContextp, itemp->_backp);
+        if (code)
+            return code;
+        if (onlyUnique)
+            break;
+    }
+
+    return 0;
+}
+
+int32_t
+RadixTree::applyNode(Node *nodep, Callback *procp, void *callbackContextp, int onlyUnique)
+{
+    Inner *innerp;
+    Node *childp;
+    uint32_t pos;
+    uint8_t key;
+    int32_t code;
+
+    if (nodep->_type == _typeLeaf)
+        return applyLeaf(static_cast<Leaf *>(nodep), procp, callbackContextp, onlyUnique);
+
+    /* a key ending here sorts before everything that continues past it */
+    innerp = static_cast<Inner *>(nodep);
+    if (innerp->_termp) {
+        code = applyLeaf(innerp->_termp, procp, callbackContextp, onlyUnique);
+        if (code)
+            return code;
+    }
+
+    pos = 0;
+    while((childp = nextChild(innerp, &pos, &key)) != NULL) {
+        code = applyNode(childp, procp, callbackContextp, onlyUnique);
+        if (code)
+            return code;
+    }
+
+    return 0;
+}
+
+int32_t
+RadixTree::apply(Callback *procp, void *callbackContextp, int onlyUnique)
+{
+    int32_t code;
 
-    for( itemp = listp->head(); itemp; itemp=itemp->_dqNextp) {
-        if (*itemp->_keyp == *keyp) {
-            *itempp = itemp;
-            *listpp = listp;
+    /* no root object */
+    if (_rootp == NULL)
+        return 0;
+
+    _applyCount++;
+    code = applyNode(_rootp, procp, callbackContextp, onlyUnique);
+    _applyCount--;
+
+    if (_applyCount == 0 && _emptyCount > 0) {
+        prune(&_rootp);
+        _emptyCount = 0;
+    }
+
+    return code;
+}
+
+/* find the node under which every key starts with the prefix; if the
+ * prefix ends partway through a node's own prefix, that node still
+ * qualifies.
+ */
+int32_t
+RadixTree::applyPrefix( std::string *prefixp,
+                        Callback *procp,
+                        void *callbackContextp,
+                        int onlyUnique)
+{
+    Node *nodep;
+    Node **childpp;
+    Inner *innerp;
+    Leaf *leafp;
+    const uint8_t *kp;
+    uint32_t len;
+    uint32_t plen;
+    uint32_t depth;
+    int32_t code;
+
+    kp = (const uint8_t *) prefixp->data();
+    len = (uint32_t) prefixp->length();
+    nodep = _rootp;
+    depth = 0;
+    while(1) {
+        if (nodep == NULL)
             return 0;
+
+        if (nodep->_type == _typeLeaf) {
+            leafp = static_cast<Leaf *>(nodep);
+            if ( leafp->_items.empty() ||
+                 leafp->_keyp->compare(0, len, *prefixp) != 0)
+                return 0;
+            break;
+        }
+
+        innerp = static_cast<Inner *>(nodep);
+        plen = (uint32_t) innerp->_prefix.length();
+        if (len - depth <= plen) {
+            /* the prefix runs out in this node */
+            if (memcmp(kp+depth, innerp->_prefix.data(), len - depth) != 0)
+                return 0;
+            break;
         }
+        if (memcmp(kp+depth, innerp->_prefix.data(), plen) != 0)
+            return 0;
+        depth += plen;
+
+        childpp = findChild(innerp, kp[depth]);
+        if (childpp == NULL)
+            return 0;
+        nodep = *childpp;
+        depth++;
     }
 
-    /* name is not present in the list */
-    return -1;
+    _applyCount++;
+    code = applyNode(nodep, procp, callbackContextp, onlyUnique);
+    _applyCount--;
+
+    if (_applyCount == 0 && _emptyCount > 0) {
+        prune(&_rootp);
+        _emptyCount = 0;
+    }
+
+    return code;
+}
+
+/* find the list and item with a particular key */
+int32_t
+RadixTree::find(std::string *keyp, dqueue<Item> **listpp, Item **itempp)
+{
+    Leaf *leafp;
+    Node **parentpp;
+    int32_t keyByte;
+
+    leafp = findLeaf(keyp, &parentpp, &keyByte);
+    if (leafp == NULL) {
+        /* key doesn't exist */
+        return -1;
+    }
+
+    *listpp = &leafp->_items;
+    *itempp = leafp->_items.head();
+    return 0;
 }
 
 int32_t
@@ -93,56 +786,115 @@ RadixTree::lookup(std::string *keyp, void **objp)
         return code;
     }
 
-    *objp = itemp;
+    *objp = itemp->_backp;
     return 0;
 }
 
 int32_t
 RadixTree::insert(std::string *keyp, Item *recordItemp, void *objp)
 {
+    Node **refpp;
+    Node **childpp;
+    Node *nodep;
+    Leaf *leafp;
+    Inner *innerp;
+    Node4 *newp;
+    const uint8_t *kp;
+    const uint8_t *okp;
+    uint32_t len;
+    uint32_t olen;
+    uint32_t plen;
+    uint32_t depth;
     uint32_t i;
-    uint32_t ix;
-    Item *itemp;
-    Item *prevItemp;
-    Ptr *ptrp;
-    dqueue<Item> *listp;
+    uint8_t okey;
+
+    osp_assert(_applyCount == 0);
 
     recordItemp->_keyp = keyp;
     recordItemp->_backp = objp;
 
-    ptrp = &_root;
-    for(i=0;i<_levelCount;i++) {
-        if (ptrp->_type == _typeNull) {
-            /* have to allocate this */
-            ptrp->_type = _typeNode;
-            ptrp->_u._nodep = new Node();
+    kp = (const uint8_t *) keyp->data();
+    len = (uint32_t) keyp->length();
+    refpp = &_rootp;
+    depth = 0;
+    while(1) {
+        nodep = *refpp;
+        if (nodep == NULL) {
+            *refpp = newLeaf(recordItemp);
+            break;
         }
-        ix = recordItemp->getKeyByte(i);
-        ptrp = ptrp->_u._nodep->_ptr+ix;
-    }
 
-    /* here, ptrp points to a pointer in the last digit Node that points to
-     * a linked list of objects, or is null.
-     */
-    osp_assert(ptrp->_type != _typeNode);
-    if (ptrp->_type == _typeNull) {
-        ptrp->_type = _typeList;
-        ptrp->_u._listp = new dqueue<Item>;
-    }
-
-    /* now insert the new item sorted into this list */
-    listp = ptrp->_u._listp;
-    for( prevItemp = NULL, itemp = listp->head();
-         itemp;
-         prevItemp = itemp, itemp = itemp->_dqNextp) {
-        if (*itemp->_keyp > *recordItemp->_keyp) {
+        if (nodep->_type == _typeLeaf) {
+            leafp = static_cast<Leaf *>(nodep);
+            if (*leafp->_keyp == *keyp) {
+                leafp->_items.append(recordItemp);
+                break;
+            }
+
+            /* split the leaf: a new node gets the bytes both keys still
+             * share, and the two leaves go under it.
+             */
+            okp = (const uint8_t *) leafp->_keyp->data();
+            olen = (uint32_t) leafp->_keyp->length();
+            for(i=depth; i<len && i<olen && kp[i] == okp[i]; i++)
+                ;
+            newp = new Node4();
+            newp->_prefix.assign((const char *) kp+depth, i-depth);
+            if (i == olen)
+                newp->_termp = leafp;
+            else
+                putChild(newp, okp[i], leafp);
+            if (i == len)
+                newp->_termp = newLeaf(recordItemp);
+            else
+                putChild(newp, kp[i], newLeaf(recordItemp));
+            *refpp = newp;
+            break;
+        }
+
+        innerp = static_cast<Inner *>(nodep);
+        plen = (uint32_t) innerp->_prefix.length();
+        for( i=0;
+             i<plen && depth+i<len && (uint8_t) innerp->_prefix[i] == kp[depth+i];
+             i++)
+            ;
+        if (i < plen) {
+            /* key leaves the prefix partway; split the prefix with a new
+             * node over this one.
+             */
+            newp = new Node4();
+            newp->_prefix.assign(innerp->_prefix, 0, i);
+            okey = innerp->_prefix[i];
+            innerp->_prefix.erase(0, i+1);
+            putChild(newp, okey, innerp);
+            if (depth+i == len)
+                newp->_termp = newLeaf(recordItemp);
+            else
+                putChild(newp, kp[depth+i], newLeaf(recordItemp));
+            *refpp = newp;
+            break;
+        }
+        depth += plen;
+
+        if (depth == len) {
+            if (innerp->_termp)
+                innerp->_termp->_items.append(recordItemp);
+            else
+                innerp->_termp = newLeaf(recordItemp);
             break;
         }
+
+        childpp = findChild(innerp, kp[depth]);
+        if (childpp == NULL) {
+            addChild(refpp, kp[depth], newLeaf(recordItemp));
+            break;
+        }
+        refpp = childpp;
+        depth++;
     }
 
-    /* insert before item that stopped our scan (i.e. after prevItemp) */
-    listp->insertAfter(prevItemp, recordItemp);
     recordItemp->_inList = 1;
+    _itemCount++;
 
     return 0;
 }
@@ -153,34 +905,75 @@ RadixTree::insert(std::string *keyp, Item *recordItemp, void *objp)
 int32_t
 RadixTree::remove(std::string *keyp, void *objp)
 {
-    int32_t code;
+    Leaf *leafp;
+    Node **parentpp;
+    int32_t keyByte;
     Item *itemp;
     Item *nitemp;
-    dqueue<Item> *listp;
-
-    code = find(keyp, &listp, &itemp);
-    if (code != 0) {
-        return code;
-    }
+    int removed;
 
-    if (objp != NULL && objp == itemp) {
-        /* we were asked to remove a single object, and find returned it, so no further
-         * search is necessary.
-         */
-        listp->remove(itemp);
-        return 0;
-    }
+    leafp = findLeaf(keyp, &parentpp, &keyByte);
+    if (leafp == NULL)
+        return -1;
 
-    /* otherwise, we search the list for this object, or if objp is null, for all
-     * objects, and remove them.
-     */
-    for( itemp = listp->head(); itemp; itemp=nitemp) {
+    /* remove the matching object, or if objp is null, all objects */
+    removed = 0;
+    for( itemp = leafp->_items.head(); itemp; itemp=nitemp) {
         nitemp = itemp->_dqNextp;       /* before removing */
-        if ( *itemp->_keyp == *keyp &&
-             (objp == NULL || objp == itemp->_backp)) {
-            listp->remove(itemp);
+        if (objp == NULL || objp == itemp->_backp) {
+            leafp->_items.remove(itemp);
+            itemp->_inList = 0;
+            _itemCount--;
+            removed = 1;
         }
     }
+    if (!removed)
+        return -1;
 
+    leafEmptied(leafp, parentpp, keyByte);
     return 0;
 }
+
+int32_t
+RadixTree::removeItem(Item *itemp)
+{
+    Leaf *leafp;
+    Node **parentpp;
+    int32_t keyByte;
+
+    if (!itemp->_inList)
+        return -1;
+
+    leafp = findLeaf(itemp->_keyp, &parentpp, &keyByte);
+    if (leafp == NULL)
+        return -1;
+
+    leafp->_items.remove(itemp);
+    itemp->_inList = 0;
+    _itemCount--;
+
+    leafEmptied(leafp, parentpp, keyByte);
+    return 0;
+}
+
+/* called after removing items from a leaf; frees the leaf if that left
+ * it empty.
+ */
+void
+RadixTree::leafEmptied(Leaf *leafp, Node **parentpp, int32_t keyByte)
+{
+    if (!leafp->_items.empty()) {
+        /* the key we pointed at may have been removed */
+        leafp->_keyp = leafp->_items.head()->_keyp;
+        return;
+    }
+
+    _keyCount--;
+    if (_applyCount > 0) {
+        /* our caller may be iterating over this leaf */
+        _emptyCount++;
+    }
+    else {
+        dropLeaf(leafp, parentpp, keyByte);
+    }
+}
@@ -446,20 +446,14 @@ Rst::Call::init( const char *relPathp,
 {
     int32_t code;
 
-    _relPathp = relPathp;
-    _sendProcp = sendProcp;
-    _sendHeadersp = sendHeadersp;
-    _rcvProcp = rcvProcp;
-    _rcvHeadersp = rcvHeadersp;
-    _headersDoneProcp = headersDoneProcp;
-    _allDoneProcp = allDoneProcp;
-    _inputDoneProcp = NULL;
-    _contextp = contextp;
-    _timerp = NULL;
-
-    _error = 0;
-    _httpError = 200;
-    _setPlaylistHost = 0;
+    prepare( relPathp,
+             sendProcp,
+             sendHeadersp,
+             rcvProcp,
+             rcvHeadersp,
+             headersDoneProcp,
+             allDoneProcp,
+             contextp);
 
     code = sendOperation();
 
@@ -531,17 +525,71 @@ Rst::splitUrl( std::string url,
 
 int32_t
 Rst::Call::sendOperation()
+{
+    int32_t code;
+
+    startTimer();
+
+    code = sendRequest(/* doFlush */ 1);
+    if (code < 0)
+        return code;
+
+    return rcvResponse();
+}
+
+void
+Rst::Call::startTimer()
+{
+    _timerMutex.take();
+    osp_assert(_timerp == NULL);
+    _timerp = new OspTimer();
+    _timerp->init(60000, &Rst::Call::callExpired, this);
+    _timerMutex.release();
+}
+
+/* setup a call without sending anything, for use by callers who will
+ * call sendRequest and rcvResponse themselves, e.g. to pipeline
+ * several calls on one connection.
+ */
+void
+Rst::Call::prepare( const char *relPathp,
+                    CopyProc *sendProcp,
+                    HdrQueue *sendHeadersp,
+                    CopyProc *rcvProcp,
+                    HdrQueue *rcvHeadersp,
+                    CompletionProc *headersDoneProcp,
+                    CompletionProc *allDoneProcp,
+                    void *contextp)
+{
+    _relPathp = relPathp;
+    _sendProcp = sendProcp;
+    _sendHeadersp = sendHeadersp;
+    _rcvProcp = rcvProcp;
+    _rcvHeadersp = rcvHeadersp;
+    _headersDoneProcp = headersDoneProcp;
+    _allDoneProcp = allDoneProcp;
+    _inputDoneProcp = NULL;
+    _contextp = contextp;
+    _timerp = NULL;
+
+    _error = 0;
+    _httpError = 200;
+    _setPlaylistHost = 0;
+}
+
+/* send the request line, headers and any data; returns 0 or a
+ * negative error code, in which case the call has been finished.
+ * If doFlush is 0, a request without data may be left buffered in
+ * the socket, so that the next request can share its packet.
+ */
+int32_t
+Rst::Call::sendRequest(int doFlush)
 {
     std::string firstLine;
     int32_t code;
     char tbuffer[RST_COMMON_MAX_BYTES];
     Hdr *hdrp;
     BufGen *socketp = _rstp->_bufGenp;
-    char *tp;
-
-    /* start timer */
-    _timerp = new OspTimer();
-    _timerp->init(60000, &Rst::Call::callExpired, this);
 
     firstLine = _op;
     firstLine += " ";
@@ -585,12 +633,6 @@ Rst::Call::sendOperation()
 
     code = (int32_t) socketp->write((char *) firstLine.c_str(),
                                     (int32_t) firstLine.length());
-    if (code < 0) {
-        finished();
-        return code;
-    }
-
-    code = socketp->flush();
     if (code < 0) {
         _error = 100;
         finished();
@@ -598,6 +640,13 @@ Rst::Call::sendOperation()
     }
 
     if ((_op == "PUT" || _op == "POST") && _sendContentLength != 0) {
+        code = socketp->flush();
+        if (code < 0) {
+            _error = 100;
+            finished();
+            return code;
+        }
+
         code = sendData();
         if (code < 0) {
             _error = 100;
@@ -605,6 +654,28 @@ Rst::Call::sendOperation()
             return code;
         }
     }
+    else if (doFlush) {
+        code = socketp->flush();
+        if (code < 0) {
+            _error = 100;
+            finished();
+            return code;
+        }
+    }
+
+    return 0;
+}
+
+/* read the response to a request sent by sendRequest; the call is
+ * finished when this returns.
+ */
+int32_t
+Rst::Call::rcvResponse()
+{
+    int32_t code;
+    char tbuffer[RST_COMMON_MAX_BYTES];
+    BufGen *socketp = _rstp->_bufGenp;
+    char *tp;
 
     code = socketp->readLine(tbuffer, sizeof(tbuffer));
     if (code < 0) {
@@ -189,11 +189,35 @@ class Rst {
                       CompletionProc *allDoneProcp,
                       void *contextp);
 
+        /* like init, but doesn't send anything; follow with
+         * startTimer, sendRequest and rcvResponse.
+         */
+        void prepare( const char *relPathp,
+                      CopyProc *sendProcp,
+                      HdrQueue *sendHeadersp,
+                      CopyProc *rcvProcp,
+                      HdrQueue *rcvHeadersp,
+                      CompletionProc *headersDoneProcp,
+                      CompletionProc *allDoneProcp,
+                      void *contextp);
+
         /* abort a call in progress */
         void abort(int32_t httpCode);
 
         int32_t sendOperation();
 
+        void startTimer();
+
+        /* finish a prepared call that won't be sent or answered */
+        void fail(int32_t error) {
+            _error = error;
+            finished();
+        }
+
+        int32_t sendRequest(int doFlush);
+
+        int32_t rcvResponse();
+
         Call(Rst *rstp);
 
         ~Call();
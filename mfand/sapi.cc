@@ -23,14 +23,22 @@ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
  */
 
+#include <errno.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <pthread.h>
+#include <sys/stat.h>
+
+#include <vector>
 
 #include "bufsocket.h"
 #include "buftls.h"
 #include "sapi.h"
 
+CThreadMutex SApi::Template::_cacheLock;
+dqueue<SApi::Template> SApi::Template::_cache[SApi::Template::_hashSize];
+
 /* task main loop to listen for incoming connections.
  *
  * The basic model is that a connection arrives and we create a
@@ -330,87 +338,271 @@ SApi::ServerConn::listenConn(void *cxp)
 /* static */ int32_t
 SApi::ServerConn::interpretFile(const char *fileNamep, SApi::Dict *dictp, std::string *responsep)
 {
-    FILE *filep;
-    int tc;
-    int inDollar;
-    char opcode;
-    std::string parm;
-    std::string interpretedParm;
+    Template *templatep;
     int32_t code;
 
     responsep->erase();
-    filep = fopen(fileNamep, "r");
-    if (!filep)
-        return -1;
+    code = Template::get(fileNamep, &templatep);
+    if (code)
+        return code;
 
-    inDollar = 0;
-    while(1) {
-        tc = fgetc(filep);
-        if (tc < 0)
-            break;
-        if (!inDollar) {
-            if (tc == '$') {
-                inDollar = 1;
-                opcode = 0;
-            }
-            else {
-                responsep->append(1, tc);
+    code = templatep->render(dictp, responsep);
+    templatep->release();
+    return code;
+}
+
+/* parse the template text into segments.  A '$$' turns into a
+ * literal '$', and '$x:parm$' turns into a parameter slot with
+ * opcode 'x'.  Adjacent literal text is merged into a single
+ * segment.
+ */
+int32_t
+SApi::Template::compile(const char *datap, size_t length)
+{
+    const char *endp = datap + length;
+    const char *p;
+    const char *dollarp;
+    Segment *segp;
+    Segment *litp;
+    char opcode;
+
+    litp = NULL;
+    p = datap;
+    while(p < endp) {
+        dollarp = (const char *) memchr(p, '$', endp - p);
+        if (!dollarp)
+            dollarp = endp;
+
+        if (dollarp > p) {
+            if (!litp) {
+                litp = new Segment();
+                _segments.append(litp);
             }
+            litp->_text.append(p, dollarp - p);
+            _literalBytes += dollarp - p;
         }
-        else {
-            /* in a dollar sign region */
-            if (opcode == 0) {
-                /* about to read the opcode */
-                opcode = tc;
-                if (opcode == '$') {
-                    /* this is a '$$' string, which just turns into a $ character */
-                    responsep->append(1, '$');
-                    inDollar = 0;
-                    continue;
-                }
 
-                tc = fgetc(filep);
-                if (tc != ':') {
-                    /* this is all we expect with 1 char opcodes */
-                    fclose(filep);
-                    return -2;
-                }
-                parm.erase();
+        if (dollarp >= endp)
+            break;
+
+        /* skip the '$' and get the opcode */
+        p = dollarp+1;
+        if (p >= endp)
+            break;
+        opcode = *p++;
+        if (opcode == '$') {
+            /* this is a '$$' string, which just turns into a $ character */
+            if (!litp) {
+                litp = new Segment();
+                _segments.append(litp);
             }
-            else {
-                /* opcode parsed, get the rest of the string */
-                if (tc == '$') {
-                    /* we're done parsing the parameter string */
-                    code = interpretParm(opcode, &parm, &interpretedParm, dictp);
-                    if (code) {
-                        fclose(filep);
-                        return code;
-                    }
-                    responsep->append(interpretedParm);
-                    inDollar = 0;
-                }
-                else {
-                    /* just another character in the parameter string */
-                    parm.append(1, tc);
-                }
-            } /* saw opcode after '$' */
-        } /* if '$' */
-    } /* while */
+            litp->_text.append(1, '$');
+            _literalBytes++;
+            continue;
+        }
+
+        /* this is all we expect with 1 char opcodes */
+        if (p >= endp || *p != ':')
+            return -2;
+        p++;
+
+        dollarp = (const char *) memchr(p, '$', endp - p);
+        if (!dollarp) {
+            /* unterminated parameter at EOF is dropped */
+            break;
+        }
+
+        segp = new Segment();
+        segp->_opcode = opcode;
+        segp->_text.assign(p, dollarp - p);
+        _segments.append(segp);
+        _parmCount++;
+        litp = NULL;
+
+        p = dollarp+1;
+    }
 
-    fclose(filep);
     return 0;
 }
 
-/* static */ int32_t
+/* expand the template into *responsep, substituting parameters from
+ * dictp.  We resolve all of the parameters first so that the response
+ * can be sized with a single reserve.
+ */
+int32_t
+SApi::Template::render(Dict *dictp, std::string *responsep)
+{
+    Segment *segp;
+    std::vector<const std::string *> values;
+    const std::string *valuep;
+    size_t totalBytes;
+    uint32_t ix;
+    int32_t code;
+
+    values.reserve(_parmCount);
+    totalBytes = _literalBytes;
+    for(segp = _segments.head(); segp; segp=segp->_dqNextp) {
+        if (segp->_opcode == 0)
+            continue;
+        code = ServerConn::interpretParm(segp->_opcode, &segp->_text, &valuep, dictp);
+        if (code)
+            return code;
+        values.push_back(valuep);
+        totalBytes += valuep->length();
+    }
+
+    responsep->erase();
+    responsep->reserve(totalBytes);
+    ix = 0;
+    for(segp = _segments.head(); segp; segp=segp->_dqNextp) {
+        if (segp->_opcode == 0)
+            responsep->append(segp->_text);
+        else
+            responsep->append(*values[ix++]);
+    }
+
+    return 0;
+}
+
+SApi::Template::~Template()
+{
+    Segment *segp;
+
+    while((segp = _segments.pop()) != NULL) {
+        delete segp;
+    }
+}
+
+/* drop a reference obtained from Template::get */
+void
+SApi::Template::release()
+{
+    int doFree;
+
+    _cacheLock.take();
+    osp_assert(_refCount > 0);
+    _refCount--;
+    doFree = (_refCount == 0);
+    _cacheLock.release();
+
+    if (doFree)
+        delete this;
+}
+
+/* static; return a held, compiled template for the named file,
+ * compiling the file only if we don't have a cached copy matching
+ * the file's current mtime and size.
+ */
+int32_t
+SApi::Template::get(const char *fileNamep, Template **templatepp)
+{
+    struct stat tstat;
+    Template *templatep;
+    Template *oldp;
+    uint32_t ix;
+    int fd;
+    int32_t code;
+    char *datap;
+    ssize_t nbytes;
+    off_t totalBytes;
+    std::string fileName(fileNamep);
+
+    *templatepp = NULL;
+
+    fd = open(fileNamep, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    code = fstat(fd, &tstat);
+    if (code < 0) {
+        close(fd);
+        return -1;
+    }
+
+    ix = SApi::hashString(&fileName) % _hashSize;
+    _cacheLock.take();
+    for(templatep = _cache[ix].head(); templatep; templatep=templatep->_dqNextp) {
+        if (templatep->_fileName == fileName)
+            break;
+    }
+    if ( templatep &&
+         templatep->_mtimeSec == tstat.st_mtime &&
+         templatep->_fileSize == tstat.st_size) {
+        templatep->_refCount++;
+        _cacheLock.release();
+        close(fd);
+        *templatepp = templatep;
+        return 0;
+    }
+    _cacheLock.release();
+
+    /* read the whole file and compile it; a short read would cache a
+     * truncated template under the full file's mtime and size.
+     */
+    datap = new char[tstat.st_size + 1];
+    totalBytes = 0;
+    while(totalBytes < tstat.st_size) {
+        nbytes = read(fd, datap + totalBytes, tstat.st_size - totalBytes);
+        if (nbytes < 0 && errno == EINTR)
+            continue;
+        if (nbytes <= 0)
+            break;
+        totalBytes += nbytes;
+    }
+    close(fd);
+    if (totalBytes != tstat.st_size) {
+        delete [] datap;
+        return -1;
+    }
+
+    templatep = new Template();
+    templatep->_fileName = fileName;
+    templatep->_mtimeSec = tstat.st_mtime;
+    templatep->_fileSize = tstat.st_size;
+    code = templatep->compile(datap, totalBytes);
+    delete [] datap;
+    if (code) {
+        delete templatep;
+        return code;
+    }
+
+    /* replace any stale entry; someone may have beaten us to it, in
+     * which case we just replace theirs.  Our caller gets one
+     * reference and the cache holds the other.
+     */
+    _cacheLock.take();
+    for(oldp = _cache[ix].head(); oldp; oldp=oldp->_dqNextp) {
+        if (oldp->_fileName == fileName)
+            break;
+    }
+    if (oldp) {
+        _cache[ix].remove(oldp);
+        oldp->_inCache = 0;
+    }
+    _cache[ix].append(templatep);
+    templatep->_inCache = 1;
+    templatep->_refCount++;
+    _cacheLock.release();
+
+    if (oldp)
+        oldp->release();
+
+    *templatepp = templatep;
+    return 0;
+}
+
+/* static; resolve one template parameter to a value that stays in
+ * dictp, so the caller can append it without another copy.
+ */
+int32_t
 SApi::ServerConn::interpretParm( int opcode,
                                  std::string *parmp,
-                                 std::string *outParmp,
+                                 const std::string **valuepp,
                                  SApi::Dict *dictp)
 {
     if (opcode == 'v') {
-        if (dictp->lookup(*parmp, outParmp) == 0) {
+        *valuepp = dictp->find(parmp);
+        if (*valuepp)
             return 0;
-        }
         else
             return -4;
     }
@@ -500,29 +692,65 @@ SApi::addCookieState(std::string cookieId)
     return ep;
 }
 
-int32_t
-SApi::Dict::lookup(std::string inStr, std::string *outp)
+/* FNV-1a hash, for the dictionary and template cache */
+/* static */ uint64_t
+SApi::hashString(const std::string *strp)
+{
+    uint64_t hash;
+    const uint8_t *datap = (const uint8_t *) strp->c_str();
+    uint32_t nchars = strp->length();
+    uint32_t i;
+
+    hash = 0xcbf29ce484222325ULL;
+    for(i=0;i<nchars;i++) {
+        hash = hash ^ datap[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/* static */ uint32_t
+SApi::Dict::hashKey(const std::string *keyp)
+{
+    return SApi::hashString(keyp) % _hashSize;
+}
+
+const std::string *
+SApi::Dict::find(const std::string *keyp)
 {
     Elt *ep;
+    dqueue<Elt> *bucketp = &_hash[hashKey(keyp)];
 
-    for(ep = _all.head(); ep; ep=ep->_dqNextp) {
-        if (ep->_key == inStr) {
-            *outp = ep->_value;
-            return 0;
+    for(ep = bucketp->head(); ep; ep=ep->_dqNextp) {
+        if (ep->_key == *keyp) {
+            return &ep->_value;
         }
     }
-    return -1;
+    return NULL;
+}
+
+int32_t
+SApi::Dict::lookup(std::string inStr, std::string *outp)
+{
+    const std::string *valuep;
+
+    valuep = find(&inStr);
+    if (!valuep)
+        return -1;
+    *outp = *valuep;
+    return 0;
 }
 
 void
 SApi::Dict::erase()
 {
     Elt *ep;
-    Elt *nep;
+    uint32_t i;
 
-    for(ep=_all.head(); ep; ep=nep) {
-        nep = ep->_dqNextp;
-        delete ep;
+    for(i=0;i<_hashSize;i++) {
+        while((ep = _hash[i].pop()) != NULL) {
+            delete ep;
+        }
     }
 }
 
@@ -530,8 +758,9 @@ int32_t
 SApi::Dict::add(std::string inStr, std::string newStr)
 {
     Elt *ep;
+    dqueue<Elt> *bucketp = &_hash[hashKey(&inStr)];
 
-    for(ep = _all.head(); ep; ep=ep->_dqNextp) {
+    for(ep = bucketp->head(); ep; ep=ep->_dqNextp) {
         if (ep->_key == inStr) {
             /* update the value */
             ep->_value = newStr;
@@ -542,7 +771,7 @@ SApi::Dict::add(std::string inStr, std::string newStr)
     ep = new Elt;
     ep->_key = inStr;
     ep->_value = newStr;
-    _all.append(ep);
+    bucketp->append(ep);
     return 0;
 }
 
@@ -27,6 +27,7 @@ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #define _SAPI_H_ENV__ 1
 
 #include <stdlib.h>
+#include <sys/types.h>
 #include "dqueue.h"
 #include "cthread.h"
 
@@ -63,7 +64,12 @@ class SApi : public CThread {
         UrlEntry *_dqPrevp;
     };
 
+    /* dictionary of template parameters; hashed by key, since a
+     * template render looks up every parameter it substitutes.
+     */
     class Dict {
+        static const uint32_t _hashSize = 61;
+
         class Elt {
         public:
             std::string _key;
@@ -72,7 +78,9 @@ class SApi : public CThread {
             Elt *_dqPrevp;
         };
 
-        dqueue<Elt> _all;
+        dqueue<Elt> _hash[_hashSize];
+
+        static uint32_t hashKey(const std::string *keyp);
 
     public:
         void erase();
@@ -80,6 +88,72 @@ class SApi : public CThread {
         int32_t add(std::string instr, std::string outstr);
 
         int32_t lookup(std::string instr, std::string *outp);
+
+        /* returns a pointer to the value, valid until the dictionary is
+         * next modified, or NULL if the key isn't present.
+         */
+        const std::string *find(const std::string *keyp);
+
+        ~Dict() {
+            erase();
+        }
+    };
+
+    /* An HTML template file compiled into a list of segments, each
+     * either a literal span of text or a '$x:name$' parameter slot.
+     * Compiled templates are cached by file name, and recompiled
+     * if the file's mtime or size changes.  A template is held while being
+     * rendered, so that a recompile doesn't free it out from under
+     * another user thread.
+     */
+    class Template {
+    public:
+        class Segment {
+        public:
+            char _opcode;       /* 0 for literal text */
+            std::string _text;  /* literal text, or parameter name */
+            Segment *_dqNextp;
+            Segment *_dqPrevp;
+
+            Segment() {
+                _opcode = 0;
+            }
+        };
+
+        static const uint32_t _hashSize = 31;
+        static CThreadMutex _cacheLock;
+        static dqueue<Template> _cache[_hashSize];
+
+        std::string _fileName;
+        time_t _mtimeSec;
+        off_t _fileSize;
+        uint32_t _refCount;     /* protected by _cacheLock */
+        uint8_t _inCache;
+        dqueue<Segment> _segments;
+        uint32_t _literalBytes;
+        uint32_t _parmCount;
+
+        Template *_dqNextp;     /* in _cache bucket */
+        Template *_dqPrevp;
+
+        Template() {
+            _mtimeSec = 0;
+            _fileSize = 0;
+            _refCount = 1;
+            _inCache = 0;
+            _literalBytes = 0;
+            _parmCount = 0;
+        }
+
+        ~Template();
+
+        int32_t compile(const char *datap, size_t length);
+
+        int32_t render(Dict *dictp, std::string *responsep);
+
+        static int32_t get(const char *fileNamep, Template **templatepp);
+
+        void release();
     };
 
     class CookieEntry {
@@ -265,7 +339,7 @@ class SApi : public CThread {
 
         static int32_t interpretParm( int opcode,
                                       std::string *parmNamep,
-                                      std::string *outParmp,
+                                      const std::string **valuepp,
                                       SApi::Dict *dictp);
 
         static int32_t ReqRcvProc( void *contextp,
@@ -479,6 +553,8 @@ class SApi : public CThread {
 
     static int32_t parseOpFromUrl(std::string *strp, std::string *resultp);
 
+    static uint64_t hashString(const std::string *strp);
+
     void initWithPort(uint16_t port);
 
     std::string getPathPrefix() {
@@ -13,15 +13,15 @@ displayStations(RadioScanQuery *queryp)
     uint32_t nextScannedVersion;
     uint32_t prevScannedVersion;
 
-    while(!queryp->_verifying) {
+    while(!queryp->isVerifying()) {
         printf("Searching, %s\n", queryp->getStatus().c_str());
         sleep(1);
     }
 
     uint32_t count=0;
-    for( stationp = queryp->_goodStations.head();
+    for( stationp = queryp->getFirstStation();
          stationp != nullptr;
-         stationp = stationp->_dqNextp) {
+         stationp = queryp->getNextStation(stationp)) {
         count++;
     }
     printf("Initial station list has %d entries\n", count);
@@ -29,23 +29,23 @@ displayStations(RadioScanQuery *queryp)
     // now watch for verification updatesx
     prevScannedVersion = 0;
     while(true) {
-        bool stopAfter = queryp->_allVerified;
-        nextScannedVersion = queryp->_nextVersion;
+        bool stopAfter = queryp->isAllVerified();
+        nextScannedVersion = queryp->getUpdateVersion();
 
-        for( stationp = queryp->_goodStations.head();
+        for( stationp = queryp->getFirstStation();
              stationp;
-             stationp = stationp->_dqNextp) {
-            if (stationp->_updateVersion >= prevScannedVersion) {
-                if (stationp->_verified) {
+             stationp = queryp->getNextStation(stationp)) {
+            if (stationp->getUpdateVersion() >= prevScannedVersion) {
+                if (stationp->isVerified()) {
                     printf("Update for station %s: verifiedWorking=%d\n",
-                           stationp->_stationName.c_str(), stationp->_verifiedWorking);
+                           stationp->_stationName.c_str(), stationp->isVerifiedWorking());
                     printf("Station name is '%s'\n", stationp->_stationName.c_str());
                     printf("Description:\n%s\n", stationp->_stationShortDescr.c_str());
                     if (stationp->_iconUrl.length() > 0)
                         printf("Icon %s\n", stationp->_iconUrl.c_str());
                     printf("Source was %s\n", stationp->_stationSource.c_str());
                     printf("Streams:\n");
-                    for(ep = stationp->_entries.head(); ep; ep=ep->_dqNextp) {
+                    for(ep = stationp->getFirstEntry(); ep; ep=stationp->getNextEntry(ep)) {
                         printf("%s with type=%s rate=%d kbits/sec(icy-br=%d)\n",
                                ep->_streamUrl.c_str(), ep->_streamType.c_str(), ep->_streamRateKb,
                                ep->_sawIcyBr);
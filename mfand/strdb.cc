@@ -92,14 +92,14 @@ UserDb::lookupUser( const char *emailp,         /* IN */
                     std::string *uidStrp)  /* OUT */
 {
     Json::Node *rootNodep;
-    Jsdb::Tran *tranp;
+    Jsdb::ReadTran *tranp;
     int32_t code;
     Json::Node *userNameNodep;
     Json::Node *passwordNodep;
     Json::Node *uidNodep;
     std::string emailStr;
 
-    tranp = new Jsdb::Tran();
+    tranp = new Jsdb::ReadTran();
     tranp->init(this);
 
     emailStr = std::string(emailp);
@@ -123,7 +123,7 @@ UserDb::lookupUser( const char *emailp,         /* IN */
         }
     }
 
-    tranp->commit();
+    tranp->end();
     return code;
 }
 
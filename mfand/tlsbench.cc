@@ -0,0 +1,235 @@
+/*
+
+Copyright 2016-2020 Cazamar Systems
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be
+included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ */
+
+/* TLS throughput benchmark for BufTls.  Run a server in one window
+ * with "tlsbench s <port>" from a directory containing test_cert.pem
+ * and test_key.pem, and then run "tlsbench c <port> <mbytes> [<writeSize>]"
+ * to time sending and then receiving that many megabytes, issuing
+ * BufTls writes of writeSize bytes each (default 16K).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <string>
+
+#include "buftls.h"
+
+void client(int argc, char **argv, int port);
+void server(int argc, char **argv, int port);
+
+int
+main(int argc, char **argv)
+{
+    int port;
+
+    if (argc <= 2) {
+        printf("usage: tlsbench c|s <port> [<mbytes> [<writeSize>]]\n");
+        printf("usage: mbytes and writeSize only present for client ('c')\n");
+        return 1;
+    }
+
+    port = atoi(argv[2]);
+
+    if (strcmp(argv[1], "c") == 0) {
+        client(argc-3, argv+3, port);
+    }
+    else if (strcmp(argv[1], "s") == 0) {
+        server(argc-3, argv+3, port);
+    }
+
+    return 0;
+}
+
+/* run one put or get of totalBytes over the connection, returning
+ * the elapsed time in ms, or -1 on failure.
+ */
+int64_t
+runOne(BufTls *socketp, int isPut, uint64_t totalBytes, char *bufferp, int32_t writeSize)
+{
+    char tbuffer[128];
+    uint64_t startMs;
+    uint64_t bytesLeft;
+    int32_t tcount;
+    int32_t code;
+
+    startMs = osp_time_ms();
+    snprintf(tbuffer, sizeof(tbuffer), "%s %llu\n",
+             (isPut? "put" : "get"), (unsigned long long) totalBytes);
+    code = socketp->write(tbuffer, strlen(tbuffer));
+    if (code < 0)
+        return -1;
+
+    if (isPut) {
+        bytesLeft = totalBytes;
+        while(bytesLeft > 0) {
+            tcount = (bytesLeft > (uint64_t) writeSize? writeSize : bytesLeft);
+            code = socketp->write(bufferp, tcount);
+            if (code != tcount)
+                return -1;
+            bytesLeft -= tcount;
+        }
+    }
+    socketp->flush();
+
+    if (!isPut) {
+        bytesLeft = totalBytes;
+        while(bytesLeft > 0) {
+            tcount = (bytesLeft > (uint64_t) writeSize? writeSize : bytesLeft);
+            code = socketp->read(bufferp, tcount);
+            if (code != tcount)
+                return -1;
+            bytesLeft -= tcount;
+        }
+    }
+
+    code = socketp->readLine(tbuffer, sizeof(tbuffer));
+    if (code < 0 || strcmp(tbuffer, "done") != 0)
+        return -1;
+
+    return osp_time_ms() - startMs;
+}
+
+void
+client(int argc, char **argv, int port)
+{
+    BufTls *socketp;
+    char *bufferp;
+    int32_t writeSize = 16384;
+    uint64_t totalBytes = 256ULL << 20;
+    int64_t putMs;
+    int64_t getMs;
+    char hostName[64];
+    BufTls::Stats stats;
+
+    if (argc > 0)
+        totalBytes = strtoull(argv[0], NULL, 10) << 20;
+    if (argc > 1)
+        writeSize = atoi(argv[1]);
+    if (writeSize <= 0)
+        writeSize = 1;
+
+    bufferp = new char[writeSize];
+    memset(bufferp, 'x', writeSize);
+
+    snprintf(hostName, sizeof(hostName), "127.0.0.1:%d", port);
+    socketp = new BufTls("");
+    socketp->init(hostName, port);
+
+    putMs = runOne(socketp, 1, totalBytes, bufferp, writeSize);
+    getMs = runOne(socketp, 0, totalBytes, bufferp, writeSize);
+    if (putMs < 0 || getMs < 0) {
+        printf("tlsbench: transfer failed\n");
+        return;
+    }
+
+    if (putMs == 0)
+        putMs = 1;
+    if (getMs == 0)
+        getMs = 1;
+    printf("tlsbench: %llu MB with %d byte ops: send %llu ms (%.1f MB/s), receive %llu ms (%.1f MB/s)\n",
+           (unsigned long long) (totalBytes >> 20), writeSize,
+           (unsigned long long) putMs, (totalBytes / 1048576.0) * 1000.0 / putMs,
+           (unsigned long long) getMs, (totalBytes / 1048576.0) * 1000.0 / getMs);
+
+    BufTls::getStats(&stats);
+    printf("tlsbench: %llu full and %llu resumed handshakes\n",
+           (unsigned long long) stats._fullHandshakes,
+           (unsigned long long) stats._resumedHandshakes);
+
+    socketp->disconnect();
+    delete socketp;
+    delete [] bufferp;
+}
+
+/* serve requests on one connection until the client goes away */
+void *
+serveConn(void *cxp)
+{
+    BufGen *socketp = (BufGen *) cxp;
+    char tbuffer[128];
+    char *bufferp;
+    uint64_t bytesLeft;
+    int32_t tcount;
+    int32_t code;
+    static const int32_t bufferSize = 65536;
+
+    bufferp = new char[bufferSize];
+    memset(bufferp, 'y', bufferSize);
+
+    while(1) {
+        code = socketp->readLine(tbuffer, sizeof(tbuffer));
+        if (code < 0)
+            break;
+
+        bytesLeft = strtoull(tbuffer+4, NULL, 10);
+        while(bytesLeft > 0) {
+            tcount = (bytesLeft > (uint64_t) bufferSize? bufferSize : bytesLeft);
+            if (strncmp(tbuffer, "put ", 4) == 0)
+                code = socketp->read(bufferp, tcount);
+            else
+                code = socketp->write(bufferp, tcount);
+            if (code != tcount)
+                break;
+            bytesLeft -= tcount;
+        }
+        if (bytesLeft > 0)
+            break;
+
+        socketp->write("done\n", 5);
+        socketp->flush();
+    }
+
+    socketp->disconnect();
+    delete socketp;
+    delete [] bufferp;
+    return NULL;
+}
+
+void
+server(int argc, char **argv, int port)
+{
+    BufTls *lsocketp;
+    BufGen *socketp;
+    pthread_t junk;
+    int32_t code;
+
+    lsocketp = new BufTls("");
+    lsocketp->init((char *) NULL, port);
+    code = lsocketp->listen();
+    if (code < 0) {
+        printf("tlsbench: listen failed code=%d\n", code);
+        return;
+    }
+
+    while(1) {
+        code = lsocketp->accept(&socketp);
+        if (code < 0)
+            continue;
+        pthread_create(&junk, NULL, serveConn, socketp);
+        pthread_detach(junk);
+    }
+}
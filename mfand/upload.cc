@@ -18,14 +18,273 @@
 /* stupid rabbit */
 UploadApp *UploadApp::_globalApp;
 
+void
+UploadManifest::clear()
+{
+    Entry *ep;
+    Entry *nextp;
+    uint32_t i;
+
+    _lock.take();
+    for(i=0;i<_hashSize;i++) {
+        for(ep = _hashTablep[i]; ep; ep = nextp) {
+            nextp = ep->_nextHashp;
+            delete ep;
+        }
+        _hashTablep[i] = NULL;
+    }
+    _count = 0;
+    _unsavedCount = 0;
+    _lock.release();
+}
+
+/* called with _lock held */
+void
+UploadManifest::rehash(uint32_t newSize)
+{
+    Entry **newTablep;
+    Entry *ep;
+    Entry *nextp;
+    uint32_t i;
+    uint32_t ix;
+
+    newTablep = new Entry *[newSize];
+    memset(newTablep, 0, newSize * sizeof(Entry *));
+    for(i=0;i<_hashSize;i++) {
+        for(ep = _hashTablep[i]; ep; ep = nextp) {
+            nextp = ep->_nextHashp;
+            ix = Cfs::fnvHash64(&ep->_relPath) % newSize;
+            ep->_nextHashp = newTablep[ix];
+            newTablep[ix] = ep;
+        }
+    }
+    delete [] _hashTablep;
+    _hashTablep = newTablep;
+    _hashSize = newSize;
+}
+
+/* called with _lock held */
+UploadManifest::Entry *
+UploadManifest::findNL(std::string *relPathp, uint64_t hash)
+{
+    Entry *ep;
+
+    for(ep = _hashTablep[hash % _hashSize]; ep; ep = ep->_nextHashp) {
+        if (ep->_relPath == *relPathp)
+            return ep;
+    }
+    return NULL;
+}
+
+int
+UploadManifest::isCurrent(std::string *relPathp, uint64_t size, uint64_t mtime)
+{
+    Entry *ep;
+    int rcode;
+
+    _lock.take();
+    ep = findNL(relPathp, Cfs::fnvHash64(relPathp));
+    rcode = (ep && ep->_size == size && ep->_mtime == mtime);
+    _lock.release();
+    return rcode;
+}
+
+void
+UploadManifest::update( std::string *relPathp,
+                        uint64_t size,
+                        uint64_t mtime,
+                        uint64_t cloudMtime,
+                        std::string *cloudIdp)
+{
+    Entry *ep;
+    uint64_t hash;
+    uint32_t ix;
+
+    hash = Cfs::fnvHash64(relPathp);
+
+    _lock.take();
+    ep = findNL(relPathp, hash);
+    if (!ep) {
+        if (_count >= 2 * _hashSize)
+            rehash(4 * _hashSize);
+        ep = new Entry();
+        ep->_relPath = *relPathp;
+        ix = hash % _hashSize;
+        ep->_nextHashp = _hashTablep[ix];
+        _hashTablep[ix] = ep;
+        _count++;
+    }
+    ep->_size = size;
+    ep->_mtime = mtime;
+    ep->_cloudMtime = cloudMtime;
+    ep->_cloudId = *cloudIdp;
+    _unsavedCount++;
+    _lock.release();
+}
+
+void
+UploadManifest::checkpoint()
+{
+    if (_unsavedCount >= _saveEvery)
+        save();
+}
+
+static void
+manifestPutString(FILE *filep, std::string *strp)
+{
+    uint32_t len = (uint32_t) strp->length();
+
+    fwrite(&len, sizeof(len), 1, filep);
+    fwrite(strp->c_str(), len, 1, filep);
+}
+
+/* returns 0 on success, -1 on EOF or a bogus length */
+static int32_t
+manifestGetString(FILE *filep, std::string *strp)
+{
+    uint32_t len;
+
+    /* paths can be longer than PATH_MAX, so just guard against
+     * a garbage length.
+     */
+    if (fread(&len, sizeof(len), 1, filep) != 1 || len > (1 << 20))
+        return -1;
+    strp->resize(len);
+    if (len > 0 && fread(&(*strp)[0], len, 1, filep) != 1)
+        return -1;
+    return 0;
+}
+
+int32_t
+UploadManifest::load()
+{
+    FILE *filep;
+    uint32_t magic;
+    uint32_t count;
+    uint32_t i;
+    std::string fsRoot;
+    std::string cloudRoot;
+    std::string relPath;
+    std::string cloudId;
+    uint64_t values[3];
+    int32_t code;
+
+    clear();
+
+    filep = fopen(_fileName.c_str(), "r");
+    if (!filep)
+        return -1;
+
+    code = -2;
+    if ( fread(&magic, sizeof(magic), 1, filep) != 1 ||
+         magic != _magic ||
+         fread(&count, sizeof(count), 1, filep) != 1 ||
+         manifestGetString(filep, &fsRoot) != 0 ||
+         manifestGetString(filep, &cloudRoot) != 0 ||
+         fsRoot != _fsRoot ||
+         cloudRoot != _cloudRoot) {
+        fclose(filep);
+        return code;
+    }
+
+    for(i=0;i<count;i++) {
+        if ( manifestGetString(filep, &relPath) != 0 ||
+             fread(values, sizeof(values), 1, filep) != 1 ||
+             manifestGetString(filep, &cloudId) != 0) {
+            /* truncated; forget all of it rather than trust part of it */
+            fclose(filep);
+            clear();
+            return code;
+        }
+        update(&relPath, values[0], values[1], values[2], &cloudId);
+    }
+    fclose(filep);
+
+    _unsavedCount = 0;
+    return 0;
+}
+
 int32_t
-DataSourceFile::open(const char *fileNamep)
+UploadManifest::save()
+{
+    FILE *filep;
+    std::string tempName;
+    Entry *ep;
+    uint32_t i;
+    uint64_t values[3];
+    uint32_t magic;
+    int32_t code;
+
+    tempName = _fileName + ".new";
+    magic = _magic;
+
+    _lock.take();
+    filep = fopen(tempName.c_str(), "w");
+    if (!filep) {
+        _lock.release();
+        return -1;
+    }
+
+    fwrite(&magic, sizeof(magic), 1, filep);
+    fwrite(&_count, sizeof(_count), 1, filep);
+    manifestPutString(filep, &_fsRoot);
+    manifestPutString(filep, &_cloudRoot);
+    for(i=0;i<_hashSize;i++) {
+        for(ep = _hashTablep[i]; ep; ep = ep->_nextHashp) {
+            manifestPutString(filep, &ep->_relPath);
+            values[0] = ep->_size;
+            values[1] = ep->_mtime;
+            values[2] = ep->_cloudMtime;
+            fwrite(values, sizeof(values), 1, filep);
+            manifestPutString(filep, &ep->_cloudId);
+        }
+    }
+
+    code = 0;
+    if (ferror(filep))
+        code = -2;
+    if (fclose(filep) != 0)
+        code = -2;
+    if (code == 0) {
+        if (rename(tempName.c_str(), _fileName.c_str()) != 0)
+            code = -3;
+        else
+            _unsavedCount = 0;
+    }
+    else
+        unlink(tempName.c_str());
+    _lock.release();
+
+    return code;
+}
+
+int32_t
+DataSourceFile::open(const char *fileNamep, CacheMode mode)
 {
     _fd = ::open(fileNamep, O_RDONLY);
     if (_fd < 0)
 	return -1;
-    else
-	return 0;
+
+    _cacheMode = mode;
+    if (mode == cacheDirect) {
+#if defined(O_DIRECT)
+        _directFd = ::open(fileNamep, O_RDONLY | O_DIRECT);
+#elif defined(F_NOCACHE)
+        _directFd = ::open(fileNamep, O_RDONLY);
+        if (_directFd >= 0)
+            fcntl(_directFd, F_NOCACHE, 1);
+#endif
+        /* some file systems, like tmpfs, won't do direct I/O */
+        if (_directFd < 0)
+            _cacheMode = cacheDropBehind;
+    }
+
+#ifdef POSIX_FADV_SEQUENTIAL
+    if (_cacheMode != cacheDirect)
+        posix_fadvise(_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    return 0;
 }
 
 int32_t
@@ -46,31 +305,241 @@ DataSourceFile::getAttr(CAttr *attrp)
     return 0;
 }
 
+/* positional reads, so no lock is needed except to keep the hash
+ * straight when we're computing one.
+ */
 int32_t
 DataSourceFile::read( uint64_t offset, uint32_t count, char *bufferp)
 {
     int32_t code;
-    int64_t retOffset;
 
     if (_fd < 0)
 	return -1;
 
-    /* make seek + read for this file atomic */
-    _lock.take();
+    if (_cacheMode == cacheDirect)
+        code = readDirect(offset, count, bufferp);
+    else
+        code = (int32_t) pread(_fd, bufferp, count, offset);
+    if (code < 0)
+        return -1;
 
-    retOffset = lseek(_fd, offset, SEEK_SET);
-    if (retOffset < 0) {
-	_lock.release();
-	return -1;
+#ifdef POSIX_FADV_DONTNEED
+    if (_cacheMode == cacheDropBehind && code > 0) {
+        posix_fadvise(_fd, offset, code, POSIX_FADV_DONTNEED);
+    }
+    else if (_cacheMode == cacheNormal && code == (int32_t) count) {
+        /* get the next chunk coming while this one's being sent */
+        posix_fadvise(_fd, offset + count, count, POSIX_FADV_WILLNEED);
     }
+#endif
 
-    code = (int32_t) ::read(_fd, bufferp, count);
+    /* hash whatever part of this we haven't seen yet */
+    if (code > 0 && _hashCtxp) {
+        _lock.take();
+        if (_hashValid) {
+            if (offset > _hashOffset)
+                _hashValid = 0;
+            else if (offset + code > _hashOffset) {
+                EVP_DigestUpdate( _hashCtxp,
+                                  bufferp + (_hashOffset - offset),
+                                  offset + code - _hashOffset);
+                _hashOffset = offset + code;
+            }
+        }
+        _lock.release();
+    }
 
-    _lock.release();
+    return code;
+}
+
+/* read through _directFd, which needs the buffer, offset and count all
+ * aligned; if the caller's aren't, bounce the data through an aligned
+ * buffer of our own.
+ */
+int32_t
+DataSourceFile::readDirect( uint64_t offset, uint32_t count, char *bufferp)
+{
+    uint64_t alignedOffset;
+    uint32_t alignedCount;
+    uint32_t skip;
+    char *bouncep;
+    int32_t code;
+
+    if ( ((uintptr_t) bufferp % _directAlign) == 0 &&
+         (offset % _directAlign) == 0 &&
+         (count % _directAlign) == 0)
+        return (int32_t) pread(_directFd, bufferp, count, offset);
+
+    alignedOffset = offset - (offset % _directAlign);
+    skip = (uint32_t) (offset - alignedOffset);
+    alignedCount = (skip + count + _directAlign - 1) / _directAlign * _directAlign;
+    if (posix_memalign((void **) &bouncep, _directAlign, alignedCount) != 0)
+        return -1;
+
+    code = (int32_t) pread(_directFd, bouncep, alignedCount, alignedOffset);
+    if (code > (int32_t) skip) {
+        code -= skip;
+        if (code > (int32_t) count)
+            code = count;
+        memcpy(bufferp, bouncep + skip, code);
+    }
+    else if (code >= 0)
+        code = 0;
 
+    free(bouncep);
     return code;
 }
 
+void
+DataSourceFile::startHash()
+{
+    if (!_hashCtxp)
+        _hashCtxp = EVP_MD_CTX_new();
+    EVP_DigestInit_ex(_hashCtxp, EVP_blake2b512(), NULL);
+    _hashOffset = 0;
+    _hashValid = 1;
+}
+
+/* get the digest of the first _digestBytes of the BLAKE2b hash, if
+ * every byte of a file 'length' bytes long went through it.
+ */
+int
+DataSourceFile::finishHash(uint64_t length, uint8_t *digestp)
+{
+    uint8_t fullDigest[EVP_MAX_MD_SIZE];
+    unsigned int digestLength;
+
+    if (!_hashCtxp || !_hashValid || _hashOffset != length)
+        return 0;
+    _hashValid = 0;
+    if (!EVP_DigestFinal_ex(_hashCtxp, fullDigest, &digestLength))
+        return 0;
+    memcpy(digestp, fullDigest, _digestBytes);
+    return 1;
+}
+
+/* read the whole file just to hash it */
+int32_t
+DataSourceFile::computeHash(uint64_t length, uint8_t *digestp)
+{
+    static const uint32_t bufferBytes = 1024*1024;
+    char *bufferp;
+    uint64_t offset;
+    int32_t code;
+
+    startHash();
+    bufferp = new char[bufferBytes];
+    for(offset = 0; offset < length; offset += code) {
+        code = read(offset, bufferBytes, bufferp);
+        if (code <= 0)
+            break;
+    }
+    delete [] bufferp;
+
+    return (finishHash(length, digestp)? 0 : -1);
+}
+
+UploadDedup::~UploadDedup()
+{
+    uint32_t i;
+    Entry *ep;
+    Entry *nextp;
+
+    for(i=0;i<_hashSize;i++) {
+        for(ep = _hashTablep[i]; ep; ep = nextp) {
+            nextp = ep->_nextHashp;
+            delete ep;
+        }
+    }
+    delete [] _hashTablep;
+    delete [] _lengthMapp;
+}
+
+UploadDedup::Entry *
+UploadDedup::findNL(uint64_t length, uint8_t *digestp)
+{
+    Entry *ep;
+
+    for(ep = _hashTablep[hashKey(length, digestp)]; ep; ep = ep->_nextHashp) {
+        if ( ep->_length == length &&
+             memcmp(ep->_digest, digestp, DataSourceFile::_digestBytes) == 0)
+            return ep;
+    }
+    return NULL;
+}
+
+int
+UploadDedup::find(uint64_t length, uint8_t *digestp, std::string *cloudIdp, uint64_t *cloudMtimep)
+{
+    Entry *ep;
+
+    _lock.take();
+    ep = findNL(length, digestp);
+    if (ep) {
+        *cloudIdp = ep->_cloudId;
+        *cloudMtimep = ep->_cloudMtime;
+    }
+    _lock.release();
+    return (ep != NULL);
+}
+
+void
+UploadDedup::add(uint64_t length, uint8_t *digestp, std::string *cloudIdp, uint64_t cloudMtime)
+{
+    Entry *ep;
+    uint32_t bit;
+    uint32_t ix;
+
+    if (cloudIdp->length() == 0)
+        return;
+
+    _lock.take();
+    ep = findNL(length, digestp);
+    if (ep) {
+        ep->_cloudId = *cloudIdp;
+        ep->_cloudMtime = cloudMtime;
+    }
+    else if (_count < _maxEntries) {
+        ep = new Entry();
+        ep->_length = length;
+        memcpy(ep->_digest, digestp, DataSourceFile::_digestBytes);
+        ep->_cloudId = *cloudIdp;
+        ep->_cloudMtime = cloudMtime;
+        ix = hashKey(length, digestp);
+        ep->_nextHashp = _hashTablep[ix];
+        _hashTablep[ix] = ep;
+        _count++;
+
+        bit = lengthBit(length);
+        _lengthMapp[bit>>3] |= (1 << (bit & 7));
+    }
+    _lock.release();
+}
+
+/* forget a file, probably because it's gone from the cloud; the length
+ * bitmap isn't cleared, since other files may share the bit.
+ */
+void
+UploadDedup::remove(uint64_t length, uint8_t *digestp)
+{
+    Entry **lepp;
+    Entry *ep;
+
+    _lock.take();
+    for( lepp = &_hashTablep[hashKey(length, digestp)];
+         (ep = *lepp) != NULL;
+         lepp = &ep->_nextHashp) {
+        if ( ep->_length == length &&
+             memcmp(ep->_digest, digestp, DataSourceFile::_digestBytes) == 0) {
+            *lepp = ep->_nextHashp;
+            delete ep;
+            _count--;
+            break;
+        }
+    }
+    _lock.release();
+}
+
 /* static */ int32_t
 UploadApp::parseInterval(std::string istring)
 {
@@ -144,6 +613,8 @@ Uploader::done(CDisp *disp, void *contextp)
 {
     Uploader *up = (Uploader *) contextp;
     printf("Uploader done for FS path=%s\n", up->_fsRoot.c_str());
+    if (up->_manifestp)
+        up->_manifestp->save();
     if (up->_stateProcp) {
         up->_stateProcp(up->_stateContextp);
     }
@@ -159,6 +630,7 @@ Uploader::start()
     int32_t code;
     std::string uploadUrl;
     WalkTask *taskp;
+    FsWatcher::Change *changep;
 
     printf("Uploader %p starts with cfsp=%p\n", this, _cfsp);
 
@@ -167,16 +639,16 @@ Uploader::start()
     _stopReason = REASON_DONE;
 
     code = _cfsp->root((Cnode **) &rootp, NULL);
-    if (checkAbort(code)) {
-        printf("root creation failed, probabliy auth issue\n");
+    if (code != 0) {
+        printf("root creation failed code=%d, probabliy auth issue\n", code);
+        startFailed(code);
         return;
     }
 
     code = rootp->getAttr(&attrs, NULL);
     if (code != 0) {
-        _status = STOPPED;
-        checkAbort(code);
         printf("root getattr failed code=%d\n", code);
+        startFailed(code);
         return;
     }
 
@@ -184,9 +656,8 @@ Uploader::start()
     if (code != 0) {
         code = _cfsp->mkpath(_cloudRoot, (Cnode **) &testDirp, NULL);
         if (code != 0) {
-            _status = STOPPED;
-            checkAbort(code);
             printf("mkpath failed code=%d\n", code);
+            startFailed(code);
             return;
         }
     }
@@ -199,9 +670,9 @@ Uploader::start()
     /* lookup succeeded */
     code = testDirp->getAttr(&dirAttrs, NULL);
     if (code != 0) {
-        _status = STOPPED;
         printf("dir getattr failed code=%d\n", code);
-        checkAbort(code);
+        testDirp->release();
+        startFailed(code);
         return;
     }
     testDirp->release();
@@ -211,6 +682,7 @@ Uploader::start()
     _filesCopied = 0;
     _bytesCopied = 0;
     _filesSkipped = 0;
+    _manifestSkips = 0;
     _fileCopiesFailed = 0;
 
     /* copy the pictures directory to a subdir of testdir */
@@ -219,11 +691,37 @@ Uploader::start()
     printf("Created new CDispGroup at %p\n", _group);
     _group->setCompletionProc(&Uploader::done, this);
 
-    printf("Starting copy\n");
-    taskp = new WalkTask();
-    taskp->initWithPath(_fsRoot);
-    taskp->setCallback(&Uploader::mainCallback, this);
-    _group->queueTask(taskp);
+    if (_changesp) {
+        /* an incremental pass: walk just what changed, which for a
+         * file is just the file, since WalkTask calls back for it.
+         */
+        printf("Starting incremental copy of %ld paths\n", (long) _changesp->count());
+        while((changep = _changesp->pop()) != NULL) {
+            taskp = new WalkTask();
+            taskp->initWithPath(_fsRoot + changep->_relPath);
+            taskp->setCallback(&Uploader::mainCallback, this);
+            taskp->setFast(/* batchSize */ 1);
+            if (!changep->_subtree) {
+                /* e.g. a directory's attributes changed, not its contents */
+                taskp->setEntryOnly();
+            }
+            _group->queueTask(taskp);
+            delete changep;
+        }
+        delete _changesp;
+        _changesp = NULL;
+    }
+    else {
+        printf("Starting copy\n");
+        taskp = new WalkTask();
+        taskp->initWithPath(_fsRoot);
+        taskp->setCallback(&Uploader::mainCallback, this);
+        /* each file's callback does a network upload, so keep them in
+         * separate tasks so they run in parallel.
+         */
+        taskp->setFast(/* batchSize */ 1);
+        _group->queueTask(taskp);
+    }
 
     _status = RUNNING;
 
@@ -237,6 +735,7 @@ Uploader::stop()
     if (_group)
         _group->stop();
     _status = STOPPED;
+    _stopReason = REASON_MANUAL;
     return;
 }
 
@@ -272,6 +771,13 @@ Uploader::mainCallback(void *contextp, std::string *pathp, struct stat *statp)
     std::string relativeName;
     CAttr cloudAttr;
     CAttr fsAttr;
+    CAttr srcAttr;
+    std::string cloudId;
+    std::string copyId;
+    uint8_t digest[DataSourceFile::_digestBytes];
+    int haveDigest = 0;
+    CfsStats *statsp;
+    DataSourceFile::CacheMode cacheMode;
 
     /* e.g. remove /usr/home from /usr/home/foo/bar, leaving /foo/bar */
     relativeName = pathp->substr(up->_fsRootLen);
@@ -279,14 +785,30 @@ Uploader::mainCallback(void *contextp, std::string *pathp, struct stat *statp)
     if (up->_verbose)
         printf("In walkcallback %s\n", pathp->c_str());
     cloudName = cfsp->legalizeIt(up->_cloudRoot + relativeName);
+    DataSourceFile::statToAttr(statp, &fsAttr);
+
+    /* if the manifest says we've uploaded this exact version before,
+     * we're done without asking the cloud.
+     */
+    if ( up->_manifestp && !up->_reconcile &&
+         ((statp->st_mode & S_IFMT) == S_IFREG ||
+          (statp->st_mode & S_IFMT) == S_IFLNK)) {
+        if (up->_manifestp->isCurrent(&relativeName, fsAttr._length, fsAttr._mtime)) {
+            if (up->_verbose)
+                printf("callback: skipping %s from manifest\n", pathp->c_str());
+            up->_filesSkipped++;
+            up->_manifestSkips++;
+            up->_bytesCopied += fsAttr._length;
+            return 0;
+        }
+    }
 
     /* before doing upload, stat the object to see if we've already done the copy; don't
      * do this for dirs.
      */
     if ((statp->st_mode & S_IFMT) == S_IFREG) {
-        code = cfsp->stat(cloudName, &cloudAttr, NULL);
+        code = cfsp->stat(cloudName, &cloudAttr, NULL, &cloudId);
         if (code == 0) {
-            DataSourceFile::statToAttr(statp, &fsAttr);
 
             if (fsAttr._length == cloudAttr._length &&
                 cloudAttr._mtime - fsAttr._mtime > 300*1000000000ULL) {
@@ -296,6 +818,11 @@ Uploader::mainCallback(void *contextp, std::string *pathp, struct stat *statp)
                  */
                 if (up->_verbose)
                     printf("callback: skipping already copied %s\n", pathp->c_str());
+                if (up->_manifestp) {
+                    up->_manifestp->update( &relativeName, fsAttr._length, fsAttr._mtime,
+                                            cloudAttr._mtime, &cloudId);
+                    up->_manifestp->checkpoint();
+                }
                 up->_filesSkipped++;
                 up->_bytesCopied += fsAttr._length;
                 return 0;
@@ -306,12 +833,16 @@ Uploader::mainCallback(void *contextp, std::string *pathp, struct stat *statp)
         }
     }
     else if ((statp->st_mode & S_IFMT) == S_IFLNK) {
-        code = cfsp->stat(cloudName, &cloudAttr, NULL);
+        code = cfsp->stat(cloudName, &cloudAttr, NULL, &cloudId);
         if (code == 0) {
-            DataSourceFile::statToAttr(statp, &fsAttr);
             if (cloudAttr._mtime - fsAttr._mtime > 100*1000000000ULL) {
                 if (up->_verbose)
                     printf("callback: skipping already copied symlink %s\n", pathp->c_str());
+                if (up->_manifestp) {
+                    up->_manifestp->update( &relativeName, fsAttr._length, fsAttr._mtime,
+                                            cloudAttr._mtime, &cloudId);
+                    up->_manifestp->checkpoint();
+                }
                 up->_filesSkipped++;
                 up->_bytesCopied += fsAttr._length;
                 return 0;
@@ -343,7 +874,10 @@ Uploader::mainCallback(void *contextp, std::string *pathp, struct stat *statp)
             printf("mkdir of %p done, code=%d\n", cloudName.c_str(), code);
     }
     else if ((statp->st_mode & S_IFMT) == S_IFREG) {
-        code = dataFile.open(pathp->c_str());
+        cacheMode = DataSourceFile::cacheNormal;
+        if (up->_bypassCacheBytes != 0 && fsAttr._length >= up->_bypassCacheBytes)
+            cacheMode = (up->_directIO? DataSourceFile::cacheDirect : DataSourceFile::cacheDropBehind);
+        code = dataFile.open(pathp->c_str(), cacheMode);
         if (code != 0) {
             up->_fileCopiesFailed++;
             logError(code, "failed to open regular file", *pathp);
@@ -352,8 +886,46 @@ Uploader::mainCallback(void *contextp, std::string *pathp, struct stat *statp)
             return code;
         }
 
+        /* with dedup, a file with the same length as one we've sent is
+         * hashed first, and copied on the server if it's a duplicate;
+         * any other file is hashed as it's sent.
+         */
+        if (up->_dedupp && fsAttr._length >= UploadDedup::_minBytes) {
+            if (!up->_dedupp->mayHave(fsAttr._length)) {
+                dataFile.startHash();
+            }
+            else if (dataFile.computeHash(fsAttr._length, digest) == 0) {
+                haveDigest = 1;
+                if (up->_dedupp->find(fsAttr._length, digest, &cloudId, &srcAttr._mtime)) {
+                    /* copy only if the original hasn't changed since */
+                    srcAttr._length = fsAttr._length;
+                    code = cfsp->copyFile(cloudName, cloudId, &srcAttr, NULL, &cloudAttr, &copyId);
+                    if (code == 0) {
+                        if (up->_verbose)
+                            printf("callback: copied duplicate %s\n", pathp->c_str());
+                        statsp = cfsp->getStats();
+                        statsp->_dedupFiles++;
+                        statsp->_dedupBytesSaved += fsAttr._length;
+                        up->_filesCopied++;
+                        up->_bytesCopied += fsAttr._length;
+
+                        /* the dedup index already has the source */
+                        up->recordUpload(&relativeName, &fsAttr, &copyId, cloudAttr._mtime);
+                        return 0;
+                    }
+                    if (up->checkAbort(code))
+                        return 0;
+
+                    /* the original may be gone, or changed; forget it, and
+                     * send ours.
+                     */
+                    up->_dedupp->remove(fsAttr._length, digest);
+                }
+            }
+        }
+
         /* send the file, updating bytesCopied on the fly */
-        code = cfsp->sendFile(cloudName, &dataFile, &up->_bytesCopied, NULL);
+        code = cfsp->sendFile(cloudName, &dataFile, &up->_bytesCopied, NULL, &cloudAttr, &cloudId);
 
         if (up->_verbose)
             printf("sendfile path=%s test done, code=%d\n", cloudName.c_str(), code);
@@ -364,13 +936,17 @@ Uploader::mainCallback(void *contextp, std::string *pathp, struct stat *statp)
         }
         else {
             up->_filesCopied++;
+            if (up->_dedupp && !haveDigest)
+                haveDigest = dataFile.finishHash(fsAttr._length, digest);
+            up->recordUpload( &relativeName, &fsAttr, &cloudId, cloudAttr._mtime,
+                              (haveDigest? digest : NULL));
         }
 
         /* dataFile destructor closes file */
     }
     else if ((statp->st_mode & S_IFMT) == S_IFLNK) {
         DataSourceString dataString("Symbolic link\n");
-        code = cfsp->sendFile(cloudName, &dataString, NULL, NULL);
+        code = cfsp->sendFile(cloudName, &dataString, NULL, NULL, &cloudAttr, &cloudId);
         if (up->_verbose)
             printf("sendfile path=%s link done code=%d\n", cloudName.c_str(), code);
         if (code) {
@@ -380,6 +956,7 @@ Uploader::mainCallback(void *contextp, std::string *pathp, struct stat *statp)
         }
         else {
             up->_filesCopied++;
+            up->recordUpload(&relativeName, &fsAttr, &cloudId, cloudAttr._mtime);
         }
     }
     else {
@@ -389,6 +966,32 @@ Uploader::mainCallback(void *contextp, std::string *pathp, struct stat *statp)
     return code;
 }
 
+/* note a successful upload in the manifest, and, given its digest, in
+ * the dedup index.  fsAttrp has the local attributes from the tree
+ * walk, so if the file changed while we were sending it, the next pass
+ * will see a different mtime and send it again.  The cloud ID and
+ * mtime are what sendFile or copyFile handed back; we have nothing to
+ * record if they couldn't.
+ */
+void
+Uploader::recordUpload( std::string *relPathp,
+                        CAttr *fsAttrp,
+                        std::string *cloudIdp,
+                        uint64_t cloudMtime,
+                        uint8_t *digestp)
+{
+    if (cloudIdp->length() == 0)
+        return;
+
+    if (_dedupp && digestp)
+        _dedupp->add(fsAttrp->_length, digestp, cloudIdp, cloudMtime);
+
+    if (_manifestp) {
+        _manifestp->update(relPathp, fsAttrp->_length, fsAttrp->_mtime, cloudMtime, cloudIdp);
+        _manifestp->checkpoint();
+    }
+}
+
 /* return true if we've encountered a fatal error */
 int
 Uploader::checkAbort(int32_t code)
@@ -405,6 +1008,18 @@ Uploader::checkAbort(int32_t code)
     return 0;
 }
 
+/* we couldn't get the pass going, so the watcher's journal no longer
+ * covers everything since the last pass that finished.
+ */
+void
+Uploader::startFailed(int32_t code)
+{
+    _status = STOPPED;
+    checkAbort(code);
+    if (_watcherp)
+        _watcherp->passDone(/* finished */ 0);
+}
+
 void
 Uploader::logError(int32_t code, std::string errorString, std::string longErrorString) {
     UploadApp *app = UploadApp::getGlobalApp();
@@ -512,8 +1127,17 @@ UploadApp::readConfig(std::string pathPrefix)
     int32_t code;
     uint8_t enabled;
     uint32_t backupInt;
+    uint32_t lastReconcileTime;
 
     _backupInterval = 24 * 3600;
+    _reconcileInterval = 30 * 24 * 3600;
+    _cacheMB = 0;
+    _watchChanges = 0;
+    _dedup = 0;
+    _bypassCacheMB = 0;
+    _directIO = 0;
+    _pipelineGets = 0;
+    _connIdleSec = 0;
 
     fileName = pathPrefix + "config.js";
     filep = fopen(fileName.c_str(), "r");
@@ -533,6 +1157,46 @@ UploadApp::readConfig(std::string pathPrefix)
             _backupInterval = backupInt;
     }
 
+    tnodep = rootNodep->searchForChild("reconcileInt");
+    if (tnodep) {
+        _reconcileInterval = atoi(tnodep->_children.head()->_name.c_str());
+    }
+
+    tnodep = rootNodep->searchForChild("cacheMB");
+    if (tnodep) {
+        _cacheMB = atoi(tnodep->_children.head()->_name.c_str());
+    }
+
+    tnodep = rootNodep->searchForChild("watchChanges");
+    if (tnodep) {
+        _watchChanges = atoi(tnodep->_children.head()->_name.c_str());
+    }
+
+    tnodep = rootNodep->searchForChild("dedup");
+    if (tnodep) {
+        _dedup = atoi(tnodep->_children.head()->_name.c_str());
+    }
+
+    tnodep = rootNodep->searchForChild("bypassCacheMB");
+    if (tnodep) {
+        _bypassCacheMB = atoi(tnodep->_children.head()->_name.c_str());
+    }
+
+    tnodep = rootNodep->searchForChild("directIO");
+    if (tnodep) {
+        _directIO = atoi(tnodep->_children.head()->_name.c_str());
+    }
+
+    tnodep = rootNodep->searchForChild("pipelineGets");
+    if (tnodep) {
+        _pipelineGets = atoi(tnodep->_children.head()->_name.c_str());
+    }
+
+    tnodep = rootNodep->searchForChild("connIdleSec");
+    if (tnodep) {
+        _connIdleSec = atoi(tnodep->_children.head()->_name.c_str());
+    }
+
     /* read the json from the file -- it's a structure with an array
      * named backupEntries, each of which contains tags cloudRoot,
      * fsRoot, and lastFinishedTime.
@@ -563,15 +1227,36 @@ UploadApp::readConfig(std::string pathPrefix)
             }
             else
                 enabled = 1;
+            nnodep = tnodep->searchForChild("lastReconcileTime");
+            if (nnodep) {
+                lastReconcileTime = atoi(nnodep->_children.head()->_name.c_str());
+            }
+            else
+                lastReconcileTime = 0;
 
             /* now add the entry */
-            addConfigEntry(cloudRoot, fsRoot, lastFinishedTime, enabled);
+            addConfigEntry(cloudRoot, fsRoot, lastFinishedTime, enabled, lastReconcileTime);
         }
     }
 }
 
+Cfs *
+UploadApp::newCfs()
+{
+    CfsMs *msp;
+
+    msp = new CfsMs(_loginCookiep, _pathPrefix);
+    if (_cacheMB != 0)
+        msp->setCacheBytes((uint64_t) _cacheMB << 20);
+    msp->setPipelineGets(_pipelineGets);
+    if (_connIdleSec != 0)
+        msp->setConnIdleMs(_connIdleSec * 1000);
+    msp->setLog(&_log);
+    return msp;
+}
+
 int32_t
-UploadApp::writeConfig(std::string pathPrefix)
+UploadApp::writeConfig(std::string pathPrefix, int entryLocked)
 {
     Json json;
     Json::Node *rootNodep;
@@ -598,6 +1283,54 @@ UploadApp::writeConfig(std::string pathPrefix)
     nnodep->initNamed("backupInt", tnodep);
     rootNodep->appendChild(nnodep);
 
+    tnodep = new Json::Node();
+    tnodep->initInt(_reconcileInterval);
+    nnodep = new Json::Node();
+    nnodep->initNamed("reconcileInt", tnodep);
+    rootNodep->appendChild(nnodep);
+
+    tnodep = new Json::Node();
+    tnodep->initInt(_cacheMB);
+    nnodep = new Json::Node();
+    nnodep->initNamed("cacheMB", tnodep);
+    rootNodep->appendChild(nnodep);
+
+    tnodep = new Json::Node();
+    tnodep->initInt(_watchChanges);
+    nnodep = new Json::Node();
+    nnodep->initNamed("watchChanges", tnodep);
+    rootNodep->appendChild(nnodep);
+
+    tnodep = new Json::Node();
+    tnodep->initInt(_dedup);
+    nnodep = new Json::Node();
+    nnodep->initNamed("dedup", tnodep);
+    rootNodep->appendChild(nnodep);
+
+    tnodep = new Json::Node();
+    tnodep->initInt(_bypassCacheMB);
+    nnodep = new Json::Node();
+    nnodep->initNamed("bypassCacheMB", tnodep);
+    rootNodep->appendChild(nnodep);
+
+    tnodep = new Json::Node();
+    tnodep->initInt(_directIO);
+    nnodep = new Json::Node();
+    nnodep->initNamed("directIO", tnodep);
+    rootNodep->appendChild(nnodep);
+
+    tnodep = new Json::Node();
+    tnodep->initInt(_pipelineGets);
+    nnodep = new Json::Node();
+    nnodep->initNamed("pipelineGets", tnodep);
+    rootNodep->appendChild(nnodep);
+
+    tnodep = new Json::Node();
+    tnodep->initInt(_connIdleSec);
+    nnodep = new Json::Node();
+    nnodep->initNamed("connIdleSec", tnodep);
+    rootNodep->appendChild(nnodep);
+
     /* create array */
     arrayNodep = new Json::Node();
     arrayNodep->initArray();
@@ -607,7 +1340,8 @@ UploadApp::writeConfig(std::string pathPrefix)
     nnodep->initNamed("backupEntries", arrayNodep);
     rootNodep->appendChild(nnodep);
 
-    _entryLock.take();
+    if (!entryLocked)
+        _entryLock.take();
     for(i=0;i<_maxUploaders;i++) {
         if ((ep = _uploadEntryp[i]) != NULL) {
             snodep = new Json::Node();
@@ -637,10 +1371,17 @@ UploadApp::writeConfig(std::string pathPrefix)
             nnodep->initNamed("enabled", tnodep);
             snodep->appendChild(nnodep);
 
+            tnodep = new Json::Node();
+            tnodep->initInt(ep->_lastReconcileTime);
+            nnodep = new Json::Node();
+            nnodep->initNamed("lastReconcileTime", tnodep);
+            snodep->appendChild(nnodep);
+
             arrayNodep->appendChild(snodep);
         } /* entry exists */
     } /* for each uploader */
-    _entryLock.release();
+    if (!entryLocked)
+        _entryLock.release();
 
     /* at this point, we unmarshal the tree into the file */
     fileName = pathPrefix + "config.js";
@@ -684,6 +1425,8 @@ UploadApp::deleteConfigEntry(int32_t ix)
 
     ep->stop();
     _uploadEntryp[ix] = NULL;
+    if (ep->_manifestp)
+        ep->_manifestp->unlinkFile();
     delete ep;
     return 0;
 }
@@ -713,7 +1456,8 @@ int32_t
 UploadApp::addConfigEntry( std::string cloudRoot,
                            std::string fsRoot,
                            uint32_t lastFinishedTime,
-                           int enabled)
+                           int enabled,
+                           uint32_t lastReconcileTime)
 {
     UploadEntry *ep;
     uint32_t i;
@@ -733,6 +1477,7 @@ UploadApp::addConfigEntry( std::string cloudRoot,
             /* update in place */
             ep->_cloudRoot = cloudRoot;
             ep->_lastFinishedTime = lastFinishedTime;
+            ep->_lastReconcileTime = lastReconcileTime;
             _entryLock.release();
             return 0;
         }
@@ -748,6 +1493,7 @@ UploadApp::addConfigEntry( std::string cloudRoot,
     ep->_app = this;
     ep->_cloudRoot = cloudRoot;
     ep->_lastFinishedTime = lastFinishedTime;
+    ep->_lastReconcileTime = lastReconcileTime;
     ep->_enabled = enabled;
     _uploadEntryp[bestFreeIx] = ep;
 
@@ -1482,6 +2228,21 @@ UploadReq::UploadInfoDataMethod()
                  "<tr><td>Lookup calls</td><td>%llu</td></tr>\n",
                  (long long) sp->_lookupCalls);
         response += tbuffer;
+        snprintf(tbuffer, sizeof(tbuffer),
+                 "<tr><td>Readdir calls / pages</td><td>%llu / %llu</td></tr>\n",
+                 (long long) sp->_readdirCalls,
+                 (long long) sp->_readdirPages);
+        response += tbuffer;
+        snprintf(tbuffer, sizeof(tbuffer),
+                 "<tr><td>Lookups from listing</td><td>%llu</td></tr>\n",
+                 (long long) sp->_listingHits);
+        response += tbuffer;
+        snprintf(tbuffer, sizeof(tbuffer),
+                 "<tr><td>Cnode recycles / over budget / hash grows</td><td>%llu / %llu / %llu</td></tr>\n",
+                 (long long) sp->_cnodeRecycles,
+                 (long long) sp->_cnodeOverflows,
+                 (long long) sp->_hashGrows);
+        response += tbuffer;
         snprintf(tbuffer, sizeof(tbuffer),
                  "<tr><td>SendSmallFiles</td><td>%llu</td></tr>\n",
                  (long long) sp->_sendSmallFilesCalls);
@@ -1494,10 +2255,43 @@ UploadReq::UploadInfoDataMethod()
                  "<tr><td>SendDataCalls</td><td>%llu</td></tr>\n",
                  (long long) sp->_sendDataCalls);
         response += tbuffer;
+        snprintf(tbuffer, sizeof(tbuffer),
+                 "<tr><td>Upload session resumes</td><td>%llu</td></tr>\n",
+                 (long long) sp->_sendDataResumes);
+        response += tbuffer;
+        snprintf(tbuffer, sizeof(tbuffer),
+                 "<tr><td>Batches / batched items</td><td>%llu / %llu</td></tr>\n",
+                 (long long) sp->_batchCalls,
+                 (long long) sp->_batchItems);
+        response += tbuffer;
+        snprintf(tbuffer, sizeof(tbuffer),
+                 "<tr><td>Request window / in flight</td><td>%u / %u</td></tr>\n",
+                 sp->_govWindow,
+                 sp->_govInFlight);
+        response += tbuffer;
+        snprintf(tbuffer, sizeof(tbuffer),
+                 "<tr><td>Throttles / window cuts / paused secs</td><td>%llu / %llu / %llu</td></tr>\n",
+                 (long long) sp->_throttleEvents,
+                 (long long) sp->_windowDecreases,
+                 (long long) sp->_retryAfterMs / 1000);
+        response += tbuffer;
+        snprintf(tbuffer, sizeof(tbuffer),
+                 "<tr><td>Requests held by governor</td><td>%llu</td></tr>\n",
+                 (long long) sp->_govWaits);
+        response += tbuffer;
         snprintf(tbuffer, sizeof(tbuffer),
                  "<tr><td>Mkdir calls</td><td>%llu</td></tr>\n",
                  (long long) sp->_mkdirCalls);
         response += tbuffer;
+        snprintf(tbuffer, sizeof(tbuffer),
+                 "<tr><td>Server side copies</td><td>%llu</td></tr>\n",
+                 (long long) sp->_copyCalls);
+        response += tbuffer;
+        snprintf(tbuffer, sizeof(tbuffer),
+                 "<tr><td>Duplicates copied / MB saved</td><td>%llu / %llu</td></tr>\n",
+                 (long long) sp->_dedupFiles,
+                 (long long) sp->_dedupBytesSaved >> 20);
+        response += tbuffer;
 
         response += "</table>\n";
 
@@ -1573,6 +2367,27 @@ UploadReq::UploadInfoDataMethod()
                  (long long) poolStats._healthyCount,
                  (long long) poolStats._activeCount);
         response += tbuffer;
+        snprintf(tbuffer, sizeof(tbuffer),
+                 "<tr><td>Conns total / idle</td><td>%llu / %llu</td></tr>\n",
+                 (long long) poolStats._connCount,
+                 (long long) poolStats._idleCount);
+        response += tbuffer;
+        snprintf(tbuffer, sizeof(tbuffer),
+                 "<tr><td>Conn gets / idle reuses</td><td>%llu / %llu</td></tr>\n",
+                 (long long) poolStats._getCount,
+                 (long long) poolStats._idleHits);
+        response += tbuffer;
+        snprintf(tbuffer, sizeof(tbuffer),
+                 "<tr><td>Avg/Max conn wait</td><td>%llu ms / %llu ms</td></tr>\n",
+                 (long long) (poolStats._getCount?
+                              poolStats._totalWaitMs / poolStats._getCount : 0),
+                 (long long) poolStats._longestWaitMs);
+        response += tbuffer;
+        snprintf(tbuffer, sizeof(tbuffer),
+                 "<tr><td>Conns created / reaped</td><td>%llu / %llu</td></tr>\n",
+                 (long long) poolStats._creations,
+                 (long long) poolStats._reaps);
+        response += tbuffer;
 
         response += "</table>\n";
 
@@ -2032,8 +2847,15 @@ UploadApp::stateChanged(void *contextp)
 {
     UploadEntry *ep = (UploadEntry *) contextp;
     UploadApp *app = ep->_app;
+    Uploader *uploaderp = ep->_uploaderp;
 
     ep->_lastFinishedTime = osp_time_sec();
+    if ( uploaderp &&
+         uploaderp->_reconcile &&
+         uploaderp->getStopReason() == Uploader::REASON_DONE)
+        ep->_lastReconcileTime = ep->_lastFinishedTime;
+    if (ep->_watcherp)
+        ep->_watcherp->passDone(uploaderp && uploaderp->finishedAll());
     app->writeConfig(app->_libPath);
 }
 
@@ -2042,6 +2864,8 @@ void
 UploadApp::startEntry(UploadEntry *ep) {
     Uploader *uploaderp;
     Uploader::Status upStatus;
+    int reconcile;
+    dqueue<FsWatcher::Change> *changesp;
 
     if (!ep || !_loginCookiep || !_loginCookiep->_loginMSp)
         return;
@@ -2053,37 +2877,117 @@ UploadApp::startEntry(UploadEntry *ep) {
             uploaderp->resume();
             return;
         }
-        else if (upStatus == Uploader::RUNNING) {
+        else if (upStatus != Uploader::STOPPED) {
             return;
         }
-        else if (upStatus == Uploader::STOPPED) {
-            delete uploaderp;
-            ep->_uploaderp = NULL;
-            uploaderp = NULL;
-        }
     }
-            
-    if (!uploaderp) {
-        if (!_cfsp) {
-            _cfsp = new CfsMs(_loginCookiep, _pathPrefix);
-            _cfsp->setLog(&_log);
+
+    /* we're starting a new pass */
+    openManifest(ep);
+    reconcile = ( ep->_manifestp->getCount() == 0 ||
+                  (_reconcileInterval != 0 &&
+                   ep->_lastReconcileTime + _reconcileInterval < osp_time_sec()));
+
+    /* if the watcher has a complete journal, we only need to look at
+     * what it saw change, and if nothing did, the pass is already done.
+     */
+    changesp = NULL;
+    if (_watchChanges) {
+        openWatcher(ep);
+        changesp = new dqueue<FsWatcher::Change>;
+        if (ep->_watcherp->takeChanges(changesp, reconcile) != 0) {
+            delete changesp;
+            changesp = NULL;
+        }
+        else if (changesp->count() == 0) {
+            delete changesp;
+            ep->_watcherp->passDone(1);
+            ep->_lastFinishedTime = osp_time_sec();
+            writeConfig(_libPath, /* entryLocked */ 1);
+            return;
         }
+    }
 
-        /* create the uploader */
-        ep->_uploaderp = uploaderp = new Uploader();
-        uploaderp->init(ep->_cloudRoot,
-                        ep->_fsRoot,
-                        _cdisp,
-                        _cfsp,
-                        &UploadApp::stateChanged,
-                        ep);
-        uploaderp->start();
+    if (uploaderp) {
+        delete uploaderp;
+        ep->_uploaderp = NULL;
+        uploaderp = NULL;
+    }
+
+    if (!_cfsp)
+        _cfsp = newCfs();
+
+    /* create the uploader */
+    ep->_uploaderp = uploaderp = new Uploader();
+    uploaderp->init(ep->_cloudRoot,
+                    ep->_fsRoot,
+                    _cdisp,
+                    _cfsp,
+                    &UploadApp::stateChanged,
+                    ep);
+    if (reconcile) {
+        /* rebuild from scratch, dropping files deleted locally */
+        ep->_manifestp->clear();
+    }
+    uploaderp->setManifest(ep->_manifestp, reconcile);
+    uploaderp->setChanges(changesp);
+    if (_watchChanges)
+        uploaderp->setWatcher(ep->_watcherp);
+    uploaderp->setCacheBypass((uint64_t) _bypassCacheMB << 20, _directIO);
+    if (_dedup) {
+        if (!_dedupp)
+            _dedupp = new UploadDedup();
+        uploaderp->setDedup(_dedupp);
+    }
+    uploaderp->start();
+}
+
+/* make sure the entry has a manifest for its current roots, loading
+ * it from disk if we just created it; called with _entryLock held and
+ * no uploader running.
+ */
+void
+UploadApp::openManifest(UploadEntry *ep)
+{
+    std::string fileName;
+    char tbuffer[32];
+
+    if (ep->_manifestp) {
+        if (ep->_manifestp->matches(&ep->_fsRoot, &ep->_cloudRoot))
+            return;
+        delete ep->_manifestp;
+        ep->_manifestp = NULL;
+    }
+
+    snprintf(tbuffer, sizeof(tbuffer), "%016llx",
+             (unsigned long long) Cfs::fnvHash64(&ep->_fsRoot));
+    fileName = _libPath + "manifest-" + tbuffer + ".dat";
+    ep->_manifestp = new UploadManifest(fileName, ep->_fsRoot, ep->_cloudRoot);
+    ep->_manifestp->load();
+}
+
+/* make sure the entry has a running watcher for its current root;
+ * called with _entryLock held.
+ */
+void
+UploadApp::openWatcher(UploadEntry *ep)
+{
+    if (ep->_watcherp) {
+        if (ep->_watcherp->matches(&ep->_fsRoot))
+            return;
+        delete ep->_watcherp;
+        ep->_watcherp = NULL;
     }
+
+    ep->_watcherp = new FsWatcher(ep->_fsRoot);
+    ep->_watcherp->start();
 }
 
 UploadEntry::~UploadEntry() {
     osp_assert(!_uploaderp || _uploaderp->isIdle());
     delete _uploaderp;
+    delete _manifestp;
+    delete _watcherp;
 }
 
 /* called with entryLock held */
@@ -9,6 +9,9 @@
 #endif
 
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include <string>
 #include <stdio.h>
 
@@ -460,6 +463,147 @@ UpnpDBase::applyTree( RadixTree *treep,
     treep->apply(procp, contextp, onlyUnique);
 }
 
+void
+UpnpDBase::applyPrefix( RadixTree *treep,
+                        std::string *prefixp,
+                        RadixTree::Callback *procp,
+                        void *contextp,
+                        int onlyUnique)
+{
+    treep->applyPrefix(prefixp, procp, contextp, onlyUnique);
+}
+
+/* insert a record under one key, and index the key if it's new */
+void
+UpnpDBase::linkKey( RadixTree *treep,
+                    uint8_t field,
+                    std::string *keyp,
+                    RadixTree::Item *itemp,
+                    Record *recordp)
+{
+    dqueue<RadixTree::Item> *listp;
+    RadixTree::Item *firstp;
+
+    treep->insert(keyp, itemp, recordp);
+    if ( treep->find(keyp, &listp, &firstp) == 0 &&
+         listp->count() == 1)
+        _searchIndex.add(field, keyp);
+}
+
+/* remove a record from under one key, and drop the key from the index
+ * if that was the last record with it.
+ */
+void
+UpnpDBase::unlinkKey( RadixTree *treep,
+                      uint8_t field,
+                      std::string *keyp,
+                      RadixTree::Item *itemp)
+{
+    dqueue<RadixTree::Item> *listp;
+    RadixTree::Item *firstp;
+
+    treep->removeItem(itemp);
+    if (treep->find(keyp, &listp, &firstp) != 0)
+        _searchIndex.remove(field, keyp);
+}
+
+void
+UpnpDBase::linkRecord(Record *recordp)
+{
+    _urlTree.insert(&recordp->_url, &recordp->_urlLinks, recordp);
+    linkKey( &_titleTree, UpnpSearchIndex::_fieldTitle,
+             &recordp->_title, &recordp->_titleLinks, recordp);
+    if (recordp->_inArtistTree)
+        linkKey( &_artistTree, UpnpSearchIndex::_fieldArtist,
+                 &recordp->_artist, &recordp->_artistLinks, recordp);
+    if (recordp->_inAlbumTree)
+        linkKey( &_albumTree, UpnpSearchIndex::_fieldAlbum,
+                 &recordp->_album, &recordp->_albumLinks, recordp);
+    if (recordp->_inGenreTree)
+        linkKey( &_genreTree, UpnpSearchIndex::_fieldGenre,
+                 &recordp->_genre, &recordp->_genreLinks, recordp);
+}
+
+void
+UpnpDBase::unlinkRecord(Record *recordp)
+{
+    _urlTree.removeItem(&recordp->_urlLinks);
+    unlinkKey( &_titleTree, UpnpSearchIndex::_fieldTitle,
+               &recordp->_title, &recordp->_titleLinks);
+    if (recordp->_inArtistTree)
+        unlinkKey( &_artistTree, UpnpSearchIndex::_fieldArtist,
+                   &recordp->_artist, &recordp->_artistLinks);
+    if (recordp->_inAlbumTree)
+        unlinkKey( &_albumTree, UpnpSearchIndex::_fieldAlbum,
+                   &recordp->_album, &recordp->_albumLinks);
+    if (recordp->_inGenreTree)
+        unlinkKey( &_genreTree, UpnpSearchIndex::_fieldGenre,
+                   &recordp->_genre, &recordp->_genreLinks);
+}
+
+int32_t
+UpnpDBase::search( std::string *queryp,
+                   uint32_t fieldMask,
+                   Record **recordsp,
+                   uint32_t maxRecords,
+                   uint32_t *countp)
+{
+    UpnpSearchIndex::Match *matchesp;
+    uint32_t matchCount;
+    uint32_t count;
+    uint32_t i;
+    uint32_t j;
+    RadixTree *treep;
+    dqueue<RadixTree::Item> *listp;
+    RadixTree::Item *itemp;
+    Record *recordp;
+    int32_t code;
+
+    *countp = 0;
+
+    /* each term has at least one record, so we never need more than
+     * maxRecords of them.
+     */
+    code = _searchIndex.search(queryp, fieldMask, maxRecords, &matchesp, &matchCount);
+    if (code != 0)
+        return code;
+
+    count = 0;
+    for(i=0; i<matchCount && count < maxRecords; i++) {
+        switch(matchesp[i]._termp->_field) {
+        case UpnpSearchIndex::_fieldTitle:
+            treep = &_titleTree;
+            break;
+        case UpnpSearchIndex::_fieldArtist:
+            treep = &_artistTree;
+            break;
+        case UpnpSearchIndex::_fieldAlbum:
+            treep = &_albumTree;
+            break;
+        default:
+            treep = &_genreTree;
+            break;
+        }
+
+        if (treep->find(&matchesp[i]._termp->_key, &listp, &itemp) != 0)
+            continue;
+        for(; itemp && count < maxRecords; itemp = itemp->_dqNextp) {
+            /* a record may match in more than one field */
+            recordp = (Record *) itemp->_backp;
+            for(j=0;j<count;j++) {
+                if (recordsp[j] == recordp)
+                    break;
+            }
+            if (j == count)
+                recordsp[count++] = recordp;
+        }
+    }
+    free(matchesp);
+
+    *countp = count;
+    return 0;
+}
+
 /* called with each matching record -- caller must increment _version */
 /* static */ int32_t
 UpnpDBase::tagCallback(void *callbackContextp, void *recordContextp)
@@ -471,14 +615,7 @@ UpnpDBase::tagCallback(void *callbackContextp, void *recordContextp)
     if (dbasep->_deleteTag != 0 && recordp->_tag != dbasep->_deleteTag)
         return 0;
 
-    dbasep->_urlTree.remove(&recordp->_url, recordp);
-    dbasep->_titleTree.remove(&recordp->_title, recordp);
-    if (recordp->_inArtistTree)
-        dbasep->_artistTree.remove(&recordp->_artist, recordp);
-    if (recordp->_inAlbumTree)
-        dbasep->_albumTree.remove(&recordp->_album, recordp);
-    if (recordp->_inGenreTree)
-        dbasep->_genreTree.remove(&recordp->_genre, recordp);
+    dbasep->unlinkRecord(recordp);
     delete recordp;
 
     return 0;
@@ -722,22 +859,14 @@ UpnpDBase::restoreFromFile(const char *fileNamep)
             recp->_userFlags = userFlags;
             recp->_userContext = userContext;
 
-            /* now hash the record in; all records are visible through the title radix tree */
-            _urlTree.insert(&recp->_url, &recp->_urlLinks, recp);
-            _titleTree.insert(&recp->_title, &recp->_titleLinks, recp);
-
-            if (albumStrp && albumStrp->length() > 0) {
-                _albumTree.insert(&recp->_album, &recp->_albumLinks, recp);
+            /* now hash the record in */
+            if (albumStrp && albumStrp->length() > 0)
                 recp->_inAlbumTree = 1;
-            }
-            if (artistStrp && artistStrp->length() > 0) {
-                _artistTree.insert(&recp->_artist, &recp->_artistLinks, recp);
+            if (artistStrp && artistStrp->length() > 0)
                 recp->_inArtistTree = 1;
-            }
-            if (genreStrp && genreStrp->length() > 0) {
-                _genreTree.insert(&recp->_genre, &recp->_genreLinks, recp);
+            if (genreStrp && genreStrp->length() > 0)
                 recp->_inGenreTree = 1;
-            }
+            linkRecord(recp);
 
             _version++;
         } /* loop over all records */
@@ -748,6 +877,603 @@ UpnpDBase::restoreFromFile(const char *fileNamep)
     return code;
 }
 
+/* Binary snapshot format, version 1, in host byte order (the magic
+ * number comes out wrong on a machine of the other order):
+ *
+ *  SnapHeader
+ *  string offsets: uint32_t[stringCount+1], string i being the bytes
+ *      from offset i to offset i+1 of the string data
+ *  string data, padded to 8 bytes
+ *  SnapRecord[recordCount], sorted by URL
+ *  for each of the url, title, artist, album and genre trees, in
+ *      that order: uint32_t count, then count record indices in that
+ *      tree's key order
+ *
+ * Strings are stored once, however many records use them.  The saved
+ * key orders let restoreSnapshot build each radix tree bottom up, and
+ * feed the search index each distinct key once, rather than inserting
+ * records one at a time.
+ */
+class SnapHeader {
+public:
+    uint32_t _magic;
+    uint32_t _version;
+    uint32_t _headerBytes;
+    uint32_t _recordCount;
+    uint32_t _stringCount;
+    uint32_t _spare;
+    uint64_t _stringOffsetsOffset;
+    uint64_t _stringDataOffset;
+    uint64_t _stringDataBytes;
+    uint64_t _recordsOffset;
+    uint64_t _indexOffset;
+    uint64_t _fileBytes;
+};
+
+class SnapRecord {
+public:
+    static const uint32_t _noString = 0xffffffff;
+    static const uint32_t _flagArtist = 1;
+    static const uint32_t _flagAlbum = 2;
+    static const uint32_t _flagGenre = 4;
+
+    uint32_t _url;
+    uint32_t _title;
+    uint32_t _artist;
+    uint32_t _album;
+    uint32_t _genre;
+    uint32_t _artUrl;
+    uint32_t _tag;
+    uint32_t _flags;
+    uint64_t _userFlags;
+    uint64_t _userContext;
+};
+
+/* the distinct strings of a snapshot being saved */
+class SnapStrings {
+public:
+    class Entry {
+    public:
+        Entry *_nextHashp;
+        std::string *_strp;
+        uint32_t _id;
+    };
+
+    Entry **_hashTablep;
+    uint32_t _hashSize;
+    Entry **_entriesp;
+    uint32_t _count;
+    uint32_t _maxCount;
+    uint64_t _dataBytes;
+
+    SnapStrings(uint32_t expected) {
+        for(_hashSize = 1024; _hashSize < expected; _hashSize *= 2)
+            ;
+        _hashTablep = new Entry *[_hashSize];
+        memset(_hashTablep, 0, _hashSize * sizeof(Entry *));
+        _maxCount = 1024;
+        _entriesp = (Entry **) malloc(_maxCount * sizeof(Entry *));
+        _count = 0;
+        _dataBytes = 0;
+    }
+
+    ~SnapStrings() {
+        uint32_t i;
+        for(i=0;i<_count;i++)
+            delete _entriesp[i];
+        free(_entriesp);
+        delete [] _hashTablep;
+    }
+
+    uint32_t intern(std::string *strp) {
+        uint32_t hash;
+        size_t i;
+        Entry *entryp;
+
+        /* FNV-1a */
+        hash = 2166136261U;
+        for(i=0;i<strp->length();i++) {
+            hash ^= (uint8_t) (*strp)[i];
+            hash *= 16777619;
+        }
+        hash &= (_hashSize - 1);
+
+        for(entryp = _hashTablep[hash]; entryp; entryp = entryp->_nextHashp) {
+            if (*entryp->_strp == *strp)
+                return entryp->_id;
+        }
+
+        entryp = new Entry();
+        entryp->_strp = strp;
+        entryp->_id = _count;
+        entryp->_nextHashp = _hashTablep[hash];
+        _hashTablep[hash] = entryp;
+        if (_count >= _maxCount) {
+            _maxCount *= 2;
+            _entriesp = (Entry **) realloc(_entriesp, _maxCount * sizeof(Entry *));
+        }
+        _entriesp[_count++] = entryp;
+        _dataBytes += strp->length();
+        return entryp->_id;
+    }
+};
+
+/* records in tree order, for saving a snapshot */
+class SnapOrder {
+public:
+    UpnpDBase::Record **_recordsp;
+    uint32_t *_ixp;
+    uint32_t _count;
+    uint32_t _maxCount;
+};
+
+/* static */ int32_t
+UpnpDBase::snapCollectCallback(void *callbackContextp, void *recordContextp)
+{
+    SnapOrder *orderp = (SnapOrder *) callbackContextp;
+    UpnpDBase::Record *recp = (UpnpDBase::Record *) recordContextp;
+
+    if (orderp->_count >= orderp->_maxCount)
+        return -1;
+    if (orderp->_recordsp) {
+        recp->_snapIx = orderp->_count;
+        orderp->_recordsp[orderp->_count] = recp;
+    }
+    else {
+        orderp->_ixp[orderp->_count] = recp->_snapIx;
+    }
+    orderp->_count++;
+    return 0;
+}
+
+int32_t
+UpnpDBase::saveSnapshot(const char *fileNamep)
+{
+    SnapHeader header;
+    SnapRecord *snapRecordsp;
+    SnapRecord *snapp;
+    SnapOrder order;
+    Record *recp;
+    RadixTree *treesp[5];
+    uint32_t *offsetsp;
+    uint32_t recordCount;
+    uint32_t count;
+    uint32_t i;
+    uint64_t offset;
+    uint64_t pad;
+    int32_t code;
+    FILE *filep;
+    std::string tempName;
+    std::string *strp;
+    static const char zeroes[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+
+    /* records go in url order, which also gives each one its index */
+    recordCount = _urlTree.getItemCount();
+    order._recordsp = new Record *[recordCount > 0? recordCount : 1];
+    order._ixp = NULL;
+    order._count = 0;
+    order._maxCount = recordCount;
+    code = _urlTree.apply(snapCollectCallback, &order);
+    if (code != 0 || order._count != recordCount) {
+        delete [] order._recordsp;
+        return -1;
+    }
+
+    SnapStrings strings(recordCount * 2);
+    snapRecordsp = new SnapRecord[recordCount > 0? recordCount : 1];
+    for(i=0;i<recordCount;i++) {
+        recp = order._recordsp[i];
+        snapp = &snapRecordsp[i];
+        snapp->_url = strings.intern(&recp->_url);
+        snapp->_title = strings.intern(&recp->_title);
+        snapp->_artUrl = strings.intern(&recp->_artUrl);
+        snapp->_flags = 0;
+        snapp->_artist = SnapRecord::_noString;
+        snapp->_album = SnapRecord::_noString;
+        snapp->_genre = SnapRecord::_noString;
+        if (recp->_inArtistTree) {
+            snapp->_artist = strings.intern(&recp->_artist);
+            snapp->_flags |= SnapRecord::_flagArtist;
+        }
+        if (recp->_inAlbumTree) {
+            snapp->_album = strings.intern(&recp->_album);
+            snapp->_flags |= SnapRecord::_flagAlbum;
+        }
+        if (recp->_inGenreTree) {
+            snapp->_genre = strings.intern(&recp->_genre);
+            snapp->_flags |= SnapRecord::_flagGenre;
+        }
+        snapp->_tag = recp->_tag;
+        snapp->_userFlags = recp->_userFlags;
+        snapp->_userContext = recp->_userContext;
+    }
+
+    if (strings._dataBytes >= 0xffffffffULL) {
+        delete [] snapRecordsp;
+        delete [] order._recordsp;
+        return -1;
+    }
+
+    offsetsp = new uint32_t[strings._count+1];
+    offset = 0;
+    for(i=0;i<strings._count;i++) {
+        offsetsp[i] = (uint32_t) offset;
+        offset += strings._entriesp[i]->_strp->length();
+    }
+    offsetsp[strings._count] = (uint32_t) offset;
+
+    memset(&header, 0, sizeof(header));
+    header._magic = _snapMagic;
+    header._version = _snapVersion;
+    header._headerBytes = sizeof(header);
+    header._recordCount = recordCount;
+    header._stringCount = strings._count;
+    header._stringOffsetsOffset = sizeof(header);
+    header._stringDataOffset = ( header._stringOffsetsOffset +
+                                 (strings._count+1) * sizeof(uint32_t));
+    header._stringDataBytes = strings._dataBytes;
+    pad = (8 - ((header._stringDataOffset + strings._dataBytes) & 7)) & 7;
+    header._recordsOffset = header._stringDataOffset + strings._dataBytes + pad;
+    header._indexOffset = header._recordsOffset + recordCount * sizeof(SnapRecord);
+
+    treesp[0] = &_urlTree;
+    treesp[1] = &_titleTree;
+    treesp[2] = &_artistTree;
+    treesp[3] = &_albumTree;
+    treesp[4] = &_genreTree;
+    header._fileBytes = header._indexOffset;
+    for(i=0;i<5;i++)
+        header._fileBytes += (1 + treesp[i]->getItemCount()) * sizeof(uint32_t);
+
+    /* write to a temporary file, and rename it into place once it's
+     * all there.
+     */
+    tempName = std::string(fileNamep) + ".tmp";
+    filep = fopen(tempName.c_str(), "w");
+    if (!filep) {
+        delete [] offsetsp;
+        delete [] snapRecordsp;
+        delete [] order._recordsp;
+        return -1;
+    }
+
+    code = 0;
+    if (fwrite(&header, sizeof(header), 1, filep) != 1)
+        code = -1;
+    if (code == 0 && fwrite(offsetsp, sizeof(uint32_t), strings._count+1, filep) != strings._count+1)
+        code = -1;
+    for(i=0; code == 0 && i<strings._count; i++) {
+        strp = strings._entriesp[i]->_strp;
+        if (strp->length() > 0 && fwrite(strp->data(), strp->length(), 1, filep) != 1)
+            code = -1;
+    }
+    if (code == 0 && pad > 0 && fwrite(zeroes, pad, 1, filep) != 1)
+        code = -1;
+    if ( code == 0 &&
+         recordCount > 0 &&
+         fwrite(snapRecordsp, sizeof(SnapRecord), recordCount, filep) != recordCount)
+        code = -1;
+
+    /* each tree's order, as record indices */
+    delete [] order._recordsp;
+    order._recordsp = NULL;
+    order._ixp = new uint32_t[recordCount > 0? recordCount : 1];
+    for(i=0; code == 0 && i<5; i++) {
+        order._count = 0;
+        count = treesp[i]->getItemCount();
+        order._maxCount = count;
+        if (treesp[i]->apply(snapCollectCallback, &order) != 0 || order._count != count) {
+            code = -1;
+            break;
+        }
+        if (fwrite(&count, sizeof(count), 1, filep) != 1)
+            code = -1;
+        else if (count > 0 && fwrite(order._ixp, sizeof(uint32_t), count, filep) != count)
+            code = -1;
+    }
+    delete [] order._ixp;
+    delete [] offsetsp;
+    delete [] snapRecordsp;
+
+    if (fflush(filep) != 0 || fsync(fileno(filep)) < 0)
+        code = -1;
+    fclose(filep);
+
+    if (code == 0 && rename(tempName.c_str(), fileNamep) < 0)
+        code = -1;
+    if (code != 0)
+        unlink(tempName.c_str());
+
+    return code;
+}
+
+/* the tree item for position tree in the snapshot's list of indices,
+ * with its key and object set.
+ */
+static RadixTree::Item *
+snapTreeItem(UpnpDBase::Record *recp, uint32_t tree)
+{
+    RadixTree::Item *itemp;
+
+    switch(tree) {
+    case 0:
+        itemp = &recp->_urlLinks;
+        itemp->_keyp = &recp->_url;
+        break;
+    case 1:
+        itemp = &recp->_titleLinks;
+        itemp->_keyp = &recp->_title;
+        break;
+    case 2:
+        itemp = &recp->_artistLinks;
+        itemp->_keyp = &recp->_artist;
+        break;
+    case 3:
+        itemp = &recp->_albumLinks;
+        itemp->_keyp = &recp->_album;
+        break;
+    default:
+        itemp = &recp->_genreLinks;
+        itemp->_keyp = &recp->_genre;
+        break;
+    }
+    itemp->_backp = recp;
+    return itemp;
+}
+
+/* check that a mapped snapshot is self consistent, so that loading it
+ * can't run off the end of anything.
+ */
+static int32_t
+snapValidate(const char *basep, uint64_t size)
+{
+    const SnapHeader *headerp;
+    const uint32_t *offsetsp;
+    const SnapRecord *snapRecordsp;
+    const SnapRecord *snapp;
+    const uint32_t *indexp;
+    uint8_t *seenp;
+    uint32_t needed[5];
+    uint32_t count;
+    uint32_t i;
+    uint32_t j;
+    uint32_t tree;
+    uint64_t offset;
+    int32_t code;
+
+    if (size < sizeof(SnapHeader))
+        return -2;
+    headerp = (const SnapHeader *) basep;
+    if ( headerp->_magic != UpnpDBase::_snapMagic ||
+         headerp->_version != UpnpDBase::_snapVersion ||
+         headerp->_headerBytes != sizeof(SnapHeader) ||
+         headerp->_fileBytes != size)
+        return -2;
+
+    /* the sections must be where they should be, in order */
+    if ( headerp->_stringCount >= (1U<<30) ||
+         headerp->_stringOffsetsOffset != sizeof(SnapHeader) ||
+         headerp->_stringDataOffset != ( headerp->_stringOffsetsOffset +
+                                         (headerp->_stringCount + 1ULL) * sizeof(uint32_t)) ||
+         headerp->_stringDataBytes > size ||
+         headerp->_stringDataOffset + headerp->_stringDataBytes > headerp->_recordsOffset ||
+         (headerp->_recordsOffset & 7) != 0 ||
+         headerp->_recordsOffset > size ||
+         headerp->_recordCount > (size - headerp->_recordsOffset) / sizeof(SnapRecord) ||
+         headerp->_indexOffset != ( headerp->_recordsOffset +
+                                    (uint64_t) headerp->_recordCount * sizeof(SnapRecord)))
+        return -2;
+
+    offsetsp = (const uint32_t *) (basep + headerp->_stringOffsetsOffset);
+    if ( offsetsp[0] != 0 ||
+         offsetsp[headerp->_stringCount] != headerp->_stringDataBytes)
+        return -2;
+    for(i=0;i<headerp->_stringCount;i++) {
+        if (offsetsp[i] > offsetsp[i+1])
+            return -2;
+    }
+
+    memset(needed, 0, sizeof(needed));
+    snapRecordsp = (const SnapRecord *) (basep + headerp->_recordsOffset);
+    for(i=0;i<headerp->_recordCount;i++) {
+        snapp = &snapRecordsp[i];
+        if ( snapp->_url >= headerp->_stringCount ||
+             snapp->_title >= headerp->_stringCount ||
+             snapp->_artUrl >= headerp->_stringCount)
+            return -2;
+        if ( ((snapp->_flags & SnapRecord::_flagArtist) && snapp->_artist >= headerp->_stringCount) ||
+             ((snapp->_flags & SnapRecord::_flagAlbum) && snapp->_album >= headerp->_stringCount) ||
+             ((snapp->_flags & SnapRecord::_flagGenre) && snapp->_genre >= headerp->_stringCount))
+            return -2;
+        if (snapp->_flags & SnapRecord::_flagArtist)
+            needed[2]++;
+        if (snapp->_flags & SnapRecord::_flagAlbum)
+            needed[3]++;
+        if (snapp->_flags & SnapRecord::_flagGenre)
+            needed[4]++;
+    }
+    needed[0] = headerp->_recordCount;
+    needed[1] = headerp->_recordCount;
+
+    /* each index must list exactly the records belonging in its tree */
+    code = 0;
+    seenp = new uint8_t[headerp->_recordCount + 1];
+    offset = headerp->_indexOffset;
+    for(tree=0; code == 0 && tree<5; tree++) {
+        if (offset + sizeof(uint32_t) > size) {
+            code = -2;
+            break;
+        }
+        count = *(const uint32_t *) (basep + offset);
+        offset += sizeof(uint32_t);
+        if (count != needed[tree] || offset + (uint64_t) count * sizeof(uint32_t) > size) {
+            code = -2;
+            break;
+        }
+
+        indexp = (const uint32_t *) (basep + offset);
+        memset(seenp, 0, headerp->_recordCount);
+        for(j=0;j<count;j++) {
+            i = indexp[j];
+            if ( i >= headerp->_recordCount ||
+                 seenp[i] ||
+                 (tree == 2 && !(snapRecordsp[i]._flags & SnapRecord::_flagArtist)) ||
+                 (tree == 3 && !(snapRecordsp[i]._flags & SnapRecord::_flagAlbum)) ||
+                 (tree == 4 && !(snapRecordsp[i]._flags & SnapRecord::_flagGenre))) {
+                code = -2;
+                break;
+            }
+            seenp[i] = 1;
+        }
+        offset += (uint64_t) count * sizeof(uint32_t);
+    }
+    delete [] seenp;
+
+    if (code == 0 && offset != size)
+        code = -2;
+
+    return code;
+}
+
+int32_t
+UpnpDBase::restoreSnapshot(const char *fileNamep)
+{
+    static const uint8_t fields[5] = {
+        0,      /* url isn't searched */
+        UpnpSearchIndex::_fieldTitle,
+        UpnpSearchIndex::_fieldArtist,
+        UpnpSearchIndex::_fieldAlbum,
+        UpnpSearchIndex::_fieldGenre };
+    int fd;
+    struct stat tstat;
+    void *mapp;
+    const char *basep;
+    const SnapHeader *headerp;
+    const uint32_t *offsetsp;
+    const char *datap;
+    const SnapRecord *snapp;
+    const uint32_t *indexp;
+    Record **recordsp;
+    Record *recp;
+    RadixTree *treesp[5];
+    RadixTree::Item **itemsp;
+    uint64_t size;
+    uint64_t offset;
+    uint32_t recordCount;
+    uint32_t count;
+    uint32_t i;
+    uint32_t j;
+    uint32_t tree;
+    int bulk;
+    int32_t code;
+
+    fd = open(fileNamep, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    code = fstat(fd, &tstat);
+    if (code < 0 || tstat.st_size < (off_t) sizeof(SnapHeader)) {
+        close(fd);
+        return -2;
+    }
+    size = tstat.st_size;
+
+    mapp = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapp == MAP_FAILED)
+        return -1;
+    madvise(mapp, size, MADV_SEQUENTIAL);
+    basep = (const char *) mapp;
+
+    code = snapValidate(basep, size);
+    if (code != 0) {
+        munmap(mapp, size);
+        return code;
+    }
+
+    headerp = (const SnapHeader *) basep;
+    offsetsp = (const uint32_t *) (basep + headerp->_stringOffsetsOffset);
+    datap = basep + headerp->_stringDataOffset;
+    recordCount = headerp->_recordCount;
+
+    /* decode the records straight out of the mapping */
+    recordsp = new Record *[recordCount > 0? recordCount : 1];
+    for(i=0;i<recordCount;i++) {
+        snapp = ((const SnapRecord *) (basep + headerp->_recordsOffset)) + i;
+        recp = new Record();
+        recp->_url.assign(datap + offsetsp[snapp->_url],
+                          offsetsp[snapp->_url+1] - offsetsp[snapp->_url]);
+        recp->_title.assign(datap + offsetsp[snapp->_title],
+                            offsetsp[snapp->_title+1] - offsetsp[snapp->_title]);
+        recp->_artUrl.assign(datap + offsetsp[snapp->_artUrl],
+                             offsetsp[snapp->_artUrl+1] - offsetsp[snapp->_artUrl]);
+        if (snapp->_flags & SnapRecord::_flagArtist) {
+            recp->_artist.assign(datap + offsetsp[snapp->_artist],
+                                 offsetsp[snapp->_artist+1] - offsetsp[snapp->_artist]);
+            recp->_inArtistTree = 1;
+        }
+        if (snapp->_flags & SnapRecord::_flagAlbum) {
+            recp->_album.assign(datap + offsetsp[snapp->_album],
+                                offsetsp[snapp->_album+1] - offsetsp[snapp->_album]);
+            recp->_inAlbumTree = 1;
+        }
+        if (snapp->_flags & SnapRecord::_flagGenre) {
+            recp->_genre.assign(datap + offsetsp[snapp->_genre],
+                                offsetsp[snapp->_genre+1] - offsetsp[snapp->_genre]);
+            recp->_inGenreTree = 1;
+        }
+        recp->_tag = snapp->_tag;
+        recp->_userFlags = snapp->_userFlags;
+        recp->_userContext = snapp->_userContext;
+        recordsp[i] = recp;
+    }
+
+    /* into an empty database, build each tree from its saved order;
+     * otherwise, merge the records in the slow way.
+     */
+    bulk = (_urlTree.getItemCount() == 0);
+    if (!bulk) {
+        for(i=0;i<recordCount;i++)
+            linkRecord(recordsp[i]);
+    }
+    else {
+        treesp[0] = &_urlTree;
+        treesp[1] = &_titleTree;
+        treesp[2] = &_artistTree;
+        treesp[3] = &_albumTree;
+        treesp[4] = &_genreTree;
+        itemsp = new RadixTree::Item *[recordCount > 0? recordCount : 1];
+        offset = headerp->_indexOffset;
+        for(tree=0;tree<5;tree++) {
+            count = *(const uint32_t *) (basep + offset);
+            indexp = (const uint32_t *) (basep + offset + sizeof(uint32_t));
+            offset += (1 + (uint64_t) count) * sizeof(uint32_t);
+
+            for(j=0;j<count;j++)
+                itemsp[j] = snapTreeItem(recordsp[indexp[j]], tree);
+            if (treesp[tree]->bulkLoad(itemsp, count) != 0) {
+                for(j=0;j<count;j++)
+                    treesp[tree]->insert(itemsp[j]->_keyp, itemsp[j], itemsp[j]->_backp);
+            }
+
+            /* the search index wants each distinct key once */
+            if (tree == 0)
+                continue;
+            for(j=0;j<count;j++) {
+                if (j == 0 || *itemsp[j]->_keyp != *itemsp[j-1]->_keyp)
+                    _searchIndex.add(fields[tree], itemsp[j]->_keyp);
+            }
+        }
+        delete [] itemsp;
+    }
+
+    delete [] recordsp;
+    munmap(mapp, size);
+    _version++;
+
+    return 0;
+}
+
 int32_t
 UpnpAv::browse(UpnpDBase *dbasep, const char *idp, int rlevel) {
     CThreadPipe *inPipep;
@@ -810,6 +1536,7 @@ UpnpAv::browse(UpnpDBase *dbasep, const char *idp, int rlevel) {
         if (code != browseSendCount) {
             printf("Write code=%d should be %d\n", code, browseSendCount);
         }
+        outPipep->eof();
         
         code = _reqp->waitForHeadersDone();
         
@@ -910,7 +1637,6 @@ UpnpAv::addItemsFromTree( UpnpDBase *dbasep,
     Xgml::Node *classNodep;
     Xgml::Node *genreNodep;
     Xgml::Node *artUrlNodep;
-    int32_t tpLength;
     std::string title;
     std::string album;
     std::string artist;
@@ -919,10 +1645,6 @@ UpnpAv::addItemsFromTree( UpnpDBase *dbasep,
     std::string parentId;
     int32_t code;
     int32_t rcode;
-    int32_t minLen;
-    uint8_t isAudioTrack;
-    const char *tp;
-    const char *up;
     
     rcode = 0;
     if (_recurse && !nodep->_isLeaf && nodep->_name == "container") {
@@ -940,27 +1662,9 @@ UpnpAv::addItemsFromTree( UpnpDBase *dbasep,
              * it, and skip it.
              */
             dcTitleNodep = nodep->searchForChild("dc:title");
-            if (dcTitleNodep) {
-                tp = dcTitleNodep->_children.head()->_name.c_str();
-                tpLength = (int32_t) strlen(tp);
-                tp += tpLength; /* points at terminating null */
-                if (tpLength >= 5) {
-                    if (strncasecmp(tp-5, "photo", 5) == 0)
-                        return 0;
-                    if (strncasecmp(tp-5, "video", 5) == 0)
-                        return 0;
-                }
-                if (tpLength >= 6) {
-                    if (strncasecmp(tp-5, "photos", 6) == 0)
-                        return 0;
-                    if (strncasecmp(tp-5, "videos", 6) == 0)
-                        return 0;
-                }
-                if (tpLength >= 8) {
-                    if (strncasecmp(tp-8, "pictures", 8) == 0)
-                        return 0;
-                }
-            }
+            if (dcTitleNodep &&
+                skipContainer(dcTitleNodep->_children.head()->_name.c_str()))
+                return 0;
         }
 
         /* if the parent ID matches us, then recurse; note that some media
@@ -991,7 +1695,7 @@ UpnpAv::addItemsFromTree( UpnpDBase *dbasep,
         urlNodep = NULL;
         genreNodep = NULL;
         artUrlNodep = NULL;
-        isAudioTrack = 1;
+        classNodep = NULL;
         for(tnodep = nodep->_children.head(); tnodep; tnodep=tnodep->_dqNextp) {
             if (tnodep->_name == "dc:title") {
                 titleNodep = tnodep->_children.head();
@@ -1007,14 +1711,6 @@ UpnpAv::addItemsFromTree( UpnpDBase *dbasep,
             }
             else if (tnodep->_name == "upnp:class") {
                 classNodep = tnodep->_children.head();
-                tp = classNodep->_name.c_str();
-                up = "object.item.audioItem";
-                minLen = (int32_t) strlen(up);
-                /* must start object.item.audioItem to match */
-                if (strlen(tp) < minLen)
-                    isAudioTrack = 0;
-                else if (strncmp(tp, up, minLen) != 0)
-                    isAudioTrack = 0;
             }
             else if (tnodep->_name == "upnp:genre") {
                 genreNodep = tnodep->_children.head();
@@ -1029,18 +1725,8 @@ UpnpAv::addItemsFromTree( UpnpDBase *dbasep,
             return -1;
         }
         else {
-            tp = urlNodep->_name.c_str();
-            tpLength = (int32_t) strlen(tp);
-            tp += tpLength;     /* points past end */
-            if ( isAudioTrack &&
-                 tpLength >= 5 &&
-                 (strncasecmp(tp-4, ".mp3", 4) == 0 ||
-                  strncasecmp(tp-4, ".aac", 4) == 0 ||
-                  strncasecmp(tp-4, ".m4a", 4) == 0 ||
-                  strncasecmp(tp-4, ".wav", 4) == 0 ||
-                  strncasecmp(tp-4, ".aif", 4) == 0 ||
-                  strncasecmp(tp-4, ".mp4", 4) == 0 ||
-                  strncasecmp(tp-5, ".aiff", 5) == 0)) {
+            if (isAudioItem( (classNodep? classNodep->_name.c_str() : NULL),
+                             urlNodep->_name.c_str())) {
                 code = dbasep->addRecord( &urlNodep->_name,
                                           &titleNodep->_name,
                                           (albumNodep? &albumNodep->_name : NULL),
@@ -1063,3 +1749,1122 @@ UpnpAv::addItemsFromTree( UpnpDBase *dbasep,
     
     return rcode;
 }
+
+/* static */ int
+UpnpAv::skipContainer(const char *titlep)
+{
+    static const char *skipNames[] = {"photo", "photos", "video", "videos", "pictures"};
+    uint32_t i;
+    uint32_t titleLength;
+    uint32_t nameLength;
+
+    titleLength = (uint32_t) strlen(titlep);
+    for(i=0;i<sizeof(skipNames)/sizeof(skipNames[0]);i++) {
+        nameLength = (uint32_t) strlen(skipNames[i]);
+        if ( titleLength >= nameLength &&
+             strcasecmp(titlep + titleLength - nameLength, skipNames[i]) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+/* static */ int
+UpnpAv::isAudioItem(const char *classp, const char *urlp)
+{
+    static const char *audioClassp = "object.item.audioItem";
+    const char *tp;
+    uint32_t urlLength;
+
+    /* must start object.item.audioItem to match */
+    if (classp && strncmp(classp, audioClassp, strlen(audioClassp)) != 0)
+        return 0;
+
+    urlLength = (uint32_t) strlen(urlp);
+    if (urlLength < 5)
+        return 0;
+    tp = urlp + urlLength;     /* points past end */
+    return ( strncasecmp(tp-4, ".mp3", 4) == 0 ||
+             strncasecmp(tp-4, ".aac", 4) == 0 ||
+             strncasecmp(tp-4, ".m4a", 4) == 0 ||
+             strncasecmp(tp-4, ".wav", 4) == 0 ||
+             strncasecmp(tp-4, ".aif", 4) == 0 ||
+             strncasecmp(tp-4, ".mp4", 4) == 0 ||
+             strncasecmp(tp-5, ".aiff", 5) == 0);
+}
+
+/* crawl's scanner.  These work on a response or DIDL-Lite document in
+ * place, null terminated, rather than building an Xgml tree of it.
+ */
+
+/* return the end of the tag starting at datap, skipping quoted
+ * attribute values; points at the '>', or the terminating null.
+ */
+static char *
+crawlTagEnd(char *datap)
+{
+    int tc;
+    int quote;
+
+    quote = 0;
+    for(;(tc = *datap) != 0; datap++) {
+        if (quote) {
+            if (tc == quote)
+                quote = 0;
+        }
+        else if (tc == '"' || tc == '\'')
+            quote = tc;
+        else if (tc == '>')
+            break;
+    }
+    return datap;
+}
+
+static char *
+crawlNameEnd(char *datap)
+{
+    int tc;
+
+    while((tc = *datap) != 0) {
+        if (tc == '>' || tc == '/' || tc == '=' || Xgml::isWhitespace(tc))
+            break;
+        datap++;
+    }
+    return datap;
+}
+
+static int
+crawlNameIs(char *namep, char *nameEndp, const char *matchp)
+{
+    size_t len = strlen(matchp);
+    return ((size_t) (nameEndp - namep) == len && memcmp(namep, matchp, len) == 0);
+}
+
+/* copy text up to endp, decoding entities */
+static void
+crawlDecode(char *datap, char *endp, std::string *outp)
+{
+    char *ampp;
+
+    outp->clear();
+    while(datap < endp) {
+        ampp = (char *) memchr(datap, '&', endp - datap);
+        if (!ampp) {
+            outp->append(datap, endp - datap);
+            break;
+        }
+        outp->append(datap, ampp - datap);
+        datap = ampp;
+        Xgml::handleAmpString(outp, &datap);
+    }
+}
+
+/* find the value of attribute namep in the tag between tagp and
+ * tagEndp, which is past the tag's name.
+ */
+static int
+crawlAttr(char *tagp, char *tagEndp, const char *namep, std::string *valuep)
+{
+    char *attrp;
+    char *attrEndp;
+    char *valueEndp;
+    int quote;
+
+    while(tagp < tagEndp) {
+        if (Xgml::isWhitespace(*tagp) || *tagp == '/') {
+            tagp++;
+            continue;
+        }
+        attrp = tagp;
+        attrEndp = crawlNameEnd(tagp);
+        if (attrEndp == attrp)
+            break;
+        tagp = attrEndp;
+        while(tagp < tagEndp && Xgml::isWhitespace(*tagp))
+            tagp++;
+        if (tagp >= tagEndp || *tagp != '=')
+            continue;   /* no value */
+        tagp++;
+        while(tagp < tagEndp && Xgml::isWhitespace(*tagp))
+            tagp++;
+        if (tagp >= tagEndp || (*tagp != '"' && *tagp != '\''))
+            break;
+        quote = *tagp++;
+        valueEndp = (char *) memchr(tagp, quote, tagEndp - tagp);
+        if (!valueEndp)
+            break;
+        if (crawlNameIs(attrp, attrEndp, namep)) {
+            crawlDecode(tagp, valueEndp, valuep);
+            return 1;
+        }
+        tagp = valueEndp+1;
+    }
+
+    return 0;
+}
+
+/* find the text of element namep, returning its start and end, with
+ * no decoding; CDATA sections are returned as is.
+ */
+static char *
+crawlElement(char *datap, const char *namep, char **endpp)
+{
+    char *tp;
+    char *textp;
+    char *endp;
+    size_t len;
+
+    len = strlen(namep);
+    for(tp = datap; (tp = strchr(tp, '<')) != NULL; tp++) {
+        if (strncmp(tp+1, namep, len) != 0)
+            continue;
+        if (tp[len+1] != '>' && !Xgml::isWhitespace(tp[len+1]))
+            continue;
+        textp = crawlTagEnd(tp+1);
+        if (*textp == 0 || textp[-1] == '/')
+            return NULL;
+        textp++;
+        if (strncmp(textp, "<![CDATA[", 9) == 0) {
+            textp += 9;
+            endp = strstr(textp, "]]>");
+        }
+        else
+            endp = strstr(textp, "</");
+        if (!endp)
+            return NULL;
+        *endpp = endp;
+        return textp;
+    }
+    return NULL;
+}
+
+static uint32_t
+crawlCount(char *datap, const char *namep, int *foundp = NULL)
+{
+    char *textp;
+    char *endp;
+
+    textp = crawlElement(datap, namep, &endp);
+    if (foundp)
+        *foundp = (textp != NULL);
+    if (!textp)
+        return 0;
+    return (uint32_t) strtoul(textp, NULL, 10);
+}
+
+static const char *crawlMetadataTemplate = "<?xml version=\"1.0\" encoding=\"utf-8\"?>\r\n\
+<s:Envelope s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\" xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\">\r\n\
+<s:Body>\r\n\
+<u:Browse xmlns:u=\"urn:schemas-upnp-org:service:ContentDirectory:1\">\r\n\
+<ObjectID>%s</ObjectID>\r\n\
+<BrowseFlag>BrowseMetadata</BrowseFlag>\r\n\
+<Filter>id</Filter>\r\n\
+<StartingIndex>0</StartingIndex>\r\n\
+<RequestedCount>0</RequestedCount>\r\n\
+<SortCriteria></SortCriteria>\r\n\
+</u:Browse>\r\n\
+</s:Body>\r\n\
+</s:Envelope>\r\n";
+
+static const char *crawlSystemUpdateIdData = "<?xml version=\"1.0\" encoding=\"utf-8\"?>\r\n\
+<s:Envelope s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\" xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\">\r\n\
+<s:Body>\r\n\
+<u:GetSystemUpdateID xmlns:u=\"urn:schemas-upnp-org:service:ContentDirectory:1\">\r\n\
+</u:GetSystemUpdateID>\r\n\
+</s:Body>\r\n\
+</s:Envelope>\r\n";
+
+/* the UPnP error for a Browse of an object that doesn't exist */
+static const uint32_t crawlNoSuchObject = 701;
+
+/* static */ uint32_t
+UpnpAv::crawlHash(std::string *strp, uint32_t hashSize)
+{
+    const uint8_t *tp;
+    uint32_t len;
+    uint32_t hash;
+
+    tp = (const uint8_t *) strp->c_str();
+    len = (uint32_t) strp->length();
+    hash = 2166136261U;
+    while(len-- > 0) {
+        hash ^= *tp++;
+        hash *= 16777619;
+    }
+    return hash % hashSize;
+}
+
+UpnpAv::CrawlContainer *
+UpnpAv::findContainer(std::string *idp)
+{
+    CrawlContainer *containerp;
+
+    for( containerp = _containerHashp[crawlHash(idp, _containerHashSize)];
+         containerp;
+         containerp = containerp->_nextHashp) {
+        if (containerp->_id == *idp)
+            return containerp;
+    }
+    return NULL;
+}
+
+UpnpAv::CrawlContainer *
+UpnpAv::newContainer(std::string *idp, CrawlContainer *parentp)
+{
+    CrawlContainer *containerp;
+    uint32_t ix;
+
+    containerp = new CrawlContainer();
+    containerp->_id = *idp;
+    containerp->_parentp = parentp;
+    if (parentp) {
+        containerp->_rlevel = parentp->_rlevel + 1;
+        parentp->_children.append(containerp);
+    }
+    containerp->_listedGen = _refreshGen;
+
+    ix = crawlHash(idp, _containerHashSize);
+    containerp->_nextHashp = _containerHashp[ix];
+    _containerHashp[ix] = containerp;
+    _containerCount++;
+
+    return containerp;
+}
+
+/* called with _crawlMutex held */
+void
+UpnpAv::addContainerUrl(CrawlContainer *containerp, std::string *urlp)
+{
+    CrawlUrl *urlEntryp;
+    uint32_t ix;
+
+    ix = crawlHash(urlp, _urlHashSize);
+    for(urlEntryp = _urlHashp[ix]; urlEntryp; urlEntryp = urlEntryp->_nextHashp) {
+        if (urlEntryp->_url == *urlp)
+            break;
+    }
+    if (!urlEntryp) {
+        urlEntryp = new CrawlUrl();
+        urlEntryp->_url = *urlp;
+        urlEntryp->_refs = 0;
+        urlEntryp->_nextHashp = _urlHashp[ix];
+        _urlHashp[ix] = urlEntryp;
+    }
+    urlEntryp->_refs++;
+
+    if (containerp->_urlCount >= containerp->_maxUrls) {
+        containerp->_maxUrls = (containerp->_maxUrls? 2 * containerp->_maxUrls : 16);
+        containerp->_urlsp = (CrawlUrl **) realloc( containerp->_urlsp,
+                                                    containerp->_maxUrls * sizeof(CrawlUrl *));
+    }
+    containerp->_urlsp[containerp->_urlCount++] = urlEntryp;
+}
+
+/* drop a reference to each url, deleting the records no container
+ * lists any more.
+ */
+void
+UpnpAv::releaseUrls(CrawlUrl **urlsp, uint32_t count)
+{
+    CrawlUrl *urlEntryp;
+    CrawlUrl **urlEntrypp;
+    UpnpDBase::Record *recordp;
+    uint32_t i;
+
+    for(i=0;i<count;i++) {
+        urlEntryp = urlsp[i];
+        if (--urlEntryp->_refs > 0)
+            continue;
+
+        if (_crawlDBasep) {
+            recordp = _crawlDBasep->findRecord(&urlEntryp->_url);
+            if (recordp)
+                _crawlDBasep->deleteRecord(recordp);
+        }
+
+        for( urlEntrypp = &_urlHashp[crawlHash(&urlEntryp->_url, _urlHashSize)];
+             *urlEntrypp != urlEntryp;
+             urlEntrypp = &(*urlEntrypp)->_nextHashp)
+            ;
+        *urlEntrypp = urlEntryp->_nextHashp;
+        delete urlEntryp;
+    }
+}
+
+/* delete a container and everything under it, along with their
+ * tracks.
+ */
+void
+UpnpAv::deleteContainer(CrawlContainer *containerp)
+{
+    CrawlContainer **containerpp;
+
+    while(!containerp->_children.empty())
+        deleteContainer(containerp->_children.head());
+
+    releaseUrls(containerp->_urlsp, containerp->_urlCount);
+    releaseUrls(containerp->_oldUrlsp, containerp->_oldUrlCount);
+
+    if (containerp->_parentp)
+        containerp->_parentp->_children.remove(containerp);
+    if (containerp == _rootContainerp)
+        _rootContainerp = NULL;
+
+    for( containerpp = &_containerHashp[crawlHash(&containerp->_id, _containerHashSize)];
+         *containerpp != containerp;
+         containerpp = &(*containerpp)->_nextHashp)
+        ;
+    *containerpp = containerp->_nextHashp;
+    _containerCount--;
+
+    delete containerp;
+}
+
+/* forget everything crawl saw, without touching the database */
+void
+UpnpAv::clearContainers()
+{
+    CrawlContainer *containerp;
+    CrawlContainer *nextContainerp;
+    CrawlUrl *urlEntryp;
+    CrawlUrl *nextUrlp;
+    uint32_t i;
+
+    if (!_containerHashp) {
+        _containerHashp = new CrawlContainer *[_containerHashSize];
+        memset(_containerHashp, 0, _containerHashSize * sizeof(CrawlContainer *));
+        _urlHashp = new CrawlUrl *[_urlHashSize];
+        memset(_urlHashp, 0, _urlHashSize * sizeof(CrawlUrl *));
+        return;
+    }
+
+    for(i=0;i<_containerHashSize;i++) {
+        for(containerp = _containerHashp[i]; containerp; containerp = nextContainerp) {
+            nextContainerp = containerp->_nextHashp;
+            delete containerp;
+        }
+        _containerHashp[i] = NULL;
+    }
+    for(i=0;i<_urlHashSize;i++) {
+        for(urlEntryp = _urlHashp[i]; urlEntryp; urlEntryp = nextUrlp) {
+            nextUrlp = urlEntryp->_nextHashp;
+            delete urlEntryp;
+        }
+        _urlHashp[i] = NULL;
+    }
+    _rootContainerp = NULL;
+    _containerCount = 0;
+    _haveSystemUpdateId = 0;
+}
+
+int32_t
+UpnpAv::crawl(UpnpDBase *dbasep, const char *idp)
+{
+    CrawlBuffer *bufp;
+    CrawlContainer *containerp;
+    std::string rootId;
+    int32_t code;
+    uint32_t i;
+
+    if (!_xapiPoolp)
+        return -1;
+
+    if (!_crawlDispp) {
+        _crawlDispp = new CDisp();
+        _crawlDispp->init(_maxInFlight);
+        _crawlGroupp = new CDispGroup();
+        _crawlGroupp->init(_crawlDispp);
+    }
+
+    clearContainers();
+    _refreshing = 0;
+    _loadedPages = 0;
+    _loadedItems = 0;
+    _canceled = 0;
+    _crawlError = 0;
+    _crawlDBasep = dbasep;
+
+    /* get the SystemUpdateID first, so that anything changing while
+     * we crawl makes the next refresh look.
+     */
+    bufp = _crawlBuffers.pop();
+    if (!bufp)
+        bufp = new CrawlBuffer();
+    code = getSystemUpdateId(bufp, &_systemUpdateId);
+    _haveSystemUpdateId = (code == 0);
+    _crawlBuffers.append(bufp);
+
+    rootId = idp;
+    _rootContainerp = newContainer(&rootId, NULL);
+    queueCrawl(_rootContainerp, 0, _numAtOnce, 1);
+    waitForCrawl();
+
+    /* a container we couldn't browse completely has to look changed
+     * to the next refresh, or the rest of it never gets loaded.
+     */
+    for(i=0;i<_containerHashSize;i++) {
+        for(containerp = _containerHashp[i]; containerp; containerp = containerp->_nextHashp) {
+            if (containerp->_failed) {
+                containerp->_haveUpdateId = 0;
+                containerp->_failed = 0;
+            }
+        }
+    }
+
+    code = _crawlError;
+    if (code == 0 && _canceled)
+        code = -1;
+    if (code != 0)
+        _haveSystemUpdateId = 0;
+    _crawlDBasep = NULL;
+
+    return code;
+}
+
+int32_t
+UpnpAv::refresh(UpnpDBase *dbasep, const char *idp)
+{
+    CrawlBuffer *bufp;
+    CrawlContainer *containerp;
+    CrawlContainer *childp;
+    CrawlContainer *nextChildp;
+    CrawlContainer **changedContainerspp;
+    CrawlContainer **goneContainerspp;
+    uint32_t goneCount;
+    uint32_t systemUpdateId;
+    int32_t systemCode;
+    int32_t code;
+    uint32_t i;
+
+    if (!_rootContainerp || _rootContainerp->_id != idp)
+        return crawl(dbasep, idp);
+
+    _refreshing = 1;
+    _loadedPages = 0;
+    _loadedItems = 0;
+    _changedContainers = 0;
+    _canceled = 0;
+    _crawlError = 0;
+    _crawlDBasep = dbasep;
+
+    bufp = _crawlBuffers.pop();
+    if (!bufp)
+        bufp = new CrawlBuffer();
+    systemCode = getSystemUpdateId(bufp, &systemUpdateId);
+    _crawlBuffers.append(bufp);
+    if ( systemCode == 0 &&
+         _haveSystemUpdateId &&
+         systemUpdateId == _systemUpdateId) {
+        _refreshing = 0;
+        _crawlDBasep = NULL;
+        return 0;
+    }
+
+    /* find the containers whose UpdateIDs have changed */
+    for(i=0;i<_containerHashSize;i++) {
+        for(containerp = _containerHashp[i]; containerp; containerp = containerp->_nextHashp)
+            queueCheck(containerp);
+    }
+    waitForCrawl();
+
+    /* and browse them again.  Their current urls move aside, to be
+     * released once we have the new ones, so that tracks that are
+     * still there never leave the database.  The browses add new
+     * containers to the hash table, so collect the changed ones first.
+     */
+    _refreshGen++;
+    changedContainerspp = new CrawlContainer *[_containerCount];
+    for(i=0;i<_containerHashSize;i++) {
+        for(containerp = _containerHashp[i]; containerp; containerp = containerp->_nextHashp) {
+            if (!containerp->_changed || containerp->_gone)
+                continue;
+            containerp->_failed = 0;
+            containerp->_oldUrlsp = containerp->_urlsp;
+            containerp->_oldUrlCount = containerp->_urlCount;
+            containerp->_urlsp = NULL;
+            containerp->_urlCount = 0;
+            containerp->_maxUrls = 0;
+            changedContainerspp[_changedContainers++] = containerp;
+        }
+    }
+    for(i=0;i<_changedContainers;i++)
+        queueCrawl(changedContainerspp[i], 0, _numAtOnce, 1);
+    delete [] changedContainerspp;
+    waitForCrawl();
+
+    /* now drop what the changed containers no longer list; a container
+     * we couldn't browse completely keeps what it had, and gets
+     * browsed again next time.
+     */
+    goneContainerspp = new CrawlContainer *[_containerCount];
+    goneCount = 0;
+    for(i=0;i<_containerHashSize;i++) {
+        for(containerp = _containerHashp[i]; containerp; containerp = containerp->_nextHashp) {
+            if (containerp->_gone) {
+                goneContainerspp[goneCount++] = containerp;
+                continue;
+            }
+            if (!containerp->_changed) {
+                /* one this refresh found, but couldn't browse completely */
+                if (containerp->_failed) {
+                    containerp->_haveUpdateId = 0;
+                    containerp->_failed = 0;
+                }
+                continue;
+            }
+            containerp->_changed = 0;
+
+            if (containerp->_failed) {
+                containerp->_haveUpdateId = 0;
+                releaseUrls(containerp->_urlsp, containerp->_urlCount);
+                free(containerp->_urlsp);
+                containerp->_urlsp = containerp->_oldUrlsp;
+                containerp->_urlCount = containerp->_maxUrls = containerp->_oldUrlCount;
+            }
+            else {
+                releaseUrls(containerp->_oldUrlsp, containerp->_oldUrlCount);
+                free(containerp->_oldUrlsp);
+                for(childp = containerp->_children.head(); childp; childp = nextChildp) {
+                    nextChildp = childp->_dqNextp;
+                    if (childp->_listedGen != _refreshGen && !childp->_gone)
+                        goneContainerspp[goneCount++] = childp;
+                }
+            }
+            containerp->_oldUrlsp = NULL;
+            containerp->_oldUrlCount = 0;
+        }
+    }
+
+    /* a gone container may be under another one, so mark them all
+     * first, and only delete those whose parents aren't going too.
+     */
+    for(i=0;i<goneCount;i++)
+        goneContainerspp[i]->_gone = 1;
+    for(i=0;i<goneCount;i++) {
+        containerp = goneContainerspp[i];
+        for(childp = containerp->_parentp; childp; childp = childp->_parentp) {
+            if (childp->_gone)
+                break;
+        }
+        if (!childp)
+            deleteContainer(containerp);
+    }
+    delete [] goneContainerspp;
+
+    code = _crawlError;
+    if (code == 0 && _canceled)
+        code = -1;
+    if (code == 0 && systemCode == 0) {
+        _systemUpdateId = systemUpdateId;
+        _haveSystemUpdateId = 1;
+    }
+    else
+        _haveSystemUpdateId = 0;
+    _refreshing = 0;
+    _crawlDBasep = NULL;
+
+    return code;
+}
+
+void
+UpnpAv::queueCrawl(CrawlContainer *containerp, uint32_t startIx, uint32_t count, int firstPage)
+{
+    CrawlTask *taskp;
+
+    taskp = new CrawlTask();
+    taskp->_avp = this;
+    taskp->_containerp = containerp;
+    taskp->_startIx = startIx;
+    taskp->_count = count;
+    taskp->_firstPage = firstPage;
+    taskp->_checkOnly = 0;
+
+    _crawlMutex.take();
+    _crawlTasks++;
+    _crawlMutex.release();
+
+    /* pages and children queued by a running page go to the front, so
+     * that we finish off subtrees, rather than queueing up every
+     * container on the server before loading any of their items.
+     */
+    _crawlGroupp->queueTask(taskp, /* head */ (containerp->_parentp != NULL || !firstPage));
+}
+
+void
+UpnpAv::queueCheck(CrawlContainer *containerp)
+{
+    CrawlTask *taskp;
+
+    taskp = new CrawlTask();
+    taskp->_avp = this;
+    taskp->_containerp = containerp;
+    taskp->_startIx = 0;
+    taskp->_count = 0;
+    taskp->_firstPage = 0;
+    taskp->_checkOnly = 1;
+
+    _crawlMutex.take();
+    _crawlTasks++;
+    _crawlMutex.release();
+
+    _crawlGroupp->queueTask(taskp);
+}
+
+void
+UpnpAv::waitForCrawl()
+{
+    _crawlMutex.take();
+    while(_crawlTasks > 0)
+        _crawlDoneCV.wait();
+    _crawlMutex.release();
+}
+
+void
+UpnpAv::crawlTaskDone(int32_t code)
+{
+    _crawlMutex.take();
+    if (code != 0 && _crawlError == 0)
+        _crawlError = code;
+    if (--_crawlTasks == 0)
+        _crawlDoneCV.broadcast();
+    _crawlMutex.release();
+}
+
+int32_t
+UpnpAv::CrawlTask::start()
+{
+    CrawlBuffer *bufp;
+    UpnpAv *avp = _avp;
+    uint8_t canceled;
+    int32_t code;
+
+    avp->_crawlMutex.take();
+    bufp = avp->_crawlBuffers.pop();
+    canceled = avp->_canceled;
+    avp->_crawlMutex.release();
+
+    if (canceled)
+        code = -1;
+    else {
+        if (!bufp)
+            bufp = new CrawlBuffer();
+        if (_checkOnly)
+            code = avp->crawlCheck(this, bufp);
+        else
+            code = avp->crawlPage(this, bufp);
+    }
+
+    avp->_crawlMutex.take();
+    if (code != 0 && !_checkOnly)
+        _containerp->_failed = 1;
+    if (bufp)
+        avp->_crawlBuffers.append(bufp);
+    avp->_crawlMutex.release();
+
+    /* after this, avp's crawl may return */
+    avp->crawlTaskDone(code);
+
+    return 0;
+}
+
+/* make one ContentDirectory call, leaving the response in bufp */
+int32_t
+UpnpAv::crawlCall( const char *actionp,
+                   const char *sendDatap,
+                   CrawlBuffer *bufp,
+                   int32_t *httpCodep)
+{
+    XApi::ClientConn *connp;
+    XApi::ClientReq *reqp;
+    std::string soapAction;
+    int32_t sendCount;
+    uint32_t length;
+    int32_t code;
+
+    soapAction = std::string("\"urn:schemas-upnp-org:service:ContentDirectory:1#") + actionp + "\"";
+    sendCount = (int32_t) strlen(sendDatap);
+
+    connp = _xapiPoolp->getConn(_host, 1900, /* !TLS */ 0);
+    reqp = new XApi::ClientReq();
+    reqp->addHeader("Content-Type", "text/xml");
+    reqp->addHeader("SOAPACTION", soapAction.c_str());
+    reqp->setSendContentLength(sendCount);
+    reqp->startCall(connp, _devp->_controlRelativePath.c_str(), /* isPost */ XApi::reqPost);
+
+    code = reqp->getOutgoingPipe()->write(sendDatap, sendCount);
+    if (code != sendCount) {
+        printf("Write code=%d should be %d\n", code, sendCount);
+    }
+    reqp->getOutgoingPipe()->eof();
+
+    reqp->waitForHeadersDone();
+    code = crawlRead(reqp, bufp, &length);
+    if (code == 0)
+        code = reqp->getError();
+    *httpCodep = reqp->getHttpError();
+    delete reqp;
+
+    return code;
+}
+
+int32_t
+UpnpAv::getSystemUpdateId(CrawlBuffer *bufp, uint32_t *idp)
+{
+    int32_t httpCode;
+    int32_t code;
+    int found;
+
+    code = crawlCall("GetSystemUpdateID", crawlSystemUpdateIdData, bufp, &httpCode);
+    if (code != 0)
+        return code;
+    if (httpCode != 200)
+        return -1;
+
+    *idp = crawlCount(bufp->_datap, "Id", &found);
+    return (found? 0 : -1);
+}
+
+/* see whether a container's UpdateID has changed */
+int32_t
+UpnpAv::crawlCheck(CrawlTask *taskp, CrawlBuffer *bufp)
+{
+    CrawlContainer *containerp = taskp->_containerp;
+    char browseSendData[1024];
+    uint32_t updateId;
+    int32_t httpCode;
+    int32_t code;
+    int found;
+
+    snprintf(browseSendData, sizeof(browseSendData),
+             crawlMetadataTemplate, containerp->_id.c_str());
+    code = crawlCall("Browse", browseSendData, bufp, &httpCode);
+    if (code != 0)
+        return code;
+
+    if (httpCode != 200) {
+        if (crawlCount(bufp->_datap, "errorCode") == crawlNoSuchObject) {
+            containerp->_gone = 1;
+            return 0;
+        }
+        return -1;
+    }
+
+    /* a server that doesn't tell us gets browsed every time */
+    updateId = crawlCount(bufp->_datap, "UpdateID", &found);
+    if (!found || !containerp->_haveUpdateId || updateId != containerp->_updateId)
+        containerp->_changed = 1;
+
+    return 0;
+}
+
+int32_t
+UpnpAv::crawlPage(CrawlTask *taskp, CrawlBuffer *bufp)
+{
+    char browseSendData[1024];
+    int32_t httpCode;
+    int32_t code;
+
+    snprintf(browseSendData, sizeof(browseSendData),
+             _browseTemplate.c_str(), taskp->_containerp->_id.c_str(),
+             taskp->_startIx, taskp->_count);
+    code = crawlCall("Browse", browseSendData, bufp, &httpCode);
+    if (code != 0)
+        return code;
+
+    _crawlMutex.take();
+    _loadedPages++;
+    _crawlMutex.release();
+
+    return crawlScan(taskp, bufp);
+}
+
+/* read the whole response into bufp, null terminated, growing the
+ * buffer if it doesn't fit.
+ */
+int32_t
+UpnpAv::crawlRead(XApi::ClientReq *reqp, CrawlBuffer *bufp, uint32_t *lengthp)
+{
+    CThreadPipe *inPipep;
+    uint32_t length;
+    char *newDatap;
+    int32_t code;
+
+    inPipep = reqp->getIncomingPipe();
+    length = 0;
+    while(1) {
+        if (bufp->_size - length < 2) {
+            newDatap = (char *) realloc(bufp->_datap, 2 * bufp->_size);
+            if (!newDatap) {
+                bufp->_datap[length] = 0;
+                return -1;
+            }
+            bufp->_datap = newDatap;
+            bufp->_size *= 2;
+        }
+        code = inPipep->read(bufp->_datap + length, bufp->_size - length - 1);
+        if (code <= 0)
+            break;
+        length += code;
+    }
+    bufp->_datap[length] = 0;
+    *lengthp = length;
+
+    return 0;
+}
+
+/* pick the rest of a container's pages, if any, to queue, and then
+ * walk the DIDL-Lite Result, queueing containers and adding items as
+ * we finish each one.
+ */
+int32_t
+UpnpAv::crawlScan(CrawlTask *taskp, CrawlBuffer *bufp)
+{
+    CrawlContainer *containerp = taskp->_containerp;
+    uint32_t numReturned;
+    uint32_t totalMatches;
+    uint32_t updateId;
+    uint32_t endIx;
+    uint32_t ix;
+    uint32_t count;
+    int found;
+    char *textp;
+    char *endp;
+    char *tp;
+    char *namep;
+    char *nameEndp;
+    char *tagEndp;
+    std::string *fieldp;
+    uint32_t fieldBit;
+    uint8_t inContainer;
+    uint8_t inItem;
+
+    numReturned = crawlCount(bufp->_datap, "NumberReturned");
+    totalMatches = crawlCount(bufp->_datap, "TotalMatches");
+    endIx = taskp->_startIx + numReturned;
+
+    /* remember the UpdateID as of the first page, so that a change
+     * while we're paging through shows up next refresh.
+     */
+    if (taskp->_firstPage && taskp->_startIx == 0) {
+        updateId = crawlCount(bufp->_datap, "UpdateID", &found);
+        containerp->_updateId = updateId;
+        containerp->_haveUpdateId = found;
+    }
+
+    /* servers may return fewer than we ask for, so once the first page
+     * tells us how many there are, ask for all the rest at once, in
+     * pages of the size the server is willing to send.
+     */
+    if (numReturned > 0) {
+        if (taskp->_firstPage && totalMatches > endIx) {
+            for(ix = endIx; ix < totalMatches; ix += count) {
+                count = totalMatches - ix;
+                if (count > numReturned)
+                    count = numReturned;
+                queueCrawl(containerp, ix, count, 0);
+            }
+        }
+        else if (!taskp->_firstPage && numReturned < taskp->_count) {
+            queueCrawl(containerp, endIx, taskp->_count - numReturned, 0);
+        }
+        else if (totalMatches == 0 && numReturned == taskp->_count) {
+            /* the server doesn't know how many there are */
+            queueCrawl(containerp, endIx, _numAtOnce, 1);
+        }
+    }
+
+    /* Result is a DIDL-Lite document encoded as a string, so decode it
+     * before scanning it.
+     */
+    textp = crawlElement(bufp->_datap, "Result", &endp);
+    if (!textp) {
+        printf("crawl: no Result for %s at %d\n", containerp->_id.c_str(), taskp->_startIx);
+        return -1;
+    }
+    crawlDecode(textp, endp, &bufp->_didl);
+
+    inContainer = 0;
+    inItem = 0;
+    for(tp = const_cast<char *>(bufp->_didl.c_str()); (tp = strchr(tp, '<')) != NULL; ) {
+        if (tp[1] == '/') {
+            namep = tp+2;
+            nameEndp = crawlNameEnd(namep);
+            if (inContainer && crawlNameIs(namep, nameEndp, "container")) {
+                crawlContainer(taskp, bufp);
+                inContainer = 0;
+            }
+            else if (inItem && crawlNameIs(namep, nameEndp, "item")) {
+                crawlAddItem(taskp, bufp);
+                inItem = 0;
+            }
+            tp = crawlTagEnd(nameEndp);
+            continue;
+        }
+        if (tp[1] == '!' || tp[1] == '?') {
+            tp = crawlTagEnd(tp+1);
+            continue;
+        }
+
+        namep = tp+1;
+        nameEndp = crawlNameEnd(namep);
+        tagEndp = crawlTagEnd(nameEndp);
+        if (*tagEndp == 0)
+            break;
+        tp = tagEndp+1;
+
+        if (crawlNameIs(namep, nameEndp, "container")) {
+            bufp->_haveFields = 0;
+            bufp->_containerId.clear();
+            bufp->_parentId.clear();
+            crawlAttr(nameEndp, tagEndp, "id", &bufp->_containerId);
+            crawlAttr(nameEndp, tagEndp, "parentID", &bufp->_parentId);
+            inItem = 0;
+            if (tagEndp[-1] == '/')
+                crawlContainer(taskp, bufp);
+            else
+                inContainer = 1;
+            continue;
+        }
+        if (crawlNameIs(namep, nameEndp, "item")) {
+            bufp->_haveFields = 0;
+            inContainer = 0;
+            inItem = (tagEndp[-1] != '/');
+            continue;
+        }
+        if ((!inContainer && !inItem) || tagEndp[-1] == '/')
+            continue;
+
+        /* a field; as with browse, if there's more than one, the last
+         * one wins.
+         */
+        if (crawlNameIs(namep, nameEndp, "dc:title")) {
+            fieldp = &bufp->_title;
+            fieldBit = CrawlBuffer::_haveTitle;
+        }
+        else if (!inItem)
+            continue;
+        else if (crawlNameIs(namep, nameEndp, "upnp:album")) {
+            fieldp = &bufp->_album;
+            fieldBit = CrawlBuffer::_haveAlbum;
+        }
+        else if (crawlNameIs(namep, nameEndp, "upnp:artist")) {
+            fieldp = &bufp->_artist;
+            fieldBit = CrawlBuffer::_haveArtist;
+        }
+        else if (crawlNameIs(namep, nameEndp, "res")) {
+            fieldp = &bufp->_url;
+            fieldBit = CrawlBuffer::_haveUrl;
+        }
+        else if (crawlNameIs(namep, nameEndp, "upnp:class")) {
+            fieldp = &bufp->_class;
+            fieldBit = CrawlBuffer::_haveClass;
+        }
+        else if (crawlNameIs(namep, nameEndp, "upnp:genre")) {
+            fieldp = &bufp->_genre;
+            fieldBit = CrawlBuffer::_haveGenre;
+        }
+        else if (crawlNameIs(namep, nameEndp, "upnp:albumArtURI")) {
+            fieldp = &bufp->_artUrl;
+            fieldBit = CrawlBuffer::_haveArtUrl;
+        }
+        else
+            continue;
+
+        endp = strchr(tp, '<');
+        if (!endp)
+            break;
+        crawlDecode(tp, endp, fieldp);
+        bufp->_haveFields |= fieldBit;
+        tp = endp;
+    }
+
+    return 0;
+}
+
+/* the same rules as addItemsFromTree for descending into a container.
+ * During a refresh, a container we already know is just noted as still
+ * being there; it's browsed again only if its own UpdateID changed.
+ */
+void
+UpnpAv::crawlContainer(CrawlTask *taskp, CrawlBuffer *bufp)
+{
+    CrawlContainer *parentp = taskp->_containerp;
+    CrawlContainer *containerp;
+
+    if (!_recurse)
+        return;
+
+    if ( parentp->_rlevel == 0 &&
+         _musicHack &&
+         (bufp->_haveFields & CrawlBuffer::_haveTitle) &&
+         skipContainer(bufp->_title.c_str()))
+        return;
+
+    if (bufp->_parentId != parentp->_id || bufp->_containerId.length() == 0) {
+        printf("skipping browse of %s -- hard link\n", bufp->_containerId.c_str());
+        return;
+    }
+
+    _crawlMutex.take();
+    containerp = findContainer(&bufp->_containerId);
+    if (containerp) {
+        /* it may have moved here from another container */
+        if (containerp->_parentp != parentp && containerp != _rootContainerp) {
+            if (containerp->_parentp)
+                containerp->_parentp->_children.remove(containerp);
+            containerp->_parentp = parentp;
+            parentp->_children.append(containerp);
+        }
+        containerp->_listedGen = _refreshGen;
+        _crawlMutex.release();
+        return;
+    }
+    containerp = newContainer(&bufp->_containerId, parentp);
+    _crawlMutex.release();
+
+    queueCrawl(containerp, 0, _numAtOnce, 1);
+}
+
+void
+UpnpAv::crawlAddItem(CrawlTask *taskp, CrawlBuffer *bufp)
+{
+    uint32_t have = bufp->_haveFields;
+    UpnpDBase::Record *recordp;
+    int32_t code;
+
+    if (!(have & CrawlBuffer::_haveUrl) || !(have & CrawlBuffer::_haveTitle))
+        return;
+
+    if (!isAudioItem( ((have & CrawlBuffer::_haveClass)? bufp->_class.c_str() : NULL),
+                      bufp->_url.c_str()))
+        return;
+
+    _crawlMutex.take();
+
+    /* when refreshing, a track we have may have been edited */
+    if (_refreshing && (recordp = _crawlDBasep->findRecord(&bufp->_url)) != NULL) {
+        if ( recordp->_title != bufp->_title ||
+             recordp->_inAlbumTree != ((have & CrawlBuffer::_haveAlbum) != 0) ||
+             recordp->_album != ((have & CrawlBuffer::_haveAlbum)? bufp->_album : "") ||
+             recordp->_inArtistTree != ((have & CrawlBuffer::_haveArtist) != 0) ||
+             recordp->_artist != ((have & CrawlBuffer::_haveArtist)? bufp->_artist : "") ||
+             recordp->_inGenreTree != ((have & CrawlBuffer::_haveGenre) != 0) ||
+             recordp->_genre != ((have & CrawlBuffer::_haveGenre)? bufp->_genre : "") ||
+             recordp->_artUrl != ((have & CrawlBuffer::_haveArtUrl)? bufp->_artUrl : "")) {
+            _crawlDBasep->deleteRecord(recordp);
+        }
+    }
+
+    code = _crawlDBasep->addRecord( &bufp->_url,
+                                    &bufp->_title,
+                                    ((have & CrawlBuffer::_haveAlbum)? &bufp->_album : NULL),
+                                    ((have & CrawlBuffer::_haveArtist)? &bufp->_artist : NULL),
+                                    ((have & CrawlBuffer::_haveGenre)? &bufp->_genre : NULL),
+                                    ((have & CrawlBuffer::_haveArtUrl)? &bufp->_artUrl : NULL),
+                                    _devp->_tag);
+    if (code == 0)
+        _loadedItems++;
+    if (code == 0 || code == -2)
+        addContainerUrl(taskp->_containerp, &bufp->_url);
+
+    _crawlMutex.release();
+}
@@ -0,0 +1,442 @@
+#include "upnpsearch.h"
+#include <ctype.h>
+
+/* most trigrams of a query we intersect; the rest are only checked by
+ * the final substring test.
+ */
+static const uint32_t _maxQueryTrigrams = 32;
+
+/* ranks are quality * fieldCount + the field's priority */
+static const uint32_t _rankCount = 3 * UpnpSearchIndex::_fieldCount;
+
+UpnpSearchIndex::~UpnpSearchIndex()
+{
+    clear();
+    delete [] _termHashp;
+    delete [] _postingHashp;
+    free(_termsp);
+}
+
+/* static */ uint64_t
+UpnpSearchIndex::hashKey(uint8_t field, std::string *keyp)
+{
+    uint64_t hash;
+    const uint8_t *tp;
+    size_t i;
+    size_t length;
+
+    /* FNV-1a */
+    hash = 0xcbf29ce484222325ULL ^ field;
+    tp = (const uint8_t *) keyp->data();
+    length = keyp->length();
+    for(i=0;i<length;i++) {
+        hash ^= tp[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/* lower case ASCII, leaving everything else (including UTF-8) alone */
+/* static */ void
+UpnpSearchIndex::lowerString(std::string *inp, std::string *outp)
+{
+    size_t i;
+    size_t length;
+
+    length = inp->length();
+    outp->resize(length);
+    for(i=0;i<length;i++) {
+        (*outp)[i] = tolower((uint8_t) (*inp)[i]);
+    }
+}
+
+UpnpSearchIndex::Term *
+UpnpSearchIndex::findTerm(uint8_t field, std::string *keyp, uint64_t hash)
+{
+    Term *termp;
+
+    for( termp = _termHashp[hash % _termHashSize]; termp; termp = termp->_nextHashp) {
+        if ( termp->_hash == hash &&
+             termp->_field == field &&
+             termp->_key == *keyp)
+            return termp;
+    }
+    return NULL;
+}
+
+UpnpSearchIndex::Posting *
+UpnpSearchIndex::findPosting(uint32_t trigram, int create)
+{
+    Posting *postingp;
+    uint32_t ix;
+
+    ix = postingHash(trigram);
+    for(postingp = _postingHashp[ix]; postingp; postingp = postingp->_nextHashp) {
+        if (postingp->_trigram == trigram)
+            return postingp;
+    }
+
+    if (!create)
+        return NULL;
+
+    postingp = new Posting();
+    postingp->_trigram = trigram;
+    postingp->_count = 0;
+    postingp->_maxCount = 4;
+    postingp->_idsp = (uint32_t *) malloc(postingp->_maxCount * sizeof(uint32_t));
+    postingp->_nextHashp = _postingHashp[ix];
+    _postingHashp[ix] = postingp;
+    _postingCount++;
+    return postingp;
+}
+
+/* add a term's id to the posting list of each of its trigrams */
+void
+UpnpSearchIndex::indexTerm(Term *termp)
+{
+    Posting *postingp;
+    const char *datap;
+    uint32_t length;
+    uint32_t i;
+    uint32_t id;
+
+    datap = termp->_lower.data();
+    length = (uint32_t) termp->_lower.length();
+    id = termp->_id;
+    for(i=0; i+3<=length; i++) {
+        postingp = findPosting(trigramAt(datap, i), 1);
+
+        /* ids come in order, so a trigram repeated in the term has
+         * just been added.
+         */
+        if (postingp->_count > 0 && postingp->_idsp[postingp->_count-1] == id)
+            continue;
+
+        if (postingp->_count >= postingp->_maxCount) {
+            postingp->_maxCount *= 2;
+            postingp->_idsp = (uint32_t *) realloc( postingp->_idsp,
+                                                    postingp->_maxCount * sizeof(uint32_t));
+        }
+        postingp->_idsp[postingp->_count++] = id;
+    }
+}
+
+void
+UpnpSearchIndex::growTermHash()
+{
+    Term **oldHashp;
+    uint32_t oldSize;
+    Term *termp;
+    Term *ntermp;
+    uint32_t i;
+    uint32_t ix;
+
+    oldHashp = _termHashp;
+    oldSize = _termHashSize;
+    _termHashSize = oldSize * 4;
+    _termHashp = new Term *[_termHashSize];
+    memset(_termHashp, 0, _termHashSize * sizeof(Term *));
+    for(i=0;i<oldSize;i++) {
+        for(termp = oldHashp[i]; termp; termp = ntermp) {
+            ntermp = termp->_nextHashp;
+            ix = termp->_hash % _termHashSize;
+            termp->_nextHashp = _termHashp[ix];
+            _termHashp[ix] = termp;
+        }
+    }
+    delete [] oldHashp;
+}
+
+void
+UpnpSearchIndex::add(uint8_t field, std::string *keyp)
+{
+    Term *termp;
+    uint64_t hash;
+    uint32_t ix;
+
+    hash = hashKey(field, keyp);
+    if (findTerm(field, keyp, hash) != NULL)
+        return;
+
+    termp = new Term();
+    termp->_key = *keyp;
+    lowerString(keyp, &termp->_lower);
+    termp->_hash = hash;
+    termp->_field = field;
+
+    if (_nextId >= _maxTerms) {
+        _maxTerms *= 2;
+        _termsp = (Term **) realloc(_termsp, _maxTerms * sizeof(Term *));
+    }
+    termp->_id = _nextId++;
+    _termsp[termp->_id] = termp;
+
+    ix = hash % _termHashSize;
+    termp->_nextHashp = _termHashp[ix];
+    _termHashp[ix] = termp;
+    _liveCount++;
+    if (_liveCount > 2 * _termHashSize)
+        growTermHash();
+
+    indexTerm(termp);
+}
+
+void
+UpnpSearchIndex::remove(uint8_t field, std::string *keyp)
+{
+    Term *termp;
+    Term **lastpp;
+    uint64_t hash;
+    uint32_t dead;
+
+    hash = hashKey(field, keyp);
+    for( lastpp = &_termHashp[hash % _termHashSize], termp = *lastpp;
+         termp;
+         lastpp = &termp->_nextHashp, termp = *lastpp) {
+        if ( termp->_hash == hash &&
+             termp->_field == field &&
+             termp->_key == *keyp)
+            break;
+    }
+    if (termp == NULL)
+        return;
+
+    *lastpp = termp->_nextHashp;
+    _termsp[termp->_id] = NULL;
+    delete termp;
+    _liveCount--;
+
+    dead = _nextId - _liveCount;
+    if (dead >= _minRebuildDead && dead > _liveCount)
+        rebuild();
+}
+
+void
+UpnpSearchIndex::freePostings()
+{
+    Posting *postingp;
+    Posting *npostingp;
+    uint32_t i;
+
+    for(i=0;i<_postingHashSize;i++) {
+        for(postingp = _postingHashp[i]; postingp; postingp = npostingp) {
+            npostingp = postingp->_nextHashp;
+            free(postingp->_idsp);
+            delete postingp;
+        }
+        _postingHashp[i] = NULL;
+    }
+    _postingCount = 0;
+}
+
+/* renumber the live terms densely, and rebuild the posting lists
+ * without the dead ids.
+ */
+void
+UpnpSearchIndex::rebuild()
+{
+    uint32_t i;
+    uint32_t j;
+
+    freePostings();
+
+    j = 0;
+    for(i=0;i<_nextId;i++) {
+        if (_termsp[i] == NULL)
+            continue;
+        _termsp[j] = _termsp[i];
+        _termsp[j]->_id = j;
+        indexTerm(_termsp[j]);
+        j++;
+    }
+    _nextId = j;
+}
+
+void
+UpnpSearchIndex::clear()
+{
+    uint32_t i;
+
+    for(i=0;i<_nextId;i++) {
+        if (_termsp[i])
+            delete _termsp[i];
+    }
+    _nextId = 0;
+    _liveCount = 0;
+    memset(_termHashp, 0, _termHashSize * sizeof(Term *));
+
+    freePostings();
+}
+
+/* return how well a term matches the query, or -1 if it doesn't */
+/* static */ int32_t
+UpnpSearchIndex::quality(Term *termp, std::string *lowerQueryp)
+{
+    size_t pos;
+    uint8_t tc;
+
+    pos = termp->_lower.find(*lowerQueryp);
+    if (pos == std::string::npos)
+        return -1;
+    if (pos == 0)
+        return _matchPrefix;
+
+    /* look for an occurrence at the start of a word */
+    while(pos != std::string::npos) {
+        tc = termp->_lower[pos-1];
+        if (!isalnum(tc) && tc < 0x80)
+            return _matchWord;
+        pos = termp->_lower.find(*lowerQueryp, pos+1);
+    }
+    return _matchInside;
+}
+
+int32_t
+UpnpSearchIndex::search( std::string *queryp,
+                         uint32_t fieldMask,
+                         uint32_t maxMatches,
+                         Match **matchespp,
+                         uint32_t *countp)
+{
+    std::string lowerQuery;
+    Posting *postingsp[_maxQueryTrigrams];
+    Posting *postingp;
+    uint32_t positions[_maxQueryTrigrams];
+    uint32_t postingCount;
+    uint32_t rankCounts[_rankCount];
+    Match *foundp;
+    Match *matchesp;
+    uint32_t foundCount;
+    uint32_t maxFound;
+    uint32_t length;
+    uint32_t trigram;
+    uint32_t rank;
+    uint32_t total;
+    uint32_t count;
+    uint32_t id;
+    uint32_t i;
+    uint32_t j;
+    uint32_t lo;
+    uint32_t hi;
+    uint32_t mid;
+    int32_t tquality;
+    Term *termp;
+
+    *matchespp = NULL;
+    *countp = 0;
+
+    lowerString(queryp, &lowerQuery);
+    length = (uint32_t) lowerQuery.length();
+    if (length == 0 || maxMatches == 0)
+        return 0;
+
+    postingCount = 0;
+    if (length >= 3) {
+        for(i=0; i+3<=length && postingCount < _maxQueryTrigrams; i++) {
+            trigram = trigramAt(lowerQuery.data(), i);
+            postingp = findPosting(trigram, 0);
+            if (postingp == NULL) {
+                /* nothing has this trigram, so nothing matches */
+                return 0;
+            }
+            for(j=0;j<postingCount;j++) {
+                if (postingsp[j] == postingp)
+                    break;
+            }
+            if (j < postingCount)
+                continue;
+
+            /* keep them sorted, shortest first */
+            for(j=postingCount; j>0 && postingsp[j-1]->_count > postingp->_count; j--) {
+                postingsp[j] = postingsp[j-1];
+            }
+            postingsp[j] = postingp;
+            postingCount++;
+        }
+    }
+
+    maxFound = 64;
+    foundp = (Match *) malloc(maxFound * sizeof(Match));
+    foundCount = 0;
+    memset(positions, 0, sizeof(positions));
+
+    /* candidates are every id in the shortest list that's in all of
+     * the others, or for a short query, every term.
+     */
+    count = (postingCount > 0? postingsp[0]->_count : _nextId);
+    for(i=0;i<count;i++) {
+        if (postingCount > 0) {
+            id = postingsp[0]->_idsp[i];
+            for(j=1;j<postingCount;j++) {
+                /* binary search the rest of list j, since we search
+                 * for ids in increasing order.
+                 */
+                postingp = postingsp[j];
+                lo = positions[j];
+                hi = postingp->_count;
+                while(lo < hi) {
+                    mid = lo + (hi - lo) / 2;
+                    if (postingp->_idsp[mid] < id)
+                        lo = mid+1;
+                    else
+                        hi = mid;
+                }
+                positions[j] = lo;
+                if (lo >= postingp->_count || postingp->_idsp[lo] != id)
+                    break;
+            }
+            if (j < postingCount)
+                continue;
+        }
+        else {
+            id = i;
+        }
+
+        termp = _termsp[id];
+        if (termp == NULL || !(fieldMask & (1 << termp->_field)))
+            continue;
+        tquality = quality(termp, &lowerQuery);
+        if (tquality < 0)
+            continue;
+
+        if (foundCount >= maxFound) {
+            maxFound *= 2;
+            foundp = (Match *) realloc(foundp, maxFound * sizeof(Match));
+        }
+        foundp[foundCount]._termp = termp;
+        foundp[foundCount]._quality = tquality;
+        foundCount++;
+    }
+
+    /* a counting sort by rank, best first, which keeps each rank in id
+     * order.
+     */
+    memset(rankCounts, 0, sizeof(rankCounts));
+    for(i=0;i<foundCount;i++) {
+        rank = ( (_matchPrefix - foundp[i]._quality) * _fieldCount +
+                 foundp[i]._termp->_field);
+        rankCounts[rank]++;
+    }
+    total = 0;
+    for(i=0;i<_rankCount;i++) {
+        count = rankCounts[i];
+        rankCounts[i] = total;
+        total += count;
+    }
+
+    if (foundCount > maxMatches)
+        foundCount = maxMatches;
+    matchesp = (Match *) malloc((foundCount > 0? foundCount : 1) * sizeof(Match));
+    for(i=0;i<total;i++) {
+        rank = ( (_matchPrefix - foundp[i]._quality) * _fieldCount +
+                 foundp[i]._termp->_field);
+        j = rankCounts[rank]++;
+        if (j < foundCount)
+            matchesp[j] = foundp[i];
+    }
+    free(foundp);
+
+    *matchespp = matchesp;
+    *countp = foundCount;
+    return 0;
+}
@@ -0,0 +1,156 @@
+#ifndef __UPNPSEARCH_H_ENV__
+#define __UPNPSEARCH_H_ENV__ 1
+
+#include "osp.h"
+#include <string>
+#include <string.h>
+#include <stdlib.h>
+
+/* A trigram index over the distinct titles, artists, albums and genres
+ * in an UpnpDBase, for substring search.  Each distinct string is a
+ * Term, numbered in the order it was added, and each trigram of a
+ * term's lower cased text has a posting list of the ids of the terms
+ * containing it.  Since ids only grow, posting lists are appended to
+ * in order, and stay sorted.
+ *
+ * A query finds the terms containing all of its trigrams by
+ * intersecting their posting lists, shortest first, and then checks
+ * each survivor for the query as a real substring.  Queries too short
+ * to have a trigram just check every term.
+ *
+ * Removing a term only clears its slot; the posting lists keep the
+ * stale id until half of the ids are dead, when everything is
+ * renumbered and the lists rebuilt.  The index only knows strings,
+ * not records; UpnpDBase maps matching terms back to records through
+ * its radix trees.
+ */
+class UpnpSearchIndex {
+ public:
+    /* fields, in the order they rank among otherwise equal matches */
+    static const uint8_t _fieldTitle = 0;
+    static const uint8_t _fieldArtist = 1;
+    static const uint8_t _fieldAlbum = 2;
+    static const uint8_t _fieldGenre = 3;
+    static const uint8_t _fieldCount = 4;
+    static const uint32_t _allFields = 0xf;
+
+    /* how well a term matched; higher is better */
+    static const uint8_t _matchInside = 0;
+    static const uint8_t _matchWord = 1;       /* at the start of a word */
+    static const uint8_t _matchPrefix = 2;     /* at the start of the term */
+
+    class Term {
+    public:
+        Term *_nextHashp;
+        std::string _key;       /* as it is in the radix tree */
+        std::string _lower;     /* what we search */
+        uint64_t _hash;
+        uint32_t _id;
+        uint8_t _field;
+    };
+
+    class Match {
+    public:
+        Term *_termp;
+        uint8_t _quality;
+    };
+
+ private:
+    class Posting {
+    public:
+        Posting *_nextHashp;
+        uint32_t _trigram;
+        uint32_t _count;
+        uint32_t _maxCount;
+        uint32_t *_idsp;
+    };
+
+    static const uint32_t _minHashSize = 1024;
+    static const uint32_t _postingHashSize = 65536;
+    static const uint32_t _minRebuildDead = 1024;
+
+    /* terms, by (field, key) */
+    Term **_termHashp;
+    uint32_t _termHashSize;
+
+    /* terms, by id; dead ids are null */
+    Term **_termsp;
+    uint32_t _maxTerms;
+    uint32_t _nextId;
+    uint32_t _liveCount;
+
+    Posting **_postingHashp;
+    uint32_t _postingCount;
+
+    static uint64_t hashKey(uint8_t field, std::string *keyp);
+
+    static void lowerString(std::string *inp, std::string *outp);
+
+    static uint32_t trigramAt(const char *datap, uint32_t ix) {
+        return ( ((uint32_t) (uint8_t) datap[ix] << 16) |
+                 ((uint32_t) (uint8_t) datap[ix+1] << 8) |
+                 (uint32_t) (uint8_t) datap[ix+2]);
+    }
+
+    static uint32_t postingHash(uint32_t trigram) {
+        return (trigram * 2654435761U) >> 16;
+    }
+
+    Term *findTerm(uint8_t field, std::string *keyp, uint64_t hash);
+
+    Posting *findPosting(uint32_t trigram, int create);
+
+    void indexTerm(Term *termp);
+
+    void growTermHash();
+
+    void freePostings();
+
+    void rebuild();
+
+    static int32_t quality(Term *termp, std::string *lowerQueryp);
+
+ public:
+    UpnpSearchIndex() {
+        _termHashSize = _minHashSize;
+        _termHashp = new Term *[_termHashSize];
+        memset(_termHashp, 0, _termHashSize * sizeof(Term *));
+        _maxTerms = _minHashSize;
+        _termsp = (Term **) malloc(_maxTerms * sizeof(Term *));
+        _nextId = 0;
+        _liveCount = 0;
+        _postingHashp = new Posting *[_postingHashSize];
+        memset(_postingHashp, 0, _postingHashSize * sizeof(Posting *));
+        _postingCount = 0;
+    }
+
+    ~UpnpSearchIndex();
+
+    /* add a string, if it's not already there */
+    void add(uint8_t field, std::string *keyp);
+
+    void remove(uint8_t field, std::string *keyp);
+
+    void clear();
+
+    /* find up to maxMatches terms, in the fields in fieldMask (a bit
+     * per field), containing a query, ignoring case.  Returns a
+     * malloc'd array, which the caller frees, of the best matches
+     * first: by quality, then by field, then oldest first.
+     */
+    int32_t search( std::string *queryp,
+                    uint32_t fieldMask,
+                    uint32_t maxMatches,
+                    Match **matchespp,
+                    uint32_t *countp);
+
+    uint32_t getTermCount() {
+        return _liveCount;
+    }
+
+    uint32_t getTrigramCount() {
+        return _postingCount;
+    }
+};
+
+#endif /* __UPNPSEARCH_H_ENV__ */
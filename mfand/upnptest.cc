@@ -30,6 +30,134 @@ mainPrintCallback(void *callbackContextp, void *arecordp) {
     return 0;
 }
 
+/* a ContentDirectory server for crawlFailCheck: container "0" holds
+ * four tracks, which it hands out two at a time, and it leaves the
+ * Result out of the second page the first time it's asked for it.
+ */
+class CrawlService : public XApi::ServerReq {
+public:
+    static uint32_t _laterPageFailures;
+
+    void startMethod() {
+        char tbuffer[4096];
+        std::string request;
+        std::string response;
+        std::string didl;
+        const char *tp;
+        uint32_t startIx;
+        uint32_t i;
+        int32_t code;
+
+        CThreadPipe *inPipep = getIncomingPipe();
+        CThreadPipe *outPipep = getOutgoingPipe();
+
+        while(1) {
+            code = inPipep->read(tbuffer, sizeof(tbuffer));
+            if (code <= 0)
+                break;
+            request.append(tbuffer, code);
+        }
+
+        response = "<?xml version=\"1.0\"?>\r\n<s:Envelope><s:Body>";
+        if (strstr(request.c_str(), "GetSystemUpdateID")) {
+            response += "<u:GetSystemUpdateIDResponse><Id>7</Id></u:GetSystemUpdateIDResponse>";
+        }
+        else if (strstr(request.c_str(), "BrowseMetadata")) {
+            response += "<u:BrowseResponse><UpdateID>5</UpdateID></u:BrowseResponse>";
+        }
+        else {
+            tp = strstr(request.c_str(), "<StartingIndex>");
+            startIx = (tp? atoi(tp+15) : 0);
+            response += "<u:BrowseResponse>";
+            if (startIx == 0 || _laterPageFailures == 0) {
+                for(i=startIx; i<startIx+2 && i<4; i++) {
+                    snprintf(tbuffer, sizeof(tbuffer),
+                             "&lt;item id=\"i%d\" parentID=\"0\"&gt;&lt;dc:title&gt;Track %d&lt;/dc:title&gt;"
+                             "&lt;upnp:class&gt;object.item.audioItem.musicTrack&lt;/upnp:class&gt;"
+                             "&lt;res&gt;http://127.0.0.1/track%d.mp3&lt;/res&gt;&lt;/item&gt;",
+                             i, i, i);
+                    didl += tbuffer;
+                }
+                response += "<Result>&lt;DIDL-Lite&gt;" + didl + "&lt;/DIDL-Lite&gt;</Result>";
+            }
+            else
+                _laterPageFailures--;
+            response += "<NumberReturned>2</NumberReturned><TotalMatches>4</TotalMatches>"
+                "<UpdateID>5</UpdateID></u:BrowseResponse>";
+        }
+        response += "</s:Body></s:Envelope>\r\n";
+
+        setSendContentLength((int32_t) response.length());
+        inputReceived();
+        outPipep->write(response.c_str(), (int32_t) response.length());
+        outPipep->eof();
+        requestDone();
+    }
+};
+
+uint32_t CrawlService::_laterPageFailures = 1;
+
+static XApi::ServerReq *
+crawlServiceFactory(std::string *opcodep)
+{
+    return new CrawlService();
+}
+
+static int32_t
+countCallback(void *contextp, void *arecordp) {
+    (*(uint32_t *) contextp)++;
+    return 0;
+}
+
+/* crawl a server whose second page fails, and check that the next
+ * refresh browses the container again and gets the rest of it.
+ */
+static int
+crawlFailCheck(int port)
+{
+    XApi *xapip;
+    UpnpDevice dev;
+    UpnpAv av;
+    UpnpDBase dbase;
+    char tbuffer[64];
+    uint32_t count;
+    int32_t code;
+    int failed = 0;
+
+    xapip = new XApi();
+    xapip->registerFactory(&crawlServiceFactory);
+    xapip->initWithPort(port);
+
+    snprintf(tbuffer, sizeof(tbuffer), "127.0.0.1:%d", port);
+    dev._host = tbuffer;
+    dev._controlRelativePath = "/ContentDirectory/control";
+    dev._controlPathKnown = 1;
+    av.init(&dev);
+
+    code = av.crawl(&dbase, "0");
+    count = 0;
+    dbase.apply(countCallback, &count);
+    printf("crawl code=%d pages=%d items=%d records=%d\n",
+           code, av.loadedPages(), av.loadedItems(), count);
+    if (code == 0 || count != 2) {
+        printf("crawl should have failed with 2 tracks\n");
+        failed = 1;
+    }
+
+    code = av.refresh(&dbase, "0");
+    count = 0;
+    dbase.apply(countCallback, &count);
+    printf("refresh code=%d changed=%d pages=%d records=%d\n",
+           code, av.changedContainers(), av.loadedPages(), count);
+    if (code != 0 || av.changedContainers() != 1 || count != 4) {
+        printf("refresh should have browsed the partly loaded container again\n");
+        failed = 1;
+    }
+
+    printf("upnptest: crawl failure check %s\n", (failed? "FAILED" : "passed"));
+    return failed;
+}
+
 int
 main(int argc, char **argv)
 {
@@ -50,6 +178,10 @@ main(int argc, char **argv)
     int i;
     int scanItems;
 
+    /* upnptest ct <port> checks crawl against a server in this process */
+    if (argc > 2 && strcmp(argv[1], "ct") == 0)
+        return crawlFailCheck(atoi(argv[2]));
+
     while(1) {
         printf("\n>> ");
         fflush(stdout);
@@ -94,9 +226,17 @@ main(int argc, char **argv)
             code = dbase.restoreFromFile("dbase.json");
             printf("DBase restore done, code=%d\n", code);
         }
-        else if (strcmp(cmd, "b") == 0) {
+        else if (strcmp(cmd, "ssave") == 0) {
+            code = dbase.saveSnapshot("dbase.snap");
+            printf("DBase snapshot save done, code=%d\n", code);
+        }
+        else if (strcmp(cmd, "srestore") == 0) {
+            code = dbase.restoreSnapshot("dbase.snap");
+            printf("DBase snapshot restore done, code=%d\n", code);
+        }
+        else if (strcmp(cmd, "b") == 0 || strcmp(cmd, "c") == 0 || strcmp(cmd, "u") == 0) {
             if (scanItems < 2) {
-                printf("usage: b <count>\n");
+                printf("usage: %s <count>\n", cmd);
                 continue;
             }
 
@@ -127,8 +267,20 @@ main(int argc, char **argv)
             else
                 obIdp = "0";
 
-            code = av.browse(&dbase, obIdp);
-            printf("Av browse code=%d\n", code);
+            if (strcmp(cmd, "u") == 0) {
+                code = av.refresh(&dbase, obIdp);
+                printf("Av refresh code=%d changed=%d pages=%d items=%d\n",
+                       code, av.changedContainers(), av.loadedPages(), av.loadedItems());
+            }
+            else if (strcmp(cmd, "c") == 0) {
+                code = av.crawl(&dbase, obIdp);
+                printf("Av crawl code=%d pages=%d items=%d\n",
+                       code, av.loadedPages(), av.loadedItems());
+            }
+            else {
+                code = av.browse(&dbase, obIdp);
+                printf("Av browse code=%d\n", code);
+            }
         }
         else if (strcmp(cmd, "l") == 0) {
             for(i=0, devp = probe._allDevices.head(); devp; devp=devp->_dqNextp, i++) {
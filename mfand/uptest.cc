@@ -7,6 +7,7 @@
 #include "upload.h"
 
 void server(int port, std::string pathPrefix, int single);
+int configCheck();
 
 /* This is the main program for the test application; it just runs the
  * server application function after peeling off the port and app name
@@ -21,9 +22,13 @@ main(int argc, char **argv)
 
     if (argc <= 1) {
         printf("usage: apptest <port> [-single]\n");
+        printf("usage: apptest -config checks that the config reaches the cloud fs\n");
         return 1;
     }
 
+    if (!strcmp(argv[1], "-config"))
+        return configCheck();
+
     port = atoi(argv[1]);
 
     argc -= 2;
@@ -61,3 +66,63 @@ server(int port, std::string pathPrefix, int single)
     uploadApp->setGlobalLoginCookie(loginCookiep);
     uploadApp->initLoop(sapip, single);
 }
+
+/* check a new cloud fs from the app; returns non-zero on a mismatch */
+static int
+checkCfs(UploadApp *uploadApp, uint8_t pipelineGets, uint32_t idleMs)
+{
+    CfsMs *msp;
+    int failed = 0;
+
+    msp = (CfsMs *) uploadApp->newCfs();
+    printf("pipelineGets=%d idleMs=%d\n", msp->_pipelineGets, msp->_xapiPoolp->_idleTimeoutMs);
+    if (msp->_pipelineGets != pipelineGets || msp->_xapiPoolp->_idleTimeoutMs != idleMs)
+        failed = 1;
+    return failed;
+}
+
+/* read a config.js with the connection settings in a scratch dir, and
+ * check they reach the cloud fs, and survive writing the config back.
+ */
+int
+configCheck()
+{
+    char tbuffer[1024];
+    std::string prefix;
+    UploadApp *uploadApp;
+    FILE *filep;
+    int failed = 0;
+
+    strcpy(tbuffer, "/tmp/uptestXXXXXX");
+    if (!mkdtemp(tbuffer)) {
+        printf("uptest: can't make a scratch dir\n");
+        return 1;
+    }
+    prefix = std::string(tbuffer) + "/";
+
+    /* nothing configured gets the defaults */
+    uploadApp = new UploadApp(prefix, prefix, std::string(""));
+    failed |= checkCfs(uploadApp, 0, 60000);
+
+    filep = fopen((prefix + "config.js").c_str(), "w");
+    if (!filep) {
+        printf("uptest: can't write config.js\n");
+        return 1;
+    }
+    fprintf(filep, "{\"pipelineGets\": 1, \"connIdleSec\": 5}\n");
+    fclose(filep);
+
+    uploadApp = new UploadApp(prefix, prefix, std::string(""));
+    failed |= checkCfs(uploadApp, 1, 5000);
+    uploadApp->writeConfig(prefix);
+
+    uploadApp = new UploadApp(prefix, prefix, std::string(""));
+    failed |= checkCfs(uploadApp, 1, 5000);
+
+    /* the apps and cloud fses are just left behind */
+    unlink((prefix + "config.js").c_str());
+    rmdir(tbuffer);
+
+    printf("uptest: config check %s\n", (failed? "FAILED" : "passed"));
+    return failed;
+}
@@ -0,0 +1,179 @@
+/*
+
+Copyright 2016-2020 Cazamar Systems
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be
+included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ */
+
+/* Walk-only benchmark for WalkTask.  "walkbench <dir> [<nfiles>
+ * [<nhelpers> [<batchSize>]]]" builds a synthetic tree of nfiles
+ * empty files (default a million, 1000 to a directory, in a two level
+ * tree) under dir if dir doesn't exist yet, and then times walking it
+ * with the original walker, the fast walker with full stats, and the
+ * fast walker using just d_type.  Drop the page cache between runs if
+ * you want cold cache numbers.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <string>
+
+#include "walkdisp.h"
+
+static const uint32_t _filesPerDir = 1000;
+static const uint32_t _dirsPerDir = 100;
+
+static uint64_t _dirCount;
+static uint64_t _fileCount;
+
+int32_t
+countCallback(void *contextp, std::string *pathp, struct stat *statp)
+{
+    if ((statp->st_mode & S_IFMT) == S_IFDIR)
+        __atomic_add_fetch(&_dirCount, 1, __ATOMIC_RELAXED);
+    else
+        __atomic_add_fetch(&_fileCount, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+int32_t
+makeTree(std::string *rootp, uint64_t nfiles)
+{
+    uint64_t created;
+    uint32_t i;
+    uint32_t top;
+    uint32_t sub;
+    int fd;
+    char tbuffer[64];
+    std::string path;
+
+    if (mkdir(rootp->c_str(), 0755) < 0)
+        return -1;
+
+    created = 0;
+    for(top = 0; created < nfiles; top++) {
+        snprintf(tbuffer, sizeof(tbuffer), "/t%03u", top);
+        path = *rootp + tbuffer;
+        mkdir(path.c_str(), 0755);
+        for(sub = 0; sub < _dirsPerDir && created < nfiles; sub++) {
+            snprintf(tbuffer, sizeof(tbuffer), "/t%03u/s%03u", top, sub);
+            path = *rootp + tbuffer;
+            mkdir(path.c_str(), 0755);
+            for(i = 0; i < _filesPerDir && created < nfiles; i++, created++) {
+                snprintf(tbuffer, sizeof(tbuffer), "/t%03u/s%03u/f%04u", top, sub, i);
+                path = *rootp + tbuffer;
+                fd = open(path.c_str(), O_CREAT | O_WRONLY, 0644);
+                if (fd < 0) {
+                    printf("create %s failed errno=%d\n", path.c_str(), errno);
+                    return -1;
+                }
+                close(fd);
+            }
+        }
+        printf("created %lld files\n", (long long) created);
+    }
+
+    return 0;
+}
+
+void
+timeWalk(CDisp *disp, std::string *rootp, const char *namep, int fast, uint32_t batchSize, int typeOnly)
+{
+    CDispGroup *group;
+    WalkTask *taskp;
+    uint64_t startMs;
+    uint64_t elapsedMs;
+
+    _dirCount = 0;
+    _fileCount = 0;
+
+    group = new CDispGroup();
+    group->init(disp);
+
+    startMs = osp_time_ms();
+    taskp = new WalkTask();
+    taskp->initWithPath(*rootp);
+    taskp->setCallback(&countCallback, NULL);
+    if (fast)
+        taskp->setFast(batchSize, typeOnly);
+    group->queueTask(taskp);
+
+    while(!group->isAllDone())
+        usleep(1000);
+    elapsedMs = osp_time_ms() - startMs;
+    if (elapsedMs == 0)
+        elapsedMs = 1;
+
+    printf("%-12s %8lld ms  dirs=%lld files=%lld  %lld entries/sec\n",
+           namep, (long long) elapsedMs, (long long) _dirCount, (long long) _fileCount,
+           (long long) ((_dirCount + _fileCount) * 1000 / elapsedMs));
+}
+
+int
+main(int argc, char **argv)
+{
+    CDisp *disp;
+    std::string root;
+    uint64_t nfiles = 1000000;
+    int nhelpers = 4;
+    uint32_t batchSize = 256;
+    struct stat tstat;
+
+    if (argc < 2) {
+        printf("usage: walkbench <dir> [<nfiles> [<nhelpers> [<batchSize>]]]\n");
+        return 1;
+    }
+
+    root = std::string(argv[1]);
+    if (argc > 2)
+        nfiles = strtoull(argv[2], NULL, 10);
+    if (argc > 3)
+        nhelpers = atoi(argv[3]);
+    if (argc > 4)
+        batchSize = atoi(argv[4]);
+    if (nhelpers <= 0)
+        nhelpers = 1;
+    if (batchSize == 0)
+        batchSize = 1;
+
+    if (stat(root.c_str(), &tstat) < 0) {
+        printf("Building tree of %lld files in %s\n", (long long) nfiles, root.c_str());
+        if (makeTree(&root, nfiles) < 0) {
+            printf("tree creation failed\n");
+            return 1;
+        }
+    }
+
+    disp = new CDisp();
+    disp->init(nhelpers);
+
+    printf("Walking %s with %d helpers, batch size %d\n", root.c_str(), nhelpers, batchSize);
+    timeWalk(disp, &root, "legacy", 0, 0, 0);
+    timeWalk(disp, &root, "fast", 1, batchSize, 0);
+    timeWalk(disp, &root, "fast-dtype", 1, batchSize, 1);
+
+    return 0;
+}
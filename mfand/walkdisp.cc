@@ -1,9 +1,35 @@
 #include <stdio.h>
+#include <string.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/stat.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
 
 #include "walkdisp.h"
 
+#ifdef __linux__
+/* the kernel's layout for getdents64 records */
+struct WalkDirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    uint16_t d_reclen;
+    uint8_t d_type;
+    char d_name[1];
+};
+#endif
+
+void
+WalkDir::release()
+{
+    if (__atomic_sub_fetch(&_refCount, 1, __ATOMIC_SEQ_CST) == 0) {
+        close(_fd);
+        delete this;
+    }
+}
+
 int32_t
 WalkTask::start()
 {
@@ -19,6 +45,9 @@ WalkTask::start()
 
     CDispGroup *group = getGroup();
 
+    if (_fast)
+        return startFast();
+
     code = lstat(_path.c_str(), &tstat);
     if (code < 0)
         return code;
@@ -29,6 +58,13 @@ WalkTask::start()
         return 0;
     }
     else if ((tstat.st_mode & S_IFMT) == S_IFDIR) {
+        if (_entryOnly) {
+            if (_callbackProcp) {
+                _callbackProcp(_callbackContextp, &_path, &tstat);
+            }
+            return 0;
+        }
+
         dirp = opendir(_path.c_str());
         if (!dirp)
             return -1;
@@ -91,3 +127,188 @@ WalkTask::start()
         return 0;
     }
 }
+
+/* a directory entry found by startFast; subdirectories get their own
+ * WalkTask, queued at the tail, and everything else is added to the
+ * batch in *batchpp, which is queued at the head once it's full.
+ */
+void
+WalkTask::addEntry(WalkDir *dirp, WalkBatchTask **batchpp, const char *namep, uint8_t type)
+{
+    struct stat tstat;
+    int haveStat = 0;
+    WalkTask *childTaskp;
+    WalkBatchTask *batchp;
+    int32_t code;
+
+    if (namep[0] == '.' && (namep[1] == 0 || (namep[1] == '.' && namep[2] == 0)))
+        return;
+
+    /* some file systems don't fill in d_type */
+    if (type == DT_UNKNOWN) {
+        code = fstatat(dirp->_fd, namep, &tstat, AT_SYMLINK_NOFOLLOW);
+        if (code < 0)
+            return;
+        type = IFTODT(tstat.st_mode);
+        haveStat = 1;
+    }
+
+    if (type == DT_DIR) {
+        childTaskp = new WalkTask();
+        childTaskp->_path.reserve(_path.length() + 1 + strlen(namep));
+        childTaskp->_path.append(_path);
+        childTaskp->_path.push_back('/');
+        childTaskp->_path.append(namep);
+        childTaskp->setCallback(_callbackProcp, _callbackContextp);
+        childTaskp->inheritMode(this);
+        if (haveStat) {
+            childTaskp->_stat = tstat;
+            childTaskp->_haveStat = 1;
+        }
+        getGroup()->queueTask(childTaskp, /* !queue at head */ 0);
+        return;
+    }
+
+    batchp = *batchpp;
+    if (!batchp) {
+        batchp = new WalkBatchTask(dirp, _batchSize);
+        batchp->_callbackProcp = _callbackProcp;
+        batchp->_callbackContextp = _callbackContextp;
+        batchp->_typeOnly = _typeOnly;
+        *batchpp = batchp;
+    }
+    batchp->_names.append(namep, strlen(namep) + 1);
+    batchp->_typesp[batchp->_count++] = type;
+    if (batchp->_count >= _batchSize) {
+        getGroup()->queueTask(batchp, /* queue at head */ 1);
+        *batchpp = NULL;
+    }
+}
+
+/* the fast walker: one open, one getdents loop and no per-entry stat
+ * for a directory, and one task per batch of files rather than per file.
+ */
+int32_t
+WalkTask::startFast()
+{
+    int32_t code;
+    int fd;
+    WalkDir *dirp;
+    WalkBatchTask *batchp;
+
+    if (!_haveStat) {
+        code = lstat(_path.c_str(), &_stat);
+        if (code < 0)
+            return code;
+        _haveStat = 1;
+    }
+
+    if ((_stat.st_mode & S_IFMT) != S_IFDIR || _entryOnly) {
+        if (_callbackProcp) {
+            _callbackProcp(_callbackContextp, &_path, &_stat);
+        }
+        return 0;
+    }
+
+    fd = open(_path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    /* process the dir */
+    if (_callbackProcp) {
+        _callbackProcp(_callbackContextp, &_path, &_stat);
+    }
+
+    dirp = new WalkDir(fd, &_path);
+    batchp = NULL;
+    code = 0;
+
+#ifdef __linux__
+    {
+        char tbuffer[32768] __attribute__((aligned(8)));
+        long nbytes;
+        long offset;
+        WalkDirent64 *entryp;
+
+        while(1) {
+            nbytes = syscall(SYS_getdents64, fd, tbuffer, sizeof(tbuffer));
+            if (nbytes <= 0) {
+                if (nbytes < 0)
+                    code = -1;
+                break;
+            }
+            for(offset = 0; offset < nbytes; offset += entryp->d_reclen) {
+                entryp = (WalkDirent64 *) (tbuffer + offset);
+                addEntry(dirp, &batchp, entryp->d_name, entryp->d_type);
+            }
+        }
+    }
+#else
+    {
+        DIR *tdirp;
+        struct dirent *entryp;
+        int tfd;
+
+        /* fdopendir takes over the fd it's given, and our batches still
+         * need theirs.
+         */
+        tfd = dup(fd);
+        tdirp = (tfd >= 0? fdopendir(tfd) : NULL);
+        if (tdirp) {
+            while((entryp = readdir(tdirp)) != NULL) {
+                addEntry(dirp, &batchp, entryp->d_name, entryp->d_type);
+            }
+            closedir(tdirp);
+        }
+        else {
+            if (tfd >= 0)
+                close(tfd);
+            code = -1;
+        }
+    }
+#endif
+
+    if (batchp)
+        getGroup()->queueTask(batchp, /* queue at head */ 1);
+
+    /* batches hold their own references */
+    dirp->release();
+    return code;
+}
+
+int32_t
+WalkBatchTask::start()
+{
+    std::string path;
+    size_t prefixLength;
+    const char *namep;
+    uint32_t i;
+    struct stat tstat;
+    int32_t code;
+
+    if (!_callbackProcp)
+        return 0;
+
+    path.reserve(_dirp->_path.length() + 256);
+    path.append(_dirp->_path);
+    path.push_back('/');
+    prefixLength = path.length();
+
+    namep = _names.c_str();
+    for(i = 0; i < _count; i++, namep += strlen(namep) + 1) {
+        if (_typeOnly && _typesp[i] != DT_UNKNOWN) {
+            memset(&tstat, 0, sizeof(tstat));
+            tstat.st_mode = DTTOIF(_typesp[i]);
+        }
+        else {
+            code = fstatat(_dirp->_fd, namep, &tstat, AT_SYMLINK_NOFOLLOW);
+            if (code < 0)
+                continue;
+        }
+        path.resize(prefixLength);
+        path.append(namep);
+        _callbackProcp(_callbackContextp, &path, &tstat);
+    }
+
+    return 0;
+}
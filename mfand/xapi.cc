@@ -214,12 +214,13 @@ XApi::ServerConn::HeadersProc( void *contextp,
     reqp->_connp = serverConnp;
     reqp->_xapip = xapip;
 
-    /* if no data is coming in, we should mark the input done, and set
-     * the input stream so that it looks like we're at EOF, in case
-     * someone reads it anyway.
+    /* if no data is coming in, set the input stream so that it looks
+     * like we're at EOF, in case someone reads it anyway.  We leave
+     * marking the input done to the user's inputReceived call, since
+     * Rst generates the response header as soon as input is done, and
+     * the user may not have set the response's content length yet.
      */
     if (rstReqp->getRcvContentLength() == 0) {
-        serverConnp->setInputDone();
         reqp->_incomingDatap->eof();
     }
 
@@ -494,6 +495,167 @@ XApi::ClientReq::startCall(ClientConn *connp, const char *relativePathp, reqType
     return 0;
 }
 
+/* start a GET that shares the connection with other pipelined GETs;
+ * the caller must already have reserved a slot with
+ * ClientConn::addPipelined.  The call is queued for the connection's
+ * pipeline runner, which we start if it isn't already running.
+ */
+int32_t
+XApi::ClientReq::startPipelinedCall(ClientConn *connp, const char *relativePathp)
+{
+    XApi *xapip = connp->_xapip;
+    UserThread *userThreadp;
+    int startRunner;
+
+    _relativePath = std::string(relativePathp);
+    _isPost = reqGet;
+    _connp = connp;
+    _error = 0;
+    _pipelined = 1;
+    _headersDone = 0;
+    _allDone = 0;
+
+    _pipeIncomingp = new CThreadPipe();
+    _pipeOutgoingp = new CThreadPipe();
+    _incomingDatap = _pipeIncomingp;
+    _outgoingDatap = _pipeOutgoingp;
+
+    connp->_mutex.take();
+    connp->_pipeReqs.append(this);
+    if (!connp->_pipeRunning) {
+        connp->_pipeRunning = 1;
+        startRunner = 1;
+    }
+    else
+        startRunner = 0;
+    connp->_mutex.release();
+
+    if (startRunner) {
+        userThreadp = xapip->getUserThread();
+        userThreadp->deliverReq(connp->_runnerp);
+    }
+    return 0;
+}
+
+/* called from Rst callbacks for a pipelined call */
+void
+XApi::ClientReq::setPipelinedDone(int headersOnly)
+{
+    _mutex.take();
+    _headersDone = 1;
+    if (!headersOnly) {
+        _allDone = 1;
+        _incomingDatap->eof();
+        _outgoingDatap->eof();
+    }
+    _mutex.release();
+    _doneCV.broadcast();
+}
+
+void
+XApi::PipelineRunner::startMethod()
+{
+    _connp->runPipeline();
+}
+
+/* runs in a user thread; sends all queued pipelined calls back to
+ * back, and then reads their responses in the same order.  Calls
+ * queued while we're doing this are picked up on the next pass.  We
+ * do all of the socket I/O from this one thread, since a TLS
+ * connection can't be read and written concurrently.
+ *
+ * If anything fails, we reset the connection and fail every call in
+ * the batch that hasn't completed yet.  Once a call has finished, its
+ * owner may delete it, so we never touch a call after finishing it.
+ */
+void
+XApi::ClientConn::runPipeline()
+{
+    dqueue<ClientReq> batch;
+    ClientReq *reqp;
+    ClientReq *nreqp;
+    ClientReq *failedp;
+    ClientReq *failedNextp;
+    int32_t code;
+
+    while(1) {
+        batch.init();
+        _mutex.take();
+        batch.concat(&_pipeReqs);
+        if (batch.empty()) {
+            _pipeRunning = 0;
+            _mutex.release();
+            return;
+        }
+        _mutex.release();
+
+        _startMs = osp_time_ms();
+        _bufGenp->reopen();
+
+        for(reqp = batch.head(); reqp; reqp = reqp->_dqNextp) {
+            reqp->_callp = new Rst::Call(_rstp);
+            reqp->_callp->prepare( reqp->_relativePath.c_str(),
+                                   ClientReq::callSendProc,
+                                   &reqp->_sendHeaders,
+                                   ClientReq::callRecvProc,
+                                   &reqp->_recvHeaders,
+                                   ClientReq::headersDoneProc,
+                                   ClientReq::allDoneProc,
+                                   reqp);
+        }
+
+        /* send everything, flushing only after the last request; the
+         * first call's timer covers the send phase.
+         */
+        failedp = NULL;
+        batch.head()->_callp->startTimer();
+        for(reqp = batch.head(); reqp; reqp = nreqp) {
+            nreqp = reqp->_dqNextp;
+            code = reqp->_callp->sendRequest(/* doFlush */ nreqp == NULL);
+            if (code != 0) {
+                /* Rst has already finished this call */
+                failedp = reqp;
+                break;
+            }
+        }
+
+        if (failedp) {
+            /* failedp's owner may already have deleted it, so fail the
+             * calls on either side of it without following its links;
+             * nreqp still holds the one after it from the send loop.
+             */
+            _bufGenp->disconnect();
+            failedNextp = nreqp;
+            for(reqp = batch.head(); reqp != failedp; reqp = nreqp) {
+                nreqp = reqp->_dqNextp;
+                reqp->_callp->fail(100);
+            }
+            for(reqp = failedNextp; reqp; reqp = nreqp) {
+                nreqp = reqp->_dqNextp;
+                reqp->_callp->fail(100);
+            }
+            continue;
+        }
+
+        /* now collect the responses in order */
+        for(reqp = batch.head(); reqp; reqp = nreqp) {
+            nreqp = reqp->_dqNextp;
+            if (reqp != batch.head())
+                reqp->_callp->startTimer();
+            code = reqp->_callp->rcvResponse();
+            if (code != 0) {
+                /* the stream is out of sync; drop it and fail the rest */
+                _bufGenp->disconnect();
+                for(reqp = nreqp; reqp; reqp = nreqp) {
+                    nreqp = reqp->_dqNextp;
+                    reqp->_callp->fail(100);
+                }
+                break;
+            }
+        }
+    }
+}
+
 void
 XApi::ClientReq::addHeader(const char *keyp, const char *valuep)
 {
@@ -587,7 +749,10 @@ XApi::ClientReq::headersDoneProc( void *contextp,
     reqp->_error = errorCode;
     reqp->_httpError = httpCode;
 
-    connp->setHeadersDone();
+    if (reqp->_pipelined)
+        reqp->setPipelinedDone(/* headersOnly */ 1);
+    else
+        connp->setHeadersDone();
 }
 
 /* static */ void
@@ -603,7 +768,10 @@ XApi::ClientReq::allDoneProc( void *contextp,
     reqp->_error = errorCode;
     reqp->_httpError = httpCode;
 
-    connp->setAllDone();
+    if (reqp->_pipelined)
+        reqp->setPipelinedDone(/* headersOnly */ 0);
+    else
+        connp->setAllDone();
 }
 
 
@@ -681,11 +849,23 @@ XApi::ClientReq::~ClientReq() {
      * the connection as available for reallocation.  Don't reference connp after
      * this, as it doesn't belong to us any more.
      */
-    _connp->setBusy(0);
+    if (_pipelined)
+        _connp->pipelinedDone();
+    else
+        _connp->setBusy(0);
     _connp = NULL;
     
     if (_callp) {
         delete _callp;
         _callp = NULL;
     }
+
+    if (_pipeIncomingp) {
+        delete _pipeIncomingp;
+        _pipeIncomingp = NULL;
+    }
+    if (_pipeOutgoingp) {
+        delete _pipeOutgoingp;
+        _pipeOutgoingp = NULL;
+    }
 }
@@ -42,6 +42,7 @@ class XApi : public CThread {
  public:
     class ServerReq;
     class ClientReq;
+    class ClientConn;
     class UserThread;
 
     enum reqType {
@@ -98,8 +99,30 @@ class XApi : public CThread {
         }
     };
 
+    /* delivered to a user thread to send and receive a connection's
+     * pipelined calls; see ClientConn::runPipeline.
+     */
+    class PipelineRunner : public CommonReq {
+    public:
+        ClientConn *_connp;
+
+        PipelineRunner(ClientConn *connp) {
+            _connp = connp;
+        }
+
+        void startMethod();
+    };
+
     class ClientConn : public CThread {
     public:
+        /* called, without any locks held, each time the connection
+         * goes from in use to completely idle.
+         */
+        typedef void IdleProc(ClientConn *connp, void *contextp);
+
+        /* max pipelined calls outstanding on one connection */
+        static const uint32_t _maxPipeline = 8;
+
         CThreadPipe _incomingData;
         CThreadPipe _outgoingData;
         BufGen *_bufGenp;
@@ -118,6 +141,23 @@ class XApi : public CThread {
 
         ClientReq *_activeReqp;
 
+        /* pipelined GETs.  _pipeCount counts calls that have reserved a
+         * slot and haven't been deleted; a non-pipelined call can't use
+         * the connection until it drops to zero.  _pipeWaiting of those
+         * have reserved a slot but are still waiting in waitPipelined
+         * for room in the pipeline.  _pipeReqs holds calls waiting to be
+         * sent by the runner, which is active iff _pipeRunning is set.
+         * All protected by _mutex.
+         */
+        dqueue<ClientReq> _pipeReqs;
+        uint32_t _pipeCount;
+        uint32_t _pipeWaiting;
+        uint8_t _pipeRunning;
+        PipelineRunner *_runnerp;
+
+        IdleProc *_idleProcp;
+        void *_idleContextp;
+
         ClientConn(XApi *xapip, BufGen *bufGenp) :
             _doneCV(&_mutex),
             _busyCV(&_mutex) {
@@ -132,33 +172,105 @@ class XApi : public CThread {
             _startMs = 0;
             _busy = 0;
             _activeReqp = NULL;
+            _pipeCount = 0;
+            _pipeWaiting = 0;
+            _pipeRunning = 0;
+            _runnerp = new PipelineRunner(this);
+            _idleProcp = NULL;
+            _idleContextp = NULL;
+        }
+
+        void setIdleProc(IdleProc *procp, void *contextp) {
+            _idleProcp = procp;
+            _idleContextp = contextp;
         }
 
         /* if setting busy on a connection, wait until previous user is done with it;
          * and if clearing busy, signal anyone waiting that they can proceed.
          */
         void setBusy(uint8_t busy) {
+            uint8_t idle = 0;
+
             _mutex.take();
             if (busy) {
-                while(_busy) {
+                while(_busy || _pipeCount > 0) {
                     _busyCV.wait();
                 }
                 _busy = 1;
             }
             else {
                 _busy = 0;
+                idle = (_pipeCount == 0);
                 _busyCV.broadcast();
             }
             _mutex.release();
+
+            if (idle && _idleProcp)
+                _idleProcp(this, _idleContextp);
+        }
+
+        /* reserve a slot for a pipelined call, waiting while a
+         * non-pipelined call has the connection or the pipeline is
+         * full.  The slot is released when the ClientReq is deleted.
+         */
+        void addPipelined() {
+            reservePipelined();
+            waitPipelined();
+        }
+
+        /* the two halves of addPipelined.  reservePipelined never
+         * blocks, and keeps the connection from being handed to a
+         * non-pipelined call or going idle, so a pool can call it under
+         * its own lock and call waitPipelined after dropping it.
+         */
+        void reservePipelined() {
+            _mutex.take();
+            _pipeCount++;
+            _pipeWaiting++;
+            _mutex.release();
         }
 
+        void waitPipelined() {
+            _mutex.take();
+            while(_busy || _pipeCount - _pipeWaiting >= _maxPipeline) {
+                _busyCV.wait();
+            }
+            _pipeWaiting--;
+            _mutex.release();
+        }
+
+        void pipelinedDone() {
+            uint8_t idle;
+
+            _mutex.take();
+            osp_assert(_pipeCount > 0);
+            _pipeCount--;
+            idle = (_pipeCount == 0 && !_busy);
+            _mutex.release();
+            _busyCV.broadcast();
+
+            if (idle && _idleProcp)
+                _idleProcp(this, _idleContextp);
+        }
+
+        /* no locking; as with getBusy, the answer may change right away */
+        int pipelineFull() {
+            return (_busy || _pipeCount >= _maxPipeline);
+        }
+
+        uint32_t getPipelineCount() {
+            return _pipeCount;
+        }
+
+        void runPipeline();
+
         uint64_t getStartMs() {
             return _startMs;
         }
 
         uint8_t getBusy() {
             /* no locking; busy can change right after this call anyway */
-            return _busy;
+            return (_busy || _pipeCount > 0);
         }
 
         void setHeadersDone() {
@@ -222,6 +334,16 @@ class XApi : public CThread {
      * To terminate one of these calls early while streaming data,
      * call eof() on the incoming pipe, and the call will terminate
      * shortly after the next data is delivered.
+     *
+     * GETs may instead be started with startPipelinedCall, after
+     * reserving a slot on the connection with ClientConn::addPipelined
+     * (XApiPool::getPipelineConn does this).  Several such calls share
+     * the connection, with their requests sent back to back and the
+     * responses matched to calls in the order sent; each call gets its
+     * own pipes and done state, and otherwise is used as above.  If
+     * the connection fails, every call not yet answered fails with
+     * the same error a non-pipelined call would see, and callers
+     * retry as usual.
      */
     class ClientReq : public CommonReq {
     public:
@@ -237,13 +359,30 @@ class XApi : public CThread {
         Rst::Call *_callp;
         CThreadMutex _mutex;
 
-        ClientReq() {
+        /* state for pipelined calls, which can't share the connection's */
+        uint8_t _pipelined;
+        uint8_t _headersDone;
+        uint8_t _allDone;
+        CThreadCV _doneCV;      /* uses _mutex */
+        CThreadPipe *_pipeIncomingp;
+        CThreadPipe *_pipeOutgoingp;
+
+        /* in connection's _pipeReqs */
+        ClientReq *_dqNextp;
+        ClientReq *_dqPrevp;
+
+        ClientReq() : _doneCV(&_mutex) {
             _connp = NULL;
             _userThreadp = NULL;
             _isPost = reqGet;
             _error = 0;
             _sendContentLength = 0;
             _callp = NULL;
+            _pipelined = 0;
+            _headersDone = 0;
+            _allDone = 0;
+            _pipeIncomingp = NULL;
+            _pipeOutgoingp = NULL;
         }
 
         virtual ~ClientReq();
@@ -263,18 +402,34 @@ class XApi : public CThread {
 
         int32_t startCall(ClientConn *connp, const char *relativePathp, reqType isPost);
 
+        int32_t startPipelinedCall(ClientConn *connp, const char *relativePathp);
+
         std::string getRelativePath() {
             return _relativePath;
         }
 
         int32_t waitForHeadersDone() {
-            _connp->waitForHeadersDone();
+            if (_pipelined) {
+                _mutex.take();
+                while(!_headersDone)
+                    _doneCV.wait();
+                _mutex.release();
+            }
+            else
+                _connp->waitForHeadersDone();
             return _error;
         }
 
         int32_t waitForAllDone() {
             _incomingDatap->eof();
-            _connp->waitForAllDone();
+            if (_pipelined) {
+                _mutex.take();
+                while(!_allDone)
+                    _doneCV.wait();
+                _mutex.release();
+            }
+            else
+                _connp->waitForAllDone();
             return _error;
         }
 
@@ -296,11 +451,15 @@ class XApi : public CThread {
         int32_t findIncomingHeader(const char *keyp, std::string *valuep);
 
     private:
+        friend class ClientConn;
+
         /* called internally to start helper userThread, which runs the HTTP 
          * state machine.
          */
         void startMethod();
 
+        void setPipelinedDone(int headersOnly);
+
         static int32_t callRecvProc( void *contextp,
                                      Rst::Common *commonp,
                                      char *bufferp,
@@ -26,109 +26,388 @@ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include "xapipool.h"
 #include "buftls.h"
 
+/* static */ uint32_t
+XApiPool::hashHost(std::string *hostNamep, uint32_t port, uint8_t isTls)
+{
+    uint32_t hash = 2166136261U;
+    const char *tp;
+    uint32_t i;
+
+    for(tp = hostNamep->c_str(), i = hostNamep->length(); i > 0; i--, tp++) {
+        hash = (hash ^ (uint8_t) *tp) * 16777619U;
+    }
+    hash = (hash ^ port) * 16777619U;
+    hash = (hash ^ isTls) * 16777619U;
+    return hash % _hostHashSize;
+}
+
+/* find or create the entry for an address; called with _lock held */
+XApiPool::Host *
+XApiPool::getHost(std::string *hostNamep, uint32_t port, uint8_t isTls)
+{
+    Host *hostp;
+    uint32_t ix;
+
+    ix = hashHost(hostNamep, port, isTls);
+    for(hostp = _hosts[ix].head(); hostp; hostp=hostp->_dqNextp) {
+        if ( hostp->_port == port &&
+             hostp->_isTls == isTls &&
+             hostp->_hostName == *hostNamep)
+            return hostp;
+    }
+
+    hostp = new Host();
+    hostp->_hostName = *hostNamep;
+    hostp->_port = port;
+    hostp->_isTls = isTls;
+    _hosts[ix].append(hostp);
+    return hostp;
+}
+
+/* pop the most recently used idle conn, if any, and move it to the
+ * busy list; called with _lock held.
+ */
+XApiPool::Entry *
+XApiPool::popIdle(Host *hostp)
+{
+    Entry *ep;
+
+    while((ep = hostp->_idle.pop()) != NULL) {
+        ep->_isIdle = 0;
+        hostp->_busy.append(ep);
+        /* connIdle checks busy under _lock, so this should always be
+         * idle, but don't bet a hang on it.
+         */
+        if (!ep->_connp->getBusy())
+            return ep;
+    }
+    return NULL;
+}
+
+/* all conns are busy and we can't create more; choose the one whose
+ * current call looks likely to end first.  Called with _lock held.
+ */
+XApiPool::Entry *
+XApiPool::pickBusy(Host *hostp, uint64_t now)
+{
+    Entry *ep;
+    Entry *bestEp = NULL;
+    Entry *oldestEp = NULL;
+    int64_t elapsed;
+    int64_t remaining;
+    int64_t bestRemaining = 0;
+    int64_t oldestElapsed = 0;
+
+    for(ep = hostp->_busy.head(); ep; ep=ep->_dqNextp) {
+        if (ep->_connp->getStartMs() == 0)
+            elapsed = 0;        /* handed out, but no call started yet */
+        else
+            elapsed = now - ep->_connp->getStartMs();
+        if (elapsed >= _stuckMs) {
+            /* remember the least stuck, in case everyone is */
+            if (!oldestEp || elapsed < oldestElapsed) {
+                oldestEp = ep;
+                oldestElapsed = elapsed;
+            }
+            continue;
+        }
+
+        remaining = (int64_t) ep->_avgCallMs - elapsed;
+        if (remaining < 0)
+            remaining = 0;
+        if (!bestEp || remaining < bestRemaining) {
+            bestEp = ep;
+            bestRemaining = remaining;
+        }
+    }
+
+    return (bestEp? bestEp : oldestEp);
+}
+
+/* called with _lock held */
+XApiPool::Entry *
+XApiPool::newEntry(Host *hostp)
+{
+    Entry *ep;
+    OspTimer *timerp;
+
+    ep = new Entry();
+    ep->_poolp = this;
+    ep->_hostp = hostp;
+    ep->_isTls = hostp->_isTls;
+    if (hostp->_isTls) {
+        BufTls *tlsp;
+        ep->_bufGenp = tlsp = new BufTls(_pathPrefix);
+        tlsp->init(const_cast<char *>(hostp->_hostName.c_str()), hostp->_port);
+        ep->_connp = _xapip->addClientConn(tlsp);
+    }
+    else {
+        BufSocket *socketp;
+        ep->_bufGenp = socketp = new BufSocket();
+        socketp->init(const_cast<char *>(hostp->_hostName.c_str()), hostp->_port);
+        ep->_connp = _xapip->addClientConn(socketp);
+    }
+    ep->_connp->setIdleProc(&XApiPool::connIdle, ep);
+    hostp->_busy.append(ep);
+    hostp->_connCount++;
+    _stats._creations++;
+
+    if (!_reaperRunning && _idleTimeoutMs) {
+        _reaperRunning = 1;
+        timerp = new OspTimer();
+        timerp->init(_reapIntervalMs, &XApiPool::reapTimer, this);
+    }
+
+    return ep;
+}
+
 XApi::ClientConn *
 XApiPool::getConn(std::string fullHostName, uint32_t port, uint8_t isTls)
 {
+    Host *hostp;
     Entry *ep;
     XApi::ClientConn *connp;
-    uint16_t loop;
-    Entry *randomBusyEp = NULL;
-    uint16_t matchingCount;
+    uint64_t startMs;
+    uint32_t waitMs;
+
+    startMs = osp_time_ms();
 
     _lock.take();
     
-    /* randomize which busy conn to use */
-    loop = _loop++;
-    if (_loop >= _maxConns)
-        _loop = 0;
-
-    matchingCount = 0;
-    for(ep = _allConns.head(); ep; ep=ep->_dqNextp) {
-        if ( *ep->_bufGenp->getFullHostName() == fullHostName &&
-             ep->_isTls == isTls &&
-             port == ep->_bufGenp->getPort()) {
-            matchingCount++;
-            if (!ep->_connp->getBusy()) {
-                /* we can use this connection */
-                break;
-            }
-            else {
-                if (loop-- >= 0) {
-                    /* remember one connection to use if all allowed are busy */
-                    randomBusyEp = ep;
-                }
-            } /* not busy */
-        } /* matching connection */
-    } /* loop over all cached connections */
+    hostp = getHost(&fullHostName, port, isTls);
 
-    if (ep) {
-        /* found an idle connection */
-        connp = ep->_connp;
+    if ((ep = popIdle(hostp)) != NULL) {
+        /* reuse the warmest idle connection */
+        _stats._idleHits++;
     }
-    else if (matchingCount < _maxConns) {
+    else if (hostp->_connCount < _maxConns) {
         /* all existing conns are busy, but we're allowed to create a new one */
-        ep = new Entry();
-        ep->_isTls = isTls;
-        if (isTls) {
-            BufTls *tlsp;
-            ep->_bufGenp = tlsp = new BufTls(_pathPrefix);
-            tlsp->init(const_cast<char *>(fullHostName.c_str()), port);
-            connp = ep->_connp = _xapip->addClientConn(tlsp);
-        }
-        else {
-            BufSocket *socketp;
-            ep->_bufGenp = socketp = new BufSocket();
-            socketp->init(const_cast<char *>(fullHostName.c_str()), port);
-            ep->_connp = _xapip->addClientConn(socketp);
-            connp = ep->_connp;
-        }
-        _allConns.append(ep);
+        ep = newEntry(hostp);
     }
     else {
         /* we have to reuse an existing conn */
-        connp = randomBusyEp->_connp;
+        ep = pickBusy(hostp, startMs);
     }
+    connp = ep->_connp;
 
     /* we mark it as busy before releasing the pool lock so that noone else finds the
      * same connection when there are better non-busy conns.  We release the busy
      * flag in xapi as soon as the call is done.
      */
     connp->setBusy(1);
+
+    waitMs = osp_time_ms() - startMs;
+    _stats._getCount++;
+    _stats._totalWaitMs += waitMs;
+    if (waitMs > _stats._longestWaitMs)
+        _stats._longestWaitMs = waitMs;
+    _lock.release();
+
+    return connp;
+}
+
+XApi::ClientConn *
+XApiPool::getPipelineConn(std::string fullHostName, uint32_t port, uint8_t isTls)
+{
+    Host *hostp;
+    Entry *ep;
+    Entry *bestEp;
+    uint32_t bestCount;
+    uint32_t count;
+    XApi::ClientConn *connp;
+    uint64_t startMs;
+    uint32_t waitMs;
+
+    startMs = osp_time_ms();
+
+    _lock.take();
+
+    hostp = getHost(&fullHostName, port, isTls);
+
+    if ((bestEp = popIdle(hostp)) != NULL) {
+        _stats._idleHits++;
+    }
+    else {
+        /* join the least loaded conn that's already pipelining */
+        bestCount = 0;
+        for(ep = hostp->_busy.head(); ep; ep=ep->_dqNextp) {
+            count = ep->_connp->getPipelineCount();
+            if (count == 0 || ep->_connp->pipelineFull())
+                continue;
+            if (!bestEp || count < bestCount) {
+                bestEp = ep;
+                bestCount = count;
+            }
+        }
+
+        if (!bestEp) {
+            if (hostp->_connCount < _maxConns)
+                bestEp = newEntry(hostp);
+            else
+                bestEp = pickBusy(hostp, startMs);  /* waitPipelined will wait */
+        }
+    }
+
+    /* reserve our slot before dropping the lock, so the conn can't go
+     * idle or be handed to a non-pipelined call, but don't hold up
+     * everyone else using the pool while we wait for room on it.
+     */
+    connp = bestEp->_connp;
+    connp->reservePipelined();
+    _stats._getCount++;
+    _lock.release();
+
+    connp->waitPipelined();
+
+    waitMs = osp_time_ms() - startMs;
+    _lock.take();
+    _stats._totalWaitMs += waitMs;
+    if (waitMs > _stats._longestWaitMs)
+        _stats._longestWaitMs = waitMs;
     _lock.release();
 
     return connp;
 }
 
+/* called by the conn when its last user finishes; push it on its
+ * host's idle stack, and fold its call time into its average.
+ */
+/* static */ void
+XApiPool::connIdle(XApi::ClientConn *connp, void *contextp)
+{
+    Entry *ep = (Entry *) contextp;
+    XApiPool *poolp = ep->_poolp;
+    Host *hostp = ep->_hostp;
+    uint64_t now;
+    uint32_t callMs;
+
+    poolp->_lock.take();
+
+    /* someone may have been handed this conn again before we got the
+     * lock; they'll call us again when they're done.
+     */
+    if (ep->_isIdle || connp->getBusy()) {
+        poolp->_lock.release();
+        return;
+    }
+
+    now = osp_time_ms();
+    if (connp->getStartMs() != 0) {
+        callMs = now - connp->getStartMs();
+        if (ep->_avgCallMs == 0)
+            ep->_avgCallMs = callMs;
+        else
+            ep->_avgCallMs = (3 * ep->_avgCallMs + callMs) / 4;
+    }
+
+    hostp->_busy.remove(ep);
+    hostp->_idle.prepend(ep);
+    ep->_isIdle = 1;
+    ep->_reaped = 0;
+    ep->_idleMs = now;
+
+    poolp->_lock.release();
+}
+
+/* static */ void
+XApiPool::reapTimer(OspTimer *timerp, void *contextp)
+{
+    XApiPool *poolp = (XApiPool *) contextp;
+
+    poolp->reap();
+
+    /* timers are one shot, and free themselves once they've run */
+    timerp = new OspTimer();
+    timerp->init(_reapIntervalMs, &XApiPool::reapTimer, poolp);
+}
+
+/* close the sockets of conns that have been idle too long, and move
+ * them to the bottom of the idle stack.  The oldest idle conns are at
+ * the tail, so we can stop at the first one that's still fresh.
+ */
+void
+XApiPool::reap()
+{
+    Host *hostp;
+    Entry *ep;
+    Entry *nextEp;
+    dqueue<Entry> reaped;
+    uint64_t now;
+    uint32_t i;
+
+    if (_idleTimeoutMs == 0)
+        return;
+
+    now = osp_time_ms();
+
+    _lock.take();
+    for(i=0;i<_hostHashSize;i++) {
+        for(hostp = _hosts[i].head(); hostp; hostp=hostp->_dqNextp) {
+            reaped.init();
+            for(ep = hostp->_idle.tail(); ep; ep=nextEp) {
+                nextEp = ep->_dqPrevp;
+                if (ep->_reaped)
+                    continue;
+                if (now - ep->_idleMs < _idleTimeoutMs)
+                    break;
+                ep->_bufGenp->disconnect();
+                ep->_reaped = 1;
+                hostp->_idle.remove(ep);
+                reaped.append(ep);
+                _stats._reaps++;
+            }
+            hostp->_idle.concat(&reaped);
+        }
+    }
+    _lock.release();
+}
+
 void
 XApiPool::getStats(XApiPoolStats *statsp)
 {
+    Host *hostp;
     Entry *ep;
     XApi::ClientConn *connp;
     uint32_t totalActiveMs;
     uint32_t longestActiveMs;
     uint32_t healthyCount;
-    uint32_t now;
-    int32_t delta;
+    uint64_t now;
+    int64_t delta;
     uint32_t activeCount;
+    uint32_t i;
 
     _lock.take();
 
+    *statsp = _stats;
+
     totalActiveMs = 0;
     longestActiveMs = 0;
     healthyCount = 0;
     activeCount = 0;
     now = osp_time_ms();
 
-    for(ep = _allConns.head(); ep; ep=ep->_dqNextp) {
-        connp = ep->_connp;
-        if (connp && connp->getBusy()) {
-            activeCount++;
-            delta = now - connp->getStartMs();
-            totalActiveMs += delta;
-            if (delta > longestActiveMs)
-                longestActiveMs = delta;
-            if (delta < 20000)
-                healthyCount++;
+    for(i=0;i<_hostHashSize;i++) {
+        for(hostp = _hosts[i].head(); hostp; hostp=hostp->_dqNextp) {
+            statsp->_connCount += hostp->_connCount;
+            for(ep = hostp->_idle.head(); ep; ep=ep->_dqNextp) {
+                if (!ep->_reaped)
+                    statsp->_idleCount++;
+            }
+            for(ep = hostp->_busy.head(); ep; ep=ep->_dqNextp) {
+                connp = ep->_connp;
+                if (connp->getBusy()) {
+                    activeCount++;
+                    if (connp->getStartMs() == 0)
+                        delta = 0;      /* handed out, but no call started yet */
+                    else
+                        delta = now - connp->getStartMs();
+                    totalActiveMs += delta;
+                    if (delta > longestActiveMs)
+                        longestActiveMs = delta;
+                    if (delta < 20000)
+                        healthyCount++;
+                }
+            }
         }
     }
     
@@ -142,4 +421,3 @@ XApiPool::getStats(XApiPoolStats *statsp)
     statsp->_healthyCount = healthyCount;
     statsp->_activeCount = activeCount;
 }
-
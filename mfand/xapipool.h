@@ -30,6 +30,7 @@ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include "dqueue.h"
 #include "bufsocket.h"
 #include "xapi.h"
+#include "osptimer.h"
 
 class XApiPoolStats {
  public:
@@ -38,6 +39,15 @@ class XApiPoolStats {
     uint32_t _healthyCount;
     uint32_t _activeCount;
 
+    uint32_t _idleCount;        /* connected and idle */
+    uint32_t _connCount;        /* all connections, including reaped ones */
+    uint64_t _getCount;         /* calls to getConn and getPipelineConn */
+    uint64_t _idleHits;         /* ... satisfied from the idle stack */
+    uint64_t _totalWaitMs;      /* time spent in getConn* */
+    uint32_t _longestWaitMs;
+    uint64_t _creations;
+    uint64_t _reaps;
+
     XApiPoolStats() {
         memset(this, 0, sizeof(*this));
     }
@@ -45,47 +55,134 @@ class XApiPoolStats {
 
 /* manage a pool of TLS and regular connections, creating new
  * connections up to a configured maximum if connections are busy.
+ *
+ * Connections are grouped by (host, port, TLS) in a small hash table.
+ * Each group keeps its idle connections on a LIFO stack, so that the
+ * most recently used, and thus warmest, connection is reused first,
+ * and the rest on a busy list.  If all of a group's connections are
+ * busy and we're at the limit, we pick the busy connection that looks
+ * likely to finish soonest, based on how long its current call has
+ * been running and its recent call times, avoiding connections stuck
+ * in a call for over _stuckMs.
+ *
+ * A timer closes the sockets of connections that have been idle for
+ * _idleTimeoutMs.  The connections themselves are kept, since XApi
+ * has no way to get rid of a client conn, and reconnect when next used;
+ * they sit at the bottom of the idle stack until then.
  */
 class XApiPool {
  public:
     static const uint32_t _maxConns = 128;        /* per address */
+    static const uint32_t _hostHashSize = 31;
+    static const uint32_t _stuckMs = 20000;
+    static const uint32_t _reapIntervalMs = 10000;
+
+    class Host;
+
     class Entry {
     public:
         Entry *_dqNextp;
         Entry *_dqPrevp;
+        XApiPool *_poolp;
+        Host *_hostp;
         XApi::ClientConn *_connp;
         BufGen *_bufGenp;
         uint8_t _isTls;
+        uint8_t _isIdle;        /* in _hostp->_idle, else in _busy */
+        uint8_t _reaped;        /* socket closed by the idle reaper */
+        uint64_t _idleMs;       /* when we went idle */
+        uint32_t _avgCallMs;    /* moving average of call times */
 
         Entry() {
             _dqNextp = _dqPrevp = NULL;
+            _poolp = NULL;
+            _hostp = NULL;
             _connp = NULL;
             _bufGenp = NULL;
             _isTls = 0;
+            _isIdle = 0;
+            _reaped = 0;
+            _idleMs = 0;
+            _avgCallMs = 0;
+        }
+    };
+
+    class Host {
+    public:
+        Host *_dqNextp;
+        Host *_dqPrevp;
+        std::string _hostName;
+        uint32_t _port;
+        uint8_t _isTls;
+        uint32_t _connCount;
+        dqueue<Entry> _idle;    /* head is most recently idle */
+        dqueue<Entry> _busy;
+
+        Host() {
+            _dqNextp = _dqPrevp = NULL;
+            _port = 0;
+            _isTls = 0;
+            _connCount = 0;
         }
     };
 
     XApi *_xapip;
-    dqueue<Entry> _allConns;
+    dqueue<Host> _hosts[_hostHashSize];
     CThreadMutex _lock;
-    uint16_t _loop;
     std::string _pathPrefix;
+    uint32_t _idleTimeoutMs;
+    uint8_t _reaperRunning;
+    XApiPoolStats _stats;       /* counters only; getStats fills in the rest */
 
     XApiPool(std::string pathPrefix) {
         _pathPrefix = pathPrefix;
         _xapip = new XApi();
-        _loop = 0;
+        _idleTimeoutMs = 60000;
+        _reaperRunning = 0;
         return;
     }
 
+    /* close sockets idle for this long; 0 disables reaping */
+    void setIdleTimeout(uint32_t ms) {
+        _idleTimeoutMs = ms;
+    }
+
     XApi::ClientConn *getConn( std::string fullHostName,
                                uint32_t port,
                                uint8_t isTls);
 
+    /* like getConn, but returns a conn with a pipeline slot reserved
+     * (see XApi::ClientConn::addPipelined) for a GET to be started
+     * with ClientReq::startPipelinedCall.  Prefers an idle conn, then
+     * the least loaded pipelining conn, and creates a new one only if
+     * neither is available.
+     */
+    XApi::ClientConn *getPipelineConn( std::string fullHostName,
+                                       uint32_t port,
+                                       uint8_t isTls);
+
     /* return the longest busy running call, the average of all busy calls, and the
-     * number of conns that are busy and haven't been running for over 20 seconds.
+     * number of conns that are busy and haven't been running for over 20 seconds,
+     * along with the pool's connection counters.
      */
     void getStats(XApiPoolStats *statsp);
+
+ private:
+    static uint32_t hashHost(std::string *hostNamep, uint32_t port, uint8_t isTls);
+
+    Host *getHost(std::string *hostNamep, uint32_t port, uint8_t isTls);
+
+    Entry *popIdle(Host *hostp);
+
+    Entry *pickBusy(Host *hostp, uint64_t now);
+
+    Entry *newEntry(Host *hostp);
+
+    static void connIdle(XApi::ClientConn *connp, void *contextp);
+
+    static void reapTimer(OspTimer *timerp, void *contextp);
+
+    void reap();
 };
 
 #endif /* __XAPIPOOL_H_ENV__ */
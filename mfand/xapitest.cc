@@ -31,7 +31,11 @@ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include "buftls.h"
 
 void client(int argc, char **argv, int port);
+uint32_t pipelineClient(XApi::ClientConn *connp, int32_t maxCount);
+void pipelineCheck(int argc, char **argv, int port);
+void sendFailCheck();
 void server(int argc, char **argv, int port);
+XApi *startServer(int useSecure, int port);
 
 int
 main(int argc, char **argv)
@@ -39,11 +43,20 @@ main(int argc, char **argv)
     int port;
 
     if (argc <= 1) {
-        printf("usage: xapitest c|s <port> [<count>] [s|n]\n");
+        printf("usage: xapitest c|s <port> [<count>] [s|n] [p]\n");
         printf("usage: count only present for client ('c')\n");
+        printf("usage: 'p' makes the client pipeline GETs, 8 at a time\n");
+        printf("usage: xapitest p <port> [<count>] runs a server and a pipelining\n");
+        printf("usage:   client, and fails unless every response matches its call\n");
+        printf("usage: xapitest f fails a send in the middle of a pipelined batch\n");
         return 1;
     }
 
+    if (strcmp(argv[1], "f") == 0) {
+        sendFailCheck();
+        return 0;
+    }
+
     port = atoi(argv[2]);
 
     if (strcmp(argv[1], "c") == 0) {
@@ -52,6 +65,9 @@ main(int argc, char **argv)
     else if (strcmp(argv[1], "s") == 0) {
         server(argc-3, argv+3, port);
     }
+    else if (strcmp(argv[1], "p") == 0) {
+        pipelineCheck(argc-3, argv+3, port);
+    }
 
     return 0;
 }
@@ -95,6 +111,11 @@ client(int argc, char **argv, int port)
 
     connp = xapip->addClientConn(socketp);
 
+    if (argc > 2 && *argv[2] == 'p') {
+        pipelineClient(connp, maxCount);
+        return;
+    }
+
     for(ix=0;ix<maxCount;ix++) {
         /* now prepare a call */
         strcpy(tbuffer, "Client call data\n");
@@ -140,6 +161,271 @@ client(int argc, char **argv, int port)
     printf("Multi-call test is done\n");
 }
 
+/* issue GETs in groups of up to 8 pipelined calls on one connection,
+ * then read each group's responses in order.  Each call sends its
+ * sequence number, which the server echoes, so we can tell if a
+ * response got matched up with the wrong call.  Returns the number of
+ * calls that failed or got the wrong response.
+ */
+uint32_t
+pipelineClient(XApi::ClientConn *connp, int32_t maxCount)
+{
+    static const uint32_t maxGroup = 8;
+    XApi::ClientReq *reqs[maxGroup];
+    char tbuffer[1024];
+    char seqBuffer[32];
+    std::string response;
+    CThreadPipe *inPipep;
+    int32_t ix;
+    uint32_t i;
+    uint32_t groupCount;
+    int32_t code;
+    uint32_t failures = 0;
+    uint32_t startMs;
+    uint32_t elapsedMs;
+
+    startMs = osp_time_ms();
+    for(ix=0;ix<maxCount;ix+=groupCount) {
+        groupCount = maxCount - ix;
+        if (groupCount > maxGroup)
+            groupCount = maxGroup;
+
+        for(i=0;i<groupCount;i++) {
+            connp->addPipelined();
+            reqs[i] = new XApi::ClientReq();
+            reqs[i]->addHeader("X-XAPITEST", "xapitest-value");
+            snprintf(seqBuffer, sizeof(seqBuffer), "%d", ix+i);
+            reqs[i]->addHeader("X-XAPITEST-SEQ", seqBuffer);
+            reqs[i]->startPipelinedCall(connp, "/service");
+            reqs[i]->getOutgoingPipe()->eof();
+        }
+
+        for(i=0;i<groupCount;i++) {
+            code = reqs[i]->waitForHeadersDone();
+            if (code == 0) {
+                response.clear();
+                inPipep = reqs[i]->getIncomingPipe();
+                while(1) {
+                    code = inPipep->read(tbuffer, sizeof(tbuffer)-1);
+                    if (code <= 0)
+                        break;
+                    response.append(tbuffer, code);
+                }
+                printf("client: call %d: %s", ix+i, response.c_str());
+
+                snprintf(seqBuffer, sizeof(seqBuffer), "seq=%d ", ix+i);
+                if (response.compare(0, strlen(seqBuffer), seqBuffer) != 0) {
+                    printf("client: call %d got the wrong response\n", ix+i);
+                    failures++;
+                }
+            }
+            else {
+                printf("client: call %d failed code=%d\n", ix+i, code);
+                failures++;
+            }
+            delete reqs[i];
+            reqs[i] = NULL;
+        }
+    }
+    elapsedMs = osp_time_ms() - startMs;
+
+    printf("Pipelined test is done, %d calls, %d failures, %d ms\n",
+           maxCount, failures, elapsedMs);
+    return failures;
+}
+
+/* run a server in this process and pipeline calls to it, exiting
+ * non-zero unless every call got its own response.
+ */
+void
+pipelineCheck(int argc, char **argv, int port)
+{
+    XApi *xapip;
+    BufSocket *socketp;
+    XApi::ClientConn *connp;
+    int32_t maxCount = 100;
+    uint32_t failures;
+
+    if (argc > 0)
+        maxCount = atoi(argv[0]);
+
+    startServer(/* !secure */ 0, port);
+
+    xapip = new XApi();
+    socketp = new BufSocket();
+    socketp->init(const_cast<char *>("localhost"), port);
+    connp = xapip->addClientConn(socketp);
+
+    failures = pipelineClient(connp, maxCount);
+    if (failures != 0) {
+        printf("xapitest: pipeline check FAILED\n");
+        exit(1);
+    }
+    printf("xapitest: pipeline check passed\n");
+    exit(0);
+}
+
+/* a connection that fails the failWrite'th write, and holds the
+ * runner in the disconnect that follows until released, so that the
+ * test can delete the failed call first.  The first write waits for
+ * the gate to open, so that the calls queued meanwhile end up in one
+ * batch.  Reads always fail.
+ */
+class FailBufGen : public BufGen {
+public:
+    CThreadMutex _lock;
+    CThreadCV _cv;
+    uint32_t _writes;
+    uint32_t _failWrite;
+    uint8_t _gateOpen;
+    uint8_t _holding;
+    uint8_t _released;
+
+    FailBufGen(uint32_t failWrite) : _cv(&_lock) {
+        _writes = 0;
+        _failWrite = failWrite;
+        _gateOpen = 0;
+        _holding = 0;
+        _released = 0;
+        _fullHostName = "localhost:1";
+    }
+
+    void waitForWrites(uint32_t count) {
+        _lock.take();
+        while(_writes < count)
+            _cv.wait();
+        _lock.release();
+    }
+
+    void openGate() {
+        _lock.take();
+        _gateOpen = 1;
+        _lock.release();
+        _cv.broadcast();
+    }
+
+    void releaseDisconnect() {
+        _lock.take();
+        _released = 1;
+        _lock.release();
+        _cv.broadcast();
+    }
+
+    int32_t write(const char *tbufferp, int32_t count) {
+        uint32_t writes;
+
+        _lock.take();
+        writes = ++_writes;
+        _cv.broadcast();
+        while(!_gateOpen)
+            _cv.wait();
+        if (writes == _failWrite)
+            _holding = 1;
+        _lock.release();
+        return (writes == _failWrite? -1 : count);
+    }
+
+    void disconnect() {
+        _lock.take();
+        if (_holding) {
+            while(!_released)
+                _cv.wait();
+            _holding = 0;
+        }
+        _lock.release();
+    }
+
+    int32_t listen() { return -1; }
+    void reopen() { return; }
+    int32_t accept(BufGen **remotepp) { return -1; }
+    int32_t getc() { return -1; }
+    int32_t read(char *tbufferp, int32_t count) { return -1; }
+    int32_t readLine(char *tbufferp, int32_t count) { return -1; }
+    int32_t putc(const char tc) { return -1; }
+    void setTimeoutMs(uint32_t ms) { return; }
+    void abort() { return; }
+    int32_t flush() { return 0; }
+    int32_t getError() { return 0; }
+    int atEof() { return 0; }
+};
+
+/* deleted calls are poisoned and never freed, so that touching one
+ * after its owner deleted it crashes instead of quietly working.
+ */
+class PoisonReq : public XApi::ClientReq {
+public:
+    static void *operator new(size_t size) {
+        return ::operator new(size);
+    }
+
+    static void operator delete(void *p) {
+        memset(p, 0xdb, sizeof(PoisonReq));
+    }
+};
+
+/* start 4 pipelined calls, the last 3 in one batch, and fail the send
+ * of the middle one of those.  Its owner deletes it before the runner
+ * cleans up the rest, and every call must fail.
+ */
+void
+sendFailCheck()
+{
+    static const uint32_t reqCount = 4;
+    XApi *xapip;
+    FailBufGen *bufGenp;
+    XApi::ClientConn *connp;
+    XApi::ClientReq *reqs[reqCount];
+    uint32_t failures = 0;
+    uint32_t i;
+    int32_t code;
+
+    xapip = new XApi();
+    bufGenp = new FailBufGen(/* failWrite */ 3);
+    connp = xapip->addClientConn(bufGenp);
+
+    for(i=0;i<reqCount;i++) {
+        connp->addPipelined();
+        reqs[i] = new PoisonReq();
+        reqs[i]->startPipelinedCall(connp, "/service");
+        reqs[i]->getOutgoingPipe()->eof();
+        /* hold the first call's batch until the others are queued */
+        if (i == 0)
+            bufGenp->waitForWrites(1);
+    }
+    bufGenp->openGate();
+
+    /* the first call's response read fails; then the second batch's
+     * middle call fails to send.
+     */
+    code = reqs[0]->waitForAllDone();
+    printf("xapitest: call 0 code=%d\n", code);
+    if (code == 0)
+        failures++;
+    delete reqs[0];
+
+    code = reqs[2]->waitForAllDone();
+    printf("xapitest: call 2 code=%d\n", code);
+    if (code == 0)
+        failures++;
+    delete reqs[2];
+    bufGenp->releaseDisconnect();
+
+    for(i=1;i<reqCount;i+=2) {
+        code = reqs[i]->waitForAllDone();
+        printf("xapitest: call %d code=%d\n", i, code);
+        if (code == 0)
+            failures++;
+        delete reqs[i];
+    }
+
+    if (failures != 0) {
+        printf("xapitest: send failure check FAILED\n");
+        exit(1);
+    }
+    printf("xapitest: send failure check passed\n");
+    exit(0);
+}
+
 class Service : public XApi::ServerReq {
     static uint32_t _counter;
 public:
@@ -172,7 +458,16 @@ public:
 
         _counter++;
 
-        snprintf(tbuffer, sizeof(tbuffer), "counter=%d\n", _counter);
+        /* echo the client's sequence number, if it sent one */
+        for(hdrp = getRecvHeaders(); hdrp; hdrp=hdrp->_dqNextp) {
+            if (strcasecmp(hdrp->_key.c_str(), "X-XAPITEST-SEQ") == 0)
+                break;
+        }
+        if (hdrp)
+            snprintf(tbuffer, sizeof(tbuffer), "seq=%s counter=%d\n",
+                     hdrp->_value.c_str(), _counter);
+        else
+            snprintf(tbuffer, sizeof(tbuffer), "counter=%d\n", _counter);
 
         setSendContentLength(strlen(tbuffer));
 
@@ -205,15 +500,25 @@ serverRestFactory(std::string *opcodep)
 void
 server(int argc, char **argv, int port)
 {
-    XApi *xapip;
     int useSecure=0;
-    BufGen *lsocketp = NULL;
 
     if (argc > 0) {
         if (*argv[0] == 's')
             useSecure = 1;
     }
 
+    startServer(useSecure, port);
+    while(1) {
+        sleep(1);
+    }
+}
+
+XApi *
+startServer(int useSecure, int port)
+{
+    XApi *xapip;
+    BufGen *lsocketp = NULL;
+
     xapip = new XApi();
     xapip->registerFactory(&serverRestFactory);
     if (useSecure) {
@@ -223,7 +528,5 @@ server(int argc, char **argv, int port)
     }
     else
         xapip->initWithPort(port);
-    while(1) {
-        sleep(1);
-    }
+    return xapip;
 }